@@ -0,0 +1,214 @@
+//
+// Registry of rigid marker boards (sets of markers with known relative poses, and ChArUco boards).
+//
+
+#ifndef ARUCOSLAM_BOARDREGISTRY_H
+#define ARUCOSLAM_BOARDREGISTRY_H
+
+#include <jni.h>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/aruco.hpp>
+#include <opencv2/aruco/charuco.hpp>
+
+#include "frameContext.h"
+#include "overlayCommands.h"
+
+/**
+ * Minimum number of markers of a board that must be detected in order to use the board pose
+ * instead of the poses of the single markers.
+ */
+constexpr int BOARD_MIN_DETECTED_MARKERS = 2;
+
+/**
+ * Minimum number of interpolated chessboard corners needed to refine the pose of a ChArUco board.
+ */
+constexpr int CHARUCO_MIN_CORNERS = 4;
+
+struct RegisteredBoard {
+    cv::Ptr<cv::aruco::Board> board;
+    cv::Ptr<cv::aruco::CharucoBoard> charucoBoard; // nullptr for plain marker boards
+    // Transformation to switch from room's coord sys to board's coord sys
+    cv::Vec3d rvec, tvec;
+    // length of the axis drawn on the overlay
+    float axisLength;
+
+    bool contains(int markerId) const {
+        return std::find(board->ids.begin(), board->ids.end(), markerId) != board->ids.end();
+    }
+};
+
+/**
+ * A BoardRegistry keeps the boards placed in the world, with their object points computed once
+ * at registration time. When enough markers of a board are detected, the pose of the camera is
+ * estimated from the whole board in one shot (and, for ChArUco boards, refined with the
+ * interpolated chessboard corners), which is much more stable than the poses of the single
+ * markers of the board.
+ *
+ * Boards must be registered before the frames are processed: the registry is then only read by
+ * the workers, so no synchronization is needed.
+ */
+class BoardRegistry {
+public:
+    /**
+     * Registers a board made of markers with arbitrary, known, relative poses.
+     *
+     * @param markerCorners the 3D positions of the 4 corners of each marker, in the board's coord
+     *                      sys, in the same order of the detected corners (clockwise from the
+     *                      top-left one)
+     * @return the index of the board
+     */
+    int registerMarkerBoard(int dictionary,
+                            const std::vector<int> &markerIds,
+                            const std::vector<std::vector<cv::Point3f>> &markerCorners,
+                            const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                            float axisLength) {
+        RegisteredBoard registered;
+        registered.board = cv::aruco::Board::create(
+                markerCorners, cv::aruco::getPredefinedDictionary(dictionary), markerIds);
+        registered.rvec = rvec;
+        registered.tvec = tvec;
+        registered.axisLength = axisLength;
+        boards.push_back(registered);
+        return static_cast<int>(boards.size()) - 1;
+    }
+
+    /**
+     * Registers a ChArUco board. cv::aruco::CharucoBoard::create numbers the markers of every
+     * board from 0, which would collide with the ids of the markers of the map (and of the other
+     * boards): the markers of the board are moved to the ids starting from firstMarkerId, so the
+     * board must be printed with the same offset.
+     *
+     * @return the index of the board
+     */
+    int registerCharucoBoard(int dictionary, int squaresX, int squaresY,
+                             float squareLength, float markerLength, int firstMarkerId,
+                             const cv::Vec3d &rvec, const cv::Vec3d &tvec) {
+        RegisteredBoard registered;
+        registered.charucoBoard = cv::aruco::CharucoBoard::create(
+                squaresX, squaresY, squareLength, markerLength,
+                cv::aruco::getPredefinedDictionary(dictionary));
+        for (int &markerId : registered.charucoBoard->ids) {
+            markerId += firstMarkerId;
+        }
+        registered.board = registered.charucoBoard;
+        registered.rvec = rvec;
+        registered.tvec = tvec;
+        registered.axisLength = squareLength * 2.0f;
+        boards.push_back(registered);
+        return static_cast<int>(boards.size()) - 1;
+    }
+
+    size_t size() const { return boards.size(); }
+
+    /**
+     * @return true if the marker belongs to a registered board
+     */
+    bool contains(int markerId) const {
+        for (const RegisteredBoard &registered : boards) {
+            if (registered.contains(markerId)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Estimates a pose of the camera (room's coord sys to camera's coord sys) from each registered
+     * board with enough detected markers, and appends them to the output vectors. The ids of the
+     * markers belonging to the boards that produced a pose are appended to usedIDs, so that their
+     * single-marker poses can be skipped.
+     * The weight of each board pose is the sum of the qualities of its detected markers, and the
+     * number of such markers is appended to outMarkerCounts.
+     *
+     * @param gray the grayscale frame, used to interpolate the ChArUco corners
+     * @param qualities the quality of each detected marker (see observationQuality())
+     * @return the number of poses estimated from boards
+     */
+    template<typename VECS, typename IDS, typename WEIGHTS>
+    int estimateCameraPoses(const std::vector<std::vector<cv::Point2f>> &corners,
+                            const std::vector<int> &ids,
+                            const std::vector<double> &qualities,
+                            const cv::Mat &gray,
+                            cv::InputArray cameraMatrix,
+                            cv::InputArray distCoeffs,
+                            FrameContext &context,
+                            VECS &outRvecs, VECS &outTvecs, WEIGHTS &outWeights,
+                            IDS &outMarkerCounts, IDS &usedIDs,
+                            OverlayCommandBuffer *overlay) const {
+        int estimated = 0;
+        for (const RegisteredBoard &registered : boards) {
+            cv::Vec3d boardRvec, boardTvec;
+            int usedMarkers = cv::aruco::estimatePoseBoard(
+                    corners, ids, registered.board, cameraMatrix, distCoeffs,
+                    boardRvec, boardTvec);
+            if (usedMarkers < BOARD_MIN_DETECTED_MARKERS) {
+                continue;
+            }
+
+            if (registered.charucoBoard) {
+                // refine the pose with the chessboard corners, using the marker-based pose as
+                // initial guess
+                std::vector<cv::Point2f> &charucoCorners = context.charucoCorners;
+                std::vector<int> &charucoIDs = context.charucoIDs;
+                charucoCorners.clear();
+                charucoIDs.clear();
+                int interpolated = cv::aruco::interpolateCornersCharuco(
+                        corners, ids, gray, registered.charucoBoard,
+                        charucoCorners, charucoIDs, cameraMatrix, distCoeffs);
+                if (interpolated >= CHARUCO_MIN_CORNERS) {
+                    cv::aruco::estimatePoseCharucoBoard(
+                            charucoCorners, charucoIDs, registered.charucoBoard,
+                            cameraMatrix, distCoeffs, boardRvec, boardTvec, true);
+                    if (overlay != nullptr) {
+                        for (const cv::Point2f &corner : charucoCorners) {
+                            overlay->marker(corner, cv::Scalar(255, 0, 255),
+                                            cv::MARKER_CROSS, 6);
+                        }
+                    }
+                }
+            }
+
+            cv::Vec3d computedRvec, computedTvec;
+            cv::composeRT(
+                    // Transformation to switch from room's coord sys to board's coord sys
+                    registered.rvec, registered.tvec,
+                    // Transformation to switch from board's coord sys to camera's coord sys
+                    boardRvec, boardTvec,
+                    // (result) Transf to change from room's coord sys to camera's coord sys
+                    computedRvec, computedTvec
+            );
+            outRvecs.push_back(computedRvec);
+            outTvecs.push_back(computedTvec);
+            double weight = 0.0;
+            int markerCount = 0;
+            for (size_t i = 0; i < ids.size(); i++) {
+                if (registered.contains(ids[i])) {
+                    usedIDs.push_back(ids[i]);
+                    weight += i < qualities.size() ? qualities[i] : 1.0;
+                    markerCount++;
+                }
+            }
+            outWeights.push_back(weight);
+            outMarkerCounts.push_back(markerCount);
+            if (overlay != nullptr) {
+                overlay->axis(cameraMatrix, distCoeffs, boardRvec, boardTvec,
+                              registered.axisLength);
+            }
+            estimated++;
+        }
+        return estimated;
+    }
+
+private:
+    std::vector<RegisteredBoard> boards;
+};
+
+BoardRegistry *castToBoardRegistryPtr(jlong addr) {
+    return (BoardRegistry *) addr;
+}
+
+#endif //ARUCOSLAM_BOARDREGISTRY_H
@@ -0,0 +1,272 @@
+//
+// Pool of the markers observed but not known yet, promoted into the map when their pose
+// estimate has converged.
+//
+
+#ifndef ARUCOSLAM_CANDIDATEPOOL_H
+#define ARUCOSLAM_CANDIDATEPOOL_H
+
+#include <jni.h>
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Default number of slots of a pool: the candidates are the markers seen in the last seconds and
+ * not known yet, a handful at a time.
+ */
+constexpr int CANDIDATE_POOL_DEFAULT_CAPACITY = 64;
+
+/**
+ * A candidate is promoted when it has at least this many observations, and the standard error of
+ * its mean position is below the threshold (meters).
+ */
+constexpr int CANDIDATE_MIN_OBSERVATIONS = 5;
+constexpr double CANDIDATE_MAX_POSITION_ERROR = 0.01;
+
+/**
+ * ... and the circular standard deviation of each component of its rotation vector is below this
+ * threshold (radians).
+ */
+constexpr double CANDIDATE_MAX_ROTATION_DEVIATION = 0.1;
+
+/**
+ * ... and it was observed from viewpoints at least this far apart (meters), so that the errors
+ * of the observations are not all the same.
+ */
+constexpr double CANDIDATE_MIN_BASELINE = 0.05;
+
+/**
+ * A candidate not observed for this many frames can be evicted to make room for new ones.
+ */
+constexpr uint64_t CANDIDATE_STALE_FRAMES = 150;
+
+/**
+ * Number of values written by MarkerCandidatePool::stats().
+ */
+constexpr int CANDIDATE_POOL_STATS_SIZE = 4;
+
+/**
+ * Statistics of the observations of a candidate marker, updated in O(1): Welford's running mean
+ * and covariance of the translation, the running sums of the sines and cosines of the components
+ * of the rotation vector (their circular mean, as in computeAngleCentroid()), and the largest
+ * distance of the camera from the first viewpoint.
+ */
+struct MarkerCandidate {
+    int markerId = -1; // -1 if the slot is free
+    int observations = 0;
+    uint64_t lastFrame = 0;
+    cv::Vec3d meanTvec;
+    cv::Matx33d tvecM2;
+    cv::Vec3d cosSums, sinSums;
+    cv::Vec3d firstViewpoint;
+    double baseline = 0.0;
+
+    void observe(const cv::Vec3d &rvec, const cv::Vec3d &tvec, const cv::Vec3d &viewpoint) {
+        observations++;
+        cv::Vec3d delta = tvec - meanTvec;
+        meanTvec += delta * (1.0 / observations);
+        cv::Vec3d deltaAfterUpdate = tvec - meanTvec;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++) {
+                tvecM2(row, col) += delta[row] * deltaAfterUpdate[col];
+            }
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            cosSums[axis] += std::cos(rvec[axis]);
+            sinSums[axis] += std::sin(rvec[axis]);
+        }
+        if (observations == 1) {
+            firstViewpoint = viewpoint;
+        } else {
+            baseline = std::max(baseline, cv::norm(viewpoint - firstViewpoint));
+        }
+    }
+
+    cv::Vec3d meanRvec() const {
+        return cv::Vec3d(std::atan2(sinSums[0], cosSums[0]),
+                         std::atan2(sinSums[1], cosSums[1]),
+                         std::atan2(sinSums[2], cosSums[2]));
+    }
+
+    bool converged() const {
+        if (observations < CANDIDATE_MIN_OBSERVATIONS || baseline < CANDIDATE_MIN_BASELINE) {
+            return false;
+        }
+        // variance of the mean = trace of the sample covariance / n
+        double trace = tvecM2(0, 0) + tvecM2(1, 1) + tvecM2(2, 2);
+        double meanVariance = trace / (observations - 1) / observations;
+        if (meanVariance > CANDIDATE_MAX_POSITION_ERROR * CANDIDATE_MAX_POSITION_ERROR) {
+            return false;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            double resultant = std::hypot(cosSums[axis], sinSums[axis]) / observations;
+            if (-2.0 * std::log(std::max(resultant, 1e-12)) >
+                CANDIDATE_MAX_ROTATION_DEVIATION * CANDIDATE_MAX_ROTATION_DEVIATION) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * A MarkerCandidatePool collects the observations of the markers not known yet, and promotes a
+ * marker into the map only when the mean of its observations has converged, instead of fixing
+ * its pose at the first (possibly noisy) observation.
+ *
+ * The candidates live in a fixed array of slots, indexed by marker id in an open addressing
+ * table (linear probing, deletions by backward shift): an observation is O(1) and the pool never
+ * allocates after construction. When all the slots are taken, the least recently observed stale
+ * candidate is evicted; if none is stale, the new marker is not tracked until a slot frees up.
+ * The pool is shared by the workers: each call holds a lock for the few updates of one frame.
+ */
+class MarkerCandidatePool {
+public:
+    explicit MarkerCandidatePool(int capacity = CANDIDATE_POOL_DEFAULT_CAPACITY) :
+            slots(std::max(1, capacity)) {
+        size_t tableSize = 1;
+        while (tableSize < 2 * slots.size()) {
+            tableSize <<= 1;
+        }
+        table.assign(tableSize, -1);
+        freeSlots.reserve(slots.size());
+        for (int i = (int) slots.size() - 1; i >= 0; i--) {
+            freeSlots.push_back(i);
+        }
+    }
+
+    /**
+     * Adds an observation of a marker (its pose in the room, seen from the camera at viewpoint).
+     *
+     * @param outRvec, outTvec the converged pose of the marker, if it is promoted
+     * @return true if the marker has converged: it is removed from the pool and must be added to
+     *         the map with the returned pose
+     */
+    bool observe(int markerId, const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                 const cv::Vec3d &viewpoint, uint64_t frameNumber,
+                 cv::Vec3d &outRvec, cv::Vec3d &outTvec) {
+        std::unique_lock<std::mutex> lock(mutex);
+        observationCount++;
+        int slot = find(markerId);
+        if (slot < 0) {
+            slot = allocate(markerId, frameNumber);
+            if (slot < 0) {
+                return false;
+            }
+        }
+        MarkerCandidate &candidate = slots[slot];
+        candidate.observe(rvec, tvec, viewpoint);
+        candidate.lastFrame = std::max(candidate.lastFrame, frameNumber);
+        if (!candidate.converged()) {
+            return false;
+        }
+        outRvec = candidate.meanRvec();
+        outTvec = candidate.meanTvec;
+        release(markerId);
+        promotedCount++;
+        return true;
+    }
+
+    /**
+     * Writes on out: [0] candidates in the pool, [1] observations, [2] promoted markers,
+     * [3] evicted candidates.
+     */
+    void stats(jlong *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        out[0] = (jlong) (slots.size() - freeSlots.size());
+        out[1] = observationCount;
+        out[2] = promotedCount;
+        out[3] = evictedCount;
+    }
+
+private:
+    size_t home(int markerId) const {
+        return (uint32_t(markerId) * 2654435761u) & (table.size() - 1);
+    }
+
+    int find(int markerId) const {
+        for (size_t i = home(markerId);; i = (i + 1) & (table.size() - 1)) {
+            if (table[i] < 0) {
+                return -1;
+            }
+            if (slots[table[i]].markerId == markerId) {
+                return table[i];
+            }
+        }
+    }
+
+    int allocate(int markerId, uint64_t frameNumber) {
+        if (freeSlots.empty() && !evictStale(frameNumber)) {
+            return -1;
+        }
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot] = MarkerCandidate();
+        slots[slot].markerId = markerId;
+        size_t i = home(markerId);
+        while (table[i] >= 0) {
+            i = (i + 1) & (table.size() - 1);
+        }
+        table[i] = slot;
+        return slot;
+    }
+
+    /**
+     * Frees the least recently observed candidate, if it is stale.
+     */
+    bool evictStale(uint64_t frameNumber) {
+        int oldest = -1;
+        for (int i = 0; i < (int) slots.size(); i++) {
+            if (oldest < 0 || slots[i].lastFrame < slots[oldest].lastFrame) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0 || slots[oldest].lastFrame + CANDIDATE_STALE_FRAMES > frameNumber) {
+            return false;
+        }
+        release(slots[oldest].markerId);
+        evictedCount++;
+        return true;
+    }
+
+    void release(int markerId) {
+        size_t mask = table.size() - 1;
+        size_t i = home(markerId);
+        while (slots[table[i]].markerId != markerId) {
+            i = (i + 1) & mask;
+        }
+        int slot = table[i];
+        slots[slot].markerId = -1;
+        freeSlots.push_back(slot);
+        // backward shift: move back the following entries which would not be found anymore
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask; table[j] >= 0; j = (j + 1) & mask) {
+            size_t entryHome = home(slots[table[j]].markerId);
+            bool movable = hole <= j ? (entryHome <= hole || entryHome > j)
+                                     : (entryHome <= hole && entryHome > j);
+            if (movable) {
+                table[hole] = table[j];
+                hole = j;
+            }
+        }
+        table[hole] = -1;
+    }
+
+    std::mutex mutex;
+    std::vector<MarkerCandidate> slots;
+    std::vector<int> freeSlots;
+    std::vector<int> table; // slot of each entry, -1 if empty
+    jlong observationCount = 0;
+    jlong promotedCount = 0;
+    jlong evictedCount = 0;
+};
+
+MarkerCandidatePool *castToMarkerCandidatePoolPtr(jlong addr) {
+    return (MarkerCandidatePool *) addr;
+}
+
+#endif //ARUCOSLAM_CANDIDATEPOOL_H
@@ -0,0 +1,174 @@
+//
+// Compact storage of the long term track of the phone: poses quantized to 16 bits, relative to
+// the origin of their block, with delta-encoded timestamps.
+//
+
+#ifndef ARUCOSLAM_COMPACTTRACK_H
+#define ARUCOSLAM_COMPACTTRACK_H
+
+#include <jni.h>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Number of poses of a block.
+ */
+constexpr int COMPACT_TRACK_BLOCK_SIZE = 256;
+
+/**
+ * Quantization steps: the translations are stored in millimeters relative to the origin of their
+ * block (so a block spans +-32 m), the components of the rotation vectors (in [-pi, pi]) in steps
+ * of ~1e-4 radians, and the timestamps as the milliseconds elapsed since the previous pose of the
+ * block (up to ~65 s). A pose which does not fit starts a new block.
+ */
+constexpr double COMPACT_TRACK_TRANSLATION_STEP = 0.001;
+constexpr double COMPACT_TRACK_ROTATION_STEP = CV_PI / INT16_MAX;
+constexpr int64_t COMPACT_TRACK_MAX_TIMESTAMP_DELTA = UINT16_MAX;
+
+/**
+ * Number of values written by CompactTrack::stats().
+ */
+constexpr int COMPACT_TRACK_STATS_SIZE = 3;
+
+/**
+ * A block of up to COMPACT_TRACK_BLOCK_SIZE poses (fewer when a pose did not fit); the quantized
+ * vectors are interleaved, so that a block is decoded by a few 3-channel conversions.
+ */
+struct CompactTrackBlock {
+    cv::Vec3d origin; // translation of the first pose of the block
+    int64_t firstTimestamp = 0;
+    int64_t lastTimestamp = 0;
+    int count = 0;
+    int16_t rvecs[COMPACT_TRACK_BLOCK_SIZE * 3];
+    int16_t tvecs[COMPACT_TRACK_BLOCK_SIZE * 3];
+    uint16_t timestampDeltas[COMPACT_TRACK_BLOCK_SIZE];
+};
+
+/**
+ * A CompactTrack stores the long term track of the phone in 14 bytes per pose (instead of the 6
+ * doubles and the boxed timestamp of the Kotlin lists), and decodes it on the fly when it is
+ * rendered or analyzed: the quantized vectors of each block are converted and offset by the
+ * vectorized OpenCV kernels, straight into the output buffers.
+ *
+ * The track is appended by one thread at a time and read by the workers; a mutex guards both,
+ * held only for the append of a pose or the decoding of the requested range.
+ */
+class CompactTrack {
+public:
+    void append(const cv::Vec3d &rvec, const cv::Vec3d &tvec, int64_t timestamp) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (blocks.empty() || !fits(*blocks.back(), tvec, timestamp)) {
+            blocks.emplace_back(new CompactTrackBlock());
+            blockStarts.push_back(poseCount);
+            blocks.back()->origin = tvec;
+            blocks.back()->firstTimestamp = timestamp;
+            blocks.back()->lastTimestamp = timestamp;
+        }
+        CompactTrackBlock &block = *blocks.back();
+        int i = block.count;
+        for (int axis = 0; axis < 3; axis++) {
+            block.rvecs[i * 3 + axis] = quantize(rvec[axis] / COMPACT_TRACK_ROTATION_STEP);
+            block.tvecs[i * 3 + axis] = quantize(
+                    (tvec[axis] - block.origin[axis]) / COMPACT_TRACK_TRANSLATION_STEP);
+        }
+        block.timestampDeltas[i] = (uint16_t) (timestamp - block.lastTimestamp);
+        block.lastTimestamp = timestamp;
+        block.count++;
+        poseCount++;
+    }
+
+    int size() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return poseCount;
+    }
+
+    /**
+     * Decodes the poses in [first, first + count) (clamped to the track) on the output buffers,
+     * which must have room for count poses; outTimestamps can be nullptr.
+     *
+     * @return the number of decoded poses
+     */
+    int decode(int first, int count, cv::Vec3d *outRvecs, cv::Vec3d *outTvecs,
+               int64_t *outTimestamps) {
+        std::unique_lock<std::mutex> lock(mutex);
+        first = std::max(0, first);
+        count = std::max(0, std::min(count, poseCount - first));
+        int decoded = 0;
+        int b = std::upper_bound(blockStarts.begin(), blockStarts.end(), first) -
+                blockStarts.begin() - 1;
+        for (; decoded < count; b++) {
+            const CompactTrackBlock &block = *blocks[b];
+            int offset = first + decoded - blockStarts[b];
+            int n = std::min(block.count - offset, count - decoded);
+            cv::Mat quantizedRvecs(n, 1, CV_16SC3, (void *) (block.rvecs + offset * 3));
+            cv::Mat quantizedTvecs(n, 1, CV_16SC3, (void *) (block.tvecs + offset * 3));
+            cv::Mat rvecs(n, 1, CV_64FC3, outRvecs + decoded);
+            cv::Mat tvecs(n, 1, CV_64FC3, outTvecs + decoded);
+            quantizedRvecs.convertTo(rvecs, CV_64F, COMPACT_TRACK_ROTATION_STEP);
+            quantizedTvecs.convertTo(tvecs, CV_64F, COMPACT_TRACK_TRANSLATION_STEP);
+            cv::add(tvecs, cv::Scalar(block.origin[0], block.origin[1], block.origin[2]), tvecs);
+            if (outTimestamps != nullptr) {
+                // the delta of the first pose of a block is 0
+                int64_t timestamp = block.firstTimestamp;
+                for (int i = 0; i < offset; i++) {
+                    timestamp += block.timestampDeltas[i];
+                }
+                for (int i = 0; i < n; i++) {
+                    timestamp += block.timestampDeltas[offset + i];
+                    outTimestamps[decoded + i] = timestamp;
+                }
+            }
+            decoded += n;
+        }
+        return decoded;
+    }
+
+    /**
+     * Writes COMPACT_TRACK_STATS_SIZE values on out: [0] poses, [1] blocks, [2] bytes used.
+     */
+    void stats(jlong *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        out[0] = poseCount;
+        out[1] = blocks.size();
+        out[2] = blocks.size() * sizeof(CompactTrackBlock) +
+                 blocks.capacity() * sizeof(std::unique_ptr<CompactTrackBlock>) +
+                 blockStarts.capacity() * sizeof(int);
+    }
+
+private:
+    static int16_t quantize(double value) {
+        return (int16_t) std::max<double>(INT16_MIN,
+                                          std::min<double>(INT16_MAX, std::round(value)));
+    }
+
+    static bool fits(const CompactTrackBlock &block, const cv::Vec3d &tvec, int64_t timestamp) {
+        if (block.count == COMPACT_TRACK_BLOCK_SIZE || timestamp < block.lastTimestamp ||
+            timestamp - block.lastTimestamp > COMPACT_TRACK_MAX_TIMESTAMP_DELTA) {
+            return false;
+        }
+        double range = INT16_MAX * COMPACT_TRACK_TRANSLATION_STEP;
+        for (int axis = 0; axis < 3; axis++) {
+            if (std::abs(tvec[axis] - block.origin[axis]) > range) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<CompactTrackBlock>> blocks;
+    std::vector<int> blockStarts; // index of the first pose of each block
+    int poseCount = 0;
+};
+
+CompactTrack *castToCompactTrackPtr(jlong addr) {
+    return (CompactTrack *) addr;
+}
+
+#endif //ARUCOSLAM_COMPACTTRACK_H
@@ -0,0 +1,78 @@
+//
+// Sub-pixel refinement of the corners of the detected markers, restricted to the markers that are
+// actually used.
+//
+
+#ifndef ARUCOSLAM_CORNERREFINEMENT_H
+#define ARUCOSLAM_CORNERREFINEMENT_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "utils.h"
+#include "frameContext.h"
+#include "markerMap.h"
+#include "boardRegistry.h"
+
+/**
+ * Half size (in pixels) of the search window of the refinement in full resolution images, and its
+ * stop criteria: the same defaults of the corner refinement of cv::aruco::DetectorParameters.
+ */
+constexpr int CORNER_REFINEMENT_WINDOW = 5;
+constexpr int CORNER_REFINEMENT_MAX_ITERATIONS = 30;
+constexpr double CORNER_REFINEMENT_MIN_ACCURACY = 0.1;
+
+/**
+ * Refines, in parallel, the corners of the markers at the specified indices of the context, on the
+ * grayscale frame, and marks them as refined. The refinement is the gradient-based one of
+ * cv::cornerSubPix, run on the 4 corners of a marker at once.
+ *
+ * @param windowSize half size of the search window, in pixels; it must cover the error of the
+ *                   detected corners, so it grows with the decimation of the searched image
+ */
+template<typename INDICES>
+void refineMarkerCorners(const cv::Mat &gray, const INDICES &indices, int windowSize,
+                         FrameContext &context) {
+    std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+    cv::TermCriteria criteria(cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS,
+                              CORNER_REFINEMENT_MAX_ITERATIONS, CORNER_REFINEMENT_MIN_ACCURACY);
+    // each iteration writes only the corners of its own marker
+    p_for(i, (int) indices.size()) {
+        cv::cornerSubPix(gray, corners[indices[i]], cv::Size(windowSize, windowSize),
+                         cv::Size(-1, -1), criteria);
+    };
+    for (int index : indices) {
+        context.detectedRefined[index] = 1;
+    }
+}
+
+/**
+ * Refines the corners of the detected markers which can contribute to the pose of the camera in
+ * this frame: the ones known in the snapshot and the ones belonging to a registered board. The
+ * other markers are left unrefined (they are refined later by refinePromotedMarkers(), if they
+ * are promoted into the map).
+ *
+ * @param snapshot the known markers, or nullptr to refine all the markers
+ * @param boards the registered boards, or nullptr
+ * @return the number of refined markers
+ */
+int refinePoseRelevantMarkers(const cv::Mat &gray, const MarkerMapSnapshot *snapshot,
+                              const BoardRegistry *boards, int windowSize, FrameContext &context) {
+    const std::vector<int> &ids = context.detectedIDs;
+    context.detectedRefined.assign(ids.size(), 0);
+    context.refinementWindow = windowSize;
+    ArenaVector<int> relevant((ArenaAllocator<int>(&context.arena)));
+    relevant.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (snapshot == nullptr || snapshot->indexOf(ids[i]) >= 0 ||
+            (boards != nullptr && boards->contains(ids[i]))) {
+            relevant.push_back((int) i);
+        }
+    }
+    refineMarkerCorners(gray, relevant, windowSize, context);
+    return (int) relevant.size();
+}
+
+#endif //ARUCOSLAM_CORNERREFINEMENT_H
@@ -0,0 +1,277 @@
+//
+// Tracking of the corners of the detected markers with pyramidal Lucas-Kanade, between full
+// detections.
+//
+
+#ifndef ARUCOSLAM_CORNERTRACKER_H
+#define ARUCOSLAM_CORNERTRACKER_H
+
+#include <jni.h>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "frameContext.h"
+
+/**
+ * Full detections are run at most every this many frames; on the other frames the corners are
+ * tracked from the most recent reference frame.
+ */
+constexpr int CORNER_TRACKER_DEFAULT_DETECTION_INTERVAL = 3;
+
+/**
+ * A reference frame older than this many frames is not used: the motion would be too large for
+ * the pyramid, and the workers must detect again.
+ */
+constexpr uint64_t CORNER_TRACKER_MAX_FRAME_GAP = 8;
+
+/**
+ * Window and number of pyramid levels of the Lucas-Kanade tracker (4 levels of 21x21 windows
+ * follow motions of ~150 pixels between the frames), and its stop criteria.
+ */
+constexpr int CORNER_TRACKER_WINDOW = 21;
+constexpr int CORNER_TRACKER_MAX_LEVEL = 3;
+constexpr int CORNER_TRACKER_MAX_ITERATIONS = 20;
+constexpr double CORNER_TRACKER_MIN_ACCURACY = 0.03;
+
+/**
+ * A corner is tracked only if tracking it back to the reference frame lands within this distance
+ * (pixels) of where it started.
+ */
+constexpr double CORNER_TRACKER_MAX_FORWARD_BACKWARD_ERROR = 1.0;
+
+/**
+ * Number of values written by CornerTracker::stats().
+ */
+constexpr int CORNER_TRACKER_STATS_SIZE = 4;
+
+/**
+ * A frame from which the markers can be tracked: its image pyramid and the corners of its
+ * markers. A published reference is never modified (the same scheme of the marker map
+ * snapshots), so the workers can track from it without holding any lock.
+ */
+struct TrackingReference {
+    uint64_t frameNumber = 0;
+    std::vector<cv::Mat> pyramid;
+    std::vector<int> ids;
+    std::vector<cv::Point2f> corners; // 4 for each marker
+
+    // working buffers of the tracking into this frame, recycled with the reference
+    std::vector<cv::Point2f> forward, backward;
+    std::vector<unsigned char> forwardStatus, backwardStatus;
+    std::vector<float> errors;
+};
+
+/**
+ * The references no one uses anymore, whose buffers can be overwritten. A reference is put back
+ * here by the deleter of its shared_ptr, i.e. after the last worker that acquired it released it
+ * (the release of every owner happens before the deleter runs); the deleters keep the pool alive,
+ * so a reference can outlive its tracker.
+ */
+struct TrackingReferencePool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TrackingReference>> free;
+};
+
+/**
+ * A CornerTracker carries the corners of the markers of the last frames forward, so that a full
+ * detection is needed only every few frames, and the frames in which the detection fails (a
+ * partial occlusion, blur, a marker at the border) still give observations of the markers.
+ *
+ * The tracker is shared by the workers. The most recent frame with markers (detected or tracked)
+ * is published as the reference; each worker builds the pyramid of its frame once, tracks the
+ * corners of the reference forward into it and back again (forward-backward check), and keeps
+ * the markers whose 4 corners are all consistent. The pyramids are built in buffers recycled from
+ * the references that no worker uses anymore, so in the steady state the pyramids and the
+ * corners are not reallocated.
+ */
+class CornerTracker {
+public:
+    explicit CornerTracker(int detectionInterval = CORNER_TRACKER_DEFAULT_DETECTION_INTERVAL) :
+            detectionInterval(std::max(1, detectionInterval)),
+            spares(std::make_shared<TrackingReferencePool>()) {}
+
+    /**
+     * Decides whether the markers of a frame should be searched by a full detection: it is the
+     * case every detectionInterval frames, and when there is no recent reference to track from.
+     */
+    bool detectionDue(uint64_t frameNumber) {
+        std::unique_lock<std::mutex> lock(mutex);
+        bool due = frameNumber >= nextDetectionFrame || current == nullptr ||
+                   frameNumber > current->frameNumber + CORNER_TRACKER_MAX_FRAME_GAP;
+        if (due) {
+            nextDetectionFrame = frameNumber + detectionInterval;
+            detections++;
+        }
+        return due;
+    }
+
+    /**
+     * Publishes the markers found in a frame (detected or tracked) as the new reference, if the
+     * frame is more recent than the current reference.
+     */
+    void publish(uint64_t frameNumber, const cv::Mat &gray, const std::vector<int> &ids,
+                 const std::vector<std::vector<cv::Point2f>> &corners) {
+        if (ids.empty()) {
+            return;
+        }
+        std::shared_ptr<TrackingReference> reference = spareReference();
+        reference->frameNumber = frameNumber;
+        cv::buildOpticalFlowPyramid(gray, reference->pyramid,
+                                    cv::Size(CORNER_TRACKER_WINDOW, CORNER_TRACKER_WINDOW),
+                                    CORNER_TRACKER_MAX_LEVEL, false);
+        publish(reference, ids, corners);
+    }
+
+    /**
+     * Tracks the markers of the current reference into a frame, writing the tracked markers in
+     * the detected ids and corners of the context, and publishes the frame as the new reference.
+     *
+     * @return the number of tracked markers (0 if there is no usable reference)
+     */
+    int track(uint64_t frameNumber, const cv::Mat &gray, FrameContext &context) {
+        std::vector<int> &ids = context.detectedIDs;
+        std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+        ids.clear();
+        corners.clear();
+
+        std::shared_ptr<const TrackingReference> reference = acquire();
+        if (reference == nullptr || reference->frameNumber >= frameNumber ||
+            frameNumber > reference->frameNumber + CORNER_TRACKER_MAX_FRAME_GAP) {
+            return 0;
+        }
+
+        std::shared_ptr<TrackingReference> tracked = spareReference();
+        tracked->frameNumber = frameNumber;
+        cv::Size window(CORNER_TRACKER_WINDOW, CORNER_TRACKER_WINDOW);
+        cv::buildOpticalFlowPyramid(gray, tracked->pyramid, window, CORNER_TRACKER_MAX_LEVEL,
+                                    false);
+
+        cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
+                                  CORNER_TRACKER_MAX_ITERATIONS, CORNER_TRACKER_MIN_ACCURACY);
+        std::vector<cv::Point2f> &forward = tracked->forward;
+        std::vector<cv::Point2f> &backward = tracked->backward;
+        cv::calcOpticalFlowPyrLK(reference->pyramid, tracked->pyramid, reference->corners,
+                                 forward, tracked->forwardStatus, tracked->errors, window,
+                                 CORNER_TRACKER_MAX_LEVEL, criteria);
+        // the way back starts from the original corners, which are the expected result
+        backward.assign(reference->corners.begin(), reference->corners.end());
+        cv::calcOpticalFlowPyrLK(tracked->pyramid, reference->pyramid, forward,
+                                 backward, tracked->backwardStatus, tracked->errors, window,
+                                 CORNER_TRACKER_MAX_LEVEL, criteria,
+                                 cv::OPTFLOW_USE_INITIAL_FLOW);
+
+        cv::Rect2f frame(0.0f, 0.0f, gray.cols, gray.rows);
+        int lost = 0;
+        for (size_t m = 0; m < reference->ids.size(); m++) {
+            bool consistent = true;
+            for (size_t c = m * 4; c < m * 4 + 4 && consistent; c++) {
+                cv::Point2f drift = backward[c] - reference->corners[c];
+                consistent = tracked->forwardStatus[c] && tracked->backwardStatus[c] &&
+                             frame.contains(forward[c]) &&
+                             drift.dot(drift) <= CORNER_TRACKER_MAX_FORWARD_BACKWARD_ERROR *
+                                                 CORNER_TRACKER_MAX_FORWARD_BACKWARD_ERROR;
+            }
+            if (!consistent) {
+                lost++;
+                continue;
+            }
+            ids.push_back(reference->ids[m]);
+            corners.emplace_back(forward.begin() + m * 4, forward.begin() + m * 4 + 4);
+        }
+        reference.reset();
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            trackedFrames++;
+            trackedMarkers += ids.size();
+            lostMarkers += lost;
+        }
+        if (!ids.empty()) {
+            publish(tracked, ids, corners);
+        }
+        return ids.size();
+    }
+
+    /**
+     * Writes CORNER_TRACKER_STATS_SIZE values on out: [0] full detections, [1] tracked frames,
+     * [2] tracked markers, [3] markers lost by the forward-backward check.
+     */
+    void stats(jlong *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        out[0] = detections;
+        out[1] = trackedFrames;
+        out[2] = trackedMarkers;
+        out[3] = lostMarkers;
+    }
+
+private:
+    std::shared_ptr<const TrackingReference> acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return current;
+    }
+
+    /**
+     * @return a reference owned by no one else, whose buffers can be overwritten; it returns to
+     *         the spares when its last owner releases it
+     */
+    std::shared_ptr<TrackingReference> spareReference() {
+        std::unique_ptr<TrackingReference> spare;
+        {
+            std::unique_lock<std::mutex> lock(spares->mutex);
+            if (!spares->free.empty()) {
+                spare = std::move(spares->free.back());
+                spares->free.pop_back();
+            }
+        }
+        if (spare == nullptr) {
+            spare.reset(new TrackingReference());
+        }
+        std::shared_ptr<TrackingReferencePool> pool = spares;
+        return std::shared_ptr<TrackingReference>(
+                spare.release(), [pool](TrackingReference *reference) {
+                    std::unique_lock<std::mutex> lock(pool->mutex);
+                    pool->free.emplace_back(reference);
+                });
+    }
+
+    void publish(std::shared_ptr<TrackingReference> &reference, const std::vector<int> &ids,
+                 const std::vector<std::vector<cv::Point2f>> &corners) {
+        reference->ids.assign(ids.begin(), ids.end());
+        reference->corners.clear();
+        for (const std::vector<cv::Point2f> &markerCorners : corners) {
+            reference->corners.insert(reference->corners.end(), markerCorners.begin(),
+                                      markerCorners.end());
+        }
+        std::shared_ptr<TrackingReference> replaced;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (current == nullptr || reference->frameNumber > current->frameNumber) {
+                std::swap(current, reference);
+            }
+            replaced = std::move(reference);
+        }
+        // dropped outside the lock: if no worker uses it, it goes back to the spares now
+        replaced.reset();
+    }
+
+    const int detectionInterval;
+    std::mutex mutex;
+    std::shared_ptr<TrackingReference> current;
+    std::shared_ptr<TrackingReferencePool> spares;
+    uint64_t nextDetectionFrame = 0;
+    jlong detections = 0;
+    jlong trackedFrames = 0;
+    jlong trackedMarkers = 0;
+    jlong lostMarkers = 0;
+};
+
+CornerTracker *castToCornerTrackerPtr(jlong addr) {
+    return (CornerTracker *) addr;
+}
+
+#endif //ARUCOSLAM_CORNERTRACKER_H
@@ -0,0 +1,513 @@
+//
+// Per-worker state of the marker detector, kept across frames.
+//
+
+#ifndef ARUCOSLAM_DETECTORSESSION_H
+#define ARUCOSLAM_DETECTORSESSION_H
+
+#include <jni.h>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/aruco.hpp>
+
+#include "frameContext.h"
+#include "qualityController.h"
+#include "cornerRefinement.h"
+#include "multiDictionary.h"
+
+/**
+ * Margin added on each side of the bounding box of the markers found in the previous frame, as a
+ * fraction of the largest side of the box (the markers may have moved in the meantime, and the
+ * previous frame of the worker is a few frames old when more workers are active).
+ */
+constexpr double DETECTION_ROI_MARGIN = 0.5;
+constexpr int DETECTION_ROI_MIN_MARGIN = 32; // pixels
+
+/**
+ * The whole frame is searched at least once every N frames, so that the markers entering the
+ * view outside the region of interest are found.
+ */
+constexpr int DETECTION_FULL_FRAME_INTERVAL = 10;
+
+/**
+ * Maximum number of adaptive thresholding window sizes tracked by a session.
+ */
+constexpr int DETECTION_MAX_WINDOW_SIZES = 16;
+
+/**
+ * All the window sizes are tried (one by one, to learn which ones find markers) at least once
+ * every N frames.
+ */
+constexpr int DETECTION_WINDOW_SWEEP_INTERVAL = 30;
+
+/**
+ * Two markers with the same id found with different window sizes are the same marker if their
+ * centers are closer than this (in pixels).
+ */
+constexpr float DETECTION_DUPLICATE_DISTANCE = 4.0f;
+
+/**
+ * Number of values written by DetectorSession::stats().
+ */
+constexpr int DETECTOR_SESSION_STATS_SIZE = 5 + 3 * DETECTION_MAX_WINDOW_SIZES;
+
+/**
+ * The configuration a DetectorSession is currently detecting with (see
+ * DetectorSession::settings()): it changes at run time, as the session learns the window sizes
+ * and the quality controller changes the decimation.
+ */
+struct DetectorSettings {
+    int dictionaryId = -1;
+    int extraDictionaryIds[MULTI_DICTIONARY_MAX_DICTIONARIES] = {};
+    int extraDictionaryCount = 0;
+    int windowSizes[DETECTION_MAX_WINDOW_SIZES] = {}; // the adaptive threshold sizes being run
+    int windowSizeCount = 0;
+    double adaptiveThreshConstant = 0.0;
+    double minMarkerPerimeterRate = 0.0, maxMarkerPerimeterRate = 0.0;
+    int decimation = 1;
+    int cornerRefinementMethod = 0; // of the detector
+    int refinementWindowSize = 0; // half size of the window of cornerRefinement.h
+
+    bool operator==(const DetectorSettings &other) const {
+        return dictionaryId == other.dictionaryId &&
+               extraDictionaryCount == other.extraDictionaryCount &&
+               std::equal(extraDictionaryIds, extraDictionaryIds + extraDictionaryCount,
+                          other.extraDictionaryIds) &&
+               windowSizeCount == other.windowSizeCount &&
+               std::equal(windowSizes, windowSizes + windowSizeCount, other.windowSizes) &&
+               adaptiveThreshConstant == other.adaptiveThreshConstant &&
+               minMarkerPerimeterRate == other.minMarkerPerimeterRate &&
+               maxMarkerPerimeterRate == other.maxMarkerPerimeterRate &&
+               decimation == other.decimation &&
+               cornerRefinementMethod == other.cornerRefinementMethod &&
+               refinementWindowSize == other.refinementWindowSize;
+    }
+
+    bool operator!=(const DetectorSettings &other) const { return !(*this == other); }
+};
+
+/**
+ * A DetectorSession keeps the state of the detector of a worker between frames: the detector
+ * parameters and the dictionary (created once instead of at each frame), and the region where
+ * the markers were found in the last frame.
+ * According to the settings of the quality controller (if any), the markers are searched only in
+ * the region of interest around the last found ones, and in a decimated image. The corners are not
+ * refined by the detector: the markers which are actually used are refined afterwards (see
+ * cornerRefinement.h), with a window wide enough to cover the decimation.
+ *
+ * The session also learns which adaptive thresholding window sizes are worth running: the
+ * detector thresholds the whole image once for each size from adaptiveThreshWinSizeMin to
+ * adaptiveThreshWinSizeMax, but in a steady scene most of those passes only find markers already
+ * found by another one. Periodically, the sizes are run one at a time and each of them is credited
+ * with the markers it found first; the following frames run only the credited sizes, merged in a
+ * single detector pass when they are evenly spaced (e.g. contiguous). When fewer markers than in
+ * the last sweep are found, the skipped sizes are run too in the same frame, and the credits are
+ * recomputed.
+ *
+ * When additional dictionaries are added, the candidates rejected by the detector passes are
+ * decoded against them (see MultiDictionaryDecoder), so mixed marker families cost a single
+ * detection.
+ */
+class DetectorSession {
+public:
+    /**
+     * @param controller the quality controller that decides how the markers are searched, or
+     *                   nullptr to always search the whole frame at full resolution
+     */
+    explicit DetectorSession(AdaptiveQualityController *controller) :
+            controller(controller),
+            parameters(cv::aruco::DetectorParameters::create()),
+            dictionaryId(-1),
+            framesSinceFullFrame(0) {
+        parameters->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
+        windowSizeStep = std::max(1, parameters->adaptiveThreshWinSizeStep);
+        for (int size = parameters->adaptiveThreshWinSizeMin;
+             size <= parameters->adaptiveThreshWinSizeMax &&
+             windowSizeCount < DETECTION_MAX_WINDOW_SIZES;
+             size += windowSizeStep) {
+            windowSizes[windowSizeCount++] = size;
+        }
+    }
+
+    const cv::Ptr<cv::aruco::DetectorParameters> &getParameters() const { return parameters; }
+
+    /**
+     * Adds a dictionary whose markers are searched together with the ones of the main dictionary;
+     * their ids are tagged with the dictionary (see taggedMarkerId()).
+     *
+     * @return false if the dictionary was already added, or too many dictionaries were added
+     */
+    bool addDictionary(int dictionaryId) {
+        return extraDictionaries.add(dictionaryId);
+    }
+
+    /**
+     * @return the half size of the corner refinement window for the markers of the last frame,
+     *         which covers the error of corners found in a decimated image
+     */
+    int refinementWindowSize() const {
+        return std::max(CORNER_REFINEMENT_WINDOW, lastDecimation + 1);
+    }
+
+    /**
+     * Writes on out the configuration used for the last frame: the window sizes are the learned
+     * ones (all of them until something is learned).
+     */
+    void settings(DetectorSettings &out) const {
+        out.dictionaryId = dictionaryId;
+        out.extraDictionaryCount = extraDictionaries.count();
+        for (int i = 0; i < out.extraDictionaryCount; i++) {
+            out.extraDictionaryIds[i] = extraDictionaries.dictionaryIdAt(i);
+        }
+        out.windowSizeCount = 0;
+        for (int i = 0; i < windowSizeCount; i++) {
+            if (!learned || useful[i]) {
+                out.windowSizes[out.windowSizeCount++] = windowSizes[i];
+            }
+        }
+        out.adaptiveThreshConstant = parameters->adaptiveThreshConstant;
+        out.minMarkerPerimeterRate = parameters->minMarkerPerimeterRate;
+        out.maxMarkerPerimeterRate = parameters->maxMarkerPerimeterRate;
+        out.decimation = lastDecimation;
+        out.cornerRefinementMethod = parameters->cornerRefinementMethod;
+        out.refinementWindowSize = refinementWindowSize();
+    }
+
+    /**
+     * Writes DETECTOR_SESSION_STATS_SIZE values on out: the number of window sizes, the number of
+     * sweeps, of resets (sweeps forced by a drop of the found markers), of detector passes run and
+     * of window sizes skipped, then (size, 1 if currently run, markers credited) for each window
+     * size.
+     */
+    void stats(jlong *out) const {
+        out[0] = windowSizeCount;
+        out[1] = sweeps;
+        out[2] = resets;
+        out[3] = passes;
+        out[4] = skippedPasses;
+        for (int i = 0; i < DETECTION_MAX_WINDOW_SIZES; i++) {
+            bool tracked = i < windowSizeCount;
+            out[5 + 3 * i] = tracked ? windowSizes[i] : 0;
+            out[6 + 3 * i] = tracked && (!learned || useful[i]) ? 1 : 0;
+            out[7 + 3 * i] = tracked ? acceptedByWindow[i] : 0;
+        }
+    }
+
+    /**
+     * Finds the markers in the grayscale image, leaving their corners and ids in the context.
+     */
+    DetectionMode detect(int markerDictionary, const cv::Mat &gray,
+                         const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                         FrameContext &context) {
+        if (markerDictionary != dictionaryId) {
+            dictionary = cv::aruco::getPredefinedDictionary(markerDictionary);
+            dictionaryId = markerDictionary;
+        }
+        bool roiDetection = false;
+        int decimation = 1;
+        if (controller != nullptr) {
+            QualitySettings settings = controller->settings();
+            roiDetection = settings.roiDetection;
+            decimation = settings.decimation;
+        }
+        lastDecimation = decimation;
+
+        DetectionMode mode = DETECTION_MODE_FULL_FRAME;
+        cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+        if (roiDetection && lastMarkersBox.area() > 0 &&
+            framesSinceFullFrame < DETECTION_FULL_FRAME_INTERVAL) {
+            search(gray, lastMarkersBox, decimation, cameraMatrix, distCoeffs, context);
+            mode = DETECTION_MODE_ROI;
+            if (context.detectedIDs.empty()) {
+                mode = DETECTION_MODE_ROI_FALLBACK;
+            }
+        }
+        if (mode != DETECTION_MODE_ROI) {
+            search(gray, frameRect, decimation, cameraMatrix, distCoeffs, context);
+            framesSinceFullFrame = 0;
+        } else {
+            framesSinceFullFrame++;
+        }
+
+        updateMarkersBox(context.detectedCorners, frameRect);
+        if (controller != nullptr) {
+            controller->recordDetectionMode(mode);
+        }
+        return mode;
+    }
+
+private:
+    void search(const cv::Mat &gray, const cv::Rect &region, int decimation,
+                const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, FrameContext &context) {
+        std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+        if (decimation != learnedDecimation) {
+            // the window sizes are in pixels of the searched image: what was learned is lost
+            learned = false;
+            learnedDecimation = decimation;
+        }
+        bool fullResolutionFrame = decimation == 1 && region.size() == gray.size();
+        if (fullResolutionFrame) {
+            detectWithLearnedWindows(gray, cameraMatrix, distCoeffs, context);
+            return;
+        }
+
+        cv::Mat searched = gray(region);
+        if (decimation > 1) {
+            cv::Mat &decimated = context.arena.imageBuffer(
+                    FRAME_ARENA_DECIMATED_BUFFER,
+                    cv::Size(region.width / decimation, region.height / decimation), CV_8UC1);
+            cv::resize(searched, decimated, decimated.size(), 0, 0, cv::INTER_AREA);
+            searched = decimated;
+        }
+        // the camera matrix does not apply to a cropped/decimated image
+        detectWithLearnedWindows(searched, cv::noArray(), cv::noArray(), context);
+
+        float scale = static_cast<float>(decimation);
+        cv::Point2f offset(region.x + 0.5f * (scale - 1.0f), region.y + 0.5f * (scale - 1.0f));
+        for (std::vector<cv::Point2f> &markerCorners : corners) {
+            for (cv::Point2f &corner : markerCorners) {
+                corner = corner * scale + offset;
+            }
+        }
+    }
+
+    void detectWithLearnedWindows(const cv::Mat &image, cv::InputArray cameraMatrix,
+                                  cv::InputArray distCoeffs, FrameContext &context) {
+        std::vector<int> &ids = context.detectedIDs;
+        std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+        ids.clear();
+        corners.clear();
+        rejected.clear();
+        for (int i = 0; i < windowSizeCount; i++) {
+            contributed[i] = false;
+        }
+
+        if (!learned || framesSinceSweep >= DETECTION_WINDOW_SWEEP_INTERVAL) {
+            if (lastFoundCount == 0) {
+                // nothing to learn from: a single pass with all the window sizes
+                setWindowSizes(windowSizes[0], windowSizes[windowSizeCount - 1], windowSizeStep);
+                cv::aruco::detectMarkers(image, dictionary, corners, ids, parameters,
+                                         rejectedOutput(), cameraMatrix, distCoeffs);
+                rejected.swap(passRejected);
+                passes++;
+                learned = false;
+            } else {
+                for (int i = 0; i < windowSizeCount; i++) {
+                    detectWithWindows(i, i, 1, image, cameraMatrix, distCoeffs, ids, corners);
+                }
+                learnFromThisFrame(ids.size());
+                sweeps++;
+            }
+        } else {
+            for (int i = 0; i < windowSizeCount; i++) {
+                if (!useful[i]) {
+                    skippedPasses++;
+                }
+            }
+            detectWithUsefulWindows(image, cameraMatrix, distCoeffs, ids, corners);
+            framesSinceSweep++;
+            if (ids.size() < sweepFoundCount) {
+                // some markers may be lost because of the skipped window sizes: run them too
+                for (int i = 0; i < windowSizeCount; i++) {
+                    if (!useful[i]) {
+                        detectWithWindows(i, i, 1, image, cameraMatrix, distCoeffs, ids,
+                                          corners);
+                        skippedPasses--;
+                    }
+                }
+                learnFromThisFrame(ids.size());
+                resets++;
+            }
+        }
+        lastFoundCount = ids.size();
+        setWindowSizes(windowSizes[0], windowSizes[windowSizeCount - 1], windowSizeStep);
+
+        if (!extraDictionaries.empty()) {
+            // a candidate rejected by a pass may have been accepted by another one
+            rejected.erase(std::remove_if(rejected.begin(), rejected.end(),
+                                          [&](const std::vector<cv::Point2f> &candidate) {
+                                              return nearAny(candidate, corners);
+                                          }),
+                           rejected.end());
+            extraDictionaries.decode(image, rejected, *parameters, ids, corners);
+        }
+    }
+
+    /**
+     * The rejected candidates are collected only when they can be decoded as markers of the
+     * additional dictionaries.
+     */
+    cv::_OutputArray rejectedOutput() {
+        passRejected.clear();
+        return extraDictionaries.empty() ? cv::_OutputArray(cv::noArray())
+                                         : cv::_OutputArray(passRejected);
+    }
+
+    /**
+     * @return true if the center of the candidate is close to the center of one of the markers
+     */
+    static bool nearAny(const std::vector<cv::Point2f> &candidate,
+                        const std::vector<std::vector<cv::Point2f>> &markers) {
+        cv::Point2f center = markerCenter(candidate);
+        for (const std::vector<cv::Point2f> &markerCorners : markers) {
+            cv::Point2f difference = markerCenter(markerCorners) - center;
+            if (difference.dot(difference) <
+                DETECTION_DUPLICATE_DISTANCE * DETECTION_DUPLICATE_DISTANCE) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Runs the useful window sizes with as few detector passes as possible: each pass runs an
+     * evenly spaced sequence of them (the detector thresholds the image with the sizes from
+     * adaptiveThreshWinSizeMin to adaptiveThreshWinSizeMax, every adaptiveThreshWinSizeStep), so
+     * contiguous useful sizes cost a single call of the detector.
+     */
+    void detectWithUsefulWindows(const cv::Mat &image, cv::InputArray cameraMatrix,
+                                 cv::InputArray distCoeffs, std::vector<int> &ids,
+                                 std::vector<std::vector<cv::Point2f>> &corners) {
+        int first = 0;
+        while (first < windowSizeCount) {
+            if (!useful[first]) {
+                first++;
+                continue;
+            }
+            int next = first + 1;
+            while (next < windowSizeCount && !useful[next]) {
+                next++;
+            }
+            // the sequence goes on while the next useful size is at the same distance
+            int indexStep = next - first;
+            int last = first;
+            while (last + indexStep < windowSizeCount && useful[last + indexStep] &&
+                   std::find(useful + last + 1, useful + last + indexStep, true) ==
+                   useful + last + indexStep) {
+                last += indexStep;
+            }
+            detectWithWindows(first, last, indexStep, image, cameraMatrix, distCoeffs, ids,
+                              corners);
+            first = last + 1;
+        }
+    }
+
+    /**
+     * Runs the detector with the window sizes from firstIndex to lastIndex, every indexStep, in a
+     * single pass, and appends the markers not found yet; the markers are credited to the first
+     * window size of the pass, and all the window sizes of the pass contributed to the frame.
+     */
+    void detectWithWindows(int firstIndex, int lastIndex, int indexStep, const cv::Mat &image,
+                           cv::InputArray cameraMatrix, cv::InputArray distCoeffs,
+                           std::vector<int> &ids, std::vector<std::vector<cv::Point2f>> &corners) {
+        int step = lastIndex > firstIndex ?
+                   windowSizes[firstIndex + indexStep] - windowSizes[firstIndex] : windowSizeStep;
+        setWindowSizes(windowSizes[firstIndex], windowSizes[lastIndex], step);
+        cv::aruco::detectMarkers(image, dictionary, passCorners, passIDs, parameters,
+                                 rejectedOutput(), cameraMatrix, distCoeffs);
+        passes++;
+        for (const std::vector<cv::Point2f> &candidate : passRejected) {
+            if (!nearAny(candidate, rejected)) {
+                rejected.push_back(candidate);
+            }
+        }
+        for (size_t j = 0; j < passIDs.size(); j++) {
+            cv::Point2f center = markerCenter(passCorners[j]);
+            bool duplicate = false;
+            for (size_t k = 0; k < ids.size() && !duplicate; k++) {
+                cv::Point2f difference = markerCenter(corners[k]) - center;
+                duplicate = ids[k] == passIDs[j] &&
+                            difference.dot(difference) <
+                            DETECTION_DUPLICATE_DISTANCE * DETECTION_DUPLICATE_DISTANCE;
+            }
+            if (!duplicate) {
+                ids.push_back(passIDs[j]);
+                corners.push_back(passCorners[j]);
+                for (int i = firstIndex; i <= lastIndex; i += indexStep) {
+                    contributed[i] = true;
+                }
+                acceptedByWindow[firstIndex]++;
+            }
+        }
+    }
+
+    /**
+     * The window sizes to be run in the next frames are the ones that found markers in this one.
+     */
+    void learnFromThisFrame(size_t foundCount) {
+        learned = false;
+        for (int i = 0; i < windowSizeCount; i++) {
+            useful[i] = contributed[i];
+            learned = learned || contributed[i];
+        }
+        framesSinceSweep = 0;
+        sweepFoundCount = foundCount;
+    }
+
+    void setWindowSizes(int minSize, int maxSize, int step) {
+        parameters->adaptiveThreshWinSizeMin = minSize;
+        parameters->adaptiveThreshWinSizeMax = maxSize;
+        parameters->adaptiveThreshWinSizeStep = step;
+    }
+
+    static cv::Point2f markerCenter(const std::vector<cv::Point2f> &markerCorners) {
+        return (markerCorners[0] + markerCorners[1] + markerCorners[2] + markerCorners[3]) * 0.25f;
+    }
+
+    void updateMarkersBox(const std::vector<std::vector<cv::Point2f>> &corners,
+                          const cv::Rect &frameRect) {
+        if (corners.empty()) {
+            lastMarkersBox = cv::Rect();
+            return;
+        }
+        float minX = frameRect.width, minY = frameRect.height, maxX = 0, maxY = 0;
+        for (const std::vector<cv::Point2f> &markerCorners : corners) {
+            for (const cv::Point2f &corner : markerCorners) {
+                minX = std::min(minX, corner.x);
+                minY = std::min(minY, corner.y);
+                maxX = std::max(maxX, corner.x);
+                maxY = std::max(maxY, corner.y);
+            }
+        }
+        int margin = std::max(DETECTION_ROI_MIN_MARGIN, static_cast<int>(
+                std::max(maxX - minX, maxY - minY) * DETECTION_ROI_MARGIN));
+        cv::Rect box(cv::Point(static_cast<int>(minX) - margin, static_cast<int>(minY) - margin),
+                     cv::Point(static_cast<int>(maxX) + margin, static_cast<int>(maxY) + margin));
+        lastMarkersBox = box & frameRect;
+    }
+
+    AdaptiveQualityController *controller;
+    cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    cv::Ptr<cv::aruco::Dictionary> dictionary;
+    int dictionaryId;
+    cv::Rect lastMarkersBox;
+    int framesSinceFullFrame;
+    int lastDecimation = 1;
+
+    int windowSizes[DETECTION_MAX_WINDOW_SIZES] = {};
+    int windowSizeCount = 0;
+    int windowSizeStep = 1;
+    bool useful[DETECTION_MAX_WINDOW_SIZES] = {};
+    bool contributed[DETECTION_MAX_WINDOW_SIZES] = {};
+    long long acceptedByWindow[DETECTION_MAX_WINDOW_SIZES] = {};
+    bool learned = false;
+    int learnedDecimation = 1;
+    int framesSinceSweep = 0;
+    size_t sweepFoundCount = 0;
+    size_t lastFoundCount = 0;
+    long long sweeps = 0, resets = 0, passes = 0, skippedPasses = 0;
+    // recycled outputs of the passes
+    std::vector<int> passIDs;
+    std::vector<std::vector<cv::Point2f>> passCorners;
+    std::vector<std::vector<cv::Point2f>> passRejected, rejected; // candidates of the passes
+    MultiDictionaryDecoder extraDictionaries;
+};
+
+DetectorSession *castToDetectorSessionPtr(jlong addr) {
+    return (DetectorSession *) addr;
+}
+
+#endif //ARUCOSLAM_DETECTORSESSION_H
@@ -0,0 +1,199 @@
+//
+// Per-worker frame arena: a bump allocator reset at each frame boundary.
+//
+
+#ifndef ARUCOSLAM_FRAMEARENA_H
+#define ARUCOSLAM_FRAMEARENA_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Indices of the pre-sized image buffers owned by a FrameArena.
+ */
+constexpr int FRAME_ARENA_GRAY_BUFFER = 0;
+constexpr int FRAME_ARENA_DECIMATED_BUFFER = 1;
+constexpr int FRAME_ARENA_SHARPNESS_BUFFER = 2;
+constexpr int FRAME_ARENA_LAPLACIAN_BUFFER = 3;
+constexpr int FRAME_ARENA_IMAGE_BUFFERS = 4;
+
+/**
+ * A FrameArena is the allocator of a frame worker (see FrameContext): it owns a contiguous memory
+ * block from which all the short-lived containers of a frame are allocated by simply bumping an
+ * offset, and a set of image buffers which are re-used from one frame to the other.
+ * Nothing is ever freed during a frame; the whole arena is rewound by reset(), which must be
+ * called at the frame boundary (i.e. when no allocation of the previous frame is alive anymore).
+ *
+ * Allocations are lock-free (the offset is atomic), so the arena can be used inside a p_for.
+ * When the block is exhausted the arena falls back to the heap and counts the event; at the next
+ * reset() the block is grown to fit the whole demand of the previous frame, so that in the steady
+ * state the frame path does not touch the heap at all.
+ */
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity) :
+            capacity(capacity),
+            block(static_cast<char *>(std::malloc(capacity))),
+            offset(0),
+            heapAllocationsInFrame(0) {
+    }
+
+    FrameArena(const FrameArena &) = delete;
+
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    ~FrameArena() {
+        releaseOverflowBlocks();
+        std::free(block);
+    }
+
+    /**
+     * Returns a pointer to {@code bytes} bytes aligned to {@code alignment}; the memory is valid
+     * until the next reset().
+     */
+    void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        size_t start = offset.fetch_add(bytes + alignment - 1, std::memory_order_relaxed);
+        if (start + bytes + alignment - 1 <= capacity) {
+            auto address = reinterpret_cast<uintptr_t>(block + start);
+            address = (address + alignment - 1) & ~(uintptr_t(alignment) - 1);
+            return reinterpret_cast<void *>(address);
+        }
+        // the block is exhausted: fall back to the heap (the block will be grown at reset())
+        std::unique_lock<std::mutex> lock(overflowMutex);
+        heapAllocationsInFrame++;
+        void *overflow = std::malloc(bytes + alignment);
+        overflowBlocks.push_back(overflow);
+        auto address = reinterpret_cast<uintptr_t>(overflow);
+        address = (address + alignment - 1) & ~(uintptr_t(alignment) - 1);
+        return reinterpret_cast<void *>(address);
+    }
+
+    /**
+     * Rewinds the arena; to be called at the beginning of each frame.
+     */
+    void reset() {
+        size_t demand = offset.load(std::memory_order_relaxed);
+        if (demand > peakUsage) {
+            peakUsage = demand;
+        }
+        lastFrameHeapAllocations = heapAllocationsInFrame;
+        heapAllocationsInFrame = 0;
+        frames++;
+
+        if (!overflowBlocks.empty()) {
+            releaseOverflowBlocks();
+            size_t newCapacity = capacity * 2;
+            while (newCapacity < demand) {
+                newCapacity *= 2;
+            }
+            std::free(block);
+            block = static_cast<char *>(std::malloc(newCapacity));
+            capacity = newCapacity;
+        }
+        offset.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the image buffer in the specified slot, (re)allocated only if its size or type
+     * changed from the last frame.
+     */
+    cv::Mat &imageBuffer(int slot, const cv::Size &size, int type) {
+        cv::Mat &buffer = imageBuffers[slot];
+        const unsigned char *oldData = buffer.data;
+        buffer.create(size, type);
+        if (buffer.data != oldData) {
+            std::unique_lock<std::mutex> lock(overflowMutex);
+            heapAllocationsInFrame++;
+        }
+        return buffer;
+    }
+
+    /**
+     * Returns the image buffer in the specified slot, as left by the current frame.
+     */
+    const cv::Mat &imageBuffer(int slot) const {
+        return imageBuffers[slot];
+    }
+
+    uint64_t heapAllocationsInLastFrame() const { return lastFrameHeapAllocations; }
+
+    size_t peakUsageBytes() const { return peakUsage; }
+
+    size_t capacityBytes() const { return capacity; }
+
+    uint64_t frameCount() const { return frames; }
+
+private:
+    void releaseOverflowBlocks() {
+        for (void *overflow : overflowBlocks) {
+            std::free(overflow);
+        }
+        overflowBlocks.clear();
+    }
+
+    size_t capacity;
+    char *block;
+    std::atomic<size_t> offset;
+
+    std::mutex overflowMutex;
+    std::vector<void *> overflowBlocks;
+    uint64_t heapAllocationsInFrame;
+
+    uint64_t lastFrameHeapAllocations = 0;
+    size_t peakUsage = 0;
+    uint64_t frames = 0;
+
+    cv::Mat imageBuffers[FRAME_ARENA_IMAGE_BUFFERS];
+};
+
+/**
+ * Standard allocator that takes its memory from a FrameArena; deallocation is a no-op since the
+ * memory is reclaimed all at once by FrameArena::reset().
+ * When no arena is specified, it behaves like std::allocator.
+ */
+template<typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    FrameArena *arena;
+
+    ArenaAllocator(FrameArena *arena = nullptr) noexcept : arena(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        if (arena == nullptr) {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t) noexcept {
+        if (arena == nullptr) {
+            ::operator delete(p);
+        }
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena == b.arena;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena != b.arena;
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif //ARUCOSLAM_FRAMEARENA_H
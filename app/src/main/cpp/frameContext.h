@@ -0,0 +1,93 @@
+//
+// Per-worker frame context: the results of the stages of the frame pipeline, and the arena from
+// which the stages allocate their temporaries.
+//
+
+#ifndef ARUCOSLAM_FRAMECONTEXT_H
+#define ARUCOSLAM_FRAMECONTEXT_H
+
+#include <jni.h>
+#include <vector>
+#include <cstddef>
+
+#include <opencv2/core/core.hpp>
+
+#include "frameArena.h"
+
+/**
+ * A FrameContext is the native counterpart of a frame worker: the stages of the frame pipeline
+ * leave their results here (the found markers, their poses and the flags of the frame), where
+ * they remain available to the later stages and to the JNI calls of the same frame, and allocate
+ * their short-lived containers from the arena.
+ * The results are overwritten by the stages of the next frame, which must begin with reset().
+ */
+class FrameContext {
+public:
+    explicit FrameContext(size_t arenaCapacity) : arena(arenaCapacity) {
+    }
+
+    FrameContext(const FrameContext &) = delete;
+
+    FrameContext &operator=(const FrameContext &) = delete;
+
+    /**
+     * Rewinds the arena; to be called at the beginning of each frame.
+     */
+    void reset() {
+        arena.reset();
+    }
+
+    FrameArena arena;
+
+    /**
+     * The markers found in the frame. Containers passed to OpenCV functions as output arrays
+     * cannot use a custom allocator, so they are kept here and recycled (their capacity survives
+     * clear()).
+     */
+    std::vector<int> detectedIDs;
+    std::vector<std::vector<cv::Point2f>> detectedCorners;
+    std::vector<cv::Vec3d> detectedRvecs, detectedTvecs;
+    std::vector<double> detectedQualities;
+    std::vector<cv::Point2f> charucoCorners;
+    std::vector<int> charucoIDs;
+
+    /**
+     * For each detected marker, the other pose compatible with its corners (see squarePnP.h), and
+     * the ambiguity between the two: the ratio of their reprojection errors, in [0, 1], which is
+     * close to 1 when the marker is far or seen frontally and the two poses cannot be told apart.
+     */
+    std::vector<cv::Vec3d> detectedAlternativeRvecs, detectedAlternativeTvecs;
+    std::vector<double> detectedAmbiguities;
+
+    /**
+     * For each detected marker, 1 if its corners were refined to sub-pixel accuracy, and the half
+     * size of the refinement window suitable for the frame (see cornerRefinement.h).
+     */
+    std::vector<unsigned char> detectedRefined;
+    int refinementWindow = 0;
+
+    /**
+     * Sharpness of the frame measured by the sharpness gate (0 if not measured), and whether the
+     * gate skipped the detection because the frame is blurred.
+     */
+    double sharpness = 0.0;
+    bool blurredFrame = false;
+
+    /**
+     * Whether the markers of the frame were tracked from the previous frames (see
+     * cornerTracker.h) instead of detected.
+     */
+    bool trackedFrame = false;
+
+    /**
+     * Mean quality of the observations which are inliers of the camera pose estimated in the
+     * frame, 0 if no pose was estimated.
+     */
+    double poseQuality = 0.0;
+};
+
+FrameContext *castToFrameContextPtr(jlong addr) {
+    return (FrameContext *) addr;
+}
+
+#endif //ARUCOSLAM_FRAMECONTEXT_H
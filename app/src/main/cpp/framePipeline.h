@@ -0,0 +1,388 @@
+//
+// Core of the frame processing (marker detection and camera pose estimation), independent of JNI.
+//
+
+#ifndef ARUCOSLAM_FRAMEPIPELINE_H
+#define ARUCOSLAM_FRAMEPIPELINE_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/aruco.hpp>
+
+#include "utils.h"
+#include "positionRansac.h"
+#include "frameContext.h"
+#include "overlayCommands.h"
+#include "markerMap.h"
+#include "boardRegistry.h"
+#include "observationQuality.h"
+#include "detectorSession.h"
+#include "cornerRefinement.h"
+#include "sharpnessGate.h"
+#include "cornerTracker.h"
+#include "markerSizes.h"
+#include "squarePnP.h"
+
+/**
+ * Detects the markers in the RGBA (or luma-only) input image and estimates their poses w.r.t.
+ * the camera, with the analytic square solver (see estimateSquarePoses()).
+ * The results (ids, corners, both candidate poses and quality scores) are left in the recycled
+ * vectors of the context, where they remain available until the next frame.
+ * When an overlay is specified, the input image is copied on resultMat and the detected markers
+ * are recorded on the overlay.
+ *
+ * Only the corners of the markers which can contribute to the pose of the camera (the ones known
+ * in the snapshot or belonging to a registered board) are refined to sub-pixel accuracy before
+ * their poses are estimated.
+ *
+ * @param session the detector session of the worker, or nullptr to search the whole frame with
+ *                default parameters
+ * @param knownMarkers the known markers, or nullptr to refine the corners of all the markers
+ * @param boards the registered boards, or nullptr
+ * @param gate the sharpness gate: if the frame is too blurred, the detection is skipped and no
+ *             marker is found (unless they can be tracked); nullptr to always run the detection
+ * @param tracker the corner tracker: the full detection is run only when it is due, and the
+ *                markers are tracked from the previous frames on the other frames, and when the
+ *                frame is blurred or the detection finds nothing; nullptr to always detect
+ * @param frameNumber the number of the frame, used by the tracker
+ * @param sizes the side lengths of the markers which differ from markerLength, or nullptr
+ * @return the number of markers found
+ */
+int detectFrameMarkers(int markerDictionary,
+                       const cv::Mat &cameraMatrix,
+                       const cv::Mat &distCoeffs,
+                       const cv::Mat &inputMat,
+                       cv::Mat &resultMat,
+                       double markerLength,
+                       FrameContext &context,
+                       OverlayCommandBuffer *overlay,
+                       DetectorSession *session = nullptr,
+                       const MarkerMapSnapshot *knownMarkers = nullptr,
+                       const BoardRegistry *boards = nullptr,
+                       SharpnessGate *gate = nullptr,
+                       CornerTracker *tracker = nullptr,
+                       uint64_t frameNumber = 0,
+                       const MarkerSizes *sizes = nullptr) {
+    if (overlay != nullptr) {
+        // resultMat is recycled by the worker, so this copy does not allocate;
+        // in headless mode the result image is not needed at all
+        inputMat.copyTo(resultMat);
+    }
+
+    cv::Mat &grayMat = context.arena.imageBuffer(FRAME_ARENA_GRAY_BUFFER, inputMat.size(),
+                                                 CV_8UC1);
+    if (inputMat.channels() == 1) {
+        // a frame of a luma-only recording
+        inputMat.copyTo(grayMat);
+    } else {
+        cv::cvtColor(inputMat, grayMat, CV_RGBA2GRAY);
+    }
+    std::vector<int> &ids = context.detectedIDs;
+    std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+    context.poseQuality = 0.0;
+    context.sharpness = 0.0;
+    context.blurredFrame = false;
+    context.trackedFrame = false;
+
+    if (gate != nullptr) {
+        context.sharpness = SharpnessGate::measure(grayMat, context.arena);
+        context.blurredFrame = !gate->accept(context.sharpness);
+    }
+
+    if (tracker != nullptr && (context.blurredFrame || !tracker->detectionDue(frameNumber))) {
+        context.trackedFrame = tracker->track(frameNumber, grayMat, context) > 0;
+    }
+
+    if (context.blurredFrame && !context.trackedFrame) {
+        ids.clear();
+        corners.clear();
+        context.detectedRvecs.clear();
+        context.detectedTvecs.clear();
+        context.detectedAlternativeRvecs.clear();
+        context.detectedAlternativeTvecs.clear();
+        context.detectedAmbiguities.clear();
+        context.detectedQualities.clear();
+        context.detectedRefined.clear();
+        if (overlay != nullptr) {
+            char text[64];
+            snprintf(text, sizeof(text), "BLURRED FRAME SKIPPED (SHARPNESS=%.0f)",
+                     context.sharpness);
+            overlay->text(text, cv::Point2f(30.0, 150.0), CV_FONT_HERSHEY_COMPLEX_SMALL, 0.8,
+                          cv::Scalar(0, 0, 255));
+        }
+        return 0;
+    }
+
+    if (!context.trackedFrame) {
+        if (session != nullptr) {
+            session->detect(markerDictionary, grayMat, cameraMatrix, distCoeffs, context);
+        } else {
+            cv::aruco::detectMarkers(grayMat,
+                                     cv::aruco::getPredefinedDictionary(markerDictionary),
+                                     corners, ids, cv::aruco::DetectorParameters::create(),
+                                     cv::noArray(), cameraMatrix, distCoeffs);
+        }
+
+        refinePoseRelevantMarkers(grayMat, knownMarkers, boards,
+                                  session != nullptr ? session->refinementWindowSize()
+                                                     : CORNER_REFINEMENT_WINDOW,
+                                  context);
+
+        if (tracker != nullptr) {
+            if (ids.empty()) {
+                // detection dropout: carry the markers of the previous frames forward
+                context.trackedFrame = tracker->track(frameNumber, grayMat, context) > 0;
+            } else {
+                tracker->publish(frameNumber, grayMat, ids, corners);
+            }
+        }
+    }
+
+    if (context.trackedFrame) {
+        // the tracked corners are already sub-pixel accurate
+        context.detectedRefined.assign(ids.size(), 1);
+        context.refinementWindow = CORNER_REFINEMENT_WINDOW;
+        if (overlay != nullptr) {
+            overlay->text("MARKERS TRACKED", cv::Point2f(30.0, 150.0),
+                          CV_FONT_HERSHEY_COMPLEX_SMALL, 0.8, cv::Scalar(255, 200, 0));
+        }
+    }
+
+    if (overlay != nullptr) {
+        overlay->detectedMarkers(corners, ids);
+    }
+
+    context.detectedRvecs.resize(ids.size());
+    context.detectedTvecs.resize(ids.size());
+    context.detectedAlternativeRvecs.resize(ids.size());
+    context.detectedAlternativeTvecs.resize(ids.size());
+    context.detectedAmbiguities.resize(ids.size());
+    context.detectedQualities.resize(ids.size());
+    ArenaVector<int> all((ArenaAllocator<int>(&context.arena)));
+    all.resize(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        all[i] = (int) i;
+    }
+    estimateSquarePoses(cameraMatrix, distCoeffs, markerLength, sizes, all, context);
+
+    return ids.size();
+}
+
+/**
+ * Refines the corners of the detected markers which are not known in the snapshot and were not
+ * refined by detectFrameMarkers(), then re-estimates their poses (and qualities) w.r.t. the
+ * camera; to be called before the markers are promoted into the map.
+ *
+ * @param sizes the side lengths of the markers which differ from markerLength, or nullptr
+ * @return the number of refined markers
+ */
+int refinePromotedMarkers(const cv::Mat &cameraMatrix,
+                          const cv::Mat &distCoeffs,
+                          double markerLength,
+                          const MarkerMapSnapshot &knownMarkers,
+                          FrameContext &context,
+                          const MarkerSizes *sizes = nullptr) {
+    const std::vector<int> &ids = context.detectedIDs;
+    ArenaVector<int> promoted((ArenaAllocator<int>(&context.arena)));
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!context.detectedRefined[i] && knownMarkers.indexOf(ids[i]) < 0) {
+            promoted.push_back((int) i);
+        }
+    }
+    if (promoted.empty()) {
+        return 0;
+    }
+
+    // the luma plane of the frame is still in the arena
+    const cv::Mat &grayMat = context.arena.imageBuffer(FRAME_ARENA_GRAY_BUFFER);
+    refineMarkerCorners(grayMat, promoted, context.refinementWindow, context);
+    estimateSquarePoses(cameraMatrix, distCoeffs, markerLength, sizes, promoted, context);
+    return promoted.size();
+}
+
+/**
+ * Estimates the pose of the camera (room's coord sys to camera's coord sys) from the poses of the
+ * found markers which are known in the snapshot, and from the registered boards (if any): each of
+ * them gives a pose indicator, and the indicators are fused with a quality-weighted RANSAC.
+ * When the context still holds the results of detectFrameMarkers() for the found markers, the
+ * alternative pose of each ambiguous marker gives a further indicator, weighted by the ambiguity
+ * (and counted as no marker), so that the RANSAC can pick the pose consistent with the others.
+ * When an overlay is specified, the axis of the used markers and some info texts are recorded on
+ * it.
+ *
+ * @param frameSize the size of the processed image
+ * @param boards the registered boards, or nullptr
+ * @return the number of markers which are inliers of the estimate
+ */
+int estimateFrameCameraPose(const cv::Mat &cameraMatrix,
+                            const cv::Mat &distCoeffs,
+                            const cv::Size &frameSize,
+                            const MarkerMapSnapshot &fixedMarkers,
+                            double fixedLength,
+                            int foundCount,
+                            const int *foundMarkersIDs,
+                            const cv::Vec3d *foundMarkersRvecs,
+                            const cv::Vec3d *foundMarkersTvecs,
+                            const double *foundMarkersQualities,
+                            double tvecInlierTreshold,
+                            double tvecOutlierProbability,
+                            double rvecInlierTreshold,
+                            double rvecOutlierProbability,
+                            int maxRansacIterations,
+                            double optimalModelTargetProbability,
+                            const BoardRegistry *boards,
+                            FrameContext *context,
+                            OverlayCommandBuffer *overlay,
+                            cv::Vec3d &cameraRvec,
+                            cv::Vec3d &cameraTvec) {
+    FrameArena *arena = context != nullptr ? &context->arena : nullptr;
+    ArenaVector<cv::Vec3d> positionRvecs((ArenaAllocator<cv::Vec3d>(arena)));
+    ArenaVector<cv::Vec3d> positionTvecs((ArenaAllocator<cv::Vec3d>(arena)));
+    positionRvecs.reserve(foundCount * 2);
+    positionTvecs.reserve(foundCount * 2);
+    // weight (i.e. quality) of each pose indicator, and number of markers it was obtained from
+    ArenaVector<double> positionWeights((ArenaAllocator<double>(arena)));
+    ArenaVector<int> positionMarkerCounts((ArenaAllocator<int>(arena)));
+    positionWeights.reserve(foundCount * 2);
+    positionMarkerCounts.reserve(foundCount * 2);
+
+    // the registered boards with enough detected markers give a camera pose each; their markers
+    // are then not used on their own
+    ArenaVector<int> boardMarkersIDs((ArenaAllocator<int>(arena)));
+    if (boards != nullptr && context != nullptr && boards->size() > 0) {
+        cv::Mat &grayMat = arena->imageBuffer(FRAME_ARENA_GRAY_BUFFER, frameSize, CV_8UC1);
+        boards->estimateCameraPoses(context->detectedCorners, context->detectedIDs,
+                                    context->detectedQualities, grayMat,
+                                    cameraMatrix, distCoeffs, *context,
+                                    positionRvecs, positionTvecs, positionWeights,
+                                    positionMarkerCounts, boardMarkersIDs, overlay);
+    }
+
+
+
+    //for (int i = 0; i < foundCount; i++) {
+    p_for(i, foundCount) {
+        int fixedMarkerIndex = fixedMarkers.indexOf(foundMarkersIDs[i]);
+        // the ids of the markers of the boards are reserved to the boards: a marker of a board
+        // is never matched with a marker of the map, even if the board itself gave no pose
+        bool partOfBoard = boards != nullptr && boards->contains(foundMarkersIDs[i]);
+
+        if (fixedMarkerIndex >= 0 && !partOfBoard) {
+
+            cv::Vec3d computedTvec;
+            cv::Vec3d computedRvec;
+
+
+            cv::composeRT(
+                    // Transformation to switch from room's coord sys to marker's coord sys
+                    fixedMarkers.rvecs[fixedMarkerIndex], fixedMarkers.tvecs[fixedMarkerIndex],
+                    // Transformation to switch from marker's coord sys to camera's coord sys
+                    foundMarkersRvecs[i], foundMarkersTvecs[i],
+                    // (result) Transf to change from room's coord sys to camera's coord sys
+                    computedRvec, computedTvec
+            );
+
+
+
+            if (overlay != nullptr) {
+                overlay->axis(cameraMatrix, distCoeffs,
+                              foundMarkersRvecs[i], foundMarkersTvecs[i], (float) fixedLength);
+            }
+
+
+
+            p_for_criticalSectionBegin
+                positionTvecs.push_back(computedTvec);
+                positionRvecs.push_back(computedRvec);
+                positionWeights.push_back(foundMarkersQualities[i]);
+                positionMarkerCounts.push_back(1);
+            p_for_criticalSectionEnd
+
+            if (context != nullptr && (size_t) i < context->detectedAmbiguities.size() &&
+                context->detectedIDs[i] == foundMarkersIDs[i] &&
+                context->detectedAmbiguities[i] > SQUARE_PNP_AMBIGUITY_THRESHOLD) {
+                cv::Vec3d alternativeRvec, alternativeTvec;
+                cv::composeRT(fixedMarkers.rvecs[fixedMarkerIndex],
+                              fixedMarkers.tvecs[fixedMarkerIndex],
+                              context->detectedAlternativeRvecs[i],
+                              context->detectedAlternativeTvecs[i],
+                              alternativeRvec, alternativeTvec);
+                p_for_criticalSectionBegin
+                    positionTvecs.push_back(alternativeTvec);
+                    positionRvecs.push_back(alternativeRvec);
+                    positionWeights.push_back(
+                            foundMarkersQualities[i] * context->detectedAmbiguities[i]);
+                    positionMarkerCounts.push_back(0);
+                p_for_criticalSectionEnd
+            }
+
+        }
+    };
+
+    ArenaVector<int> inlierIndices((ArenaAllocator<int>(arena)));
+    estimateCameraPose(
+            positionRvecs, positionTvecs,
+            cameraRvec, cameraTvec,
+            tvecInlierTreshold,
+            tvecOutlierProbability,
+            rvecInlierTreshold,
+            rvecOutlierProbability,
+            maxRansacIterations,
+            optimalModelTargetProbability,
+            positionWeights,
+            arena,
+            &inlierIndices
+    );
+
+    // inliers are counted in markers, so that a board pose counts as all the markers it used
+    int inliersCount = 0;
+    double inliersWeight = 0.0;
+    for (int index : inlierIndices) {
+        inliersCount += positionMarkerCounts[index];
+        inliersWeight += positionWeights[index];
+    }
+    if (context != nullptr) {
+        context->poseQuality = inliersCount > 0 ? inliersWeight / inliersCount : 0.0;
+    }
+
+
+    if (overlay != nullptr) {
+        // text lines are formatted on the stack, no string streams on the frame path
+        char text[256];
+        snprintf(text, sizeof(text), "INLIERS=%d", inliersCount);
+        int side = frameSize.height / 2;
+        cv::Point2f topLeftCorner = cv::Point2f(frameSize.width - side, frameSize.height - side);
+        overlay->text(text, topLeftCorner + cv::Point2f(0, -30),
+                      CV_FONT_HERSHEY_COMPLEX_SMALL, 1.0,
+                      cv::Scalar(0, 0, 255));
+
+
+        int written = snprintf(text, sizeof(text), "KNOWN MARKERS: {");
+        for (int id : fixedMarkers.ids) {
+            if (written >= (int) sizeof(text)) {
+                break;
+            }
+            written += snprintf(text + written, sizeof(text) - written, "%d ", id);
+        }
+        if (written < (int) sizeof(text)) {
+            snprintf(text + written, sizeof(text) - written, "}");
+        }
+        overlay->text(
+                text,
+                cv::Point2f(30.0, 50.0),
+                CV_FONT_HERSHEY_COMPLEX_SMALL,
+                0.8,
+                cv::Scalar(50.0, 255.0, 50.0)
+        );
+    }
+
+    return inliersCount;
+}
+
+#endif //ARUCOSLAM_FRAMEPIPELINE_H
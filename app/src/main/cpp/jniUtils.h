@@ -13,14 +13,15 @@
 
 /**
  * Takes a jdoubleArray, jintArray etc... and extracts its elements by pushing them on the
- * {@code out} vector.
+ * {@code out} vector. The Java array is accessed as a critical region (usually without copies)
+ * and released without write-back, so no JVM-side buffer is leaked at each call.
  */
-template<typename inputArrayT, typename inputElementT, typename outputVectorElementT>
+template<typename inputArrayT, typename inputElementT, typename outputVectorElementT,
+        typename allocatorT>
 void pushJavaArrayToStdVector(
         JNIEnv *env,
         inputArrayT in,
-        const std::function<inputElementT *(JNIEnv *, inputArrayT, jboolean *)> &bufferResolver,
-        std::vector<outputVectorElementT> &out,
+        std::vector<outputVectorElementT, allocatorT> &out,
         int inputArrayOffset = 0,
         int inputArrayCount = -1,
         int collectBy = 1,
@@ -37,11 +38,11 @@ void pushJavaArrayToStdVector(
 
     int destCount = (inputArrayCount - inputArrayOffset) / collectBy;
 
-    out.reserve(destCount);
+    out.reserve(out.size() + destCount);
 
     jboolean isCopy = false;
 
-    inputElementT *buffer = bufferResolver(env, in, &isCopy);
+    auto *buffer = static_cast<inputElementT *>(env->GetPrimitiveArrayCritical(in, &isCopy));
 
     for (int j = 0; j < destCount; j++) {
         outputVectorElementT resultElement;
@@ -50,6 +51,8 @@ void pushJavaArrayToStdVector(
 
         out.push_back(resultElement);
     }
+
+    env->ReleasePrimitiveArrayCritical(in, buffer, JNI_ABORT);
 }
 
 
@@ -75,18 +78,18 @@ void fromVec3dToJdoubleArray(JNIEnv* env, const cv::Vec3d& inVec, jdoubleArray o
  * is of size at least 3).
  */
 void fromjDoubleArrayToVec3d(JNIEnv* env, const jdoubleArray inArray, cv::Vec3d &outVec){
-    jboolean isCopy = false;
-    getVec3dFromBuffer(env->GetDoubleArrayElements(inArray, &isCopy), outVec);
+    env->GetDoubleArrayRegion(inArray, 0, 3, outVec.val);
 }
 
 /**
  * Reads triples of numbers from a jdoubleArrays and uses them to construct the Vec3d which are
  * added to the output std::vector
  */
+template<typename allocatorT>
 void pushjDoubleArrayToVectorOfVec3ds(
         JNIEnv *env,
         jdoubleArray inArray,
-        std::vector<cv::Vec3d> &outVectors,
+        std::vector<cv::Vec3d, allocatorT> &outVectors,
         int inputArrayOffset = 0,
         int inputArrayElements = -1
 ) {
@@ -94,7 +97,6 @@ void pushjDoubleArrayToVectorOfVec3ds(
     pushJavaArrayToStdVector<jdoubleArray, jdouble, cv::Vec3d>(
             env,
             inArray,
-            &JNIEnv::GetDoubleArrayElements,
             outVectors,
             inputArrayOffset * 3,
             inputArrayElements * 3,
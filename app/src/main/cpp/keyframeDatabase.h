@@ -0,0 +1,276 @@
+//
+// Keyframe database with an inverted index (marker ID -> keyframes), used for relocalization.
+//
+
+#ifndef ARUCOSLAM_KEYFRAMEDATABASE_H
+#define ARUCOSLAM_KEYFRAMEDATABASE_H
+
+#include <jni.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "frameArena.h"
+#include "positionRansac.h"
+#include "markerSizes.h"
+#include "roomTransforms.h"
+
+/**
+ * Maximum number of candidate keyframes on which the pose is solved during a relocalization.
+ */
+constexpr int RELOCALIZATION_MAX_CANDIDATES = 3;
+
+/**
+ * A keyframe: the pose of the camera in a frame, along with the markers observed in it.
+ * For each marker, both the 4 image corners and the 4 corners in the room's coord sys (obtained
+ * from the pose of the camera and the pose of the marker w.r.t. the camera) are stored.
+ */
+struct Keyframe {
+    // Transformation to switch from room's coord sys to camera's coord sys
+    cv::Vec3d rvec, tvec;
+    cv::Vec3d cameraPosition;
+    int64_t timestamp;
+    std::vector<int> markerIds;
+    std::vector<cv::Point2f> imageCorners; // 4 for each marker
+    std::vector<cv::Point3f> worldCorners; // 4 for each marker
+
+    int indexOf(int markerId) const {
+        auto found = std::find(markerIds.begin(), markerIds.end(), markerId);
+        return found == markerIds.end() ? -1 : static_cast<int>(found - markerIds.begin());
+    }
+};
+
+/**
+ * A KeyframeDatabase remembers from which viewpoints the marker constellations were observed.
+ * A new keyframe is stored only when the camera sees a marker never indexed before, or when it is
+ * far enough (in position or orientation) from all the keyframes observing the same markers.
+ * The inverted index, from each marker ID to the keyframes in which the marker was observed,
+ * allows to retrieve the candidate keyframes of an observation without scanning the whole
+ * database.
+ */
+class KeyframeDatabase {
+public:
+    KeyframeDatabase(double minTranslation, double minRotation, size_t maxKeyframes) :
+            minTranslation(minTranslation),
+            minRotation(minRotation),
+            maxKeyframes(maxKeyframes) {
+    }
+
+    /**
+     * Stores a keyframe if it adds information to the database; returns true if it was stored.
+     *
+     * @param rvec, tvec the (valid) camera pose of the frame
+     * @param markerRvecs, markerTvecs the poses of the markers w.r.t. the camera
+     * @param sizes the side lengths of the markers which differ from markerLength, or nullptr
+     */
+    bool insert(const cv::Vec3d &rvec, const cv::Vec3d &tvec, int64_t timestamp,
+                const std::vector<int> &ids,
+                const std::vector<std::vector<cv::Point2f>> &corners,
+                const std::vector<cv::Vec3d> &markerRvecs,
+                const std::vector<cv::Vec3d> &markerTvecs,
+                double markerLength,
+                const MarkerSizes *sizes = nullptr) {
+        if (ids.empty()) {
+            return false;
+        }
+        cv::Vec3d cameraPosition = positionInRoom(rvec, tvec);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (keyframes.size() >= maxKeyframes || isRedundant(ids, rvec, cameraPosition)) {
+            return false;
+        }
+
+        Keyframe keyframe;
+        keyframe.rvec = rvec;
+        keyframe.tvec = tvec;
+        keyframe.cameraPosition = cameraPosition;
+        keyframe.timestamp = timestamp;
+        keyframe.markerIds = ids;
+        keyframe.imageCorners.reserve(ids.size() * 4);
+        keyframe.worldCorners.reserve(ids.size() * 4);
+
+        // camera to room: X_room = R^T * (X_camera - t)
+        cv::Matx33d cameraRotation;
+        cv::Rodrigues(rvec, cameraRotation);
+        cv::Matx33d cameraRotationT = cameraRotation.t();
+        for (size_t i = 0; i < ids.size(); i++) {
+            double halfLength = (sizes != nullptr ? sizes->lengthOf(ids[i], markerLength)
+                                                  : markerLength) / 2.0;
+            // same order of the corners used by estimatePoseSingleMarkers
+            cv::Vec3d markerCorners[4] = {
+                    cv::Vec3d(-halfLength, halfLength, 0),
+                    cv::Vec3d(halfLength, halfLength, 0),
+                    cv::Vec3d(halfLength, -halfLength, 0),
+                    cv::Vec3d(-halfLength, -halfLength, 0),
+            };
+            cv::Matx33d markerRotation;
+            cv::Rodrigues(markerRvecs[i], markerRotation);
+            for (int j = 0; j < 4; j++) {
+                cv::Vec3d inCamera = markerRotation * markerCorners[j] + markerTvecs[i];
+                cv::Vec3d inRoom = cameraRotationT * (inCamera - tvec);
+                keyframe.imageCorners.push_back(corners[i][j]);
+                keyframe.worldCorners.emplace_back(inRoom[0], inRoom[1], inRoom[2]);
+            }
+        }
+
+        int keyframeIndex = static_cast<int>(keyframes.size());
+        keyframes.push_back(std::move(keyframe));
+        for (int id : ids) {
+            invertedIndex[id].push_back(keyframeIndex);
+        }
+        return true;
+    }
+
+    /**
+     * Attempts to recover the camera pose from the current observation: the keyframes sharing
+     * the most markers with it are retrieved from the inverted index, and the pose is solved
+     * with PnP on the stored 3D corners of the shared markers, using the pose of each keyframe as
+     * initial guess. The solution with the lowest reprojection error is returned, if the error is
+     * below maxReprojectionError.
+     *
+     * @return the number of markers used by the returned pose, or 0 if the relocalization failed
+     */
+    int relocalize(const std::vector<int> &ids,
+                   const std::vector<std::vector<cv::Point2f>> &corners,
+                   cv::InputArray cameraMatrix,
+                   cv::InputArray distCoeffs,
+                   double maxReprojectionError,
+                   FrameArena *arena,
+                   cv::Vec3d &outRvec, cv::Vec3d &outTvec) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (keyframes.empty() || ids.empty()) {
+            return 0;
+        }
+
+        // vote for the keyframes which observed the same markers
+        ArenaVector<int> votes(keyframes.size(), 0, ArenaAllocator<int>(arena));
+        for (int id : ids) {
+            auto indexed = invertedIndex.find(id);
+            if (indexed == invertedIndex.end()) {
+                continue;
+            }
+            for (int keyframeIndex : indexed->second) {
+                votes[keyframeIndex]++;
+            }
+        }
+
+        // best candidates: most shared markers first, the most recent ones on ties
+        int candidates[RELOCALIZATION_MAX_CANDIDATES];
+        int candidatesCount = 0;
+        for (int k = static_cast<int>(keyframes.size()) - 1; k >= 0; k--) {
+            if (votes[k] == 0) {
+                continue;
+            }
+            int position = candidatesCount;
+            while (position > 0 && votes[candidates[position - 1]] < votes[k]) {
+                position--;
+            }
+            if (position >= RELOCALIZATION_MAX_CANDIDATES) {
+                continue;
+            }
+            int last = std::min(candidatesCount, RELOCALIZATION_MAX_CANDIDATES - 1);
+            for (int c = last; c > position; c--) {
+                candidates[c] = candidates[c - 1];
+            }
+            candidates[position] = k;
+            candidatesCount = std::min(candidatesCount + 1, RELOCALIZATION_MAX_CANDIDATES);
+        }
+
+        ArenaVector<cv::Point3f> objectPoints((ArenaAllocator<cv::Point3f>(arena)));
+        ArenaVector<cv::Point2f> imagePoints((ArenaAllocator<cv::Point2f>(arena)));
+        ArenaVector<cv::Point2f> projectedPoints((ArenaAllocator<cv::Point2f>(arena)));
+        objectPoints.reserve(ids.size() * 4);
+        imagePoints.reserve(ids.size() * 4);
+        projectedPoints.resize(ids.size() * 4);
+
+        double bestError = maxReprojectionError;
+        int bestMarkersCount = 0;
+        for (int c = 0; c < candidatesCount; c++) {
+            const Keyframe &keyframe = keyframes[candidates[c]];
+            objectPoints.clear();
+            imagePoints.clear();
+            for (size_t i = 0; i < ids.size(); i++) {
+                int markerIndex = keyframe.indexOf(ids[i]);
+                if (markerIndex < 0) {
+                    continue;
+                }
+                for (int j = 0; j < 4; j++) {
+                    objectPoints.push_back(keyframe.worldCorners[markerIndex * 4 + j]);
+                    imagePoints.push_back(corners[i][j]);
+                }
+            }
+            int pointsCount = static_cast<int>(objectPoints.size());
+            cv::Mat objectPointsMat(pointsCount, 1, CV_32FC3, objectPoints.data());
+            cv::Mat imagePointsMat(pointsCount, 1, CV_32FC2, imagePoints.data());
+            cv::Mat projectedPointsMat(pointsCount, 1, CV_32FC2, projectedPoints.data());
+
+            cv::Vec3d rvec = keyframe.rvec, tvec = keyframe.tvec;
+            if (!cv::solvePnP(objectPointsMat, imagePointsMat, cameraMatrix, distCoeffs,
+                              rvec, tvec, true, cv::SOLVEPNP_ITERATIVE)) {
+                continue;
+            }
+            cv::projectPoints(objectPointsMat, rvec, tvec, cameraMatrix, distCoeffs,
+                              projectedPointsMat);
+            double squaredErrorSum = 0;
+            for (int p = 0; p < pointsCount; p++) {
+                cv::Point2f difference = projectedPoints[p] - imagePoints[p];
+                squaredErrorSum += difference.dot(difference);
+            }
+            double error = std::sqrt(squaredErrorSum / pointsCount);
+            if (error < bestError) {
+                bestError = error;
+                bestMarkersCount = pointsCount / 4;
+                outRvec = rvec;
+                outTvec = tvec;
+            }
+        }
+        return bestMarkersCount;
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return keyframes.size();
+    }
+
+private:
+    /// to be called with the mutex held
+    bool isRedundant(const std::vector<int> &ids, const cv::Vec3d &rvec,
+                     const cv::Vec3d &cameraPosition) const {
+        auto indexed = invertedIndex.find(ids[0]);
+        for (int id : ids) {
+            if (invertedIndex.find(id) == invertedIndex.end()) {
+                return false; // a marker never seen before
+            }
+        }
+        // all the markers are already indexed: the keyframe is redundant if there is a near
+        // keyframe observing the first marker
+        for (int keyframeIndex : indexed->second) {
+            const Keyframe &keyframe = keyframes[keyframeIndex];
+            if (cv::norm(keyframe.cameraPosition - cameraPosition) < minTranslation &&
+                angularDistance(keyframe.rvec, rvec) < minRotation) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double minTranslation;
+    double minRotation;
+    size_t maxKeyframes;
+
+    std::mutex mutex;
+    std::vector<Keyframe> keyframes;
+    std::unordered_map<int, std::vector<int>> invertedIndex;
+};
+
+KeyframeDatabase *castToKeyframeDatabasePtr(jlong addr) {
+    return (KeyframeDatabase *) addr;
+}
+
+#endif //ARUCOSLAM_KEYFRAMEDATABASE_H
@@ -0,0 +1,490 @@
+//
+// Offline construction of a map from recorded sessions: the recordings are split in chunks of
+// frames mapped in parallel, and the local maps of the chunks are aligned on their shared markers
+// and merged.
+//
+
+#ifndef ARUCOSLAM_MAPBUILDER_H
+#define ARUCOSLAM_MAPBUILDER_H
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "framePipeline.h"
+#include "markerMap.h"
+#include "poseAccumulator.h"
+#include "sessionRecorder.h"
+
+/**
+ * Default length of the chunks (frames), and number of frames shared by consecutive chunks of a
+ * recording, so that they observe the same markers even where few markers are visible.
+ */
+constexpr int MAP_BUILDER_DEFAULT_CHUNK_FRAMES = 300;
+constexpr int MAP_BUILDER_DEFAULT_CHUNK_OVERLAP = 30;
+
+/**
+ * RANSAC settings of the camera pose estimation in the chunks (the full quality ones of the app,
+ * with more iterations: offline there is no frame deadline).
+ */
+constexpr double MAP_BUILDER_TVEC_INLIER_THRESHOLD = 0.05;
+constexpr double MAP_BUILDER_TVEC_OUTLIER_PROBABILITY = 0.1;
+constexpr double MAP_BUILDER_RVEC_INLIER_THRESHOLD = CV_PI / 8.0;
+constexpr double MAP_BUILDER_RVEC_OUTLIER_PROBABILITY = 0.1;
+constexpr int MAP_BUILDER_MAX_RANSAC_ITERATIONS = 100;
+constexpr double MAP_BUILDER_OPTIMAL_MODEL_PROBABILITY = 0.99;
+
+/**
+ * Two shared markers agree on the alignment of two chunks when the transformations they give
+ * differ by less than these distance (meters) and angle (radians).
+ */
+constexpr double MAP_BUILDER_ALIGNMENT_TVEC_THRESHOLD = 0.05;
+constexpr double MAP_BUILDER_ALIGNMENT_RVEC_THRESHOLD = CV_PI / 8.0;
+
+/**
+ * A marker of a built map, with its pose (map's coord sys to marker's coord sys) and the number
+ * of observations it was estimated from.
+ */
+struct BuiltMarker {
+    int markerId;
+    cv::Vec3d rvec, tvec;
+    int observations;
+};
+
+/**
+ * A chunk of consecutive frames of a recording, and the local map built from it.
+ */
+struct MapChunk {
+    int recording;
+    int firstFrame, endFrame; // range of the frames in the index of the recording
+    std::vector<BuiltMarker> markers; // sorted by id, poses in the local coord sys of the chunk
+    int64_t frames = 0;
+    int64_t framesWithPose = 0;
+
+    bool aligned = false;
+    cv::Vec3d toLocalRvec, toLocalTvec; // map's coord sys to local coord sys
+};
+
+struct MapBuilderStats {
+    int recordings = 0;
+    int chunks = 0;
+    int alignedChunks = 0; // the others share no marker with the map and are discarded
+    int64_t frames = 0;
+    int64_t framesWithPose = 0;
+    int markers = 0;
+};
+
+/**
+ * A MapBuilder builds the map of a venue from session recordings, using all the cores, instead of
+ * at the walking speed of the phone.
+ *
+ * The frames of each recording are split in overlapping chunks, and each thread maps one chunk
+ * at a time, sequentially, as the app would (detection, camera pose from the markers already
+ * known, new markers added with the pose of the camera), in a local map whose origin is the
+ * first marker seen in the chunk. The pose of each marker in the local map is the mean of all its
+ * observations in the chunk (the circular mean for the rotation, see PoseMeanAccumulator).
+ *
+ * The chunks are then aligned: each pair of chunks sharing markers gets a relative
+ * transformation (the consensus of the transformations given by the shared markers), the chunks
+ * are chained by a maximum spanning tree (weighted by the agreeing markers) from a root chunk,
+ * and the markers of all the aligned chunks are merged in the coord sys of the root, weighted by
+ * their observations.
+ */
+class MapBuilder {
+public:
+    /**
+     * @param threads number of mapping threads; 0 for one per core
+     */
+    explicit MapBuilder(int threads = 0,
+                        int chunkFrames = MAP_BUILDER_DEFAULT_CHUNK_FRAMES,
+                        int chunkOverlap = MAP_BUILDER_DEFAULT_CHUNK_OVERLAP) :
+            threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+            chunkFrames(std::max(1, chunkFrames)),
+            chunkOverlap(std::max(0, std::min(chunkOverlap, chunkFrames - 1))) {}
+
+    /**
+     * @return false if the file is not a readable recording
+     */
+    bool addRecording(const std::string &path) {
+        std::unique_ptr<SessionRecordingReader> recording(new SessionRecordingReader());
+        if (!recording->open(path)) {
+            return false;
+        }
+        recordings.push_back(std::move(recording));
+        return true;
+    }
+
+    /**
+     * Builds the map from the added recordings.
+     *
+     * @param anchorMarkerId the marker at the origin of the map (its pose is the identity), or -1
+     *                       to keep the coord sys of the first marker seen
+     * @param out the markers of the map, sorted by id
+     */
+    MapBuilderStats build(int anchorMarkerId, std::vector<BuiltMarker> &out) {
+        splitChunks();
+
+        std::atomic<int> nextChunk(0);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < std::min<int>(threads, chunks.size()); i++) {
+            workers.emplace_back([this, &nextChunk] {
+                FrameContext context(1 << 20);
+                DetectorSession detector(nullptr);
+                for (int chunk = nextChunk++; chunk < (int) chunks.size(); chunk = nextChunk++) {
+                    mapChunk(chunks[chunk], context, detector);
+                }
+            });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+
+        alignChunks(anchorMarkerId);
+        mergeChunks(anchorMarkerId, out);
+
+        MapBuilderStats stats;
+        stats.recordings = recordings.size();
+        stats.chunks = chunks.size();
+        for (const MapChunk &chunk : chunks) {
+            stats.alignedChunks += chunk.aligned;
+            stats.frames += chunk.frames;
+            stats.framesWithPose += chunk.framesWithPose;
+        }
+        stats.markers = out.size();
+        return stats;
+    }
+
+private:
+    /**
+     * The observations of a marker in a chunk: only their mean pose is needed (not the spread and
+     * the viewpoints which the candidate pool keeps to promote a marker).
+     */
+    struct ChunkObservations {
+        PoseMeanAccumulator poses;
+
+        void observe(const cv::Vec3d &rvec, const cv::Vec3d &tvec) {
+            poses.add(rvec, tvec);
+        }
+
+        BuiltMarker marker(int markerId) const {
+            BuiltMarker marker{markerId};
+            poses.mean(marker.rvec, marker.tvec);
+            marker.observations = poses.size();
+            return marker;
+        }
+    };
+
+    /**
+     * A relative transformation between two chunks, from the local coord sys of a to the one of b.
+     */
+    struct ChunkEdge {
+        int a, b;
+        int support; // shared markers agreeing on the transformation
+        cv::Vec3d rvec, tvec;
+    };
+
+    void splitChunks() {
+        chunks.clear();
+        int step = chunkFrames - chunkOverlap;
+        for (int r = 0; r < (int) recordings.size(); r++) {
+            int frameCount = recordings[r]->frames.size();
+            for (int first = 0; first < frameCount; first += step) {
+                MapChunk chunk;
+                chunk.recording = r;
+                chunk.firstFrame = first;
+                chunk.endFrame = std::min(frameCount, first + chunkFrames);
+                chunks.push_back(chunk);
+                if (chunk.endFrame == frameCount) {
+                    break;
+                }
+            }
+        }
+    }
+
+    void mapChunk(MapChunk &chunk, FrameContext &context, DetectorSession &detector) const {
+        const SessionRecordingReader &recording = *recordings[chunk.recording];
+        const cv::Mat &cameraMatrix = recording.cameraMatrix;
+        const cv::Mat &distCoeffs = recording.distCoeffs;
+        for (int dictionaryId : recording.extraDictionaries) {
+            detector.addDictionary(dictionaryId); // false if already added for another chunk
+        }
+        MarkerMap localMap;
+        int readerSlot = localMap.registerReader();
+        std::unordered_map<int, ChunkObservations> observations;
+        cv::Mat frame, result;
+
+        for (int f = chunk.firstFrame; f < chunk.endFrame; f++) {
+            if (!recording.readFrame(recording.frames[f], frame)) {
+                continue;
+            }
+            chunk.frames++;
+            context.reset();
+            const MarkerMapSnapshot *snapshot = localMap.acquire(readerSlot);
+            int foundCount = detectFrameMarkers(recording.markerDictionary, cameraMatrix,
+                                                distCoeffs, frame, result,
+                                                recording.markerLength, context, nullptr,
+                                                &detector, snapshot);
+            cv::Vec3d cameraRvec, cameraTvec;
+            int inliers = 0;
+            if (foundCount > 0 && snapshot->size() == 0) {
+                // the first marker seen is the origin of the local coord sys: the camera pose is
+                // the pose of the marker w.r.t. the camera
+                refinePromotedMarkers(cameraMatrix, distCoeffs, recording.markerLength,
+                                      *snapshot, context);
+                cameraRvec = context.detectedRvecs[0];
+                cameraTvec = context.detectedTvecs[0];
+                inliers = 1;
+            } else if (foundCount > 0) {
+                inliers = estimateFrameCameraPose(
+                        cameraMatrix, distCoeffs, frame.size(), *snapshot,
+                        recording.markerLength, foundCount, context.detectedIDs.data(),
+                        context.detectedRvecs.data(), context.detectedTvecs.data(),
+                        context.detectedQualities.data(),
+                        MAP_BUILDER_TVEC_INLIER_THRESHOLD, MAP_BUILDER_TVEC_OUTLIER_PROBABILITY,
+                        MAP_BUILDER_RVEC_INLIER_THRESHOLD, MAP_BUILDER_RVEC_OUTLIER_PROBABILITY,
+                        MAP_BUILDER_MAX_RANSAC_ITERATIONS, MAP_BUILDER_OPTIMAL_MODEL_PROBABILITY,
+                        nullptr, &context, nullptr, cameraRvec, cameraTvec);
+                if (inliers > 0) {
+                    refinePromotedMarkers(cameraMatrix, distCoeffs, recording.markerLength,
+                                          *snapshot, context);
+                }
+            }
+
+            if (inliers > 0) {
+                chunk.framesWithPose++;
+                for (int i = 0; i < foundCount; i++) {
+                    int markerId = context.detectedIDs[i];
+                    cv::Vec3d markerRvec, markerTvec;
+                    if (snapshot->size() == 0 && i == 0) {
+                        markerRvec = cv::Vec3d();
+                        markerTvec = cv::Vec3d();
+                    } else {
+                        newMarkerPoseInRoom(cameraRvec, cameraTvec, context.detectedRvecs[i],
+                                            context.detectedTvecs[i], markerRvec, markerTvec);
+                    }
+                    observations[markerId].observe(markerRvec, markerTvec);
+                    if (snapshot->indexOf(markerId) < 0) {
+                        // the pose estimation uses the first estimate, as in the app: the mean
+                        // is only taken at the end of the chunk
+                        localMap.addIfNotPresent(markerId, markerRvec, markerTvec);
+                    }
+                }
+            }
+            localMap.release(readerSlot);
+        }
+        localMap.unregisterReader(readerSlot);
+
+        chunk.markers.clear();
+        chunk.markers.reserve(observations.size());
+        for (const auto &entry : observations) {
+            chunk.markers.push_back(entry.second.marker(entry.first));
+        }
+        std::sort(chunk.markers.begin(), chunk.markers.end(),
+                  [](const BuiltMarker &a, const BuiltMarker &b) {
+                      return a.markerId < b.markerId;
+                  });
+    }
+
+    static double rotationDistance(const cv::Vec3d &rvecA, const cv::Vec3d &rvecB) {
+        cv::Matx33d rotationA, rotationB;
+        cv::Rodrigues(rvecA, rotationA);
+        cv::Rodrigues(rvecB, rotationB);
+        cv::Matx33d difference = rotationA.t() * rotationB;
+        double cosine = (difference(0, 0) + difference(1, 1) + difference(2, 2) - 1.0) / 2.0;
+        return std::acos(std::max(-1.0, std::min(1.0, cosine)));
+    }
+
+    /**
+     * Estimates the transformation from the local coord sys of chunk a to the one of chunk b:
+     * each shared marker gives an estimate, and the estimates which agree with the largest
+     * number of other ones are averaged.
+     *
+     * @return the number of agreeing markers (0 if the chunks share no marker)
+     */
+    static int relativeTransform(const MapChunk &a, const MapChunk &b,
+                                 cv::Vec3d &outRvec, cv::Vec3d &outTvec) {
+        std::vector<cv::Vec3d> rvecs, tvecs;
+        std::vector<double> weights;
+        auto markerA = a.markers.begin(), markerB = b.markers.begin();
+        while (markerA != a.markers.end() && markerB != b.markers.end()) {
+            if (markerA->markerId < markerB->markerId) {
+                ++markerA;
+            } else if (markerB->markerId < markerA->markerId) {
+                ++markerB;
+            } else {
+                // x_marker = P_a x_a = P_b x_b, so x_b = P_b^-1 P_a x_a
+                cv::Vec3d inverseRvec, inverseTvec, rvec, tvec;
+                invertRT(markerB->rvec, markerB->tvec, inverseRvec, inverseTvec);
+                cv::composeRT(markerA->rvec, markerA->tvec, inverseRvec, inverseTvec, rvec, tvec);
+                rvecs.push_back(rvec);
+                tvecs.push_back(tvec);
+                weights.push_back(std::min(markerA->observations, markerB->observations));
+                ++markerA;
+                ++markerB;
+            }
+        }
+
+        std::vector<char> best;
+        std::vector<char> agreeing(rvecs.size());
+        int bestSupport = 0;
+        for (int i = 0; i < (int) rvecs.size(); i++) {
+            int support = 0;
+            for (int j = 0; j < (int) rvecs.size(); j++) {
+                double distance = cv::norm(tvecs[i] - tvecs[j]);
+                double angle = rotationDistance(rvecs[i], rvecs[j]);
+                agreeing[j] = distance <= MAP_BUILDER_ALIGNMENT_TVEC_THRESHOLD &&
+                              angle <= MAP_BUILDER_ALIGNMENT_RVEC_THRESHOLD;
+                support += agreeing[j];
+            }
+            if (support > bestSupport) {
+                bestSupport = support;
+                best = agreeing;
+            }
+        }
+
+        PoseMeanAccumulator accumulator;
+        for (int i = 0; i < (int) best.size(); i++) {
+            if (best[i]) {
+                accumulator.add(rvecs[i], tvecs[i], weights[i]);
+            }
+        }
+        if (bestSupport > 0) {
+            accumulator.mean(outRvec, outTvec);
+        }
+        return bestSupport;
+    }
+
+    /**
+     * Computes the transformation from the coord sys of the map to the local one of each chunk
+     * reachable from the root chunk, along the maximum spanning tree of the chunks.
+     */
+    void alignChunks(int anchorMarkerId) {
+        std::vector<ChunkEdge> edges;
+        std::vector<std::vector<int>> chunkEdges(chunks.size());
+        for (int a = 0; a < (int) chunks.size(); a++) {
+            for (int b = a + 1; b < (int) chunks.size(); b++) {
+                ChunkEdge edge{a, b};
+                edge.support = relativeTransform(chunks[a], chunks[b], edge.rvec, edge.tvec);
+                if (edge.support > 0) {
+                    chunkEdges[a].push_back(edges.size());
+                    chunkEdges[b].push_back(edges.size());
+                    edges.push_back(edge);
+                }
+            }
+        }
+
+        // root: the chunk which observed the anchor the most, or else the first one with markers
+        int root = -1, rootObservations = 0;
+        for (int c = 0; c < (int) chunks.size(); c++) {
+            for (const BuiltMarker &marker : chunks[c].markers) {
+                if (marker.markerId == anchorMarkerId && marker.observations > rootObservations) {
+                    root = c;
+                    rootObservations = marker.observations;
+                }
+            }
+        }
+        for (int c = 0; c < (int) chunks.size() && root < 0; c++) {
+            if (!chunks[c].markers.empty()) {
+                root = c;
+            }
+        }
+        if (root < 0) {
+            return;
+        }
+
+        auto lessSupported = [&edges](int a, int b) {
+            return edges[a].support < edges[b].support;
+        };
+        std::priority_queue<int, std::vector<int>, decltype(lessSupported)> frontier(
+                lessSupported);
+        chunks[root].aligned = true;
+        chunks[root].toLocalRvec = cv::Vec3d();
+        chunks[root].toLocalTvec = cv::Vec3d();
+        for (int edge : chunkEdges[root]) {
+            frontier.push(edge);
+        }
+        while (!frontier.empty()) {
+            const ChunkEdge &edge = edges[frontier.top()];
+            frontier.pop();
+            bool forward = chunks[edge.a].aligned;
+            MapChunk &from = chunks[forward ? edge.a : edge.b];
+            MapChunk &to = chunks[forward ? edge.b : edge.a];
+            if (to.aligned) {
+                continue;
+            }
+            cv::Vec3d rvec = edge.rvec, tvec = edge.tvec;
+            if (!forward) {
+                invertRT(edge.rvec, edge.tvec, rvec, tvec);
+            }
+            cv::composeRT(from.toLocalRvec, from.toLocalTvec, rvec, tvec,
+                          to.toLocalRvec, to.toLocalTvec);
+            to.aligned = true;
+            for (int next : chunkEdges[&to - chunks.data()]) {
+                frontier.push(next);
+            }
+        }
+    }
+
+    void mergeChunks(int anchorMarkerId, std::vector<BuiltMarker> &out) const {
+        std::unordered_map<int, PoseMeanAccumulator> accumulators;
+        std::unordered_map<int, int> observations;
+        for (const MapChunk &chunk : chunks) {
+            if (!chunk.aligned) {
+                continue;
+            }
+            for (const BuiltMarker &marker : chunk.markers) {
+                cv::Vec3d rvec, tvec;
+                cv::composeRT(chunk.toLocalRvec, chunk.toLocalTvec, marker.rvec, marker.tvec,
+                              rvec, tvec);
+                accumulators[marker.markerId].add(rvec, tvec, marker.observations);
+                observations[marker.markerId] += marker.observations;
+            }
+        }
+
+        out.clear();
+        out.reserve(accumulators.size());
+        for (const auto &entry : accumulators) {
+            BuiltMarker marker{entry.first};
+            entry.second.mean(marker.rvec, marker.tvec);
+            marker.observations = observations[entry.first];
+            out.push_back(marker);
+        }
+        std::sort(out.begin(), out.end(), [](const BuiltMarker &a, const BuiltMarker &b) {
+            return a.markerId < b.markerId;
+        });
+
+        // moves the origin on the anchor: P' = P G^-1, where G is the pose of the anchor
+        auto anchor = std::find_if(out.begin(), out.end(),
+                                   [anchorMarkerId](const BuiltMarker &marker) {
+                                       return marker.markerId == anchorMarkerId;
+                                   });
+        if (anchor != out.end()) {
+            cv::Vec3d inverseRvec, inverseTvec;
+            invertRT(anchor->rvec, anchor->tvec, inverseRvec, inverseTvec);
+            for (BuiltMarker &marker : out) {
+                cv::Vec3d rvec, tvec;
+                cv::composeRT(inverseRvec, inverseTvec, marker.rvec, marker.tvec, rvec, tvec);
+                marker.rvec = rvec;
+                marker.tvec = tvec;
+            }
+        }
+    }
+
+    const int threads;
+    const int chunkFrames;
+    const int chunkOverlap;
+    std::vector<std::unique_ptr<SessionRecordingReader>> recordings;
+    std::vector<MapChunk> chunks;
+};
+
+#endif //ARUCOSLAM_MAPBUILDER_H
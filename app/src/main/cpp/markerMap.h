@@ -0,0 +1,316 @@
+//
+// Lock-free readable map of the known markers (read-copy-update with epoch-based reclamation).
+//
+
+#ifndef ARUCOSLAM_MARKERMAP_H
+#define ARUCOSLAM_MARKERMAP_H
+
+#include <jni.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "spatialGrid.h"
+#include "roomTransforms.h"
+
+/**
+ * Maximum number of threads that can read a MarkerMap at the same time (one per frame worker,
+ * plus the UI).
+ */
+constexpr int MARKER_MAP_MAX_READERS = 32;
+
+/**
+ * An immutable version of the marker map. Once published, a snapshot is never modified: a writer
+ * that wants to change the map creates a new snapshot and swaps it in.
+ */
+struct MarkerMapSnapshot {
+    uint64_t version = 0;
+    std::vector<int> ids;
+    std::vector<cv::Vec3d> rvecs;
+    std::vector<cv::Vec3d> tvecs;
+    std::unordered_map<int, int> indexById;
+    // positions of the centers of the markers in the room, indexed by the spatial grid
+    std::vector<cv::Vec3d> positions;
+    SpatialGrid grid;
+
+    size_t size() const { return ids.size(); }
+
+    /**
+     * Returns the index of the marker with the specified ID, or -1 if the marker is not known.
+     */
+    int indexOf(int markerId) const {
+        auto found = indexById.find(markerId);
+        return found == indexById.end() ? -1 : found->second;
+    }
+
+    /**
+     * Appends to out the indices of the markers visible from a camera (see
+     * SpatialGrid::queryFrustum).
+     */
+    template<typename OUT>
+    void markersInFrustum(const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                          const cv::Matx33d &cameraMatrix, const cv::Rect2d &viewport,
+                          double near, double far, double margin, OUT &out) const {
+        grid.queryFrustum(rvec, tvec, cameraMatrix, viewport, near, far, margin, positions, out);
+    }
+};
+
+/**
+ * A MarkerMap stores the known markers of a SLAM space as a sequence of immutable, versioned
+ * snapshots. Readers (i.e. the frame workers) acquire the current snapshot without taking any
+ * lock and can read it consistently for the whole frame; writers (serialized by a mutex) copy the
+ * current snapshot, modify the copy and publish it with an atomic pointer swap.
+ *
+ * Each snapshot also indexes the positions of its markers in a SpatialGrid, so that the readers
+ * can restrict their work to the markers near a region (e.g. the ones inside a view frustum).
+ *
+ * Replaced snapshots are reclaimed with an epoch-based scheme: each reader has a slot in which it
+ * announces the global epoch observed when it acquired its snapshot; a replaced snapshot is
+ * retired with the epoch current at the time of the swap, and it is deleted only when every
+ * active reader has announced a more recent epoch (so none of them can still hold it).
+ */
+class MarkerMap {
+public:
+    MarkerMap() : current(new MarkerMapSnapshot()), globalEpoch(1), publishedSize(0) {
+        for (int i = 0; i < MARKER_MAP_MAX_READERS; i++) {
+            readerEpochs[i].store(0);
+            readerSlotsTaken[i].store(false);
+        }
+    }
+
+    MarkerMap(const MarkerMap &) = delete;
+
+    MarkerMap &operator=(const MarkerMap &) = delete;
+
+    ~MarkerMap() {
+        for (auto &retiredSnapshot : retired) {
+            delete retiredSnapshot.second;
+        }
+        delete current.load();
+    }
+
+    /**
+     * Reserves a reader slot; returns its index, or -1 if all the slots are taken.
+     */
+    int registerReader() {
+        for (int i = 0; i < MARKER_MAP_MAX_READERS; i++) {
+            bool expected = false;
+            if (readerSlotsTaken[i].compare_exchange_strong(expected, true)) {
+                readerEpochs[i].store(0);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void unregisterReader(int slot) {
+        readerEpochs[slot].store(0);
+        readerSlotsTaken[slot].store(false);
+    }
+
+    /**
+     * Returns the current snapshot; it remains valid until release() is called with the same
+     * slot. Lock-free and wait-free.
+     */
+    const MarkerMapSnapshot *acquire(int slot) {
+        // the epoch must be announced before the pointer is read (both are sequentially
+        // consistent), so a writer that swaps the pointer after this read will see the epoch
+        readerEpochs[slot].store(globalEpoch.load());
+        return current.load();
+    }
+
+    void release(int slot) {
+        readerEpochs[slot].store(0, std::memory_order_release);
+    }
+
+    /**
+     * Adds the marker to the map, if no marker with the same ID is known; returns true if the
+     * marker was added.
+     */
+    bool addIfNotPresent(int markerId, const cv::Vec3d &rvec, const cv::Vec3d &tvec) {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        const MarkerMapSnapshot *old = current.load();
+        if (old->indexOf(markerId) >= 0) {
+            return false;
+        }
+        auto *updated = new MarkerMapSnapshot(*old);
+        updated->indexById[markerId] = static_cast<int>(updated->ids.size());
+        updated->ids.push_back(markerId);
+        updated->rvecs.push_back(rvec);
+        updated->tvecs.push_back(tvec);
+        updated->positions.push_back(positionInRoom(rvec, tvec));
+        updated->grid.insert(static_cast<int>(updated->ids.size()) - 1, updated->positions.back());
+        publish(updated);
+        return true;
+    }
+
+    /**
+     * Removes the most recently added marker; returns false if the map was already empty.
+     */
+    bool removeLast() {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        const MarkerMapSnapshot *old = current.load();
+        if (old->ids.empty()) {
+            return false;
+        }
+        auto *updated = new MarkerMapSnapshot(*old);
+        updated->indexById.erase(updated->ids.back());
+        updated->grid.remove(static_cast<int>(updated->ids.size()) - 1, updated->positions.back());
+        updated->positions.pop_back();
+        updated->ids.pop_back();
+        updated->rvecs.pop_back();
+        updated->tvecs.pop_back();
+        publish(updated);
+        return true;
+    }
+
+    /**
+     * Replaces all the markers of the map at once: build receives the current snapshot (e.g. to
+     * keep the markers added to it since the last rebuild) and fills the ids and the poses of the
+     * markers of the new one, which must be unique.
+     */
+    template<typename BUILD>
+    void rebuild(BUILD build) {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        auto *updated = new MarkerMapSnapshot();
+        build(*current.load(), updated->ids, updated->rvecs, updated->tvecs);
+        updated->positions.reserve(updated->ids.size());
+        for (int i = 0; i < (int) updated->ids.size(); i++) {
+            updated->indexById[updated->ids[i]] = i;
+            updated->positions.push_back(positionInRoom(updated->rvecs[i],
+                                                              updated->tvecs[i]));
+            updated->grid.insert(i, updated->positions.back());
+        }
+        publish(updated);
+    }
+
+    /**
+     * Copies the marker at the specified index of the current snapshot; returns false if the
+     * index is out of bounds. Used by the (rare) accesses outside the frame path, which do not
+     * own a reader slot: these are serialized with the writers instead.
+     */
+    bool get(int index, int &outId, cv::Vec3d &outRvec, cv::Vec3d &outTvec) {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        const MarkerMapSnapshot *snapshot = current.load();
+        if (index < 0 || index >= (int) snapshot->size()) {
+            return false;
+        }
+        outId = snapshot->ids[index];
+        outRvec = snapshot->rvecs[index];
+        outTvec = snapshot->tvecs[index];
+        return true;
+    }
+
+    /**
+     * Calls inspect with the current snapshot, serialized with the writers (as get()), for the
+     * accesses outside the frame path which need the whole snapshot.
+     */
+    template<typename INSPECT>
+    void inspect(INSPECT inspect) {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        inspect(*current.load());
+    }
+
+    /**
+     * Number of markers in the current snapshot (lock-free).
+     */
+    int size() const {
+        return publishedSize.load(std::memory_order_acquire);
+    }
+
+    uint64_t version() const {
+        return current.load()->version;
+    }
+
+    /**
+     * Number of replaced snapshots not yet reclaimed.
+     */
+    size_t retiredCount() {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        return retired.size();
+    }
+
+private:
+    /// to be called with writerMutex held
+    void publish(MarkerMapSnapshot *updated) {
+        updated->version = current.load()->version + 1;
+        const MarkerMapSnapshot *old = current.exchange(updated);
+        publishedSize.store(static_cast<int>(updated->size()), std::memory_order_release);
+        uint64_t retireEpoch = globalEpoch.fetch_add(1);
+        retired.emplace_back(retireEpoch, old);
+        reclaim();
+    }
+
+    /// to be called with writerMutex held
+    void reclaim() {
+        uint64_t oldestActiveEpoch = UINT64_MAX;
+        for (int i = 0; i < MARKER_MAP_MAX_READERS; i++) {
+            uint64_t epoch = readerEpochs[i].load();
+            if (epoch != 0 && epoch < oldestActiveEpoch) {
+                oldestActiveEpoch = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (auto &retiredSnapshot : retired) {
+            if (retiredSnapshot.first < oldestActiveEpoch) {
+                delete retiredSnapshot.second;
+            } else {
+                retired[kept++] = retiredSnapshot;
+            }
+        }
+        retired.resize(kept);
+    }
+
+    std::atomic<const MarkerMapSnapshot *> current;
+    std::atomic<uint64_t> globalEpoch;
+    std::atomic<int> publishedSize;
+    std::atomic<uint64_t> readerEpochs[MARKER_MAP_MAX_READERS];
+    std::atomic<bool> readerSlotsTaken[MARKER_MAP_MAX_READERS];
+
+    std::mutex writerMutex;
+    std::vector<std::pair<uint64_t, const MarkerMapSnapshot *>> retired;
+};
+
+/**
+ * Holds the snapshot acquired on a reader slot of a MarkerMap for its scope: the slot is released
+ * on every exit path (returns and exceptions), so a reader cannot stall the reclamation of the
+ * replaced snapshots.
+ */
+class MarkerMapReadGuard {
+public:
+    MarkerMapReadGuard(MarkerMap &map, int slot) :
+            map(map), slot(slot), acquired(map.acquire(slot)) {}
+
+    MarkerMapReadGuard(const MarkerMapReadGuard &) = delete;
+
+    MarkerMapReadGuard &operator=(const MarkerMapReadGuard &) = delete;
+
+    ~MarkerMapReadGuard() {
+        map.release(slot);
+    }
+
+    const MarkerMapSnapshot *snapshot() const {
+        return acquired;
+    }
+
+private:
+    MarkerMap &map;
+    const int slot;
+    const MarkerMapSnapshot *const acquired;
+};
+
+MarkerMap *castToMarkerMapPtr(jlong addr) {
+    return (MarkerMap *) addr;
+}
+
+const MarkerMapSnapshot *castToMarkerMapSnapshotPtr(jlong addr) {
+    return (const MarkerMapSnapshot *) addr;
+}
+
+#endif //ARUCOSLAM_MARKERMAP_H
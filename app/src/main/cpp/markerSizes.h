@@ -0,0 +1,83 @@
+//
+// Registry of the side lengths of the markers, for installations mixing markers of different
+// sizes.
+//
+
+#ifndef ARUCOSLAM_MARKERSIZES_H
+#define ARUCOSLAM_MARKERSIZES_H
+
+#include <jni.h>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+/**
+ * An immutable table of the side lengths of the markers (meters), by id; the markers not in the
+ * table have the common length of the space.
+ */
+class MarkerSizes {
+public:
+    double lengthOf(int markerId, double commonLength) const {
+        auto entry = lengths.find(markerId);
+        return entry != lengths.end() ? entry->second : commonLength;
+    }
+
+    size_t size() const {
+        return lengths.size();
+    }
+
+private:
+    friend class MarkerSizeRegistry;
+
+    std::unordered_map<int, double> lengths;
+};
+
+/**
+ * A MarkerSizeRegistry keeps the side lengths of the markers which differ from the common one.
+ * The sizes are set rarely (when the installation is configured) and read at every frame, so each
+ * modification publishes a new immutable table (the same scheme of the tracking references): the
+ * workers acquire the current table once per frame and read it without any lock.
+ */
+class MarkerSizeRegistry {
+public:
+    MarkerSizeRegistry() : current(std::make_shared<MarkerSizes>()) {}
+
+    /**
+     * Sets the side length of a marker; a length <= 0 removes the marker from the registry (it
+     * gets the common length again).
+     */
+    void setLength(int markerId, double length) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto updated = std::make_shared<MarkerSizes>(*current);
+        if (length > 0.0) {
+            updated->lengths[markerId] = length;
+        } else {
+            updated->lengths.erase(markerId);
+        }
+        current = std::move(updated);
+    }
+
+    std::shared_ptr<const MarkerSizes> acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return current;
+    }
+
+private:
+    std::mutex mutex;
+    std::shared_ptr<const MarkerSizes> current;
+};
+
+MarkerSizeRegistry *castToMarkerSizeRegistryPtr(jlong addr) {
+    return (MarkerSizeRegistry *) addr;
+}
+
+/**
+ * Acquires the current sizes of the registry at addr, or nullptr if addr is 0 (i.e. all the
+ * markers have the common length).
+ */
+std::shared_ptr<const MarkerSizes> acquireMarkerSizes(jlong registryAddr) {
+    MarkerSizeRegistry *registry = castToMarkerSizeRegistryPtr(registryAddr);
+    return registry != nullptr ? registry->acquire() : nullptr;
+}
+
+#endif //ARUCOSLAM_MARKERSIZES_H
@@ -0,0 +1,191 @@
+//
+// Decoding of the marker candidates against additional dictionaries, for installations mixing
+// marker families.
+//
+
+#ifndef ARUCOSLAM_MULTIDICTIONARY_H
+#define ARUCOSLAM_MULTIDICTIONARY_H
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/aruco.hpp>
+
+/**
+ * The ids of the markers of the additional dictionaries are tagged with their dictionary, so
+ * that they do not collide with the ones of the main dictionary (which are not tagged) nor with
+ * each other: tagged id = ((dictionary + 1) << MULTI_DICTIONARY_ID_SHIFT) | id.
+ */
+constexpr int MULTI_DICTIONARY_ID_SHIFT = 16;
+
+/**
+ * Maximum number of additional dictionaries of a decoder.
+ */
+constexpr int MULTI_DICTIONARY_MAX_DICTIONARIES = 8;
+
+int taggedMarkerId(int dictionary, int markerId) {
+    return ((dictionary + 1) << MULTI_DICTIONARY_ID_SHIFT) | markerId;
+}
+
+/**
+ * @return the dictionary of a tagged id, or -1 for an id of the main dictionary
+ */
+int markerIdDictionary(int taggedId) {
+    return (taggedId >> MULTI_DICTIONARY_ID_SHIFT) - 1;
+}
+
+/**
+ * A MultiDictionaryDecoder decodes the candidates rejected by the detector (quadrilaterals which
+ * are not markers of the main dictionary) against additional dictionaries. The thresholding and
+ * the contour search are done once, by the detector: here the bits of each candidate are
+ * extracted once per bit grid size (as cv::aruco does) and identified against every dictionary
+ * with that grid size.
+ * A decoder keeps its working images, so it must be used by one thread at a time.
+ */
+class MultiDictionaryDecoder {
+public:
+    /**
+     * @return false if the dictionary was already added, or too many dictionaries were added
+     */
+    bool add(int dictionaryId) {
+        if (dictionaryCount >= MULTI_DICTIONARY_MAX_DICTIONARIES) {
+            return false;
+        }
+        for (int i = 0; i < dictionaryCount; i++) {
+            if (dictionaryIds[i] == dictionaryId) {
+                return false;
+            }
+        }
+        dictionaryIds[dictionaryCount] = dictionaryId;
+        dictionaries[dictionaryCount] = cv::aruco::getPredefinedDictionary(dictionaryId);
+        dictionaryCount++;
+        return true;
+    }
+
+    bool empty() const { return dictionaryCount == 0; }
+
+    int count() const { return dictionaryCount; }
+
+    int dictionaryIdAt(int index) const { return dictionaryIds[index]; }
+
+    /**
+     * Decodes the candidates, appending the found markers (with tagged ids, and their corners
+     * rotated to the canonical order of the marker) to ids and corners.
+     *
+     * @param image the image in which the candidates were found
+     * @param candidates the corners of the candidates rejected by the detector
+     * @param parameters the parameters used by the detector
+     * @return the number of decoded markers
+     */
+    int decode(const cv::Mat &image,
+               const std::vector<std::vector<cv::Point2f>> &candidates,
+               const cv::aruco::DetectorParameters &parameters,
+               std::vector<int> &ids,
+               std::vector<std::vector<cv::Point2f>> &corners) {
+        int decodedCount = 0;
+        for (const std::vector<cv::Point2f> &candidate : candidates) {
+            int extractedSize = -1;
+            for (int d = 0; d < dictionaryCount; d++) {
+                const cv::aruco::Dictionary &dictionary = *dictionaries[d];
+                if (dictionary.markerSize != extractedSize) {
+                    extractBits(image, candidate, dictionary.markerSize, parameters);
+                    extractedSize = dictionary.markerSize;
+                }
+                int markerId, rotation;
+                if (borderErrors(parameters.markerBorderBits) >
+                    int(dictionary.markerSize * dictionary.markerSize *
+                        parameters.maxErroneousBitsInBorderRate) ||
+                    !dictionary.identify(bits(innerBits(dictionary.markerSize,
+                                                        parameters.markerBorderBits)),
+                                         markerId, rotation, parameters.errorCorrectionRate)) {
+                    continue;
+                }
+                ids.push_back(taggedMarkerId(dictionaryIds[d], markerId));
+                corners.push_back(candidate);
+                std::vector<cv::Point2f> &markerCorners = corners.back();
+                std::rotate(markerCorners.begin(), markerCorners.begin() + 4 - rotation,
+                            markerCorners.end());
+                decodedCount++;
+                break;
+            }
+        }
+        return decodedCount;
+    }
+
+private:
+    static cv::Rect innerBits(int markerSize, int borderBits) {
+        return cv::Rect(borderBits, borderBits, markerSize, markerSize);
+    }
+
+    /**
+     * Same extraction of cv::aruco: the candidate is warped on a square image with
+     * perspectiveRemovePixelPerCell pixels per cell, binarized with Otsu, and each bit is the
+     * majority of the (central part of the) pixels of its cell.
+     */
+    void extractBits(const cv::Mat &image, const std::vector<cv::Point2f> &candidate,
+                     int markerSize, const cv::aruco::DetectorParameters &parameters) {
+        int borderBits = parameters.markerBorderBits;
+        int cellSize = parameters.perspectiveRemovePixelPerCell;
+        int sizeWithBorders = markerSize + 2 * borderBits;
+        int warpedSize = sizeWithBorders * cellSize;
+        int cellMargin = int(parameters.perspectiveRemoveIgnoredMarginPerCell * cellSize);
+
+        cv::Point2f destination[4] = {
+                cv::Point2f(0, 0),
+                cv::Point2f(warpedSize - 1, 0),
+                cv::Point2f(warpedSize - 1, warpedSize - 1),
+                cv::Point2f(0, warpedSize - 1)
+        };
+        cv::Mat transform = cv::getPerspectiveTransform(candidate.data(), destination);
+        cv::warpPerspective(image, warped, transform, cv::Size(warpedSize, warpedSize),
+                            cv::INTER_NEAREST);
+
+        bits.create(sizeWithBorders, sizeWithBorders, CV_8UC1);
+        cv::Scalar mean, stdDev;
+        cv::meanStdDev(warped(cv::Rect(cellSize / 2, cellSize / 2,
+                                       warpedSize - cellSize, warpedSize - cellSize)),
+                       mean, stdDev);
+        if (stdDev[0] < parameters.minOtsuStdDev) {
+            // uniform candidate: all black or all white
+            bits.setTo(mean[0] > 127 ? 1 : 0);
+            return;
+        }
+        cv::threshold(warped, warped, 125, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+        int cellPixels = (cellSize - 2 * cellMargin) * (cellSize - 2 * cellMargin);
+        for (int y = 0; y < sizeWithBorders; y++) {
+            for (int x = 0; x < sizeWithBorders; x++) {
+                cv::Mat cell = warped(cv::Rect(x * cellSize + cellMargin, y * cellSize + cellMargin,
+                                               cellSize - 2 * cellMargin,
+                                               cellSize - 2 * cellMargin));
+                bits.at<unsigned char>(y, x) = cv::countNonZero(cell) > cellPixels / 2 ? 1 : 0;
+            }
+        }
+    }
+
+    /**
+     * @return the number of white bits in the (black) border of the extracted bits
+     */
+    int borderErrors(int borderBits) const {
+        int errors = 0;
+        for (int y = 0; y < bits.rows; y++) {
+            for (int x = 0; x < bits.cols; x++) {
+                bool border = y < borderBits || x < borderBits ||
+                              y >= bits.rows - borderBits || x >= bits.cols - borderBits;
+                if (border && bits.at<unsigned char>(y, x) != 0) {
+                    errors++;
+                }
+            }
+        }
+        return errors;
+    }
+
+    int dictionaryIds[MULTI_DICTIONARY_MAX_DICTIONARIES] = {};
+    cv::Ptr<cv::aruco::Dictionary> dictionaries[MULTI_DICTIONARY_MAX_DICTIONARIES];
+    int dictionaryCount = 0;
+
+    cv::Mat warped, bits;
+};
+
+#endif //ARUCOSLAM_MULTIDICTIONARY_H
@@ -12,6 +12,24 @@
 #include "jniUtils.h"
 #include "positionRansac.h"
 #include "opencv-extensions.h"
+#include "frameContext.h"
+#include "overlayCommands.h"
+#include "markerMap.h"
+#include "boardRegistry.h"
+#include "keyframeDatabase.h"
+#include "observationQuality.h"
+#include "framePipeline.h"
+#include "qualityController.h"
+#include "detectorSession.h"
+#include "poseStream.h"
+#include "sessionRecorder.h"
+#include "poseAccumulator.h"
+#include "candidatePool.h"
+#include "cornerTracker.h"
+#include "submapManager.h"
+#include "streamScheduler.h"
+#include "compactTrack.h"
+#include "markerSizes.h"
 
 #include <opencv2/calib3d.hpp>
 #include <string>
@@ -21,6 +39,15 @@
 
 /// SEE THE JAVADOCS IN NativeMethods.java
 
+/**
+ * Depth range (in meters) of the markers drawn on the map, and margin (in pixels) around the map
+ * box within which the centers of the drawn markers must fall (so that the markers crossing the
+ * border are drawn too).
+ */
+constexpr double MAP_CAMERA_NEAR_PLANE = 0.01;
+constexpr double MAP_CAMERA_FAR_PLANE = 100.0;
+constexpr double MAP_CULLING_MARGIN = 20.0;
+
 extern "C"
 JNIEXPORT jint JNICALL
 Java_parsleyj_arucoslam_NativeMethods_detectMarkers(
@@ -35,56 +62,44 @@ Java_parsleyj_arucoslam_NativeMethods_detectMarkers(
         jint maxMarkers, // in
         jintArray detectedIDsVect, // out
         jdoubleArray outrvecs, // out
-        jdoubleArray outtvecs // out
+        jdoubleArray outtvecs, // out
+        jdoubleArray outQualities, // out
+        jlong frameContextAddr, // in
+        jlong overlayAddr, // in (0 in headless mode)
+        jlong detectorSessionAddr, // in (0 to search the whole frame with default parameters)
+        jlong markerMapSnapshotAddr, // in (markers whose corners are refined)
+        jlong boardRegistryAddr, // in (0 if no boards are registered)
+        jlong sharpnessGateAddr, // in (0 to never skip the detection)
+        jlong cornerTrackerAddr, // in (0 to detect the markers in every frame)
+        jlong frameNumber, // in
+        jlong markerSizeRegistryAddr // in (0 if all the markers have the same length)
 ) {
-    auto dictionary = cv::aruco::getPredefinedDictionary(markerDictionary);
+    FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    std::shared_ptr<const MarkerSizes> sizes = acquireMarkerSizes(markerSizeRegistryAddr);
     cv::Mat inputMat = *castToMatPtr(inputMatAddr);
     cv::Mat resultMat = *castToMatPtr(resultMatAddr);
     cv::Mat cameraMatrix = *castToMatPtr(cameraMatrixAddr);
     cv::Mat distCoeffs = *castToMatPtr(distCoeffsAddr);
 
-
-    std::vector<cv::Mat> channels(3);
-    // this seems to be the only way to perform a correct copy of the images:
-    cv::split(inputMat, channels);
-    cv::merge(channels, resultMat);
-
-    cv::cvtColor(inputMat, inputMat, CV_RGBA2GRAY);
-    std::vector<int> ids;
-    std::vector<std::vector<cv::Point2f>> corners;
-
-    cv::aruco::detectMarkers(inputMat, dictionary, corners, ids,
-                             cv::aruco::DetectorParameters::create(), cv::noArray(), cameraMatrix,
-                             distCoeffs);
-    cv::Mat tmpMat;
-    cv::cvtColor(resultMat, tmpMat, CV_RGBA2RGB);
-
-    cv::aruco::drawDetectedMarkers(tmpMat, corners, ids);
-
-
-    std::vector<cv::Vec3d> rvecs, tvecs;
-    cv::aruco::estimatePoseSingleMarkers(
-            corners, markerLength,
-            cameraMatrix, distCoeffs,
-            rvecs, tvecs
-    );
-
-
-    for (int i = 0; i < min(int(rvecs.size()), maxMarkers); i++) {
-        auto rvec = rvecs[i];
-        auto tvec = tvecs[i];
-
-        env->SetIntArrayRegion(detectedIDsVect, i, 1, &ids[i]);
-        for (int vi = 0; vi < 3; vi++) {
-            env->SetDoubleArrayRegion(outrvecs, i * 3 + vi, 1, &rvec[vi]);
-            env->SetDoubleArrayRegion(outtvecs, i * 3 + vi, 1, &tvec[vi]);
-        }
-
+    int foundCount = detectFrameMarkers(markerDictionary, cameraMatrix, distCoeffs,
+                                        inputMat, resultMat, markerLength, context,
+                                        castToOverlayPtr(overlayAddr),
+                                        castToDetectorSessionPtr(detectorSessionAddr),
+                                        castToMarkerMapSnapshotPtr(markerMapSnapshotAddr),
+                                        castToBoardRegistryPtr(boardRegistryAddr),
+                                        castToSharpnessGatePtr(sharpnessGateAddr),
+                                        castToCornerTrackerPtr(cornerTrackerAddr),
+                                        (uint64_t) frameNumber,
+                                        sizes.get());
+
+    for (int i = 0; i < min(foundCount, maxMarkers); i++) {
+        env->SetIntArrayRegion(detectedIDsVect, i, 1, &context.detectedIDs[i]);
+        env->SetDoubleArrayRegion(outrvecs, i * 3, 3, context.detectedRvecs[i].val);
+        env->SetDoubleArrayRegion(outtvecs, i * 3, 3, context.detectedTvecs[i].val);
+        env->SetDoubleArrayRegion(outQualities, i, 1, &context.detectedQualities[i]);
     }
 
-    cv::cvtColor(tmpMat, resultMat, CV_RGB2RGBA);
-
-    return ids.size();
+    return foundCount;
 }
 
 
@@ -97,15 +112,13 @@ Java_parsleyj_arucoslam_NativeMethods_estimateCameraPosition(
         jlong cameraMatrixAddr,
         jlong distCoeffsAddr,
         jlong inputMatAddr,
-        jint fixedMarkerCount,
-        jintArray fixed_markers,
-        jdoubleArray fixed_rvects,
-        jdoubleArray fixed_tvects,
+        jlong markerMapSnapshotAddr,
         jdouble fixedLenght,
         jint foundPosesCount,
         jintArray inMarkers,
         jdoubleArray in_rvects,
         jdoubleArray in_tvects,
+        jdoubleArray in_qualities,
         jdoubleArray outRvec,
         jdoubleArray outTvec,
         jdouble tvecInlierTreshold,// = 0.05,
@@ -113,50 +126,30 @@ Java_parsleyj_arucoslam_NativeMethods_estimateCameraPosition(
         jdouble rvecInlierTreshold,// = M_PI / 8.0,
         jdouble rvecOutlierProbability,// = 0.1,
         jint maxRansacIterations,// = 100,
-        jdouble optimalModelTargetProbability// = 0.9,
+        jdouble optimalModelTargetProbability,// = 0.9,
+        jlong boardRegistryAddr,
+        jlong frameContextAddr,
+        jlong overlayAddr
 ) {
 
 
+    FrameContext *context = castToFrameContextPtr(frameContextAddr);
+    FrameArena *arena = &context->arena;
+    OverlayCommandBuffer *overlay = castToOverlayPtr(overlayAddr);
     cv::Mat inputMat = *castToMatPtr(inputMatAddr);
     cv::Mat cameraMatrix = *castToMatPtr(cameraMatrixAddr);
     cv::Mat distCoeffs = *castToMatPtr(distCoeffsAddr);
 
-    std::vector<int> fixedMarkersIDs;
-    std::vector<cv::Vec3d> fixedMarkersTvecs;
-    std::vector<cv::Vec3d> fixedMarkersRvecs;
-
+    // the known markers are read from an immutable snapshot, acquired by the worker for the
+    // whole frame: no copies and no locks
+    const MarkerMapSnapshot &fixedMarkers = *castToMarkerMapSnapshotPtr(markerMapSnapshotAddr);
 
-    pushJavaArrayToStdVector<jintArray, jint, int>(
-            env,
-            fixed_markers,
-            &JNIEnv::GetIntArrayElements,
-            fixedMarkersIDs,
-            0,
-            fixedMarkerCount
-    );
-
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            fixed_tvects,
-            fixedMarkersTvecs,
-            0,
-            fixedMarkerCount
-    );
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            fixed_rvects,
-            fixedMarkersRvecs,
-            0,
-            fixedMarkerCount
-    );
-
-    std::vector<int> foundMarkersIDs;
-    std::vector<cv::Vec3d> foundMarkersTvecs;
-    std::vector<cv::Vec3d> foundMarkersRvecs;
+    ArenaVector<int> foundMarkersIDs((ArenaAllocator<int>(arena)));
+    ArenaVector<cv::Vec3d> foundMarkersTvecs((ArenaAllocator<cv::Vec3d>(arena)));
+    ArenaVector<cv::Vec3d> foundMarkersRvecs((ArenaAllocator<cv::Vec3d>(arena)));
     pushJavaArrayToStdVector<jintArray, jint, int>(
             env,
             inMarkers,
-            &JNIEnv::GetIntArrayElements,
             foundMarkersIDs,
             0,
             foundPosesCount
@@ -164,97 +157,39 @@ Java_parsleyj_arucoslam_NativeMethods_estimateCameraPosition(
 
     pushjDoubleArrayToVectorOfVec3ds(env, in_tvects, foundMarkersTvecs, 0, foundPosesCount);
     pushjDoubleArrayToVectorOfVec3ds(env, in_rvects, foundMarkersRvecs, 0, foundPosesCount);
+    ArenaVector<double> foundMarkersQualities((ArenaAllocator<double>(arena)));
+    pushJavaArrayToStdVector<jdoubleArray, jdouble, double>(
+            env,
+            in_qualities,
+            foundMarkersQualities,
+            0,
+            foundPosesCount
+    );
 
-    std::vector<cv::Vec3d> positionRvecs;
-    std::vector<cv::Vec3d> positionTvecs;
-    cv::Mat tmpMat;
-    cv::cvtColor(inputMat, tmpMat, CV_RGBA2RGB);
-
-
-
-    //for (int i = 0; i < foundMarkersIDs.size(); i++) {
-    p_for(i, foundMarkersIDs.size()) {
-        int foundMarkerID = foundMarkersIDs[i];
-        auto findFixedMarkerIndex = std::find(fixedMarkersIDs.begin(), fixedMarkersIDs.end(),
-                                              foundMarkerID);
-
-        if (findFixedMarkerIndex != fixedMarkersIDs.end()) {
-            int fixedMarkerIndex = std::distance(fixedMarkersIDs.begin(), findFixedMarkerIndex);
-
-            cv::Vec3d computedTvec;
-            cv::Vec3d computedRvec;
-
-
-            cv::composeRT(
-                    // Transformation to switch from room's coord sys to marker's coord sys
-                    fixedMarkersRvecs[fixedMarkerIndex], fixedMarkersTvecs[fixedMarkerIndex],
-                    // Transformation to switch from marker's coord sys to camera's coord sys
-                    foundMarkersRvecs[i], foundMarkersTvecs[i],
-                    // (result) Transf to change from room's coord sys to camera's coord sys
-                    computedRvec, computedTvec
-            );
-
-
-
-            cv::aruco::drawAxis(tmpMat, cameraMatrix, distCoeffs,
-                                foundMarkersRvecs[i], foundMarkersTvecs[i], (float) fixedLenght);
-
-
-
-            p_for_criticalSectionBegin
-                positionTvecs.push_back(computedTvec);
-                positionRvecs.push_back(computedRvec);
-            p_for_criticalSectionEnd
-
-
-        }
-    };
-
-    cv::cvtColor(tmpMat, inputMat, CV_RGB2RGBA);
-
-    int inliersCount;
     cv::Vec3d cameraRvec, cameraTvec;
-
-
-
-    inliersCount = estimateCameraPose(
-            positionRvecs, positionTvecs,
-            cameraRvec, cameraTvec,
+    int inliersCount = estimateFrameCameraPose(
+            cameraMatrix, distCoeffs, inputMat.size(),
+            fixedMarkers, fixedLenght,
+            foundMarkersIDs.size(),
+            foundMarkersIDs.data(),
+            foundMarkersRvecs.data(),
+            foundMarkersTvecs.data(),
+            foundMarkersQualities.data(),
             tvecInlierTreshold,
             tvecOutlierProbability,
             rvecInlierTreshold,
             rvecOutlierProbability,
             maxRansacIterations,
-            optimalModelTargetProbability
+            optimalModelTargetProbability,
+            castToBoardRegistryPtr(boardRegistryAddr),
+            context,
+            overlay,
+            cameraRvec, cameraTvec
     );
 
     fromVec3dToJdoubleArray(env, cameraRvec, outRvec);
     fromVec3dToJdoubleArray(env, cameraTvec, outTvec);
 
-
-    std::ostringstream a, b;
-    a << "INLIERS=" << inliersCount;
-    int side = inputMat.rows / 2;
-    cv::Point2f topLeftCorner = cv::Point2f(inputMat.cols - side, inputMat.rows - side);
-    cv::putText(inputMat, a.str(), topLeftCorner + cv::Point2f(0, -30),
-                CV_FONT_HERSHEY_COMPLEX_SMALL, 1.0,
-                cv::Scalar(0, 0, 255));
-
-
-    b << "KNOWN MARKERS: {";
-    for (int id : fixedMarkersIDs) {
-        b << id << " ";
-    }
-    b << "}";
-    cv::putText(
-            inputMat,
-            b.str(),
-            cv::Point2f(30.0, 50.0),
-            CV_FONT_HERSHEY_COMPLEX_SMALL,
-            0.8,
-            cv::Scalar(50.0, 255.0, 50.0)
-    );
-
     return inliersCount;
 }
 
@@ -288,22 +223,6 @@ Java_parsleyj_arucoslam_NativeMethods_composeRT(
     fromVec3dToJdoubleArray(env, rvec, out_rvec);
 }
 
-void invertRT(
-        const cv::Vec3d &inR,
-        const cv::Vec3d &inT,
-        cv::Vec3d &outR,
-        cv::Vec3d &outT
-) {
-    cv::Mat Rmatrix;
-    cv::Rodrigues(inR, Rmatrix);
-    cv::Rodrigues(Rmatrix.t(), outR);
-    cv::Mat x(-(Rmatrix.t() * cv::Mat(inT)));
-
-    outT[0] = x.at<double>(0, 0);
-    outT[1] = x.at<double>(1, 0);
-    outT[2] = x.at<double>(2, 0);
-}
-
 extern "C"
 JNIEXPORT void JNICALL
 Java_parsleyj_arucoslam_NativeMethods_invertRT(
@@ -355,9 +274,8 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
         JNIEnv *env,
         jclass clazz,
         jdouble marker_length,
-        jdoubleArray marker_rvects,
-        jdoubleArray marker_tvects,
-        jint fixedMarkerCount,
+        jlong markerMapSnapshotAddr,
+        jlong markerSizeRegistryAddr, // 0 if all the markers have the same length
         jdoubleArray mapCameraRotation_j,
         jdoubleArray mapCameraTranslation_j,
         jdouble mapCameraFovX,
@@ -367,27 +285,28 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
         jint phonePoseStatus,
         jdoubleArray phonePositionRvect_j,
         jdoubleArray phonePositionTvect_j,
-        jint previousPhonePosesCount,
-        jdoubleArray previousPhonePosesRvects_j,
-        jdoubleArray previousPhonePosesTvects_j,
+        jlong trackAddr,
         jint mapCameraPixelsX,
         jint mapCameraPixelsY,
         jint mapTopLeftCornerX,
         jint mapTopLeftCornerY,
         jlong result_mat_addr,
-        jboolean fullScreenMode
+        jboolean fullScreenMode,
+        jlong frameContextAddr,
+        jlong qualityControllerAddr
 ) {
+    FrameArena *arena = &castToFrameContextPtr(frameContextAddr)->arena;
     double f_x = mapCameraApertureX / 2.0 * cotan(mapCameraFovX / 2.0);
     double f_y = mapCameraApertureY / 2.0 * cotan(mapCameraFovY / 2.0);
     double c_x = static_cast<double>(mapCameraPixelsX) / 2.0;
     double c_y = static_cast<double>(mapCameraPixelsY) / 2.0;
 
-    cv::Mat mapCameraMatrix = (cv::Mat_<double>(3, 3) <<
-                                                      f_x, 0.0, c_x,
+    cv::Matx33d mapCameraMatrix(
+            f_x, 0.0, c_x,
             0.0, f_y, c_y,
             0.0, 0.0, 1.0
     );
-    cv::Mat emptyDistortionCoeffs = cv::Mat::zeros(1, 4, CV_64FC1);
+    cv::Vec4d emptyDistortionCoeffs(0.0, 0.0, 0.0, 0.0);
 
     // Transformation to switch from room's coord sys to camera's coord sys
     cv::Vec3d mapCameraRotation, mapCameraTranslation;
@@ -398,38 +317,25 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
     fromjDoubleArrayToVec3d(env, phonePositionRvect_j, phonePositionRvect);
     fromjDoubleArrayToVec3d(env, phonePositionTvect_j, phonePositionTvect);
 
-    std::vector<cv::Vec3d> markersTvecs, markersRvecs;
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            marker_tvects,
-            markersTvecs,
-            0,
-            fixedMarkerCount
-    );
-
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            marker_rvects,
-            markersRvecs,
-            0,
-            fixedMarkerCount
-    );
-
-    std::vector<cv::Vec3d> previousPhonePosesRvects, previousPhonePosesTvects;
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            previousPhonePosesRvects_j,
-            previousPhonePosesRvects
-    );
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            previousPhonePosesTvects_j,
-            previousPhonePosesTvects
-    );
-
-    std::vector<cv::Point3f> origin;
-    origin.emplace_back(0.0, 0.0, 0.0);
-    std::vector<cv::Point2f> markersImagePoints;
+    const MarkerMapSnapshot &markers = *castToMarkerMapSnapshotPtr(markerMapSnapshotAddr);
+    const std::vector<cv::Vec3d> &markersRvecs = markers.rvecs;
+    const std::vector<cv::Vec3d> &markersTvecs = markers.tvecs;
+    std::shared_ptr<const MarkerSizes> markerSizes = acquireMarkerSizes(markerSizeRegistryAddr);
+
+    // the long term track is decoded from its compact storage straight into the arena
+    CompactTrack &track = *castToCompactTrackPtr(trackAddr);
+    int previousPhonePosesCount = track.size();
+    ArenaVector<cv::Vec3d> previousPhonePosesRvects(previousPhonePosesCount, cv::Vec3d(),
+                                                    ArenaAllocator<cv::Vec3d>(arena));
+    ArenaVector<cv::Vec3d> previousPhonePosesTvects(previousPhonePosesCount, cv::Vec3d(),
+                                                    ArenaAllocator<cv::Vec3d>(arena));
+    previousPhonePosesCount = track.decode(0, previousPhonePosesCount,
+                                           previousPhonePosesRvects.data(),
+                                           previousPhonePosesTvects.data(), nullptr);
+
+    // small point sets live on the stack and are wrapped in Mat headers (no allocations)
+    cv::Point3f origin[1] = {cv::Point3f(0.0, 0.0, 0.0)};
+    cv::Mat originMat(1, 1, CV_32FC3, origin);
 
     cv::Mat imageMat = *castToMatPtr(result_mat_addr);
     cv::Point2f topLeftCorner = fullScreenMode ?
@@ -444,13 +350,30 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
     } else {
         draw2DBoxFrame(imageMat, topLeftCorner);
     }
-    p_for(i, markersRvecs.size()) {
-        std::vector<cv::Point3f> points;
-        points.emplace_back(0, 0, 0);
-        points.emplace_back(-marker_length / 2.0, -marker_length / 2.0, 0);
-        points.emplace_back(-marker_length / 2.0, +marker_length / 2.0, 0);
-        points.emplace_back(+marker_length / 2.0, +marker_length / 2.0, 0);
-        points.emplace_back(+marker_length / 2.0, -marker_length / 2.0, 0);
+
+    // only the markers inside the view of the map camera (i.e. the map box, or the whole image in
+    // full screen mode) are projected and drawn
+    cv::Rect2d mapViewport = fullScreenMode ?
+                             cv::Rect2d(-topLeftCorner.x, -topLeftCorner.y,
+                                        imageMat.cols, imageMat.rows) :
+                             cv::Rect2d(0, 0, mapCameraPixelsX, mapCameraPixelsY);
+    ArenaVector<int> visibleMarkers((ArenaAllocator<int>(arena)));
+    markers.markersInFrustum(mapCameraRotation, mapCameraTranslation, mapCameraMatrix,
+                             mapViewport, MAP_CAMERA_NEAR_PLANE, MAP_CAMERA_FAR_PLANE,
+                             MAP_CULLING_MARGIN, visibleMarkers);
+    p_for(visibleIndex, visibleMarkers.size()) {
+        int i = visibleMarkers[visibleIndex];
+        double markerLength = markerSizes != nullptr
+                              ? markerSizes->lengthOf(markers.ids[i], marker_length)
+                              : marker_length;
+        float halfLength = static_cast<float>(markerLength / 2.0);
+        cv::Point3f points[5] = {
+                cv::Point3f(0, 0, 0),
+                cv::Point3f(-halfLength, -halfLength, 0),
+                cv::Point3f(-halfLength, +halfLength, 0),
+                cv::Point3f(+halfLength, +halfLength, 0),
+                cv::Point3f(+halfLength, -halfLength, 0),
+        };
         // Transformation to switch from marker's coord sys to room's coord sys
         cv::Vec3d invertedMarkerRvec, invertedMarkerTvec;
         invertRT(markersRvecs[i], markersTvecs[i],
@@ -463,15 +386,16 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
                 mapCameraRotation, mapCameraTranslation,
                 fromMarkerToMapR, fromMarkerToMapT
         );
-        std::vector<cv::Point2f> projectedPoints;
+        cv::Point2f projectedPoints[5];
+        cv::Mat projectedPointsMat(5, 1, CV_32FC2, projectedPoints);
 
         cv::projectPoints(
-                points,
+                cv::Mat(5, 1, CV_32FC3, points),
                 fromMarkerToMapR,
                 fromMarkerToMapT,
                 mapCameraMatrix,
                 emptyDistortionCoeffs,
-                projectedPoints
+                projectedPointsMat
         );
 
 
@@ -505,7 +429,8 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
                  green);
     };
 
-    std::vector<cv::Point2f> trackPoints(previousPhonePosesCount);
+    ArenaVector<cv::Point2f> trackPoints(previousPhonePosesCount, cv::Point2f(),
+                                         ArenaAllocator<cv::Point2f>(arena));
     p_for(i, previousPhonePosesCount) {
         cv::Vec3d invertedPrevPoseR, invertedPrevPoseT;
         invertRT(previousPhonePosesRvects[i], previousPhonePosesTvects[i],
@@ -516,14 +441,15 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
                       mapCameraRotation, mapCameraTranslation,
                       fromPrevPoseToMapR, fromPrevPoseToMapT);
 
-        std::vector<cv::Point2f> projectedTrackPoints;
+        cv::Point2f projectedTrackPoints[1];
+        cv::Mat projectedTrackPointsMat(1, 1, CV_32FC2, projectedTrackPoints);
         cv::projectPoints(
-                origin,
+                originMat,
                 fromPrevPoseToMapR,
                 fromPrevPoseToMapT,
                 mapCameraMatrix,
                 emptyDistortionCoeffs,
-                projectedTrackPoints
+                projectedTrackPointsMat
         );
 
         trackPoints[i] = projectedTrackPoints[0];
@@ -541,13 +467,15 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
         double sinOfFourthOfPi = sin(CV_PI / 4.0);
         double ray = cameraRaysLength * sinOfFourthOfPi;
 
-        std::vector<cv::Point3f> phoneObject3DPoints;
-        phoneObject3DPoints.emplace_back(0, 0, 0);
-        phoneObject3DPoints.emplace_back(0, 0, 0.2);
-        phoneObject3DPoints.emplace_back(-ray, -ray, ray);
-        phoneObject3DPoints.emplace_back(-ray, +ray, ray);
-        phoneObject3DPoints.emplace_back(+ray, +ray, ray);
-        phoneObject3DPoints.emplace_back(+ray, -ray, ray);
+        auto fRay = static_cast<float>(ray);
+        cv::Point3f phoneObject3DPoints[6] = {
+                cv::Point3f(0, 0, 0),
+                cv::Point3f(0, 0, 0.2),
+                cv::Point3f(-fRay, -fRay, fRay),
+                cv::Point3f(-fRay, +fRay, fRay),
+                cv::Point3f(+fRay, +fRay, fRay),
+                cv::Point3f(+fRay, -fRay, fRay),
+        };
 
         // Transformation to switch from phone's coord sys to room's coord sys
         cv::Vec3d invertedPhoneRvec, invertedPhoneTvec;
@@ -561,14 +489,15 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
                 mapCameraRotation, mapCameraTranslation,
                 fromPhoneToMapR, fromPhoneToMapT
         );
-        std::vector<cv::Point2f> projectedPhonePoints;
+        cv::Point2f projectedPhonePoints[6];
+        cv::Mat projectedPhonePointsMat(6, 1, CV_32FC2, projectedPhonePoints);
         cv::projectPoints(
-                phoneObject3DPoints,
+                cv::Mat(6, 1, CV_32FC3, phoneObject3DPoints),
                 fromPhoneToMapR,
                 fromPhoneToMapT,
                 mapCameraMatrix,
                 emptyDistortionCoeffs,
-                projectedPhonePoints
+                projectedPhonePointsMat
         );
 
         cv::Scalar centerColor, arrowColor, raysColor, panelColor;
@@ -633,7 +562,12 @@ Java_parsleyj_arucoslam_NativeMethods_renderMap(
                  panelColor);
     }
 
-
+    if (qualityControllerAddr != 0 && !fullScreenMode) {
+        // kept for the frames that skip the map rendering
+        castToQualityControllerPtr(qualityControllerAddr)->storeMapBox(
+                imageMat, cv::Rect(mapTopLeftCornerX, mapTopLeftCornerY,
+                                   mapCameraPixelsX, mapCameraPixelsY));
+    }
 }
 
 
@@ -650,26 +584,15 @@ Java_parsleyj_arucoslam_NativeMethods_poseCentroid(
         jdoubleArray outRvec_j,
         jdoubleArray outTvec_j
 ) {
-    std::vector<cv::Vec3d> inRvecs, inTvecs;
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            inRvecs_j,
-            inRvecs,
-            offset,
-            count
-    );
-
-    pushjDoubleArrayToVectorOfVec3ds(
-            env,
-            inTvecs_j,
-            inTvecs,
-            offset,
-            count
-    );
+    std::vector<double> inRvecs(count * 3), inTvecs(count * 3);
+    env->GetDoubleArrayRegion(inRvecs_j, offset * 3, count * 3, inRvecs.data());
+    env->GetDoubleArrayRegion(inTvecs_j, offset * 3, count * 3, inTvecs.data());
 
+    // same result of computeCentroid() and computeAngleCentroid(), in one pass
+    PoseMeanAccumulator accumulator;
+    accumulator.addAll(inRvecs.data(), inTvecs.data(), count);
     cv::Vec3d outTvec, outRvec;
-    computeCentroid(inTvecs, outTvec);
-    computeAngleCentroid(inRvecs, outRvec);
+    accumulator.mean(outRvec, outTvec);
 
     fromVec3dToJdoubleArray(env, outRvec, outRvec_j);
     fromVec3dToJdoubleArray(env, outTvec, outTvec_j);
@@ -686,4 +609,1356 @@ Java_parsleyj_arucoslam_NativeMethods_angularDistance(
     fromjDoubleArrayToVec3d(env, inRvec1_j, inRvec1);
     fromjDoubleArrayToVec3d(env, inRvec2_j, inRvec2);
     return angularDistance(inRvec1, inRvec2);
-}
\ No newline at end of file
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newFrameContext(
+        JNIEnv *env,
+        jclass clazz,
+        jlong capacityBytes
+) {
+    return (jlong) new FrameContext(static_cast<size_t>(capacityBytes));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseFrameContext(
+        JNIEnv *env,
+        jclass clazz,
+        jlong frameContextAddr
+) {
+    delete castToFrameContextPtr(frameContextAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_beginContextFrame(
+        JNIEnv *env,
+        jclass clazz,
+        jlong frameContextAddr
+) {
+    castToFrameContextPtr(frameContextAddr)->reset();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_frameContextStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong frameContextAddr,
+        jlongArray outStats
+) {
+    FrameArena *arena = &castToFrameContextPtr(frameContextAddr)->arena;
+    jlong stats[4] = {
+            static_cast<jlong>(arena->heapAllocationsInLastFrame()),
+            static_cast<jlong>(arena->peakUsageBytes()),
+            static_cast<jlong>(arena->capacityBytes()),
+            static_cast<jlong>(arena->frameCount()),
+    };
+    env->SetLongArrayRegion(outStats, 0, 4, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newOverlayBuffer(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new OverlayCommandBuffer();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseOverlayBuffer(
+        JNIEnv *env,
+        jclass clazz,
+        jlong overlayAddr
+) {
+    delete castToOverlayPtr(overlayAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_clearOverlay(
+        JNIEnv *env,
+        jclass clazz,
+        jlong overlayAddr
+) {
+    castToOverlayPtr(overlayAddr)->clear();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_overlayText(
+        JNIEnv *env,
+        jclass clazz,
+        jlong overlayAddr,
+        jstring text_j,
+        jdouble x,
+        jdouble y,
+        jint fontFace,
+        jdouble fontScale,
+        jdouble red,
+        jdouble green,
+        jdouble blue,
+        jint thickness
+) {
+    const char *text = env->GetStringUTFChars(text_j, nullptr);
+    castToOverlayPtr(overlayAddr)->text(text, cv::Point2f(x, y), fontFace, fontScale,
+                                        cv::Scalar(red, green, blue), thickness);
+    env->ReleaseStringUTFChars(text_j, text);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_rasterizeOverlay(
+        JNIEnv *env,
+        jclass clazz,
+        jlong overlayAddr,
+        jlong resultMatAddr
+) {
+    cv::Mat resultMat = *castToMatPtr(resultMatAddr);
+    castToOverlayPtr(overlayAddr)->rasterize(resultMat);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newMarkerMap(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new MarkerMap();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseMarkerMap(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr
+) {
+    delete castToMarkerMapPtr(markerMapAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapRegisterReader(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr
+) {
+    return castToMarkerMapPtr(markerMapAddr)->registerReader();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapUnregisterReader(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint readerSlot
+) {
+    castToMarkerMapPtr(markerMapAddr)->unregisterReader(readerSlot);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapAcquire(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint readerSlot
+) {
+    return (jlong) castToMarkerMapPtr(markerMapAddr)->acquire(readerSlot);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapRelease(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint readerSlot
+) {
+    castToMarkerMapPtr(markerMapAddr)->release(readerSlot);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapAddIfNotPresent(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint markerId,
+        jdoubleArray rvec_j,
+        jdoubleArray tvec_j
+) {
+    cv::Vec3d rvec, tvec;
+    fromjDoubleArrayToVec3d(env, rvec_j, rvec);
+    fromjDoubleArrayToVec3d(env, tvec_j, tvec);
+    return castToMarkerMapPtr(markerMapAddr)->addIfNotPresent(markerId, rvec, tvec);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapRemoveLast(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr
+) {
+    return castToMarkerMapPtr(markerMapAddr)->removeLast();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapSize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr
+) {
+    return castToMarkerMapPtr(markerMapAddr)->size();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapGet(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint index,
+        jdoubleArray outRvec,
+        jdoubleArray outTvec
+) {
+    int markerId;
+    cv::Vec3d rvec, tvec;
+    if (!castToMarkerMapPtr(markerMapAddr)->get(index, markerId, rvec, tvec)) {
+        return -1;
+    }
+    fromVec3dToJdoubleArray(env, rvec, outRvec);
+    fromVec3dToJdoubleArray(env, tvec, outTvec);
+    return markerId;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerMapCopy(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jintArray outIds,
+        jdoubleArray outRvecs,
+        jdoubleArray outTvecs
+) {
+    jint count = 0;
+    castToMarkerMapPtr(markerMapAddr)->inspect([&](const MarkerMapSnapshot &snapshot) {
+        count = (jint) snapshot.size();
+        jint copied = std::min(count, env->GetArrayLength(outIds));
+        for (jint i = 0; i < copied; i++) {
+            jint markerId = snapshot.ids[i];
+            env->SetIntArrayRegion(outIds, i, 1, &markerId);
+            env->SetDoubleArrayRegion(outRvecs, i * 3, 3, snapshot.rvecs[i].val);
+            env->SetDoubleArrayRegion(outTvecs, i * 3, 3, snapshot.tvecs[i].val);
+        }
+    });
+    return count;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_snapshotSize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapSnapshotAddr
+) {
+    return (jint) castToMarkerMapSnapshotPtr(markerMapSnapshotAddr)->size();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_countKnownMarkers(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapSnapshotAddr,
+        jint foundMarkersCount,
+        jintArray foundIDs_j
+) {
+    const MarkerMapSnapshot &snapshot = *castToMarkerMapSnapshotPtr(markerMapSnapshotAddr);
+    auto *foundIDs = (jint *) env->GetPrimitiveArrayCritical(foundIDs_j, nullptr);
+    int knownCount = 0;
+    for (int i = 0; i < foundMarkersCount; i++) {
+        if (snapshot.indexOf(foundIDs[i]) >= 0) {
+            knownCount++;
+        }
+    }
+    env->ReleasePrimitiveArrayCritical(foundIDs_j, foundIDs, JNI_ABORT);
+    return knownCount;
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newBoardRegistry(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new BoardRegistry();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseBoardRegistry(
+        JNIEnv *env,
+        jclass clazz,
+        jlong boardRegistryAddr
+) {
+    delete castToBoardRegistryPtr(boardRegistryAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_registerMarkerBoard(
+        JNIEnv *env,
+        jclass clazz,
+        jlong boardRegistryAddr,
+        jint markerDictionary,
+        jint markerCount,
+        jintArray markerIds_j,
+        jdoubleArray markerCorners_j,
+        jdoubleArray boardRvec_j,
+        jdoubleArray boardTvec_j,
+        jdouble axisLength
+) {
+    std::vector<int> markerIds(markerCount);
+    env->GetIntArrayRegion(markerIds_j, 0, markerCount, markerIds.data());
+
+    std::vector<double> flatCorners(markerCount * 4 * 3);
+    env->GetDoubleArrayRegion(markerCorners_j, 0, markerCount * 4 * 3, flatCorners.data());
+    std::vector<std::vector<cv::Point3f>> markerCorners(markerCount);
+    for (int i = 0; i < markerCount; i++) {
+        for (int j = 0; j < 4; j++) {
+            const double *corner = &flatCorners[(i * 4 + j) * 3];
+            markerCorners[i].emplace_back(corner[0], corner[1], corner[2]);
+        }
+    }
+
+    cv::Vec3d boardRvec, boardTvec;
+    fromjDoubleArrayToVec3d(env, boardRvec_j, boardRvec);
+    fromjDoubleArrayToVec3d(env, boardTvec_j, boardTvec);
+    return castToBoardRegistryPtr(boardRegistryAddr)->registerMarkerBoard(
+            markerDictionary, markerIds, markerCorners, boardRvec, boardTvec,
+            static_cast<float>(axisLength));
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_registerCharucoBoard(
+        JNIEnv *env,
+        jclass clazz,
+        jlong boardRegistryAddr,
+        jint markerDictionary,
+        jint squaresX,
+        jint squaresY,
+        jdouble squareLength,
+        jdouble markerLength,
+        jint firstMarkerId,
+        jdoubleArray boardRvec_j,
+        jdoubleArray boardTvec_j
+) {
+    cv::Vec3d boardRvec, boardTvec;
+    fromjDoubleArrayToVec3d(env, boardRvec_j, boardRvec);
+    fromjDoubleArrayToVec3d(env, boardTvec_j, boardTvec);
+    return castToBoardRegistryPtr(boardRegistryAddr)->registerCharucoBoard(
+            markerDictionary, squaresX, squaresY,
+            static_cast<float>(squareLength), static_cast<float>(markerLength),
+            firstMarkerId, boardRvec, boardTvec);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newKeyframeDatabase(
+        JNIEnv *env,
+        jclass clazz,
+        jdouble minTranslation,
+        jdouble minRotation,
+        jint maxKeyframes
+) {
+    return (jlong) new KeyframeDatabase(minTranslation, minRotation,
+                                        static_cast<size_t>(maxKeyframes));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseKeyframeDatabase(
+        JNIEnv *env,
+        jclass clazz,
+        jlong keyframeDatabaseAddr
+) {
+    delete castToKeyframeDatabasePtr(keyframeDatabaseAddr);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_insertKeyframe(
+        JNIEnv *env,
+        jclass clazz,
+        jlong keyframeDatabaseAddr,
+        jlong frameContextAddr,
+        jdouble markerLength,
+        jlong markerSizeRegistryAddr, // 0 if all the markers have the same length
+        jdoubleArray cameraRvec_j,
+        jdoubleArray cameraTvec_j,
+        jlong timestamp
+) {
+    // the observation is the one left in the context by detectMarkers in this frame
+    const FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    cv::Vec3d cameraRvec, cameraTvec;
+    fromjDoubleArrayToVec3d(env, cameraRvec_j, cameraRvec);
+    fromjDoubleArrayToVec3d(env, cameraTvec_j, cameraTvec);
+    return castToKeyframeDatabasePtr(keyframeDatabaseAddr)->insert(
+            cameraRvec, cameraTvec, timestamp,
+            context.detectedIDs, context.detectedCorners,
+            context.detectedRvecs, context.detectedTvecs,
+            markerLength, acquireMarkerSizes(markerSizeRegistryAddr).get()
+    );
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_relocalize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong keyframeDatabaseAddr,
+        jlong frameContextAddr,
+        jlong cameraMatrixAddr,
+        jlong distCoeffsAddr,
+        jdouble maxReprojectionError,
+        jdoubleArray outRvec,
+        jdoubleArray outTvec
+) {
+    FrameContext *context = castToFrameContextPtr(frameContextAddr);
+    cv::Mat cameraMatrix = *castToMatPtr(cameraMatrixAddr);
+    cv::Mat distCoeffs = *castToMatPtr(distCoeffsAddr);
+    cv::Vec3d cameraRvec, cameraTvec;
+    int markersUsed = castToKeyframeDatabasePtr(keyframeDatabaseAddr)->relocalize(
+            context->detectedIDs, context->detectedCorners,
+            cameraMatrix, distCoeffs,
+            maxReprojectionError,
+            &context->arena,
+            cameraRvec, cameraTvec
+    );
+    if (markersUsed > 0) {
+        fromVec3dToJdoubleArray(env, cameraRvec, outRvec);
+        fromVec3dToJdoubleArray(env, cameraTvec, outTvec);
+    }
+    return markersUsed;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_keyframeDatabaseSize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong keyframeDatabaseAddr
+) {
+    return (jint) castToKeyframeDatabasePtr(keyframeDatabaseAddr)->size();
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newQualityController(
+        JNIEnv *env,
+        jclass clazz,
+        jdouble frameBudgetMs,
+        jint maxRansacIterations
+) {
+    return (jlong) new AdaptiveQualityController(frameBudgetMs, maxRansacIterations);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseQualityController(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr
+) {
+    delete castToQualityControllerPtr(qualityControllerAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_qualityControllerMaxRansacIterations(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr
+) {
+    return castToQualityControllerPtr(qualityControllerAddr)->settings().maxRansacIterations;
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_qualityControllerShouldRefreshMap(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr
+) {
+    return (jboolean) castToQualityControllerPtr(qualityControllerAddr)->shouldRefreshMap();
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_qualityControllerRestoreMap(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr,
+        jlong resultMatAddr,
+        jint mapTopLeftCornerX,
+        jint mapTopLeftCornerY,
+        jint mapPixelsX,
+        jint mapPixelsY
+) {
+    return (jboolean) castToQualityControllerPtr(qualityControllerAddr)->restoreMapBox(
+            *castToMatPtr(resultMatAddr),
+            cv::Rect(mapTopLeftCornerX, mapTopLeftCornerY, mapPixelsX, mapPixelsY));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_qualityControllerReportFrame(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr,
+        jdouble detectMs,
+        jdouble estimateMs,
+        jdouble renderMs
+) {
+    castToQualityControllerPtr(qualityControllerAddr)->reportFrame(detectMs, estimateMs,
+                                                                   renderMs);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_qualityControllerTelemetry(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr,
+        jdoubleArray outTelemetry
+) {
+    double telemetry[QUALITY_TELEMETRY_SIZE];
+    castToQualityControllerPtr(qualityControllerAddr)->telemetry(telemetry);
+    env->SetDoubleArrayRegion(outTelemetry, 0, QUALITY_TELEMETRY_SIZE, telemetry);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newDetectorSession(
+        JNIEnv *env,
+        jclass clazz,
+        jlong qualityControllerAddr
+) {
+    return (jlong) new DetectorSession(castToQualityControllerPtr(qualityControllerAddr));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseDetectorSession(
+        JNIEnv *env,
+        jclass clazz,
+        jlong detectorSessionAddr
+) {
+    delete castToDetectorSessionPtr(detectorSessionAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_detectorSessionStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong detectorSessionAddr,
+        jlongArray outStats
+) {
+    jlong stats[DETECTOR_SESSION_STATS_SIZE];
+    castToDetectorSessionPtr(detectorSessionAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, DETECTOR_SESSION_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newPoseStream(
+        JNIEnv *env,
+        jclass clazz,
+        jstring logPath_j // null for no log
+) {
+    std::string logPath;
+    if (logPath_j != nullptr) {
+        const char *path = env->GetStringUTFChars(logPath_j, nullptr);
+        logPath = path;
+        env->ReleaseStringUTFChars(logPath_j, path);
+    }
+    return (jlong) new PoseStream(logPath);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releasePoseStream(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr
+) {
+    delete castToPoseStreamPtr(poseStreamAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseStreamRegisterProducer(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr
+) {
+    return castToPoseStreamPtr(poseStreamAddr)->registerProducer();
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseStreamPublish(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr,
+        jint producer,
+        jlong frameContextAddr, // in (detected markers and pose quality of the frame)
+        jlong frameNumber,
+        jlong frameTimestampMs,
+        jdoubleArray rvec_j,
+        jdoubleArray tvec_j,
+        jint status,
+        jint inliers
+) {
+    const FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    PoseRecord record{};
+    record.frameNumber = (uint64_t) frameNumber;
+    record.frameTimeUs = (int64_t) frameTimestampMs * 1000;
+    env->GetDoubleArrayRegion(rvec_j, 0, 3, record.rvec);
+    env->GetDoubleArrayRegion(tvec_j, 0, 3, record.tvec);
+    record.quality = (float) context.poseQuality;
+    record.inliers = inliers;
+    record.foundMarkers = (uint16_t) std::min<size_t>(context.detectedIDs.size(), UINT16_MAX);
+    record.status = (int8_t) status;
+    return (jboolean) castToPoseStreamPtr(poseStreamAddr)->publish(producer, record);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseStreamSubscribe(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr,
+        jint capacity
+) {
+    return (jlong) castToPoseStreamPtr(poseStreamAddr)->subscribe(capacity);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseStreamUnsubscribe(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr,
+        jlong subscriptionAddr
+) {
+    castToPoseStreamPtr(poseStreamAddr)->unsubscribe(
+            castToPoseSubscriptionPtr(subscriptionAddr));
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseSubscriptionPoll(
+        JNIEnv *env,
+        jclass clazz,
+        jlong subscriptionAddr,
+        jobject outBuffer, // direct ByteBuffer, filled with PoseRecords
+        jlong timeoutUs
+) {
+    auto *records = (PoseRecord *) env->GetDirectBufferAddress(outBuffer);
+    jlong capacity = env->GetDirectBufferCapacity(outBuffer);
+    if (records == nullptr || capacity < (jlong) sizeof(PoseRecord)) {
+        return 0;
+    }
+    return castToPoseSubscriptionPtr(subscriptionAddr)->poll(
+            records, (int) (capacity / sizeof(PoseRecord)), timeoutUs);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseStreamStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong poseStreamAddr,
+        jlongArray outStats
+) {
+    const PoseStream &stream = *castToPoseStreamPtr(poseStreamAddr);
+    jlong stats[3] = {
+            (jlong) stream.publishedRecords(),
+            (jlong) stream.dropped(),
+            (jlong) stream.loggedRecords()
+    };
+    env->SetLongArrayRegion(outStats, 0, 3, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newSessionRecorder(
+        JNIEnv *env,
+        jclass clazz,
+        jstring path_j,
+        jboolean grayOnly,
+        jint poolSize,
+        jlong cameraMatrixAddr,
+        jlong distCoeffsAddr,
+        jint markerDictionary,
+        jdouble markerLength
+) {
+    const char *path = env->GetStringUTFChars(path_j, nullptr);
+    auto *recorder = new SessionRecorder(path, grayOnly, poolSize,
+                                         *castToMatPtr(cameraMatrixAddr),
+                                         *castToMatPtr(distCoeffsAddr),
+                                         markerDictionary, markerLength);
+    env->ReleaseStringUTFChars(path_j, path);
+    return (jlong) recorder;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseSessionRecorder(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sessionRecorderAddr
+) {
+    delete castToSessionRecorderPtr(sessionRecorderAddr);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_sessionRecorderSubmit(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sessionRecorderAddr,
+        jlong frameContextAddr, // in (luma plane computed by detectMarkers)
+        jlong detectorSessionAddr, // in (0 if the settings did not change)
+        jlong inputMatAddr,
+        jlong frameNumber,
+        jlong frameTimestampMs
+) {
+    const FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    return (jboolean) castToSessionRecorderPtr(sessionRecorderAddr)->submit(
+            (uint64_t) frameNumber, (int64_t) frameTimestampMs * 1000,
+            *castToMatPtr(inputMatAddr), context.arena.imageBuffer(FRAME_ARENA_GRAY_BUFFER),
+            castToDetectorSessionPtr(detectorSessionAddr));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_sessionRecorderFinish(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sessionRecorderAddr
+) {
+    castToSessionRecorderPtr(sessionRecorderAddr)->finish();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_sessionRecorderStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sessionRecorderAddr,
+        jlongArray outStats
+) {
+    jlong stats[SESSION_RECORDER_STATS_SIZE];
+    castToSessionRecorderPtr(sessionRecorderAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, SESSION_RECORDER_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_refinePromotedMarkers(
+        JNIEnv *env,
+        jclass clazz,
+        jlong cameraMatrixAddr, // in
+        jlong distCoeffsAddr, // in
+        jdouble markerLength, // in
+        jlong markerMapSnapshotAddr, // in
+        jlong markerSizeRegistryAddr, // in (0 if all the markers have the same length)
+        jlong frameContextAddr, // in&out
+        jint maxMarkers, // in
+        jdoubleArray outrvecs, // out
+        jdoubleArray outtvecs, // out
+        jdoubleArray outQualities // out
+) {
+    FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    int refinedCount = refinePromotedMarkers(*castToMatPtr(cameraMatrixAddr),
+                                             *castToMatPtr(distCoeffsAddr),
+                                             markerLength,
+                                             *castToMarkerMapSnapshotPtr(markerMapSnapshotAddr),
+                                             context,
+                                             acquireMarkerSizes(markerSizeRegistryAddr).get());
+    if (refinedCount > 0) {
+        int count = std::min<int>(context.detectedIDs.size(), maxMarkers);
+        for (int i = 0; i < count; i++) {
+            env->SetDoubleArrayRegion(outrvecs, i * 3, 3, context.detectedRvecs[i].val);
+            env->SetDoubleArrayRegion(outtvecs, i * 3, 3, context.detectedTvecs[i].val);
+            env->SetDoubleArrayRegion(outQualities, i, 1, &context.detectedQualities[i]);
+        }
+    }
+    return refinedCount;
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newPoseMeanAccumulator(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new PoseMeanAccumulator();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releasePoseMeanAccumulator(
+        JNIEnv *env,
+        jclass clazz,
+        jlong accumulatorAddr
+) {
+    delete castToPoseMeanAccumulatorPtr(accumulatorAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseMeanAccumulatorAdd(
+        JNIEnv *env,
+        jclass clazz,
+        jlong accumulatorAddr,
+        jdoubleArray rvec_j,
+        jdoubleArray tvec_j
+) {
+    cv::Vec3d rvec, tvec;
+    fromjDoubleArrayToVec3d(env, rvec_j, rvec);
+    fromjDoubleArrayToVec3d(env, tvec_j, tvec);
+    castToPoseMeanAccumulatorPtr(accumulatorAddr)->add(rvec, tvec);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_poseMeanAccumulatorTakeMean(
+        JNIEnv *env,
+        jclass clazz,
+        jlong accumulatorAddr,
+        jdoubleArray outRvec_j,
+        jdoubleArray outTvec_j
+) {
+    PoseMeanAccumulator &accumulator = *castToPoseMeanAccumulatorPtr(accumulatorAddr);
+    int count = accumulator.size();
+    if (count > 0) {
+        cv::Vec3d rvec, tvec;
+        accumulator.mean(rvec, tvec);
+        fromVec3dToJdoubleArray(env, rvec, outRvec_j);
+        fromVec3dToJdoubleArray(env, tvec, outTvec_j);
+        accumulator.reset();
+    }
+    return count;
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_detectorSessionAddDictionary(
+        JNIEnv *env,
+        jclass clazz,
+        jlong detectorSessionAddr,
+        jint markerDictionary
+) {
+    return (jboolean) castToDetectorSessionPtr(detectorSessionAddr)->addDictionary(
+            markerDictionary);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newSharpnessGate(
+        JNIEnv *env,
+        jclass clazz,
+        jdouble ratio
+) {
+    return (jlong) new SharpnessGate(ratio);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseSharpnessGate(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sharpnessGateAddr
+) {
+    delete castToSharpnessGatePtr(sharpnessGateAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_sharpnessGateStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong sharpnessGateAddr,
+        jdoubleArray outStats
+) {
+    double stats[SHARPNESS_GATE_STATS_SIZE];
+    castToSharpnessGatePtr(sharpnessGateAddr)->stats(stats);
+    env->SetDoubleArrayRegion(outStats, 0, SHARPNESS_GATE_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newMarkerCandidatePool(
+        JNIEnv *env,
+        jclass clazz,
+        jint capacity
+) {
+    return (jlong) new MarkerCandidatePool(capacity);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseMarkerCandidatePool(
+        JNIEnv *env,
+        jclass clazz,
+        jlong candidatePoolAddr
+) {
+    delete castToMarkerCandidatePoolPtr(candidatePoolAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_candidatePoolObserve(
+        JNIEnv *env,
+        jclass clazz,
+        jlong candidatePoolAddr,
+        jlong frameContextAddr, // in (markers detected in the frame)
+        jlong markerMapSnapshotAddr, // in (known markers, which are not candidates)
+        jdoubleArray cameraRvec_j, // in (estimated phone pose)
+        jdoubleArray cameraTvec_j, // in (estimated phone pose)
+        jlong frameNumber,
+        jintArray outIds, // out (promoted markers)
+        jdoubleArray outRvecs, // out
+        jdoubleArray outTvecs // out
+) {
+    MarkerCandidatePool &pool = *castToMarkerCandidatePoolPtr(candidatePoolAddr);
+    const FrameContext &context = *castToFrameContextPtr(frameContextAddr);
+    const MarkerMapSnapshot &knownMarkers = *castToMarkerMapSnapshotPtr(markerMapSnapshotAddr);
+    cv::Vec3d cameraRvec, cameraTvec;
+    fromjDoubleArrayToVec3d(env, cameraRvec_j, cameraRvec);
+    fromjDoubleArrayToVec3d(env, cameraTvec_j, cameraTvec);
+    // position of the camera in the room (the phone pose goes from room to camera)
+    cv::Vec3d viewpoint = positionInRoom(cameraRvec, cameraTvec);
+
+    jint capacity = env->GetArrayLength(outIds);
+    jint promotedCount = 0;
+    for (size_t i = 0; i < context.detectedIDs.size() && promotedCount < capacity; i++) {
+        int markerId = context.detectedIDs[i];
+        if (knownMarkers.indexOf(markerId) >= 0) {
+            continue;
+        }
+        cv::Vec3d markerRvec, markerTvec;
+        newMarkerPoseInRoom(cameraRvec, cameraTvec, context.detectedRvecs[i],
+                            context.detectedTvecs[i], markerRvec, markerTvec);
+
+        cv::Vec3d promotedRvec, promotedTvec;
+        if (pool.observe(markerId, markerRvec, markerTvec, viewpoint, (uint64_t) frameNumber,
+                         promotedRvec, promotedTvec)) {
+            env->SetIntArrayRegion(outIds, promotedCount, 1, &markerId);
+            env->SetDoubleArrayRegion(outRvecs, promotedCount * 3, 3, promotedRvec.val);
+            env->SetDoubleArrayRegion(outTvecs, promotedCount * 3, 3, promotedTvec.val);
+            promotedCount++;
+        }
+    }
+    return promotedCount;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_candidatePoolStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong candidatePoolAddr,
+        jlongArray outStats
+) {
+    jlong stats[CANDIDATE_POOL_STATS_SIZE];
+    castToMarkerCandidatePoolPtr(candidatePoolAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, CANDIDATE_POOL_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newCornerTracker(
+        JNIEnv *env,
+        jclass clazz,
+        jint detectionInterval
+) {
+    return (jlong) new CornerTracker(detectionInterval);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseCornerTracker(
+        JNIEnv *env,
+        jclass clazz,
+        jlong cornerTrackerAddr
+) {
+    delete castToCornerTrackerPtr(cornerTrackerAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_cornerTrackerStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong cornerTrackerAddr,
+        jlongArray outStats
+) {
+    jlong stats[CORNER_TRACKER_STATS_SIZE];
+    castToCornerTrackerPtr(cornerTrackerAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, CORNER_TRACKER_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newSubmapManager(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jstring pageDirectory_j // null to keep the pages in memory
+) {
+    std::string pageDirectory;
+    if (pageDirectory_j != nullptr) {
+        const char *path = env->GetStringUTFChars(pageDirectory_j, nullptr);
+        pageDirectory = path;
+        env->ReleaseStringUTFChars(pageDirectory_j, path);
+    }
+    return (jlong) new SubmapManager(*castToMarkerMapPtr(markerMapAddr), pageDirectory);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseSubmapManager(
+        JNIEnv *env,
+        jclass clazz,
+        jlong submapManagerAddr
+) {
+    delete castToSubmapManagerPtr(submapManagerAddr);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_submapManagerDefineSubmap(
+        JNIEnv *env,
+        jclass clazz,
+        jlong submapManagerAddr,
+        jint submapId,
+        jint minMarkerId,
+        jint maxMarkerId,
+        jdoubleArray anchorRvec_j,
+        jdoubleArray anchorTvec_j
+) {
+    cv::Vec3d anchorRvec, anchorTvec;
+    fromjDoubleArrayToVec3d(env, anchorRvec_j, anchorRvec);
+    fromjDoubleArrayToVec3d(env, anchorTvec_j, anchorTvec);
+    return castToSubmapManagerPtr(submapManagerAddr)->defineSubmap(
+            submapId, minMarkerId, maxMarkerId, anchorRvec, anchorTvec);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_submapManagerConnect(
+        JNIEnv *env,
+        jclass clazz,
+        jlong submapManagerAddr,
+        jint submapIdA,
+        jint submapIdB
+) {
+    return castToSubmapManagerPtr(submapManagerAddr)->connect(submapIdA, submapIdB);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_submapManagerUpdatePosition(
+        JNIEnv *env,
+        jclass clazz,
+        jlong submapManagerAddr,
+        jdoubleArray position_j
+) {
+    cv::Vec3d position;
+    fromjDoubleArrayToVec3d(env, position_j, position);
+    castToSubmapManagerPtr(submapManagerAddr)->updatePosition(position);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_submapManagerStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong submapManagerAddr,
+        jlongArray outStats
+) {
+    jlong stats[SUBMAP_MANAGER_STATS_SIZE];
+    castToSubmapManagerPtr(submapManagerAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, SUBMAP_MANAGER_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newStreamScheduler(
+        JNIEnv *env,
+        jclass clazz,
+        jlong markerMapAddr,
+        jint threads, // 0 for one per core
+        jlong markerSizeRegistryAddr // 0 if all the markers of a stream have the same length
+) {
+    return (jlong) new StreamScheduler(*castToMarkerMapPtr(markerMapAddr), threads,
+                                       castToMarkerSizeRegistryPtr(markerSizeRegistryAddr));
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseStreamScheduler(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr
+) {
+    delete castToStreamSchedulerPtr(streamSchedulerAddr);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_streamSchedulerOpenStream(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr,
+        jint markerDictionary,
+        jdouble markerLength,
+        jlong cameraMatrixAddr,
+        jlong distCoeffsAddr,
+        jint workerBudget,
+        jdouble weight,
+        jboolean addNewMarkers,
+        jdouble minInliersRatio,
+        jdouble maxSpeed,
+        jdouble maxAngularSpeed
+) {
+    StreamConfig config;
+    config.markerDictionary = markerDictionary;
+    config.markerLength = markerLength;
+    // the calibration is copied: the stream does not depend on the Java matrices
+    castToMatPtr(cameraMatrixAddr)->copyTo(config.cameraMatrix);
+    castToMatPtr(distCoeffsAddr)->copyTo(config.distCoeffs);
+    config.workerBudget = workerBudget;
+    config.weight = weight;
+    config.addNewMarkers = addNewMarkers;
+    config.minInliersRatio = minInliersRatio;
+    config.maxSpeed = maxSpeed;
+    config.maxAngularSpeed = maxAngularSpeed;
+    return castToStreamSchedulerPtr(streamSchedulerAddr)->openStream(config);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_streamSchedulerCloseStream(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr,
+        jint streamId
+) {
+    castToStreamSchedulerPtr(streamSchedulerAddr)->closeStream(streamId);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_streamSchedulerSubmit(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr,
+        jint streamId,
+        jlong frameMatAddr,
+        jlong frameNumber,
+        jlong timestampUs
+) {
+    return castToStreamSchedulerPtr(streamSchedulerAddr)->submit(
+            streamId, *castToMatPtr(frameMatAddr), (uint64_t) frameNumber, timestampUs);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_streamSchedulerLastPoses(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr,
+        jint streamId,
+        jlongArray outFrameNumbers, // out
+        jdoubleArray outRvecs, // out
+        jdoubleArray outTvecs // out
+) {
+    int capacity = env->GetArrayLength(outFrameNumbers);
+    std::vector<StreamPose> poses(capacity);
+    int count = castToStreamSchedulerPtr(streamSchedulerAddr)->lastPoses(
+            streamId, capacity, poses.data());
+    for (int i = 0; i < count; i++) {
+        auto frameNumber = (jlong) poses[i].frameNumber;
+        env->SetLongArrayRegion(outFrameNumbers, i, 1, &frameNumber);
+        env->SetDoubleArrayRegion(outRvecs, i * 3, 3, poses[i].rvec.val);
+        env->SetDoubleArrayRegion(outTvecs, i * 3, 3, poses[i].tvec.val);
+    }
+    return count;
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_parsleyj_arucoslam_NativeMethods_streamSchedulerStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong streamSchedulerAddr,
+        jint streamId,
+        jlongArray outStats
+) {
+    jlong stats[STREAM_STATS_SIZE];
+    if (!castToStreamSchedulerPtr(streamSchedulerAddr)->stats(streamId, stats)) {
+        return false;
+    }
+    env->SetLongArrayRegion(outStats, 0, STREAM_STATS_SIZE, stats);
+    return true;
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newCompactTrack(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new CompactTrack();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseCompactTrack(
+        JNIEnv *env,
+        jclass clazz,
+        jlong trackAddr
+) {
+    delete castToCompactTrackPtr(trackAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_compactTrackAppend(
+        JNIEnv *env,
+        jclass clazz,
+        jlong trackAddr,
+        jdoubleArray rvec_j,
+        jdoubleArray tvec_j,
+        jlong timestamp
+) {
+    cv::Vec3d rvec, tvec;
+    fromjDoubleArrayToVec3d(env, rvec_j, rvec);
+    fromjDoubleArrayToVec3d(env, tvec_j, tvec);
+    castToCompactTrackPtr(trackAddr)->append(rvec, tvec, timestamp);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_compactTrackSize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong trackAddr
+) {
+    return castToCompactTrackPtr(trackAddr)->size();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_compactTrackRead(
+        JNIEnv *env,
+        jclass clazz,
+        jlong trackAddr,
+        jint first,
+        jdoubleArray outRvecs_j, // out
+        jdoubleArray outTvecs_j, // out
+        jlongArray outTimestamps_j // out
+) {
+    int capacity = env->GetArrayLength(outTimestamps_j);
+    std::vector<cv::Vec3d> rvecs(capacity), tvecs(capacity);
+    std::vector<int64_t> timestamps(capacity);
+    int count = castToCompactTrackPtr(trackAddr)->decode(first, capacity, rvecs.data(),
+                                                         tvecs.data(), timestamps.data());
+    env->SetDoubleArrayRegion(outRvecs_j, 0, count * 3, (const jdouble *) rvecs.data());
+    env->SetDoubleArrayRegion(outTvecs_j, 0, count * 3, (const jdouble *) tvecs.data());
+    env->SetLongArrayRegion(outTimestamps_j, 0, count, (const jlong *) timestamps.data());
+    return count;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_compactTrackStats(
+        JNIEnv *env,
+        jclass clazz,
+        jlong trackAddr,
+        jlongArray outStats
+) {
+    jlong stats[COMPACT_TRACK_STATS_SIZE];
+    castToCompactTrackPtr(trackAddr)->stats(stats);
+    env->SetLongArrayRegion(outStats, 0, COMPACT_TRACK_STATS_SIZE, stats);
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_parsleyj_arucoslam_NativeMethods_newMarkerSizeRegistry(
+        JNIEnv *env,
+        jclass clazz
+) {
+    return (jlong) new MarkerSizeRegistry();
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_releaseMarkerSizeRegistry(
+        JNIEnv *env,
+        jclass clazz,
+        jlong registryAddr
+) {
+    delete castToMarkerSizeRegistryPtr(registryAddr);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerSizeRegistrySetLength(
+        JNIEnv *env,
+        jclass clazz,
+        jlong registryAddr,
+        jint markerId,
+        jdouble length // <= 0 to restore the common length
+) {
+    castToMarkerSizeRegistryPtr(registryAddr)->setLength(markerId, length);
+}
+
+extern "C"
+JNIEXPORT jdouble JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerSizeRegistryLengthOf(
+        JNIEnv *env,
+        jclass clazz,
+        jlong registryAddr,
+        jint markerId,
+        jdouble commonLength
+) {
+    return castToMarkerSizeRegistryPtr(registryAddr)->acquire()->lengthOf(markerId, commonLength);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_parsleyj_arucoslam_NativeMethods_markerSizeRegistrySize(
+        JNIEnv *env,
+        jclass clazz,
+        jlong registryAddr
+) {
+    return castToMarkerSizeRegistryPtr(registryAddr)->acquire()->size();
+}
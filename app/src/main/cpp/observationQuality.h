@@ -0,0 +1,88 @@
+//
+// Quality score of a single marker observation, used to weight the pose indicators.
+//
+
+#ifndef ARUCOSLAM_OBSERVATIONQUALITY_H
+#define ARUCOSLAM_OBSERVATIONQUALITY_H
+
+#include <vector>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+/**
+ * Reprojection error (in pixels) at which the quality of an observation is halved (about).
+ */
+constexpr double QUALITY_REPROJECTION_ERROR_SCALE = 2.0;
+
+/**
+ * Apparent area (in squared pixels) at which the area factor of the quality is 0.5.
+ */
+constexpr double QUALITY_HALF_AREA = 1500.0;
+
+/**
+ * Distance (in meters) at which the distance factor of the quality is 0.5.
+ */
+constexpr double QUALITY_HALF_DISTANCE = 2.0;
+
+/**
+ * Quality of the least reliable observations; it is never 0, so that a set of observations
+ * always has a positive total weight.
+ */
+constexpr double QUALITY_MIN = 1e-3;
+
+/**
+ * Computes a quality score in (0, 1] of the pose of a detected marker, as the product of four
+ * factors:
+ *  - the reprojection error of the 4 corners with the estimated pose (a gaussian kernel),
+ *  - the apparent area of the marker in the image (small markers have noisy corners),
+ *  - the viewing angle, i.e. the cosine of the angle between the marker normal and the ray from
+ *    the camera to the marker (grazing views give unstable orientations),
+ *  - the distance of the marker from the camera.
+ */
+double observationQuality(const std::vector<cv::Point2f> &corners,
+                          const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                          double markerLength,
+                          cv::InputArray cameraMatrix, cv::InputArray distCoeffs) {
+    float halfLength = static_cast<float>(markerLength / 2.0);
+    // same order of the corners used by estimatePoseSingleMarkers
+    cv::Point3f objectPoints[4] = {
+            cv::Point3f(-halfLength, halfLength, 0),
+            cv::Point3f(halfLength, halfLength, 0),
+            cv::Point3f(halfLength, -halfLength, 0),
+            cv::Point3f(-halfLength, -halfLength, 0),
+    };
+    cv::Point2f projectedPoints[4];
+    cv::Mat projectedPointsMat(4, 1, CV_32FC2, projectedPoints);
+    cv::projectPoints(cv::Mat(4, 1, CV_32FC3, objectPoints), rvec, tvec,
+                      cameraMatrix, distCoeffs, projectedPointsMat);
+    double squaredErrorSum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        cv::Point2f difference = projectedPoints[i] - corners[i];
+        squaredErrorSum += difference.dot(difference);
+    }
+    double reprojectionError = std::sqrt(squaredErrorSum / 4.0);
+    double errorFactor = std::exp(-(reprojectionError * reprojectionError) /
+                                  (QUALITY_REPROJECTION_ERROR_SCALE *
+                                   QUALITY_REPROJECTION_ERROR_SCALE));
+
+    double area = std::abs(cv::contourArea(corners));
+    double areaFactor = area / (area + QUALITY_HALF_AREA);
+
+    cv::Matx33d rotation;
+    cv::Rodrigues(rvec, rotation);
+    cv::Vec3d normal(rotation(0, 2), rotation(1, 2), rotation(2, 2));
+    double distance = cv::norm(tvec);
+    double viewingFactor = distance > 0 ? std::abs(normal.dot(tvec)) / distance : 0.0;
+
+    double distanceRatio = distance / QUALITY_HALF_DISTANCE;
+    double distanceFactor = 1.0 / (1.0 + distanceRatio * distanceRatio);
+
+    double quality = errorFactor * areaFactor * viewingFactor * distanceFactor;
+    // (the negated comparison also catches NaNs)
+    return !(quality >= QUALITY_MIN) ? QUALITY_MIN : quality;
+}
+
+#endif //ARUCOSLAM_OBSERVATIONQUALITY_H
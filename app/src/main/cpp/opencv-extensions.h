@@ -28,7 +28,8 @@ static void _getSingleMarkerObjectPoints(float markerLength, cv::OutputArray _ob
  * the original one accepted only ONE marker length, and all the markers in the space were expected
  * to be of the same size; here, each marker can have its own size in the space.
  *
- * NOTE: After the SLAM readaptation, this is now unused.
+ * NOTE: After the SLAM readaptation, this is now unused: the frame pipeline solves the poses of
+ * the markers (each with its own size, see markerSizes.h) with estimateSquarePoses().
  */
 void estimatePoseSingleMarkers(cv::InputArrayOfArrays _corners, const std::vector<double>& markerLengths,
                                cv::InputArray _cameraMatrix, cv::InputArray _distCoeffs,
@@ -0,0 +1,218 @@
+//
+// Deferred overlay drawing: commands are recorded during the frame and rasterized once.
+//
+
+#ifndef ARUCOSLAM_OVERLAYCOMMANDS_H
+#define ARUCOSLAM_OVERLAYCOMMANDS_H
+
+#include <jni.h>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+enum OverlayCommandType : uint8_t {
+    OVERLAY_LINE,
+    OVERLAY_RECTANGLE,
+    OVERLAY_TEXT,
+    OVERLAY_MARKER,
+};
+
+/**
+ * A single recorded drawing primitive (32 bytes). Texts are not stored in the command itself, but
+ * in the text pool of the buffer, referenced by offset and length.
+ */
+struct OverlayCommand {
+    OverlayCommandType type;
+    uint8_t thickness;
+    uint8_t style; // line type for lines/rectangles, font face for texts, marker type for markers
+    uint8_t color[4]; // RGBA
+    uint8_t padding;
+    float x0, y0;
+    float x1, y1; // second point, unused by texts and markers
+    float size; // font scale for texts, marker size for markers
+    uint16_t textOffset;
+    uint16_t textLength;
+};
+
+/**
+ * An OverlayCommandBuffer records the overlays of a frame (marker contours, axes, texts...)
+ * instead of drawing them immediately, so that the frame is not converted back and forth between
+ * RGBA and RGB by each drawing step. All the commands are rasterized at the end of the frame by
+ * rasterize(), directly on the RGBA output image, in the same order they were recorded.
+ * Recording is thread-safe, so it can be done inside a p_for.
+ * The buffer is recycled by the worker: its storage is never released between frames.
+ */
+class OverlayCommandBuffer {
+public:
+    void line(const cv::Point2f &p0, const cv::Point2f &p1, const cv::Scalar &color,
+              int thickness = 1, int lineType = cv::LINE_8) {
+        std::unique_lock<std::mutex> lock(mutex);
+        pushCommand(OVERLAY_LINE, p0, p1, color, thickness, lineType, 0.0f);
+    }
+
+    void rectangle(const cv::Point2f &p0, const cv::Point2f &p1, const cv::Scalar &color,
+                   int thickness = 1, int lineType = cv::LINE_8) {
+        std::unique_lock<std::mutex> lock(mutex);
+        pushCommand(OVERLAY_RECTANGLE, p0, p1, color, thickness, lineType, 0.0f);
+    }
+
+    void marker(const cv::Point2f &position, const cv::Scalar &color, int markerType,
+                int markerSize) {
+        std::unique_lock<std::mutex> lock(mutex);
+        pushCommand(OVERLAY_MARKER, position, position, color, 1, markerType,
+                    static_cast<float>(markerSize));
+    }
+
+    void text(const char *str, const cv::Point2f &origin, int fontFace, double fontScale,
+              const cv::Scalar &color, int thickness = 1) {
+        size_t length = strlen(str);
+        std::unique_lock<std::mutex> lock(mutex);
+        if (textPool.size() + length > UINT16_MAX) {
+            return; // no more room for texts in this frame
+        }
+        OverlayCommand &command = pushCommand(OVERLAY_TEXT, origin, origin, color, thickness,
+                                              fontFace, static_cast<float>(fontScale));
+        command.textOffset = static_cast<uint16_t>(textPool.size());
+        command.textLength = static_cast<uint16_t>(length);
+        textPool.insert(textPool.end(), str, str + length);
+    }
+
+    /**
+     * Records the same primitives drawn by cv::aruco::drawDetectedMarkers with the default colors.
+     */
+    void detectedMarkers(const std::vector<std::vector<cv::Point2f>> &corners,
+                         const std::vector<int> &ids) {
+        cv::Scalar borderColor(0, 255, 0);
+        cv::Scalar cornerColor(0, 0, 255);
+        cv::Scalar textColor(255, 0, 0);
+        char idText[16];
+        for (size_t i = 0; i < corners.size(); i++) {
+            const std::vector<cv::Point2f> &marker = corners[i];
+            for (int j = 0; j < 4; j++) {
+                line(marker[j], marker[(j + 1) % 4], borderColor, 1);
+            }
+            rectangle(marker[0] - cv::Point2f(3, 3), marker[0] + cv::Point2f(3, 3),
+                      cornerColor, 1, cv::LINE_AA);
+            if (i < ids.size()) {
+                cv::Point2f centre = (marker[0] + marker[1] + marker[2] + marker[3]) / 4.0;
+                snprintf(idText, sizeof(idText), "id=%d", ids[i]);
+                text(idText, centre, cv::FONT_HERSHEY_SIMPLEX, 0.5, textColor, 2);
+            }
+        }
+    }
+
+    /**
+     * Records the same primitives drawn by cv::aruco::drawAxis.
+     */
+    void axis(cv::InputArray cameraMatrix, cv::InputArray distCoeffs,
+              const cv::Vec3d &rvec, const cv::Vec3d &tvec, float length) {
+        cv::Point3f axisPoints[4] = {
+                cv::Point3f(0, 0, 0),
+                cv::Point3f(length, 0, 0),
+                cv::Point3f(0, length, 0),
+                cv::Point3f(0, 0, length),
+        };
+        cv::Point2f imagePoints[4];
+        cv::Mat imagePointsMat(4, 1, CV_32FC2, imagePoints);
+        cv::projectPoints(cv::Mat(4, 1, CV_32FC3, axisPoints), rvec, tvec,
+                          cameraMatrix, distCoeffs, imagePointsMat);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        pushCommand(OVERLAY_LINE, imagePoints[0], imagePoints[1], cv::Scalar(0, 0, 255), 3,
+                    cv::LINE_8, 0.0f);
+        pushCommand(OVERLAY_LINE, imagePoints[0], imagePoints[2], cv::Scalar(0, 255, 0), 3,
+                    cv::LINE_8, 0.0f);
+        pushCommand(OVERLAY_LINE, imagePoints[0], imagePoints[3], cv::Scalar(255, 0, 0), 3,
+                    cv::LINE_8, 0.0f);
+    }
+
+    /**
+     * Draws all the recorded commands on the RGBA image and empties the buffer.
+     */
+    void rasterize(cv::Mat &rgbaImage) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (const OverlayCommand &command : commands) {
+            cv::Scalar color(command.color[0], command.color[1], command.color[2],
+                             command.color[3]);
+            cv::Point2f p0(command.x0, command.y0);
+            cv::Point2f p1(command.x1, command.y1);
+            switch (command.type) {
+                case OVERLAY_LINE:
+                    cv::line(rgbaImage, p0, p1, color, command.thickness, command.style);
+                    break;
+                case OVERLAY_RECTANGLE:
+                    cv::rectangle(rgbaImage, p0, p1, color, command.thickness, command.style);
+                    break;
+                case OVERLAY_MARKER:
+                    cv::drawMarker(rgbaImage, p0, color, command.style,
+                                   static_cast<int>(command.size));
+                    break;
+                case OVERLAY_TEXT:
+                    cv::putText(rgbaImage,
+                                cv::String(textPool.data() + command.textOffset,
+                                           command.textLength),
+                                p0, command.style, command.size, color, command.thickness);
+                    break;
+            }
+        }
+        commands.clear();
+        textPool.clear();
+    }
+
+    /**
+     * Drops the recorded commands without drawing them (e.g. those left by an interrupted frame).
+     */
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex);
+        commands.clear();
+        textPool.clear();
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return commands.size();
+    }
+
+private:
+    OverlayCommand &pushCommand(OverlayCommandType type,
+                                const cv::Point2f &p0, const cv::Point2f &p1,
+                                const cv::Scalar &color, int thickness, int style, float size) {
+        commands.emplace_back();
+        OverlayCommand &command = commands.back();
+        command.type = type;
+        command.thickness = static_cast<uint8_t>(thickness);
+        command.style = static_cast<uint8_t>(style);
+        for (int c = 0; c < 3; c++) {
+            command.color[c] = cv::saturate_cast<uint8_t>(color[c]);
+        }
+        command.color[3] = 255;
+        command.x0 = p0.x;
+        command.y0 = p0.y;
+        command.x1 = p1.x;
+        command.y1 = p1.y;
+        command.size = size;
+        command.textOffset = 0;
+        command.textLength = 0;
+        return command;
+    }
+
+    std::mutex mutex;
+    std::vector<OverlayCommand> commands;
+    std::vector<char> textPool;
+};
+
+/**
+ * Returns the overlay buffer at the specified address, or nullptr when the address is 0 (i.e. in
+ * headless mode, where no overlay is recorded at all).
+ */
+OverlayCommandBuffer *castToOverlayPtr(jlong addr) {
+    return (OverlayCommandBuffer *) addr;
+}
+
+#endif //ARUCOSLAM_OVERLAYCOMMANDS_H
@@ -0,0 +1,70 @@
+//
+// Streaming accumulator of the mean of a sequence of poses.
+//
+
+#ifndef ARUCOSLAM_POSEACCUMULATOR_H
+#define ARUCOSLAM_POSEACCUMULATOR_H
+
+#include <jni.h>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * A PoseMeanAccumulator keeps the running sums needed to compute the same pose centroid of
+ * computeCentroid() and computeAngleCentroid() (the mean translation, and the circular mean of
+ * each component of the rotation vector), so that adding a pose and reading the mean are O(1)
+ * and the poses themselves do not need to be stored.
+ */
+class PoseMeanAccumulator {
+public:
+    void add(const cv::Vec3d &rvec, const cv::Vec3d &tvec, double weight = 1.0) {
+        for (int axis = 0; axis < 3; axis++) {
+            cosSums[axis] += weight * std::cos(rvec[axis]);
+            sinSums[axis] += weight * std::sin(rvec[axis]);
+            translationSums[axis] += weight * tvec[axis];
+        }
+        weightSum += weight;
+        count++;
+    }
+
+    /**
+     * Adds count poses, stored as consecutive triplets of doubles (with the same double precision
+     * of add(): the float kernels of cv::polarToCart would lose it).
+     */
+    void addAll(const double *rvecs, const double *tvecs, int count) {
+        for (int i = 0; i < count * 3; i += 3) {
+            add(cv::Vec3d(rvecs[i], rvecs[i + 1], rvecs[i + 2]),
+                cv::Vec3d(tvecs[i], tvecs[i + 1], tvecs[i + 2]));
+        }
+    }
+
+    /**
+     * Writes the mean pose; the result is undefined if no pose was added.
+     */
+    void mean(cv::Vec3d &rvec, cv::Vec3d &tvec) const {
+        for (int axis = 0; axis < 3; axis++) {
+            rvec[axis] = std::atan2(sinSums[axis], cosSums[axis]);
+            tvec[axis] = translationSums[axis] / weightSum;
+        }
+    }
+
+    int size() const { return count; }
+
+    void reset() {
+        *this = PoseMeanAccumulator();
+    }
+
+private:
+    double cosSums[3] = {};
+    double sinSums[3] = {};
+    double translationSums[3] = {};
+    double weightSum = 0.0;
+    int count = 0;
+};
+
+PoseMeanAccumulator *castToPoseMeanAccumulatorPtr(jlong addr) {
+    return (PoseMeanAccumulator *) addr;
+}
+
+#endif //ARUCOSLAM_POSEACCUMULATOR_H
@@ -0,0 +1,442 @@
+//
+// Stream of the estimated poses: lock-free rings from the workers, a dispatcher thread delivering
+// the records to the subscribers and appending them to a binary log.
+//
+
+#ifndef ARUCOSLAM_POSESTREAM_H
+#define ARUCOSLAM_POSESTREAM_H
+
+#include <jni.h>
+#include <android/log.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * A pose record, as stored in the rings and in the binary log (88 bytes, little endian, no
+ * padding):
+ *
+ *  offset  size  field
+ *       0     8  frameNumber     uint64  number of the frame (token of the worker pool)
+ *       8     8  frameTimeUs     int64   start of the processing of the frame (unix epoch, us)
+ *      16     8  publishTimeUs   int64   time of publication of the record (unix epoch, us)
+ *      24    24  rvec            3 x float64, rotation vector (room to camera)
+ *      48    24  tvec            3 x float64, translation vector (room to camera)
+ *      72     4  quality         float32, mean quality in (0, 1] of the inlier observations,
+ *                                0 if no pose was estimated in the frame
+ *      76     4  inliers         int32, number of markers which are inliers of the estimate
+ *      80     2  foundMarkers    uint16, number of markers detected in the frame
+ *      82     1  status          int8, one of the PHONE_POSE_STATUS_* codes
+ *      83     1  producer        uint8, index of the worker that published the record
+ *      84     4  reserved        always 0
+ */
+struct PoseRecord {
+    uint64_t frameNumber;
+    int64_t frameTimeUs;
+    int64_t publishTimeUs;
+    double rvec[3];
+    double tvec[3];
+    float quality;
+    int32_t inliers;
+    uint16_t foundMarkers;
+    int8_t status;
+    uint8_t producer;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PoseRecord) == 88, "the layout of PoseRecord is part of the log format");
+
+/**
+ * The binary log starts with a 16 bytes header: the magic "ASPL", the format version (uint32),
+ * the size of a record (uint32) and 4 reserved bytes; then the records follow back to back.
+ */
+constexpr char POSE_LOG_MAGIC[4] = {'A', 'S', 'P', 'L'};
+constexpr uint32_t POSE_LOG_VERSION = 1;
+
+/**
+ * Maximum number of producers (i.e. frame workers) of a stream.
+ */
+constexpr int POSE_STREAM_MAX_PRODUCERS = 16;
+
+/**
+ * Capacity (in records) of the ring of each producer: several seconds of poses, so that records
+ * are dropped only if the dispatcher is stuck.
+ */
+constexpr size_t POSE_STREAM_PRODUCER_CAPACITY = 256;
+
+/**
+ * The dispatcher flushes the log at most this often, and at most this long after a write.
+ */
+constexpr int POSE_STREAM_FLUSH_INTERVAL_MS = 200;
+
+/**
+ * Bounded single-producer/single-consumer queue. push() is called by one thread only, and pop()
+ * by one other thread only; neither of them ever blocks or takes a lock.
+ */
+template<typename T>
+class SpscRing {
+public:
+    /**
+     * @param capacity the capacity, rounded up to a power of 2
+     */
+    explicit SpscRing(size_t capacity) : head(0), tail(0) {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        slots.resize(rounded);
+        mask = rounded - 1;
+    }
+
+    /**
+     * Returns false (and drops the element) if the queue is full.
+     */
+    bool push(const T &element) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        slots[currentTail & mask] = element;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &element) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        element = slots[currentHead & mask];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // head and tail are written by different threads: they are kept on different cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+/**
+ * A consumer of the pose stream: the dispatcher pushes the records on its ring, and the consumer
+ * thread pops them with poll(), optionally waiting for new ones.
+ */
+class PoseSubscription {
+public:
+    explicit PoseSubscription(size_t capacity) : ring(capacity), dropped(0) {}
+
+    /**
+     * Copies up to maxRecords records on out; if none is available, waits up to timeoutUs
+     * microseconds for new ones.
+     *
+     * @return the number of copied records
+     */
+    int poll(PoseRecord *out, int maxRecords, int64_t timeoutUs) {
+        int count = drain(out, maxRecords);
+        if (count == 0 && timeoutUs > 0) {
+            std::unique_lock<std::mutex> lock(waitMutex);
+            available.wait_for(lock, std::chrono::microseconds(timeoutUs),
+                               [this] { return !ring.empty(); });
+            lock.unlock();
+            count = drain(out, maxRecords);
+        }
+        return count;
+    }
+
+    uint64_t droppedRecords() const { return dropped.load(); }
+
+private:
+    friend class PoseStream;
+
+    void deliver(const PoseRecord &record) {
+        if (!ring.push(record)) {
+            dropped++; // the consumer is too slow
+            return;
+        }
+        // the lock makes the wake-up of a consumer about to wait impossible to miss
+        std::unique_lock<std::mutex> lock(waitMutex);
+        available.notify_one();
+    }
+
+    int drain(PoseRecord *out, int maxRecords) {
+        int count = 0;
+        while (count < maxRecords && ring.pop(out[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    SpscRing<PoseRecord> ring;
+    std::atomic<uint64_t> dropped;
+    std::mutex waitMutex;
+    std::condition_variable available;
+};
+
+/**
+ * A PoseStream takes the pose records published by the frame workers and delivers them, in frame
+ * order, to the subscribers and to an append-only binary log (see PoseRecord for the layout).
+ *
+ * Each worker registers as a producer and gets its own SpscRing: publishing a record is a copy in
+ * the ring plus, when the dispatcher is idle, a wake-up; no lock is taken and no string is
+ * formatted on the frame path. The dispatcher thread drains all the rings, sorts each batch by
+ * frame number (the workers complete their frames out of order), pushes the records to the rings
+ * of the subscribers and writes them to the log; when the rings are empty, it sleeps until a
+ * producer wakes it up.
+ *
+ * The stream must be deleted only after the producers stopped publishing: the records still in
+ * the rings are then delivered and logged before the dispatcher terminates.
+ */
+class PoseStream {
+public:
+    /**
+     * @param logPath the path of the binary log (appended if it exists with the same format,
+     *                replaced otherwise), or an empty string for no log
+     */
+    explicit PoseStream(const std::string &logPath) :
+            producerCount(0),
+            running(true),
+            dispatcherIdle(false),
+            published(0),
+            droppedRecords(0),
+            logged(0),
+            log(nullptr) {
+        for (int i = 0; i < POSE_STREAM_MAX_PRODUCERS; i++) {
+            rings[i].reset(new SpscRing<PoseRecord>(POSE_STREAM_PRODUCER_CAPACITY));
+        }
+        if (!logPath.empty()) {
+            openLog(logPath);
+        }
+        dispatcher = std::thread([this] { dispatch(); });
+    }
+
+    PoseStream(const PoseStream &) = delete;
+
+    PoseStream &operator=(const PoseStream &) = delete;
+
+    ~PoseStream() {
+        {
+            std::unique_lock<std::mutex> lock(dispatcherMutex);
+            running = false;
+        }
+        dispatcherWakeUp.notify_one();
+        // the dispatcher drains the rings before terminating
+        dispatcher.join();
+        if (log != nullptr) {
+            fclose(log);
+        }
+    }
+
+    /**
+     * @return the index of the new producer, or -1 if there are too many producers
+     */
+    int registerProducer() {
+        int index = producerCount.fetch_add(1);
+        if (index >= POSE_STREAM_MAX_PRODUCERS) {
+            producerCount--;
+            return -1;
+        }
+        return index;
+    }
+
+    /**
+     * Publishes a record; must be called only by the thread owning the producer.
+     *
+     * @return false if the record was dropped (the ring of the producer is full)
+     */
+    bool publish(int producer, PoseRecord record) {
+        record.producer = static_cast<uint8_t>(producer);
+        record.publishTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        record.reserved = 0;
+        if (!rings[producer]->push(record)) {
+            droppedRecords++;
+            return false;
+        }
+        published++;
+        // pairs with the fence of the dispatcher: either it sees the record before going to
+        // sleep, or this thread sees it idle and wakes it up
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (dispatcherIdle.load(std::memory_order_relaxed)) {
+            wakeUpDispatcher();
+        }
+        return true;
+    }
+
+    PoseSubscription *subscribe(size_t capacity) {
+        auto *subscription = new PoseSubscription(capacity);
+        std::unique_lock<std::mutex> lock(subscribersMutex);
+        subscribers.push_back(subscription);
+        return subscription;
+    }
+
+    /**
+     * Removes and deletes the subscription; the dispatcher never touches it again afterwards.
+     */
+    void unsubscribe(PoseSubscription *subscription) {
+        std::unique_lock<std::mutex> lock(subscribersMutex);
+        subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), subscription),
+                          subscribers.end());
+        delete subscription;
+    }
+
+    uint64_t publishedRecords() const { return published.load(); }
+
+    uint64_t dropped() const { return droppedRecords.load(); }
+
+    uint64_t loggedRecords() const { return logged.load(); }
+
+private:
+    void openLog(const std::string &logPath) {
+        unsigned char header[16] = {};
+        uint32_t version = POSE_LOG_VERSION;
+        uint32_t recordSize = sizeof(PoseRecord);
+        memcpy(header, POSE_LOG_MAGIC, 4);
+        memcpy(header + 4, &version, 4);
+        memcpy(header + 8, &recordSize, 4);
+
+        // an existing log is appended only if its header is the one of this format, so the
+        // records of an older version or layout are never mixed with the new ones
+        bool append = false;
+        FILE *existing = fopen(logPath.c_str(), "rb");
+        if (existing != nullptr) {
+            unsigned char existingHeader[sizeof(header)];
+            size_t headerSize = fread(existingHeader, 1, sizeof(existingHeader), existing);
+            fclose(existing);
+            append = headerSize == sizeof(header) &&
+                     memcmp(existingHeader, header, 12) == 0;
+            if (!append && headerSize > 0) {
+                __android_log_print(ANDROID_LOG_WARN, "PoseStream",
+                                    "%s has another format: replaced", logPath.c_str());
+            }
+        }
+
+        log = fopen(logPath.c_str(), append ? "ab" : "wb");
+        if (log == nullptr) {
+            __android_log_print(ANDROID_LOG_ERROR, "PoseStream", "cannot open %s",
+                                logPath.c_str());
+            return;
+        }
+        if (!append) {
+            fwrite(header, 1, sizeof(header), log);
+        }
+    }
+
+    void wakeUpDispatcher() {
+        // the lock makes the wake-up of the dispatcher about to wait impossible to miss
+        std::unique_lock<std::mutex> lock(dispatcherMutex);
+        dispatcherWakeUp.notify_one();
+    }
+
+    bool hasRecords() const {
+        int producers = std::min(producerCount.load(), POSE_STREAM_MAX_PRODUCERS);
+        for (int i = 0; i < producers; i++) {
+            if (!rings[i]->empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void dispatch() {
+        std::vector<PoseRecord> batch;
+        batch.reserve(POSE_STREAM_PRODUCER_CAPACITY);
+        auto lastFlush = std::chrono::steady_clock::now();
+        const auto flushInterval = std::chrono::milliseconds(POSE_STREAM_FLUSH_INTERVAL_MS);
+        bool unflushed = false;
+        auto wakeUp = [this] { return !running.load() || hasRecords(); };
+        for (;;) {
+            batch.clear();
+            int producers = std::min(producerCount.load(), POSE_STREAM_MAX_PRODUCERS);
+            PoseRecord record;
+            for (int i = 0; i < producers; i++) {
+                while (rings[i]->pop(record)) {
+                    batch.push_back(record);
+                }
+            }
+
+            if (batch.empty()) {
+                std::unique_lock<std::mutex> lock(dispatcherMutex);
+                if (!running.load()) {
+                    break; // all the records were drained
+                }
+                dispatcherIdle.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (unflushed) {
+                    // wake up in time for the pending flush
+                    dispatcherWakeUp.wait_until(lock, lastFlush + flushInterval, wakeUp);
+                } else {
+                    dispatcherWakeUp.wait(lock, wakeUp);
+                }
+                dispatcherIdle.store(false, std::memory_order_relaxed);
+            } else {
+                std::sort(batch.begin(), batch.end(),
+                          [](const PoseRecord &a, const PoseRecord &b) {
+                              return a.frameNumber < b.frameNumber;
+                          });
+                {
+                    std::unique_lock<std::mutex> lock(subscribersMutex);
+                    for (const PoseRecord &delivered : batch) {
+                        for (PoseSubscription *subscription : subscribers) {
+                            subscription->deliver(delivered);
+                        }
+                    }
+                }
+                if (log != nullptr) {
+                    logged += fwrite(batch.data(), sizeof(PoseRecord), batch.size(), log);
+                    unflushed = true;
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (unflushed && now - lastFlush >= flushInterval) {
+                fflush(log);
+                lastFlush = now;
+                unflushed = false;
+            }
+        }
+    }
+
+    std::unique_ptr<SpscRing<PoseRecord>> rings[POSE_STREAM_MAX_PRODUCERS];
+    std::atomic<int> producerCount;
+
+    std::thread dispatcher;
+    std::atomic<bool> running;
+    std::atomic<bool> dispatcherIdle;
+    std::mutex dispatcherMutex;
+    std::condition_variable dispatcherWakeUp;
+
+    std::mutex subscribersMutex;
+    std::vector<PoseSubscription *> subscribers;
+
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> droppedRecords;
+    std::atomic<uint64_t> logged;
+    FILE *log;
+};
+
+PoseStream *castToPoseStreamPtr(jlong addr) {
+    return (PoseStream *) addr;
+}
+
+PoseSubscription *castToPoseSubscriptionPtr(jlong addr) {
+    return (PoseSubscription *) addr;
+}
+
+#endif //ARUCOSLAM_POSESTREAM_H
@@ -8,11 +8,18 @@
 #include <mutex>
 #include <opencv2/core/core.hpp>
 #include "utils.h"
+#include "frameArena.h"
+/**
+ * Number of iterations of the IRLS refinement of the final RANSAC model.
+ */
+constexpr int IRLS_ITERATIONS = 3;
+
 /**
  * utility function used to get the i-th number of a vector if such element existed, otherwise,
  * returns 1.0
  */
-double getWeight(int i, const std::vector<double>& weights = std::vector<double>()){
+template<typename WEIGHTS = std::vector<double>>
+double getWeight(int i, const WEIGHTS& weights = WEIGHTS()){
     if(weights.size() <= i){
         return 1.0;
     }else{
@@ -32,8 +39,8 @@ double meanAngle(const ITERABLE &c, const std::vector<double>& weights = std::ve
     double y = 0.0;
     int i = 0;
     while (it != end) {
-        x += cos(*it * getWeight(i, weights));
-        y += sin(*it * getWeight(i, weights));
+        x += getWeight(i, weights) * cos(*it);
+        y += getWeight(i, weights) * sin(*it);
         it = std::next(it);
         i++;
     }
@@ -44,34 +51,32 @@ double meanAngle(const ITERABLE &c, const std::vector<double>& weights = std::ve
 /**
  * Computes the weighted average rotation in a collection of rotations.
  */
+template<typename VECS, typename WEIGHTS = std::vector<double>>
 void computeAngleCentroid(
-        const std::vector<cv::Vec3d> &rvecs,
+        const VECS &rvecs,
         cv::Vec3d &angleCentroid,
-        std::vector<double> weights = std::vector<double>()
+        const WEIGHTS &weights = WEIGHTS()
 ) {
-    std::vector<double> tmp;
-    tmp.reserve(rvecs.size());
-
-
     for (int j = 0; j < 3; j++) {
-        double weightSum = 0.0;
+        double x = 0.0;
+        double y = 0.0;
         for (int i = 0; i < rvecs.size(); i++) {
             double weight = getWeight(i, weights);
-            weightSum += weight;
-            tmp.push_back(rvecs[i][j] * weight);
+            x += weight * cos(rvecs[i][j]);
+            y += weight * sin(rvecs[i][j]);
         }
-        angleCentroid[j] = meanAngle(tmp);
-        tmp.clear();
+        angleCentroid[j] = atan2(y, x);
     }
 }
 
 /**
  * Computes the weighted centroid of various 3D points in space.
  */
+template<typename VECS, typename WEIGHTS = std::vector<double>>
 void computeCentroid(
-        const std::vector<cv::Vec3d> &vecs,
+        const VECS &vecs,
         cv::Vec3d &centre,
-        const std::vector<double> &weights = std::vector<double>()
+        const WEIGHTS &weights = WEIGHTS()
 ) {
 
     double weightSum = 0.0;
@@ -79,18 +84,65 @@ void computeCentroid(
     centre[1] = 0;
     centre[2] = 0;
     for (int i = 0; i < vecs.size(); i++) {
-        weightSum += getWeight(i);
-        centre[0] += vecs[i][0] * getWeight(i);
-        centre[1] += vecs[i][1] * getWeight(i);
-        centre[2] += vecs[i][2] * getWeight(i);
+        double weight = getWeight(i, weights);
+        weightSum += weight;
+        centre[0] += vecs[i][0] * weight;
+        centre[1] += vecs[i][1] * weight;
+        centre[2] += vecs[i][2] * weight;
     }
     centre[0] /= weightSum;
     centre[1] /= weightSum;
     centre[2] /= weightSum;
 }
 
+typedef std::function<void(const ArenaVector<cv::Vec3d> &,
+                           cv::Vec3d &, const ArenaVector<double> &)> CentroidComputer;
+
+typedef std::function<double(const cv::Vec3d &, const cv::Vec3d &)> DistanceFunction;
+
+/**
+ * Refines a model with iteratively reweighted least squares: the model is recomputed several
+ * times as the weighted centroid of the inliers, where the weight of each inlier is its own
+ * weight times the Huber weight of its residual w.r.t. the previous model (so that the inliers
+ * close to the inlier threshold count less than the ones close to the model).
+ */
+void refineModelIRLS(
+        const ArenaVector<cv::Vec3d> &vecs,
+        const ArenaVector<int> &inlierIndices,
+        const ArenaVector<double> &weights,
+        double inlierThreshold,
+        const DistanceFunction &distanceFunction,
+        const CentroidComputer &centroidComputer,
+        cv::Vec3d &model,
+        FrameArena *arena
+) {
+    ArenaVector<cv::Vec3d> inliers((ArenaAllocator<cv::Vec3d>(arena)));
+    ArenaVector<double> baseWeights((ArenaAllocator<double>(arena)));
+    ArenaVector<double> robustWeights((ArenaAllocator<double>(arena)));
+    inliers.reserve(inlierIndices.size());
+    baseWeights.reserve(inlierIndices.size());
+    for (int i : inlierIndices) {
+        inliers.push_back(vecs[i]);
+        baseWeights.push_back(getWeight(i, weights));
+    }
+    robustWeights = baseWeights;
+    centroidComputer(inliers, model, baseWeights);
+
+    double huberThreshold = inlierThreshold / 2.0;
+    for (int iteration = 0; iteration < IRLS_ITERATIONS; iteration++) {
+        for (int k = 0; k < inliers.size(); k++) {
+            double residual = distanceFunction(model, inliers[k]);
+            double robustWeight = residual <= huberThreshold ? 1.0 : huberThreshold / residual;
+            robustWeights[k] = baseWeights[k] * robustWeight;
+        }
+        centroidComputer(inliers, model, robustWeights);
+    }
+}
+
 /**
  * Computes a vector which is an estimate of 3D vectors by using the RANSAC method.
+ * Each hypothesis is scored by the sum of the weights of its inliers, and the final model is the
+ * weighted centroid of the inliers of the best hypothesis, refined with IRLS.
  * @param vecs the collection of input vectors
  * @param foundModel the computed vector estimate
  * @param inlierThreshold if the evaluation of the distanceFunction between the centroid and a point
@@ -104,36 +156,43 @@ void computeCentroid(
  * @param distanceFunction function that takes two vector and returns their distance; defaults to the
  *                          euclidean norm of the difference of the two vectors
  * @param centroidComputer function that computes the weighted average vector of a set of vectors
- * @param weights vector of the weight used to compute the averages; defaults to an empty vector,
- *                          which means that all the weigths are 1.0.
+ * @param weights vector of the weight (i.e. the quality) of each input vector; defaults to an empty
+ *                          vector, which means that all the weigths are 1.0.
+ * @param arena the frame arena from which all the per-iteration containers are allocated
+ * @param inlierIndices if not null, the indices of the inliers of the found estimate are written
+ *                      here
  */
 void vectorRansac(
-        const std::vector<cv::Vec3d> &vecs,
+        const ArenaVector<cv::Vec3d> &vecs,
         cv::Vec3d &foundModel,
         double inlierThreshold,
         double outlierProbability,
         double targetOptimalModelProbability,
         uint maxN,
         int &inliers,
-        const std::function<double(const cv::Vec3d &, const cv::Vec3d &)> &distanceFunction
+        const DistanceFunction &distanceFunction
         = [](const cv::Vec3d &v1, const cv::Vec3d &v2) { return cv::norm(v1 - v2); },
-        const std::function<void(const std::vector<cv::Vec3d> &,
-                                 cv::Vec3d &, const std::vector<double> &)> &centroidComputer
-        = &computeCentroid,
-        const std::vector<double> &weights = std::vector<double>()
+        const CentroidComputer &centroidComputer
+        = &computeCentroid<ArenaVector<cv::Vec3d>, ArenaVector<double>>,
+        const ArenaVector<double> &weights = ArenaVector<double>(),
+        FrameArena *arena = nullptr,
+        ArenaVector<int> *inlierIndices = nullptr
 ) {
+    if (inlierIndices != nullptr) {
+        inlierIndices->clear();
+    }
     if (vecs.empty()) {
         inliers = 0;
         return;
     }
-    if (vecs.size() == 1) {
-        inliers = 1;
-        foundModel = getWeight(0) * vecs[0];
-        return;
-    }
-    if (vecs.size() == 2) {
-        inliers = 2;
-        computeCentroid(vecs, foundModel, weights);
+    if (vecs.size() <= 2) {
+        inliers = vecs.size();
+        centroidComputer(vecs, foundModel, weights);
+        if (inlierIndices != nullptr) {
+            for (int i = 0; i < vecs.size(); i++) {
+                inlierIndices->push_back(i);
+            }
+        }
         return;
     }
     size_t subSetSize;
@@ -155,48 +214,58 @@ void vectorRansac(
     }
 
 
-    std::vector<cv::Vec3d> bestInliers;
-    std::vector<double> bestWeigths;
+    ArenaAllocator<cv::Vec3d> vecAllocator(arena);
+    ArenaAllocator<double> weightAllocator(arena);
+    ArenaAllocator<int> indexAllocator(arena);
+
+    ArenaVector<int> bestInlierIndices(indexAllocator);
+    bestInlierIndices.reserve(vecs.size());
+    double bestScore = -1.0;
 
 
     p_for(attempt_I, attempts) {
-        std::vector<cv::Vec3d> foundInliers;
-        std::vector<double> foundWeights;
-        foundInliers.reserve(vecs.size());
-        foundWeights.reserve(vecs.size());
+        ArenaVector<int> foundInlierIndices(indexAllocator);
+        foundInlierIndices.reserve(vecs.size());
 
-        std::vector<int> subsetOfIndices;
+        ArenaVector<int> subsetOfIndices(indexAllocator);
+        subsetOfIndices.reserve(vecs.size());
         randomUniqueIndices(vecs.size(), subSetSize, subsetOfIndices);
 
-        std::vector<cv::Vec3d> subset;
-        std::vector<double> weightsSubset;
+        ArenaVector<cv::Vec3d> subset(vecAllocator);
+        ArenaVector<double> weightsSubset(weightAllocator);
+        subset.reserve(subSetSize);
+        weightsSubset.reserve(subSetSize);
         for (auto i : subsetOfIndices) {
             subset.push_back(vecs[i]);
-            weightsSubset.push_back(getWeight(i));
+            weightsSubset.push_back(getWeight(i, weights));
         }
 
         cv::Vec3d centroid;
         centroidComputer(subset, centroid, weightsSubset);
+        double score = 0.0;
         for (int i = 0; i < vecs.size(); i++) {
-            const cv::Vec3d &vec = vecs[i];
-            if (distanceFunction(centroid, vec) <= inlierThreshold) {
-                foundInliers.push_back(vec);
-                foundWeights.push_back(getWeight(i));
+            if (distanceFunction(centroid, vecs[i]) <= inlierThreshold) {
+                foundInlierIndices.push_back(i);
+                score += getWeight(i, weights);
             }
         }
 
         p_for_criticalSectionBegin
 
-            if (foundInliers.size() > bestInliers.size()) {
-                bestInliers = foundInliers;
-                bestWeigths = foundWeights;
+            if (score > bestScore) {
+                bestScore = score;
+                bestInlierIndices = foundInlierIndices;
             }
 
         p_for_criticalSectionEnd
     };
 
-    inliers = bestInliers.size();
-    centroidComputer(bestInliers, foundModel, bestWeigths);
+    inliers = bestInlierIndices.size();
+    refineModelIRLS(vecs, bestInlierIndices, weights, inlierThreshold,
+                    distanceFunction, centroidComputer, foundModel, arena);
+    if (inlierIndices != nullptr) {
+        inlierIndices->assign(bestInlierIndices.begin(), bestInlierIndices.end());
+    }
 }
 
 /**
@@ -211,12 +280,16 @@ double angularDistance(const cv::Vec3d &p1, const cv::Vec3d &p2){
 }
 
 /**
- * Estimates a pose by using two RANSACs, one for the translation vectors and one for the rotation
- * vectors.
+ * Estimates a pose by using two weighted RANSACs, one for the translation vectors and one for the
+ * rotation vectors.
+ *
+ * @param weights the quality of each pose indicator (empty means all equal)
+ * @param inlierIndices if not null, the indices of the indicators that are inliers of the
+ *                      rotation estimate are written here
  */
 int estimateCameraPose(
-        const std::vector<cv::Vec3d> &rvecs,
-        const std::vector<cv::Vec3d> &tvecs,
+        const ArenaVector<cv::Vec3d> &rvecs,
+        const ArenaVector<cv::Vec3d> &tvecs,
         cv::Vec3d &modelRvec,
         cv::Vec3d &modelTvec,
         double tvecInlierTreshold = 0.05,
@@ -224,7 +297,10 @@ int estimateCameraPose(
         double rvecInlierTreshold = M_PI / 8.0,
         double rvecOutlierProbability = 0.1,
         uint maxRansacIterations = 100,
-        double optimalModelTargetProbability = 0.9
+        double optimalModelTargetProbability = 0.9,
+        const ArenaVector<double> &weights = ArenaVector<double>(),
+        FrameArena *arena = nullptr,
+        ArenaVector<int> *inlierIndices = nullptr
 ) {
     int inliers = -1;
 
@@ -235,7 +311,11 @@ int estimateCameraPose(
             tvecOutlierProbability,
             optimalModelTargetProbability,
             maxRansacIterations,
-            inliers
+            inliers,
+            [](const cv::Vec3d &v1, const cv::Vec3d &v2) { return cv::norm(v1 - v2); },
+            &computeCentroid<ArenaVector<cv::Vec3d>, ArenaVector<double>>,
+            weights,
+            arena
     );
 
     vectorRansac(
@@ -247,7 +327,10 @@ int estimateCameraPose(
             maxRansacIterations,
             inliers,
             &angularDistance,
-            &computeAngleCentroid
+            &computeAngleCentroid<ArenaVector<cv::Vec3d>, ArenaVector<double>>,
+            weights,
+            arena,
+            inlierIndices
     );
 
     return inliers;
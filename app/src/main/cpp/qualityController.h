@@ -0,0 +1,329 @@
+//
+// Adaptive quality controller: trades detection, estimation and map quality for frame time.
+//
+
+#ifndef ARUCOSLAM_QUALITYCONTROLLER_H
+#define ARUCOSLAM_QUALITYCONTROLLER_H
+
+#include <jni.h>
+#include <android/log.h>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * The settings adjusted by the controller ("knobs"), each with a list of steps ordered from the
+ * best quality to the cheapest one.
+ */
+enum QualityKnob : int {
+    QUALITY_KNOB_DETECTION = 0, // full frame -> region of interest -> decimated region of interest
+    QUALITY_KNOB_RANSAC = 1, // cap on the RANSAC iterations
+    QUALITY_KNOB_MAP = 2, // map refresh interval
+    QUALITY_KNOBS = 3,
+};
+
+/**
+ * Detection steps: whether the markers are searched only around the ones found in the previous
+ * frame, and the decimation factor of the image they are searched in.
+ */
+constexpr int QUALITY_DETECTION_STEPS = 4;
+constexpr bool QUALITY_DETECTION_ROI[QUALITY_DETECTION_STEPS] = {false, true, true, true};
+constexpr int QUALITY_DETECTION_DECIMATION[QUALITY_DETECTION_STEPS] = {1, 1, 2, 3};
+
+/**
+ * RANSAC steps, as fractions (in percent) of the configured maximum number of iterations.
+ */
+constexpr int QUALITY_RANSAC_STEPS = 4;
+constexpr int QUALITY_RANSAC_PERCENT[QUALITY_RANSAC_STEPS] = {100, 66, 50, 33};
+constexpr int QUALITY_RANSAC_MIN_ITERATIONS = 5;
+
+/**
+ * Map steps: the map is rendered once every N frames, and copied from the last rendered one in
+ * the others.
+ */
+constexpr int QUALITY_MAP_STEPS = 5;
+constexpr int QUALITY_MAP_REFRESH_INTERVAL[QUALITY_MAP_STEPS] = {1, 2, 3, 5, 10};
+
+/**
+ * Smoothing factor of the exponential moving averages of the stage latencies.
+ */
+constexpr double QUALITY_LATENCY_SMOOTHING = 0.2;
+
+/**
+ * Minimum number of frames between two decisions, so that the averages can reflect the effect of
+ * the last one before taking another.
+ */
+constexpr int QUALITY_SETTLE_FRAMES = 10;
+
+/**
+ * Quality is raised back only when the average frame time is below this fraction of the budget
+ * for at least QUALITY_RECOVERY_FRAMES frames (hysteresis, to avoid oscillations).
+ */
+constexpr double QUALITY_RECOVERY_BUDGET_FRACTION = 0.6;
+constexpr int QUALITY_RECOVERY_FRAMES = 30;
+
+/**
+ * Maximum number of degradations that can be stacked (one for each step of each knob).
+ */
+constexpr int QUALITY_MAX_DEGRADATIONS =
+        (QUALITY_DETECTION_STEPS - 1) + (QUALITY_RANSAC_STEPS - 1) + (QUALITY_MAP_STEPS - 1);
+
+/**
+ * How the markers of a frame were searched (see DetectorSession).
+ */
+enum DetectionMode : int {
+    DETECTION_MODE_FULL_FRAME = 0,
+    DETECTION_MODE_ROI = 1,
+    DETECTION_MODE_ROI_FALLBACK = 2, // nothing found in the region of interest, full frame searched
+    DETECTION_MODES = 3,
+};
+
+enum QualityDecision : int {
+    QUALITY_DECISION_NONE = 0,
+    QUALITY_DECISION_DEGRADE = 1, // the average frame time exceeded the budget
+    QUALITY_DECISION_RESTORE = 2, // the average frame time was well below the budget
+};
+
+/**
+ * The values of the knobs for the current frame.
+ */
+struct QualitySettings {
+    bool roiDetection;
+    int decimation;
+    int maxRansacIterations;
+    int mapRefreshInterval;
+};
+
+/**
+ * Number of values written by AdaptiveQualityController::telemetry(); the layout is documented in
+ * NativeMethods.qualityControllerTelemetry.
+ */
+constexpr int QUALITY_TELEMETRY_SIZE = 22;
+
+/**
+ * An AdaptiveQualityController keeps the processing time of the frames within a budget: it is
+ * fed with the latency of each stage (detection, estimation, rendering) of every frame, and when
+ * the smoothed frame time exceeds the budget it degrades the knob of the most expensive stage by
+ * one step; when the frame time stays well below the budget, the last degradation is undone.
+ * This way, under load (e.g. when the device is throttled) the quality decreases gradually instead
+ * of frames being dropped, and it is restored when the load goes away.
+ *
+ * It is shared by all the workers: each of them reports its frames, and reads the current
+ * settings when it starts a frame. The controller also keeps the last rendered map box, which is
+ * re-used by the frames that skip the map rendering.
+ */
+class AdaptiveQualityController {
+public:
+    /**
+     * @param frameBudgetMs the target processing time of a frame, in milliseconds
+     * @param maxRansacIterations the cap on the RANSAC iterations at full quality
+     */
+    AdaptiveQualityController(double frameBudgetMs, int maxRansacIterations) :
+            frameBudgetMs(frameBudgetMs),
+            maxRansacIterations(maxRansacIterations),
+            mapFrames(0) {
+    }
+
+    QualitySettings settings() {
+        std::unique_lock<std::mutex> lock(mutex);
+        QualitySettings current;
+        current.roiDetection = QUALITY_DETECTION_ROI[steps[QUALITY_KNOB_DETECTION]];
+        current.decimation = QUALITY_DETECTION_DECIMATION[steps[QUALITY_KNOB_DETECTION]];
+        current.maxRansacIterations = std::max(
+                QUALITY_RANSAC_MIN_ITERATIONS,
+                maxRansacIterations * QUALITY_RANSAC_PERCENT[steps[QUALITY_KNOB_RANSAC]] / 100);
+        current.mapRefreshInterval = QUALITY_MAP_REFRESH_INTERVAL[steps[QUALITY_KNOB_MAP]];
+        return current;
+    }
+
+    /**
+     * Records the latencies (in milliseconds) of the stages of a processed frame, and takes a
+     * decision if needed.
+     */
+    void reportFrame(double detectMs, double estimateMs, double renderMs) {
+        std::unique_lock<std::mutex> lock(mutex);
+        double stageMs[QUALITY_KNOBS] = {detectMs, estimateMs, renderMs};
+        for (int i = 0; i < QUALITY_KNOBS; i++) {
+            averageMs[i] = frames == 0 ? stageMs[i] :
+                           averageMs[i] + QUALITY_LATENCY_SMOOTHING * (stageMs[i] - averageMs[i]);
+        }
+        double frameMs = detectMs + estimateMs + renderMs;
+        averageFrameMs = frames == 0 ? frameMs :
+                         averageFrameMs + QUALITY_LATENCY_SMOOTHING * (frameMs - averageFrameMs);
+        frames++;
+        framesSinceDecision++;
+        framesBelowRecoveryBudget = averageFrameMs < frameBudgetMs * QUALITY_RECOVERY_BUDGET_FRACTION
+                                    ? framesBelowRecoveryBudget + 1 : 0;
+
+        if (framesSinceDecision < QUALITY_SETTLE_FRAMES) {
+            return;
+        }
+        if (averageFrameMs > frameBudgetMs) {
+            degrade();
+        } else if (framesBelowRecoveryBudget >= QUALITY_RECOVERY_FRAMES) {
+            restore();
+        }
+    }
+
+    /**
+     * Called once per frame by the workers which render the map.
+     *
+     * @return true if the map must be rendered in this frame, false if the last rendered one can
+     *          be re-used
+     */
+    bool shouldRefreshMap() {
+        int interval = settings().mapRefreshInterval;
+        return mapFrames.fetch_add(1) % interval == 0;
+    }
+
+    /**
+     * Keeps a copy of the map box just rendered on the image.
+     */
+    void storeMapBox(const cv::Mat &image, const cv::Rect &box) {
+        cv::Rect clipped = box & cv::Rect(0, 0, image.cols, image.rows);
+        std::unique_lock<std::mutex> lock(mapMutex);
+        image(clipped).copyTo(mapBox);
+        mapBoxRect = clipped;
+    }
+
+    /**
+     * Copies the last rendered map box on the image.
+     *
+     * @return false if there is no map box compatible with the image (nothing is done)
+     */
+    bool restoreMapBox(cv::Mat &image, const cv::Rect &box) {
+        cv::Rect clipped = box & cv::Rect(0, 0, image.cols, image.rows);
+        std::unique_lock<std::mutex> lock(mapMutex);
+        if (mapBox.empty() || clipped != mapBoxRect || mapBox.type() != image.type()) {
+            return false;
+        }
+        cv::Mat target = image(clipped);
+        mapBox.copyTo(target);
+        return true;
+    }
+
+    void recordDetectionMode(DetectionMode mode) {
+        detectionModeCounts[mode]++;
+    }
+
+    /**
+     * Writes QUALITY_TELEMETRY_SIZE values on out.
+     */
+    void telemetry(double *out) {
+        QualitySettings current = settings();
+        std::unique_lock<std::mutex> lock(mutex);
+        int i = 0;
+        out[i++] = frameBudgetMs;
+        out[i++] = averageFrameMs;
+        for (int knob = 0; knob < QUALITY_KNOBS; knob++) {
+            out[i++] = averageMs[knob];
+        }
+        for (int knob = 0; knob < QUALITY_KNOBS; knob++) {
+            out[i++] = steps[knob];
+        }
+        out[i++] = current.roiDetection ? 1.0 : 0.0;
+        out[i++] = current.decimation;
+        out[i++] = current.maxRansacIterations;
+        out[i++] = current.mapRefreshInterval;
+        out[i++] = static_cast<double>(frames);
+        out[i++] = degradations;
+        out[i++] = restorations;
+        out[i++] = lastDecision;
+        out[i++] = lastDecisionKnob;
+        out[i++] = static_cast<double>(lastDecisionFrame);
+        out[i++] = lastDecisionFrameMs;
+        for (int mode = 0; mode < DETECTION_MODES; mode++) {
+            out[i++] = static_cast<double>(detectionModeCounts[mode].load());
+        }
+    }
+
+private:
+    bool canDegrade(int knob) const {
+        static const int stepCounts[QUALITY_KNOBS] = {
+                QUALITY_DETECTION_STEPS, QUALITY_RANSAC_STEPS, QUALITY_MAP_STEPS
+        };
+        return steps[knob] + 1 < stepCounts[knob];
+    }
+
+    /**
+     * Degrades the knob of the stage that takes the most time (among the ones that can still be
+     * degraded).
+     */
+    void degrade() {
+        int chosenKnob = -1;
+        for (int knob = 0; knob < QUALITY_KNOBS; knob++) {
+            if (canDegrade(knob) && (chosenKnob < 0 || averageMs[knob] > averageMs[chosenKnob])) {
+                chosenKnob = knob;
+            }
+        }
+        if (chosenKnob < 0) {
+            return; // already at the lowest quality
+        }
+        steps[chosenKnob]++;
+        degradationStack[stackSize++] = chosenKnob;
+        degradations++;
+        decided(QUALITY_DECISION_DEGRADE, chosenKnob);
+    }
+
+    /**
+     * Undoes the last degradation.
+     */
+    void restore() {
+        if (stackSize == 0) {
+            return; // already at full quality
+        }
+        int knob = degradationStack[--stackSize];
+        steps[knob]--;
+        restorations++;
+        decided(QUALITY_DECISION_RESTORE, knob);
+    }
+
+    void decided(QualityDecision decision, int knob) {
+        lastDecision = decision;
+        lastDecisionKnob = knob;
+        lastDecisionFrame = frames;
+        lastDecisionFrameMs = averageFrameMs;
+        framesSinceDecision = 0;
+        framesBelowRecoveryBudget = 0;
+        __android_log_print(ANDROID_LOG_INFO, "QualityController",
+                            "frame %llu: %s knob %d to step %d (average frame time %.1f ms, "
+                            "budget %.1f ms)",
+                            (unsigned long long) frames,
+                            decision == QUALITY_DECISION_DEGRADE ? "degraded" : "restored",
+                            knob, steps[knob], averageFrameMs, frameBudgetMs);
+    }
+
+    const double frameBudgetMs;
+    const int maxRansacIterations;
+
+    std::mutex mutex;
+    int steps[QUALITY_KNOBS] = {0, 0, 0};
+    int degradationStack[QUALITY_MAX_DEGRADATIONS] = {};
+    int stackSize = 0;
+    double averageMs[QUALITY_KNOBS] = {0.0, 0.0, 0.0};
+    double averageFrameMs = 0.0;
+    uint64_t frames = 0;
+    int framesSinceDecision = 0;
+    int framesBelowRecoveryBudget = 0;
+    int degradations = 0;
+    int restorations = 0;
+    int lastDecision = QUALITY_DECISION_NONE;
+    int lastDecisionKnob = -1;
+    uint64_t lastDecisionFrame = 0;
+    double lastDecisionFrameMs = 0.0;
+    std::atomic<uint64_t> detectionModeCounts[DETECTION_MODES] = {};
+
+    std::atomic<uint64_t> mapFrames;
+    std::mutex mapMutex;
+    cv::Mat mapBox;
+    cv::Rect mapBoxRect;
+};
+
+AdaptiveQualityController *castToQualityControllerPtr(jlong addr) {
+    return (AdaptiveQualityController *) addr;
+}
+
+#endif //ARUCOSLAM_QUALITYCONTROLLER_H
@@ -0,0 +1,53 @@
+//
+// Transformations between the room's coord sys and the coord sys of the markers and the camera.
+//
+
+#ifndef ARUCOSLAM_ROOMTRANSFORMS_H
+#define ARUCOSLAM_ROOMTRANSFORMS_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+/**
+ * Position in the room of the origin of a coord sys: the center of a marker, or the camera.
+ *
+ * @param rvec, tvec transformation from room's coord sys to the marker's (or camera's) coord sys
+ */
+cv::Vec3d positionInRoom(const cv::Vec3d &rvec, const cv::Vec3d &tvec) {
+    cv::Matx33d rotation;
+    cv::Rodrigues(rvec, rotation);
+    return -(rotation.t() * tvec);
+}
+
+/**
+ * Inverse of the transformation (inR, inT).
+ */
+void invertRT(
+        const cv::Vec3d &inR,
+        const cv::Vec3d &inT,
+        cv::Vec3d &outR,
+        cv::Vec3d &outT
+) {
+    cv::Matx33d Rmatrix;
+    cv::Rodrigues(inR, Rmatrix);
+    cv::Matx33d RmatrixT = Rmatrix.t();
+    cv::Rodrigues(RmatrixT, outR);
+    outT = -(RmatrixT * inT);
+}
+
+/**
+ * Pose in the room of a new marker (the same composition used by the app when it adds the
+ * markers found in a frame to the map).
+ *
+ * @param cameraRvec, cameraTvec the pose of the camera in the frame (room to camera)
+ * @param markerRvec, markerTvec the pose of the marker w.r.t. the camera
+ */
+void newMarkerPoseInRoom(const cv::Vec3d &cameraRvec, const cv::Vec3d &cameraTvec,
+                         const cv::Vec3d &markerRvec, const cv::Vec3d &markerTvec,
+                         cv::Vec3d &outRvec, cv::Vec3d &outTvec) {
+    cv::Vec3d composedRvec, composedTvec;
+    cv::composeRT(cameraRvec, cameraTvec, markerRvec, markerTvec, composedRvec, composedTvec);
+    invertRT(composedRvec, composedTvec, outRvec, outTvec);
+}
+
+#endif //ARUCOSLAM_ROOMTRANSFORMS_H
@@ -0,0 +1,574 @@
+//
+// Recorder of the input frames of a session, with the calibration and the detector settings, on a
+// chunked container file written by a background thread.
+//
+
+#ifndef ARUCOSLAM_SESSIONRECORDER_H
+#define ARUCOSLAM_SESSIONRECORDER_H
+
+#include <jni.h>
+#include <android/log.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/aruco.hpp>
+
+#include "detectorSession.h"
+
+/**
+ * The recording starts with a 16 bytes header: the magic "ASRC", the format version (uint32) and
+ * 8 reserved bytes. Then a sequence of chunks follows, each one made of a 16 bytes chunk header
+ * (4 bytes tag, uint32 reserved, uint64 size of the payload) and of its payload. All the values
+ * are little endian. The chunks are:
+ *
+ *  "CALB" calibration: the camera matrix (9 x float64, row major), the number N of distortion
+ *         coefficients (uint32), the coefficients (N x float64)
+ *  "DSET" detector settings, written before the first frame and then before every frame detected
+ *         with different settings (the detector sessions learn their window sizes, and the
+ *         quality controller changes the decimation): dictionary (int32), marker length in
+ *         meters (float64), adaptive threshold constant (float64), min and max marker perimeter
+ *         rates (2 x float64), decimation (int32), corner refinement method of the detector
+ *         (int32), half size of the corner refinement window (int32), the number N of adaptive
+ *         threshold window sizes run (uint32), the sizes (N x int32), the number M of additional
+ *         dictionaries (uint32), the dictionaries (M x int32)
+ *  "FRAM" a frame: frame number (uint64), timestamp (int64, unix epoch microseconds), width,
+ *         height, OpenCV type (3 x int32), then the pixels, row by row without padding
+ *         (width * height * pixel size bytes)
+ *  "STAT" written when the recording is closed: recorded frames (uint64), dropped frames
+ *         (uint64)
+ *
+ * Readers must skip the chunks with unknown tags, using their size.
+ */
+constexpr char SESSION_RECORDING_MAGIC[4] = {'A', 'S', 'R', 'C'};
+constexpr uint32_t SESSION_RECORDING_VERSION = 1;
+
+/**
+ * Default number of frame buffers of a recorder: about half a second of frames can wait to be
+ * written before new frames are dropped.
+ */
+constexpr int SESSION_RECORDER_DEFAULT_POOL_SIZE = 16;
+
+/**
+ * Size of the stdio buffer of the recording file.
+ */
+constexpr size_t SESSION_RECORDER_FILE_BUFFER = 1 << 20;
+
+/**
+ * Number of counters written by SessionRecorder::stats.
+ */
+constexpr int SESSION_RECORDER_STATS_SIZE = 5;
+
+/**
+ * A SessionRecorder writes the input frames of the pipeline (or only their luma plane) on a
+ * recording file, for offline analysis and replay.
+ *
+ * The frame workers never wait for the disk: submit() takes a free buffer of a bounded pool,
+ * copies the frame in it and queues it for the writer thread; if no buffer is free (the disk is
+ * slower than the camera) the frame is dropped and counted. The buffers are allocated once, at
+ * the first frame, so recording does not allocate on the frame path; the locks are held only to
+ * move a buffer between the free list and the queue, never during a copy or a write.
+ *
+ * The recording is complete (with its "STAT" chunk) only after finish(), which the owner must
+ * call when the session ends.
+ */
+class SessionRecorder {
+public:
+    /**
+     * @param path the path of the recording file (overwritten if it exists)
+     * @param grayOnly if true, only the luma plane of the frames is recorded (a quarter of the
+     *                 size of the RGBA frames)
+     * @param poolSize the number of frame buffers
+     * @param cameraMatrix, distCoeffs the calibration of the camera
+     * @param markerDictionary, markerLength the settings of the detector
+     */
+    SessionRecorder(const std::string &path,
+                    bool grayOnly,
+                    int poolSize,
+                    const cv::Mat &cameraMatrix,
+                    const cv::Mat &distCoeffs,
+                    int markerDictionary,
+                    double markerLength) :
+            grayOnly(grayOnly),
+            markerDictionary(markerDictionary),
+            markerLength(markerLength),
+            buffers(std::max(1, poolSize)),
+            running(true),
+            recorded(0),
+            dropped(0),
+            bytesWritten(0),
+            maxQueued(0),
+            writeFailed(false) {
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            __android_log_print(ANDROID_LOG_ERROR, "SessionRecorder", "cannot open %s",
+                                path.c_str());
+            writeFailed = true;
+        } else {
+            setvbuf(file, nullptr, _IOFBF, SESSION_RECORDER_FILE_BUFFER);
+            writeHeader();
+            writeCalibration(cameraMatrix, distCoeffs);
+        }
+        for (FrameBuffer &buffer : buffers) {
+            freeBuffers.push_back(&buffer);
+        }
+        writer = std::thread([this] { writeFrames(); });
+    }
+
+    SessionRecorder(const SessionRecorder &) = delete;
+
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    ~SessionRecorder() {
+        finish();
+    }
+
+    /**
+     * Writes the queued frames and the final counters, and closes the recording; the frames
+     * submitted afterwards are dropped. Does nothing if the recording is already finished; must
+     * not be called concurrently with itself.
+     */
+    void finish() {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        queued.notify_one();
+        writer.join();
+        if (file != nullptr) {
+            unsigned char payload[16];
+            uint64_t recordedFrames = recorded.load(), droppedFrames = dropped.load();
+            memcpy(payload, &recordedFrames, 8);
+            memcpy(payload + 8, &droppedFrames, 8);
+            writeChunk("STAT", payload, sizeof(payload));
+            if (fclose(file) != 0) {
+                writeFailed = true;
+            }
+            file = nullptr;
+        }
+    }
+
+    /**
+     * Queues a frame for recording, or drops it if all the buffers are in use.
+     *
+     * @param inputMat the RGBA input frame
+     * @param grayMat the luma plane of the same frame (already computed by the detection), used
+     *                when recording only the luma plane
+     * @param detector the session which detected the markers of the frame, whose settings are
+     *                 recorded with it, or nullptr to keep the settings of the previous frame
+     * @return false if the frame was dropped
+     */
+    bool submit(uint64_t frameNumber, int64_t timestampUs,
+                const cv::Mat &inputMat, const cv::Mat &grayMat,
+                const DetectorSession *detector) {
+        if (writeFailed.load(std::memory_order_relaxed)) {
+            dropped++;
+            return false;
+        }
+        FrameBuffer *buffer;
+        {
+            std::unique_lock<std::mutex> lock(freeMutex);
+            if (freeBuffers.empty()) {
+                lock.unlock();
+                dropped++;
+                return false;
+            }
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+
+        // the copy is done outside the locks; after the first frame it does not allocate
+        (grayOnly ? grayMat : inputMat).copyTo(buffer->pixels);
+        buffer->frameNumber = frameNumber;
+        buffer->timestampUs = timestampUs;
+        buffer->hasSettings = detector != nullptr;
+        if (detector != nullptr) {
+            detector->settings(buffer->settings);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (!running) {
+                // finished, the writer is gone
+                lock.unlock();
+                dropped++;
+                std::unique_lock<std::mutex> freeLock(freeMutex);
+                freeBuffers.push_back(buffer);
+                return false;
+            }
+            queue.push_back(buffer);
+            if (queue.size() > maxQueued.load(std::memory_order_relaxed)) {
+                maxQueued.store(queue.size(), std::memory_order_relaxed);
+            }
+        }
+        queued.notify_one();
+        return true;
+    }
+
+    /**
+     * Writes on out: [0] recorded frames, [1] dropped frames, [2] bytes written, [3] the maximum
+     * number of frames which waited to be written, [4] 1 if a write failed.
+     */
+    void stats(jlong *out) const {
+        out[0] = (jlong) recorded.load();
+        out[1] = (jlong) dropped.load();
+        out[2] = (jlong) bytesWritten.load();
+        out[3] = (jlong) maxQueued.load();
+        out[4] = writeFailed.load() ? 1 : 0;
+    }
+
+private:
+    struct FrameBuffer {
+        cv::Mat pixels;
+        uint64_t frameNumber = 0;
+        int64_t timestampUs = 0;
+        DetectorSettings settings;
+        bool hasSettings = false;
+    };
+
+    template<typename T>
+    static void append(std::vector<unsigned char> &payload, T value) {
+        const auto *bytes = reinterpret_cast<const unsigned char *>(&value);
+        payload.insert(payload.end(), bytes, bytes + sizeof(T));
+    }
+
+    void write(const void *data, size_t size) {
+        if (file == nullptr || writeFailed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (fwrite(data, 1, size, file) != size) {
+            __android_log_print(ANDROID_LOG_ERROR, "SessionRecorder",
+                                "write failed, recording stopped");
+            writeFailed = true;
+            return;
+        }
+        bytesWritten += size;
+    }
+
+    void writeChunkHeader(const char tag[4], uint64_t payloadSize) {
+        unsigned char header[16] = {};
+        memcpy(header, tag, 4);
+        memcpy(header + 8, &payloadSize, 8);
+        write(header, sizeof(header));
+    }
+
+    void writeChunk(const char tag[4], const void *payload, size_t size) {
+        writeChunkHeader(tag, size);
+        write(payload, size);
+    }
+
+    void writeHeader() {
+        unsigned char header[16] = {};
+        uint32_t version = SESSION_RECORDING_VERSION;
+        memcpy(header, SESSION_RECORDING_MAGIC, 4);
+        memcpy(header + 4, &version, 4);
+        write(header, sizeof(header));
+    }
+
+    void writeCalibration(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs) {
+        std::vector<unsigned char> payload;
+        cv::Mat_<double> matrix, coefficients;
+        cameraMatrix.convertTo(matrix, CV_64F);
+        distCoeffs.convertTo(coefficients, CV_64F);
+        for (int i = 0; i < 9; i++) {
+            append<double>(payload, matrix(i / 3, i % 3));
+        }
+        auto coefficientsCount = (uint32_t) coefficients.total();
+        append<uint32_t>(payload, coefficientsCount);
+        for (uint32_t i = 0; i < coefficientsCount; i++) {
+            append<double>(payload, coefficients((int) i));
+        }
+        writeChunk("CALB", payload.data(), payload.size());
+    }
+
+    void writeDetectorSettings(const DetectorSettings &settings) {
+        settingsPayload.clear();
+        append<int32_t>(settingsPayload, markerDictionary);
+        append<double>(settingsPayload, markerLength);
+        append<double>(settingsPayload, settings.adaptiveThreshConstant);
+        append<double>(settingsPayload, settings.minMarkerPerimeterRate);
+        append<double>(settingsPayload, settings.maxMarkerPerimeterRate);
+        append<int32_t>(settingsPayload, settings.decimation);
+        append<int32_t>(settingsPayload, settings.cornerRefinementMethod);
+        append<int32_t>(settingsPayload, settings.refinementWindowSize);
+        append<uint32_t>(settingsPayload, (uint32_t) settings.windowSizeCount);
+        for (int i = 0; i < settings.windowSizeCount; i++) {
+            append<int32_t>(settingsPayload, settings.windowSizes[i]);
+        }
+        append<uint32_t>(settingsPayload, (uint32_t) settings.extraDictionaryCount);
+        for (int i = 0; i < settings.extraDictionaryCount; i++) {
+            append<int32_t>(settingsPayload, settings.extraDictionaryIds[i]);
+        }
+        writeChunk("DSET", settingsPayload.data(), settingsPayload.size());
+        writtenSettings = settings;
+        settingsWritten = true;
+    }
+
+    void writeFrame(const FrameBuffer &buffer) {
+        const cv::Mat &pixels = buffer.pixels;
+        size_t rowSize = pixels.cols * pixels.elemSize();
+        unsigned char header[28];
+        int32_t width = pixels.cols, height = pixels.rows, type = pixels.type();
+        memcpy(header, &buffer.frameNumber, 8);
+        memcpy(header + 8, &buffer.timestampUs, 8);
+        memcpy(header + 16, &width, 4);
+        memcpy(header + 20, &height, 4);
+        memcpy(header + 24, &type, 4);
+        writeChunkHeader("FRAM", sizeof(header) + rowSize * pixels.rows);
+        write(header, sizeof(header));
+        if (pixels.isContinuous()) {
+            write(pixels.data, rowSize * pixels.rows);
+        } else {
+            for (int row = 0; row < pixels.rows; row++) {
+                write(pixels.ptr(row), rowSize);
+            }
+        }
+    }
+
+    void writeFrames() {
+        while (true) {
+            FrameBuffer *buffer;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queued.wait(lock, [this] { return !queue.empty() || !running; });
+                if (queue.empty()) {
+                    return; // stopped, and everything was written
+                }
+                buffer = queue.front();
+                queue.pop_front();
+            }
+
+            if (buffer->hasSettings &&
+                (!settingsWritten || buffer->settings != writtenSettings)) {
+                writeDetectorSettings(buffer->settings);
+            } else if (!settingsWritten) {
+                writeDetectorSettings(DetectorSettings());
+            }
+            writeFrame(*buffer);
+            if (!writeFailed.load()) {
+                recorded++;
+            } else {
+                dropped++;
+            }
+
+            std::unique_lock<std::mutex> lock(freeMutex);
+            freeBuffers.push_back(buffer);
+        }
+    }
+
+    const bool grayOnly;
+    const int markerDictionary;
+    const double markerLength;
+    FILE *file;
+
+    std::vector<FrameBuffer> buffers;
+    std::mutex freeMutex;
+    std::vector<FrameBuffer *> freeBuffers;
+    std::mutex queueMutex;
+    std::condition_variable queued;
+    std::deque<FrameBuffer *> queue;
+
+    std::thread writer;
+    bool running; // guarded by queueMutex
+    // used by the writer thread only
+    DetectorSettings writtenSettings;
+    bool settingsWritten = false;
+    std::vector<unsigned char> settingsPayload;
+
+    std::atomic<uint64_t> recorded;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> maxQueued; // written under queueMutex
+    std::atomic<bool> writeFailed;
+};
+
+SessionRecorder *castToSessionRecorderPtr(jlong addr) {
+    return (SessionRecorder *) addr;
+}
+
+/**
+ * A frame in the index of a recording.
+ */
+struct RecordedFrame {
+    uint64_t frameNumber;
+    int64_t timestampUs;
+    int width, height, type;
+    int64_t pixelsOffset; // offset of the pixels in the file
+};
+
+/**
+ * Reader of the recordings written by a SessionRecorder. open() reads the calibration and the
+ * detector settings, and indexes the frames reading only the chunk headers; the frames are then
+ * read with positional reads, so several threads can read the frames of the same recording at
+ * the same time. A recording truncated by a crash is read up to its last complete chunk.
+ */
+class SessionRecordingReader {
+public:
+    SessionRecordingReader() = default;
+
+    SessionRecordingReader(const SessionRecordingReader &) = delete;
+
+    SessionRecordingReader &operator=(const SessionRecordingReader &) = delete;
+
+    ~SessionRecordingReader() {
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+
+    /**
+     * @return false if the file cannot be read, is not a recording (or a recording of another
+     *         version), or has no calibration
+     */
+    bool open(const std::string &path) {
+        file = fopen(path.c_str(), "rb");
+        if (file == nullptr || fseeko(file, 0, SEEK_END) != 0) {
+            return false;
+        }
+        int64_t fileSize = ftello(file);
+        unsigned char header[16];
+        if (!readAt(0, header, sizeof(header)) ||
+            memcmp(header, SESSION_RECORDING_MAGIC, 4) != 0) {
+            return false;
+        }
+        uint32_t version;
+        memcpy(&version, header + 4, 4);
+        if (version != SESSION_RECORDING_VERSION) {
+            return false;
+        }
+
+        std::vector<unsigned char> payload;
+        int64_t offset = sizeof(header);
+        unsigned char chunkHeader[16];
+        while (offset + 16 <= fileSize && readAt(offset, chunkHeader, sizeof(chunkHeader))) {
+            uint64_t size;
+            memcpy(&size, chunkHeader + 8, 8);
+            int64_t payloadOffset = offset + 16;
+            if (size > (uint64_t) (fileSize - payloadOffset)) {
+                break; // truncated
+            }
+            if (memcmp(chunkHeader, "FRAM", 4) == 0) {
+                indexFrame(payloadOffset, size);
+            } else if (memcmp(chunkHeader, "CALB", 4) == 0 ||
+                       memcmp(chunkHeader, "DSET", 4) == 0) {
+                payload.resize(size);
+                if (!readAt(payloadOffset, payload.data(), size)) {
+                    break;
+                }
+                if (chunkHeader[0] == 'C') {
+                    readCalibration(payload);
+                } else {
+                    readDetectorSettings(payload);
+                }
+            }
+            offset = payloadOffset + (int64_t) size;
+        }
+        return !cameraMatrix.empty();
+    }
+
+    /**
+     * Reads the pixels of a frame of the index; out is reallocated only if its size or type
+     * change. Can be called by several threads at the same time.
+     */
+    bool readFrame(const RecordedFrame &frame, cv::Mat &out) const {
+        out.create(frame.height, frame.width, frame.type);
+        return readAt(frame.pixelsOffset, out.data, out.total() * out.elemSize());
+    }
+
+    cv::Mat cameraMatrix, distCoeffs;
+    int markerDictionary = 0;
+    double markerLength = 0.0;
+    std::vector<int> extraDictionaries; // additional dictionaries of the detector
+    std::vector<RecordedFrame> frames; // in recording order
+
+private:
+    bool readAt(int64_t offset, void *data, size_t size) const {
+        auto *bytes = (unsigned char *) data;
+        while (size > 0) {
+            ssize_t read = pread(fileno(file), bytes, size, (off_t) offset);
+            if (read <= 0) {
+                return false;
+            }
+            bytes += read;
+            offset += read;
+            size -= read;
+        }
+        return true;
+    }
+
+    void indexFrame(int64_t payloadOffset, uint64_t size) {
+        unsigned char header[28];
+        if (size < sizeof(header) || !readAt(payloadOffset, header, sizeof(header))) {
+            return;
+        }
+        RecordedFrame frame;
+        memcpy(&frame.frameNumber, header, 8);
+        memcpy(&frame.timestampUs, header + 8, 8);
+        memcpy(&frame.width, header + 16, 4);
+        memcpy(&frame.height, header + 20, 4);
+        memcpy(&frame.type, header + 24, 4);
+        frame.pixelsOffset = payloadOffset + sizeof(header);
+        if (frame.width > 0 && frame.height > 0 &&
+            size == sizeof(header) + (uint64_t) frame.width * frame.height *
+                                     CV_ELEM_SIZE(frame.type)) {
+            frames.push_back(frame);
+        }
+    }
+
+    void readCalibration(const std::vector<unsigned char> &payload) {
+        uint32_t coefficientsCount;
+        if (payload.size() < 9 * 8 + 4) {
+            return;
+        }
+        memcpy(&coefficientsCount, payload.data() + 9 * 8, 4);
+        if (payload.size() < 9 * 8 + 4 + coefficientsCount * 8) {
+            return;
+        }
+        cameraMatrix.create(3, 3, CV_64F);
+        memcpy(cameraMatrix.data, payload.data(), 9 * 8);
+        distCoeffs.create(1, coefficientsCount, CV_64F);
+        memcpy(distCoeffs.data, payload.data() + 9 * 8 + 4, coefficientsCount * 8);
+    }
+
+    void readDetectorSettings(const std::vector<unsigned char> &payload) {
+        if (payload.size() < 12) {
+            return;
+        }
+        memcpy(&markerDictionary, payload.data(), 4);
+        memcpy(&markerLength, payload.data() + 4, 8);
+        // skips the scalar settings and the window sizes, which the replay learns again
+        size_t offset = 12 + 3 * 8 + 3 * 4;
+        uint32_t count;
+        if (payload.size() < offset + 4) {
+            return;
+        }
+        memcpy(&count, payload.data() + offset, 4);
+        offset += 4 + (size_t) count * 4;
+        if (payload.size() < offset + 4) {
+            return;
+        }
+        memcpy(&count, payload.data() + offset, 4);
+        offset += 4;
+        if (payload.size() < offset + (size_t) count * 4) {
+            return;
+        }
+        extraDictionaries.resize(count);
+        memcpy(extraDictionaries.data(), payload.data() + offset, (size_t) count * 4);
+    }
+
+    FILE *file = nullptr;
+};
+
+#endif //ARUCOSLAM_SESSIONRECORDER_H
@@ -0,0 +1,126 @@
+//
+// Cheap sharpness measure of the frames, used to skip the detection on motion-blurred ones.
+//
+
+#ifndef ARUCOSLAM_SHARPNESSGATE_H
+#define ARUCOSLAM_SHARPNESSGATE_H
+
+#include <jni.h>
+#include <mutex>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "frameArena.h"
+
+/**
+ * The sharpness is measured on the luma plane decimated by this factor: blur large enough to
+ * spoil the detection survives the decimation, and the measure costs a fraction of a millisecond.
+ */
+constexpr int SHARPNESS_GATE_DECIMATION = 4;
+
+/**
+ * A frame is skipped when its sharpness is below this fraction of the reference sharpness.
+ */
+constexpr double SHARPNESS_GATE_RATIO = 0.35;
+
+/**
+ * The reference sharpness is the peak of the recent frames, decaying by this factor at each
+ * frame, so that it follows the changes of the scene (e.g. a less textured view) in a few seconds.
+ */
+constexpr double SHARPNESS_GATE_PEAK_DECAY = 0.98;
+
+/**
+ * No frame is skipped until the reference has seen this many frames, and never more than this
+ * many consecutive frames are skipped (a sudden drop of the sharpness may be a change of scene).
+ */
+constexpr int SHARPNESS_GATE_WARMUP_FRAMES = 10;
+constexpr int SHARPNESS_GATE_MAX_CONSECUTIVE_SKIPS = 5;
+
+/**
+ * Number of values written by SharpnessGate::stats().
+ */
+constexpr int SHARPNESS_GATE_STATS_SIZE = 5;
+
+/**
+ * A SharpnessGate decides whether a frame is worth the detection: motion-blurred frames give no
+ * markers, or poses that are later rejected, at the full cost of the detector. The sharpness is
+ * the variance of the Laplacian of the decimated luma plane, and the threshold adapts to the
+ * scene (a fraction of the decaying peak sharpness of the recent frames).
+ * A gate is shared by all the workers: the statistics are updated under a lock, but the measure
+ * itself is done outside of it, on the buffers of the arena of the worker.
+ */
+class SharpnessGate {
+public:
+    explicit SharpnessGate(double ratio = SHARPNESS_GATE_RATIO) : ratio(ratio) {}
+
+    /**
+     * @return the sharpness of the grayscale frame (variance of the Laplacian of the decimated
+     *         frame)
+     */
+    static double measure(const cv::Mat &gray, FrameArena &arena) {
+        cv::Mat &decimated = arena.imageBuffer(
+                FRAME_ARENA_SHARPNESS_BUFFER,
+                cv::Size(gray.cols / SHARPNESS_GATE_DECIMATION,
+                         gray.rows / SHARPNESS_GATE_DECIMATION), CV_8UC1);
+        cv::resize(gray, decimated, decimated.size(), 0, 0, cv::INTER_AREA);
+        cv::Mat &laplacian = arena.imageBuffer(FRAME_ARENA_LAPLACIAN_BUFFER, decimated.size(),
+                                               CV_16SC1);
+        cv::Laplacian(decimated, laplacian, CV_16S);
+        cv::Scalar mean, stdDev;
+        cv::meanStdDev(laplacian, mean, stdDev);
+        return stdDev[0] * stdDev[0];
+    }
+
+    /**
+     * Records the sharpness of a frame and decides whether the frame is processed.
+     *
+     * @return false if the frame should be skipped
+     */
+    bool accept(double sharpness) {
+        std::unique_lock<std::mutex> lock(mutex);
+        frames++;
+        lastSharpness = sharpness;
+        peak = std::max(sharpness, peak * SHARPNESS_GATE_PEAK_DECAY);
+        bool blurred = frames > SHARPNESS_GATE_WARMUP_FRAMES &&
+                       sharpness < ratio * peak &&
+                       consecutiveSkips < SHARPNESS_GATE_MAX_CONSECUTIVE_SKIPS;
+        if (blurred) {
+            skipped++;
+            consecutiveSkips++;
+        } else {
+            consecutiveSkips = 0;
+        }
+        return !blurred;
+    }
+
+    /**
+     * Writes SHARPNESS_GATE_STATS_SIZE values on out: the number of gated frames, of skipped
+     * frames, the sharpness of the last frame, the current threshold and the reference (peak)
+     * sharpness.
+     */
+    void stats(double *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        out[0] = frames;
+        out[1] = skipped;
+        out[2] = lastSharpness;
+        out[3] = ratio * peak;
+        out[4] = peak;
+    }
+
+private:
+    const double ratio;
+    std::mutex mutex;
+    long long frames = 0;
+    long long skipped = 0;
+    int consecutiveSkips = 0;
+    double lastSharpness = 0.0;
+    double peak = 0.0;
+};
+
+SharpnessGate *castToSharpnessGatePtr(jlong addr) {
+    return (SharpnessGate *) addr;
+}
+
+#endif //ARUCOSLAM_SHARPNESSGATE_H
@@ -0,0 +1,189 @@
+//
+// Uniform grid over the positions of the markers, for spatial queries on large maps.
+//
+
+#ifndef ARUCOSLAM_SPATIALGRID_H
+#define ARUCOSLAM_SPATIALGRID_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+/**
+ * Side length (in meters) of the cells of the grid: a few markers per cell in a room-scale map.
+ */
+constexpr double SPATIAL_GRID_CELL_SIZE = 2.0;
+
+/**
+ * Cell coordinates are packed in 21 bits each, so the grid covers about +-2000 km per axis.
+ */
+constexpr int SPATIAL_GRID_COORDINATE_BITS = 21;
+constexpr int64_t SPATIAL_GRID_COORDINATE_OFFSET = int64_t(1) << (SPATIAL_GRID_COORDINATE_BITS - 1);
+
+/**
+ * A SpatialGrid buckets point indices by the cell of a uniform 3D grid they fall in; only the
+ * occupied cells are stored (in a hash map), so its size does not depend on the extent of the
+ * world. A query visits the cells overlapping the queried region (or the occupied cells, when
+ * they are fewer), so its cost depends on the number of points near the region, not on the
+ * total number of points.
+ * The grid stores indices only: the positions are passed to the queries, which test each
+ * candidate exactly.
+ */
+class SpatialGrid {
+public:
+    explicit SpatialGrid(double cellSize = SPATIAL_GRID_CELL_SIZE) : cellSize(cellSize) {}
+
+    void insert(int index, const cv::Vec3d &position) {
+        cells[cellKey(position)].push_back(index);
+    }
+
+    void remove(int index, const cv::Vec3d &position) {
+        auto cell = cells.find(cellKey(position));
+        if (cell == cells.end()) {
+            return;
+        }
+        std::vector<int> &indices = cell->second;
+        indices.erase(std::remove(indices.begin(), indices.end(), index), indices.end());
+        if (indices.empty()) {
+            cells.erase(cell);
+        }
+    }
+
+    size_t occupiedCells() const { return cells.size(); }
+
+    /**
+     * Appends to out the indices of the points inside the view frustum of a pinhole camera
+     * (without distortion), i.e. the ones at a depth in [near, far] which project inside the
+     * viewport enlarged by margin pixels on each side.
+     *
+     * @param rvec, tvec transformation from room's coord sys to camera's coord sys
+     * @param cameraMatrix the intrinsic parameters of the camera
+     * @param viewport the visible region, in pixels
+     */
+    template<typename OUT>
+    void queryFrustum(const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                      const cv::Matx33d &cameraMatrix, const cv::Rect2d &viewport,
+                      double near, double far, double margin,
+                      const std::vector<cv::Vec3d> &positions, OUT &out) const {
+        cv::Matx33d rotation;
+        cv::Rodrigues(rvec, rotation);
+        double fx = cameraMatrix(0, 0), fy = cameraMatrix(1, 1);
+        double cx = cameraMatrix(0, 2), cy = cameraMatrix(1, 2);
+        double minU = viewport.x - margin, maxU = viewport.x + viewport.width + margin;
+        double minV = viewport.y - margin, maxV = viewport.y + viewport.height + margin;
+
+        // bounding box (in the room) of the 8 corners of the frustum
+        cv::Matx33d rotationT = rotation.t();
+        cv::Vec3d minCorner(INFINITY, INFINITY, INFINITY), maxCorner(-INFINITY, -INFINITY, -INFINITY);
+        double depths[2] = {near, far};
+        double us[2] = {minU, maxU}, vs[2] = {minV, maxV};
+        for (double depth : depths) {
+            for (double u : us) {
+                for (double v : vs) {
+                    cv::Vec3d inCamera((u - cx) / fx * depth, (v - cy) / fy * depth, depth);
+                    cv::Vec3d inRoom = rotationT * (inCamera - tvec);
+                    for (int axis = 0; axis < 3; axis++) {
+                        minCorner[axis] = std::min(minCorner[axis], inRoom[axis]);
+                        maxCorner[axis] = std::max(maxCorner[axis], inRoom[axis]);
+                    }
+                }
+            }
+        }
+
+        forEachCandidate(minCorner, maxCorner, [&](int index) {
+            cv::Vec3d inCamera = rotation * positions[index] + tvec;
+            if (inCamera[2] < near || inCamera[2] > far) {
+                return;
+            }
+            double u = fx * inCamera[0] / inCamera[2] + cx;
+            double v = fy * inCamera[1] / inCamera[2] + cy;
+            if (u >= minU && u <= maxU && v >= minV && v <= maxV) {
+                out.push_back(index);
+            }
+        });
+    }
+
+private:
+    int64_t cellCoordinate(double value) const {
+        auto coordinate = static_cast<int64_t>(std::floor(value / cellSize));
+        return std::max(-SPATIAL_GRID_COORDINATE_OFFSET,
+                        std::min(SPATIAL_GRID_COORDINATE_OFFSET - 1, coordinate));
+    }
+
+    static uint64_t packKey(int64_t x, int64_t y, int64_t z) {
+        return (uint64_t(x + SPATIAL_GRID_COORDINATE_OFFSET) << (2 * SPATIAL_GRID_COORDINATE_BITS)) |
+               (uint64_t(y + SPATIAL_GRID_COORDINATE_OFFSET) << SPATIAL_GRID_COORDINATE_BITS) |
+               uint64_t(z + SPATIAL_GRID_COORDINATE_OFFSET);
+    }
+
+    static int64_t unpackCoordinate(uint64_t key, int shift) {
+        return int64_t((key >> shift) & ((uint64_t(1) << SPATIAL_GRID_COORDINATE_BITS) - 1)) -
+               SPATIAL_GRID_COORDINATE_OFFSET;
+    }
+
+    uint64_t cellKey(const cv::Vec3d &position) const {
+        return packKey(cellCoordinate(position[0]), cellCoordinate(position[1]),
+                       cellCoordinate(position[2]));
+    }
+
+    /**
+     * Calls visit on the indices in the cells overlapping the box; the cells are enumerated by
+     * coordinates or, when the box spans more cells than the occupied ones, by scanning the
+     * occupied cells.
+     */
+    template<typename VISIT>
+    void forEachCandidate(const cv::Vec3d &minCorner, const cv::Vec3d &maxCorner,
+                          VISIT visit) const {
+        if (cells.empty()) {
+            return;
+        }
+        int64_t minCell[3], maxCell[3];
+        double boxCells = 1.0;
+        for (int axis = 0; axis < 3; axis++) {
+            minCell[axis] = cellCoordinate(minCorner[axis]);
+            maxCell[axis] = cellCoordinate(maxCorner[axis]);
+            if (maxCell[axis] < minCell[axis]) {
+                return;
+            }
+            boxCells *= double(maxCell[axis] - minCell[axis] + 1);
+        }
+
+        if (boxCells > double(cells.size())) {
+            for (const auto &cell : cells) {
+                int64_t x = unpackCoordinate(cell.first, 2 * SPATIAL_GRID_COORDINATE_BITS);
+                int64_t y = unpackCoordinate(cell.first, SPATIAL_GRID_COORDINATE_BITS);
+                int64_t z = unpackCoordinate(cell.first, 0);
+                if (x >= minCell[0] && x <= maxCell[0] && y >= minCell[1] && y <= maxCell[1] &&
+                    z >= minCell[2] && z <= maxCell[2]) {
+                    for (int index : cell.second) {
+                        visit(index);
+                    }
+                }
+            }
+            return;
+        }
+
+        for (int64_t x = minCell[0]; x <= maxCell[0]; x++) {
+            for (int64_t y = minCell[1]; y <= maxCell[1]; y++) {
+                for (int64_t z = minCell[2]; z <= maxCell[2]; z++) {
+                    auto cell = cells.find(packKey(x, y, z));
+                    if (cell != cells.end()) {
+                        for (int index : cell->second) {
+                            visit(index);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    double cellSize;
+    std::unordered_map<uint64_t, std::vector<int>> cells;
+};
+
+#endif //ARUCOSLAM_SPATIALGRID_H
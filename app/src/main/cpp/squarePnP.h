@@ -0,0 +1,264 @@
+//
+// Analytic pose estimation of square markers (IPPE, infinitesimal plane-based pose estimation).
+//
+
+#ifndef ARUCOSLAM_SQUAREPNP_H
+#define ARUCOSLAM_SQUAREPNP_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "utils.h"
+#include "frameContext.h"
+#include "markerSizes.h"
+#include "observationQuality.h"
+
+/**
+ * Ambiguity (see FrameContext::detectedAmbiguities) above which the alternative pose of a marker is
+ * considered plausible: the reprojection errors of the two solutions differ by less than this
+ * factor.
+ */
+constexpr double SQUARE_PNP_AMBIGUITY_THRESHOLD = 0.5;
+
+/**
+ * A pose of a square w.r.t. the camera, with its reprojection error (in normalized image
+ * coordinates, squared and summed over the 4 corners).
+ */
+struct SquarePose {
+    cv::Vec3d rvec, tvec;
+    double error = std::numeric_limits<double>::infinity();
+};
+
+/**
+ * Homography from the plane of a square of side 2 * halfLength, centered in the origin, to its 4
+ * corners (same order of the corners used by estimatePoseSingleMarkers), in closed form: the
+ * square-to-quadrilateral mapping of the unit square, composed with the similarity from the
+ * square to the unit square.
+ *
+ * @return false if the corners are degenerate
+ */
+bool squareHomography(const cv::Point2f *corners, double halfLength, cv::Matx33d &homography) {
+    double x0 = corners[0].x, y0 = corners[0].y, x1 = corners[1].x, y1 = corners[1].y;
+    double x2 = corners[2].x, y2 = corners[2].y, x3 = corners[3].x, y3 = corners[3].y;
+    double dx1 = x1 - x2, dx2 = x3 - x2, sx = x0 - x1 + x2 - x3;
+    double dy1 = y1 - y2, dy2 = y3 - y2, sy = y0 - y1 + y2 - y3;
+    double det = dx1 * dy2 - dx2 * dy1;
+    if (std::abs(det) < 1e-12) {
+        return false;
+    }
+    double g = (sx * dy2 - dx2 * sy) / det;
+    double h = (dx1 * sy - sx * dy1) / det;
+    cv::Matx33d unitSquareToQuad(x1 - x0 + g * x1, x3 - x0 + h * x3, x0,
+                                 y1 - y0 + g * y1, y3 - y0 + h * y3, y0,
+                                 g, h, 1.0);
+    // corner 0 (-l, l) goes to (0, 0) of the unit square, corner 2 (l, -l) to (1, 1)
+    double scale = 1.0 / (2.0 * halfLength);
+    cv::Matx33d squareToUnitSquare(scale, 0.0, 0.5,
+                                   0.0, -scale, 0.5,
+                                   0.0, 0.0, 1.0);
+    homography = unitSquareToQuad * squareToUnitSquare;
+    return std::abs(homography(2, 2)) > 1e-12;
+}
+
+/**
+ * Least squares translation of a square with the given rotation, from the projection equations
+ * of its corners (linear in the translation once the rotation is known).
+ */
+cv::Vec3d squareTranslation(const cv::Matx33d &rotation, const cv::Point3d *objectPoints,
+                            const cv::Point2f *corners) {
+    cv::Matx33d normalMatrix = cv::Matx33d::zeros();
+    cv::Vec3d normalVector(0.0, 0.0, 0.0);
+    for (int i = 0; i < 4; i++) {
+        cv::Vec3d rotated = rotation * cv::Vec3d(objectPoints[i].x, objectPoints[i].y, 0.0);
+        double u = corners[i].x, v = corners[i].y;
+        // [1, 0, -u] t = u * z - x,  [0, 1, -v] t = v * z - y
+        cv::Vec3d rowU(1.0, 0.0, -u), rowV(0.0, 1.0, -v);
+        double rightU = u * rotated[2] - rotated[0], rightV = v * rotated[2] - rotated[1];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                normalMatrix(r, c) += rowU[r] * rowU[c] + rowV[r] * rowV[c];
+            }
+            normalVector[r] += rowU[r] * rightU + rowV[r] * rightV;
+        }
+    }
+    return normalMatrix.inv() * normalVector;
+}
+
+/**
+ * Computes the two poses of a square of the given side length which are compatible with its 4
+ * corners, in normalized (undistorted) image coordinates, with IPPE: the rotations are obtained
+ * in closed form from the jacobian of the plane-to-image homography at the center of the square
+ * (the two solutions are its mirror images w.r.t. the line of sight, the classic ambiguity of
+ * small or distant planar targets), and the translations by linear least squares.
+ * The solutions are sorted by reprojection error; a solution placing the square behind the
+ * camera gets an infinite error.
+ *
+ * @return false if the corners are degenerate
+ */
+bool solveSquarePose(const cv::Point2f *corners, double length, SquarePose solutions[2]) {
+    double halfLength = length / 2.0;
+    cv::Matx33d homography;
+    if (!squareHomography(corners, halfLength, homography)) {
+        return false;
+    }
+
+    // projection of the center of the square, and jacobian of the homography there
+    double p = homography(0, 2) / homography(2, 2);
+    double q = homography(1, 2) / homography(2, 2);
+    double j00 = (homography(0, 0) - homography(2, 0) * p) / homography(2, 2);
+    double j01 = (homography(0, 1) - homography(2, 1) * p) / homography(2, 2);
+    double j10 = (homography(1, 0) - homography(2, 0) * q) / homography(2, 2);
+    double j11 = (homography(1, 1) - homography(2, 1) * q) / homography(2, 2);
+
+    // rotation bringing the optical axis onto the line of sight of the center
+    cv::Matx33d rv = cv::Matx33d::eye();
+    double t = std::sqrt(p * p + q * q);
+    if (t > 1e-12) {
+        double s = std::sqrt(p * p + q * q + 1.0);
+        double cosTheta = 1.0 / s;
+        double sinTheta = std::sqrt(1.0 - 1.0 / (s * s));
+        cv::Matx33d k(0.0, 0.0, p / t,
+                      0.0, 0.0, q / t,
+                      -p / t, -q / t, 0.0);
+        rv = cv::Matx33d::eye() + sinTheta * k + (1.0 - cosTheta) * (k * k);
+    }
+
+    // a = b^-1 * j, where b = [I | -(p, q)] * (first two columns of rv)
+    double b00 = rv(0, 0) - p * rv(2, 0), b01 = rv(0, 1) - p * rv(2, 1);
+    double b10 = rv(1, 0) - q * rv(2, 0), b11 = rv(1, 1) - q * rv(2, 1);
+    double bDet = b00 * b11 - b01 * b10;
+    if (std::abs(bDet) < 1e-12) {
+        return false;
+    }
+    double a00 = (b11 * j00 - b01 * j10) / bDet, a01 = (b11 * j01 - b01 * j11) / bDet;
+    double a10 = (-b10 * j00 + b00 * j10) / bDet, a11 = (-b10 * j01 + b00 * j11) / bDet;
+
+    // largest singular value of a: the scale of the upper left 2x2 block of the rotation
+    double aa = a00 * a00 + a01 * a01, cc = a10 * a10 + a11 * a11, ac = a00 * a10 + a01 * a11;
+    double gamma = std::sqrt(0.5 * (aa + cc + std::sqrt((aa - cc) * (aa - cc) + 4 * ac * ac)));
+    if (gamma < 1e-12) {
+        return false;
+    }
+    double r00 = a00 / gamma, r01 = a01 / gamma, r10 = a10 / gamma, r11 = a11 / gamma;
+    double c0 = std::sqrt(std::max(0.0, 1.0 - r00 * r00 - r10 * r10));
+    double c1 = std::sqrt(std::max(0.0, 1.0 - r01 * r01 - r11 * r11));
+    if (-r00 * r01 - r10 * r11 < 0) {
+        c1 = -c1;
+    }
+
+    cv::Point3d objectPoints[4] = {
+            cv::Point3d(-halfLength, halfLength, 0),
+            cv::Point3d(halfLength, halfLength, 0),
+            cv::Point3d(halfLength, -halfLength, 0),
+            cv::Point3d(-halfLength, -halfLength, 0),
+    };
+    for (int k = 0; k < 2; k++) {
+        double sign = k == 0 ? 1.0 : -1.0;
+        cv::Vec3d column0(r00, r10, sign * c0), column1(r01, r11, sign * c1);
+        cv::Vec3d column2 = column0.cross(column1);
+        cv::Matx33d rotation = rv * cv::Matx33d(column0[0], column1[0], column2[0],
+                                                column0[1], column1[1], column2[1],
+                                                column0[2], column1[2], column2[2]);
+        SquarePose &solution = solutions[k];
+        solution.tvec = squareTranslation(rotation, objectPoints, corners);
+        cv::Rodrigues(rotation, solution.rvec);
+
+        solution.error = 0.0;
+        for (int i = 0; i < 4; i++) {
+            cv::Vec3d point = rotation * cv::Vec3d(objectPoints[i].x, objectPoints[i].y, 0.0) +
+                              solution.tvec;
+            if (point[2] <= 0.0) {
+                solution.error = std::numeric_limits<double>::infinity();
+                break;
+            }
+            double du = point[0] / point[2] - corners[i].x;
+            double dv = point[1] / point[2] - corners[i].y;
+            solution.error += du * du + dv * dv;
+        }
+    }
+    if (solutions[1].error < solutions[0].error) {
+        std::swap(solutions[0], solutions[1]);
+    }
+    return solutions[0].error < std::numeric_limits<double>::infinity();
+}
+
+/**
+ * Estimates, in parallel, the poses w.r.t. the camera (and the qualities) of the detected markers
+ * at the specified indices of the context, with solveSquarePose(); each marker has the side length
+ * given by the registry, or the common one.
+ * The corners of all the markers are undistorted in a single batch. Both solutions are kept in the
+ * context, with the ambiguity of the marker, so that the later stages can disambiguate the poses of
+ * the markers which are far or seen frontally; the context vectors must already have an element
+ * for each detected marker.
+ *
+ * A marker whose corners are degenerate for the analytic solver falls back to the iterative one.
+ *
+ * @param sizes the side lengths of the markers, or nullptr if they all have the common length
+ */
+template<typename INDICES>
+void estimateSquarePoses(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                         double commonLength, const MarkerSizes *sizes,
+                         const INDICES &indices, FrameContext &context) {
+    int count = indices.size();
+    if (count == 0) {
+        return;
+    }
+    const std::vector<std::vector<cv::Point2f>> &corners = context.detectedCorners;
+    ArenaVector<cv::Point2f> imageCorners((ArenaAllocator<cv::Point2f>(&context.arena)));
+    ArenaVector<cv::Point2f> normalizedCorners((ArenaAllocator<cv::Point2f>(&context.arena)));
+    imageCorners.resize(count * 4);
+    normalizedCorners.resize(count * 4);
+    for (int i = 0; i < count; i++) {
+        std::copy(corners[indices[i]].begin(), corners[indices[i]].end(),
+                  imageCorners.begin() + i * 4);
+    }
+    cv::Mat normalizedCornersMat(count * 4, 1, CV_32FC2, normalizedCorners.data());
+    cv::undistortPoints(cv::Mat(count * 4, 1, CV_32FC2, imageCorners.data()),
+                        normalizedCornersMat, cameraMatrix, distCoeffs);
+
+    // each iteration writes only the elements of its own marker
+    p_for(i, count) {
+        int index = indices[i];
+        double length = sizes != nullptr
+                        ? sizes->lengthOf(context.detectedIDs[index], commonLength)
+                        : commonLength;
+        SquarePose solutions[2];
+        if (solveSquarePose(normalizedCorners.data() + i * 4, length, solutions)) {
+            context.detectedRvecs[index] = solutions[0].rvec;
+            context.detectedTvecs[index] = solutions[0].tvec;
+            bool alternative = solutions[1].error < std::numeric_limits<double>::infinity();
+            context.detectedAlternativeRvecs[index] = alternative ? solutions[1].rvec
+                                                                  : solutions[0].rvec;
+            context.detectedAlternativeTvecs[index] = alternative ? solutions[1].tvec
+                                                                  : solutions[0].tvec;
+            context.detectedAmbiguities[index] =
+                    !alternative ? 0.0 :
+                    solutions[1].error > 0.0 ? solutions[0].error / solutions[1].error : 1.0;
+        } else {
+            float halfLength = static_cast<float>(length / 2.0);
+            cv::Point3f objectPoints[4] = {
+                    cv::Point3f(-halfLength, halfLength, 0),
+                    cv::Point3f(halfLength, halfLength, 0),
+                    cv::Point3f(halfLength, -halfLength, 0),
+                    cv::Point3f(-halfLength, -halfLength, 0),
+            };
+            cv::solvePnP(cv::Mat(4, 1, CV_32FC3, objectPoints), corners[index],
+                         cameraMatrix, distCoeffs,
+                         context.detectedRvecs[index], context.detectedTvecs[index]);
+            context.detectedAlternativeRvecs[index] = context.detectedRvecs[index];
+            context.detectedAlternativeTvecs[index] = context.detectedTvecs[index];
+            context.detectedAmbiguities[index] = 0.0;
+        }
+        context.detectedQualities[index] = observationQuality(
+                corners[index], context.detectedRvecs[index], context.detectedTvecs[index], length,
+                cameraMatrix, distCoeffs);
+    };
+}
+
+#endif //ARUCOSLAM_SQUAREPNP_H
@@ -0,0 +1,542 @@
+//
+// Concurrent processing of several independent frame streams against a shared marker map.
+//
+
+#ifndef ARUCOSLAM_STREAMSCHEDULER_H
+#define ARUCOSLAM_STREAMSCHEDULER_H
+
+#include <jni.h>
+#include <android/log.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+
+#include <opencv2/core/core.hpp>
+
+#include "framePipeline.h"
+#include "markerMap.h"
+#include "markerSizes.h"
+
+/**
+ * Default number of frames of a stream processed at the same time, and of frames waiting to be
+ * processed (when the queue is full the oldest waiting frame is dropped: only fresh frames are
+ * worth processing).
+ */
+constexpr int STREAM_DEFAULT_WORKER_BUDGET = 2;
+constexpr int STREAM_QUEUE_CAPACITY = 4;
+
+/**
+ * Number of poses kept in the track of a stream.
+ */
+constexpr size_t STREAM_TRACK_CAPACITY = 4096;
+
+/**
+ * RANSAC settings of the camera pose estimation of the streams (the full quality ones of the
+ * app).
+ */
+constexpr double STREAM_TVEC_INLIER_THRESHOLD = 0.05;
+constexpr double STREAM_TVEC_OUTLIER_PROBABILITY = 0.1;
+constexpr double STREAM_RVEC_INLIER_THRESHOLD = CV_PI / 8.0;
+constexpr double STREAM_RVEC_OUTLIER_PROBABILITY = 0.1;
+constexpr int STREAM_MAX_RANSAC_ITERATIONS = 100;
+constexpr double STREAM_OPTIMAL_MODEL_PROBABILITY = 0.9;
+
+/**
+ * Default validity constraints of the poses of the streams (the ones of the app, see
+ * PoseValidityConstraints.kt).
+ */
+constexpr double STREAM_DEFAULT_MIN_INLIERS_RATIO = 0.5;
+constexpr double STREAM_DEFAULT_MAX_SPEED = 0.8; // meters per second
+constexpr double STREAM_DEFAULT_MAX_ANGULAR_SPEED = CV_PI; // radians per second
+
+/**
+ * Number of values written by StreamScheduler::stats().
+ */
+constexpr int STREAM_STATS_SIZE = 7;
+
+/**
+ * Settings of a stream: its camera and markers, its share of the CPU and how many of its frames
+ * can be processed at the same time.
+ */
+struct StreamConfig {
+    int markerDictionary;
+    double markerLength;
+    cv::Mat cameraMatrix, distCoeffs;
+    int workerBudget = STREAM_DEFAULT_WORKER_BUDGET;
+    double weight = 1.0;
+    bool addNewMarkers = true;
+    // a pose is accepted only if at least this fraction of the known markers are RANSAC
+    // inliers, and if the camera did not move faster than this since the last pose of the stream
+    double minInliersRatio = STREAM_DEFAULT_MIN_INLIERS_RATIO;
+    double maxSpeed = STREAM_DEFAULT_MAX_SPEED;
+    double maxAngularSpeed = STREAM_DEFAULT_MAX_ANGULAR_SPEED;
+};
+
+/**
+ * A pose of the camera of a stream (room to camera).
+ */
+struct StreamPose {
+    uint64_t frameNumber;
+    int64_t timestampUs;
+    cv::Vec3d rvec, tvec;
+    int inliers;
+};
+
+/**
+ * The state of a stream: its own frame buffers, frame contexts and detector sessions (one per
+ * frame that can be in flight), its queue and its track.
+ */
+class StreamSession {
+public:
+    /**
+     * A frame of the stream with the native state used to process it.
+     */
+    struct Slot {
+        explicit Slot() : context(1 << 20), detector(nullptr) {}
+
+        cv::Mat frame, result;
+        uint64_t frameNumber = 0;
+        int64_t timestampUs = 0;
+        FrameContext context;
+        DetectorSession detector;
+    };
+
+    explicit StreamSession(const StreamConfig &config) : config(config) {
+        int slotCount = std::max(1, config.workerBudget) + STREAM_QUEUE_CAPACITY;
+        for (int i = 0; i < slotCount; i++) {
+            slots.emplace_back(new Slot());
+            freeSlots.push_back(slots.back().get());
+        }
+    }
+
+    const StreamConfig config;
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<Slot *> freeSlots;
+    std::deque<Slot *> pending;
+    int inFlight = 0;
+    int copying = 0; // frames being copied in a slot by submit()
+    bool closing = false;
+
+    // CPU time used by the stream divided by its weight: the stream with the least virtual time
+    // is served first
+    double virtualTime = 0.0;
+
+    std::deque<StreamPose> track; // ordered by frame number
+
+    jlong submitted = 0;
+    jlong processed = 0;
+    jlong dropped = 0;
+    jlong poses = 0;
+    jlong failed = 0; // frames whose processing raised an error
+    int64_t cpuTimeNs = 0;
+
+    bool runnable() const {
+        return !closing && !pending.empty() && inFlight < std::max(1, config.workerBudget);
+    }
+
+    void addPose(const StreamPose &pose) {
+        auto position = std::upper_bound(
+                track.begin(), track.end(), pose.frameNumber,
+                [](uint64_t frameNumber, const StreamPose &other) {
+                    return frameNumber < other.frameNumber;
+                });
+        track.insert(position, pose);
+        if (track.size() > STREAM_TRACK_CAPACITY) {
+            track.pop_front();
+        }
+        poses++;
+    }
+};
+
+/**
+ * A StreamScheduler runs several independent frame streams (e.g. recorded sequences, or frames
+ * relayed from several devices) in one process, all against the same marker map: each stream has
+ * its own track, detector state and worker budget, and the markers found by any stream are added
+ * to the shared map.
+ *
+ * The frames of all the streams are processed by one pool of threads, one frame per thread at a
+ * time (the frames are independent, so the throughput scales with the cores as streams are added,
+ * instead of depending on the parallel sections inside a frame). The CPU is allocated fairly:
+ * each stream is charged the CPU time of its frames divided by its weight, and an idle thread
+ * takes the next frame of the runnable stream which was charged the least (a stream is runnable
+ * when it has queued frames and fewer frames in flight than its budget).
+ *
+ * Each thread owns a reader slot of the marker map, so the frames read it without locks (the
+ * threads which do not get a slot are not started). The poses are checked as the ones of the app:
+ * enough of the known markers must be RANSAC inliers, and the camera must not move faster than
+ * the limits of the stream since its last pose; only the valid poses are tracked and used to add
+ * new markers to the map.
+ */
+class StreamScheduler {
+public:
+    /**
+     * @param threads number of processing threads; 0 for one per core. Each thread takes a
+     *                reader slot of the map: fewer threads are started if not enough slots are
+     *                free (none at all if no slot is free, see openStream())
+     * @param sizes the side lengths of the markers which differ from the one of each stream, or
+     *              nullptr
+     */
+    StreamScheduler(MarkerMap &map, int threads, MarkerSizeRegistry *sizes = nullptr) :
+            map(map), sizes(sizes) {
+        if (threads <= 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i < threads; i++) {
+            int readerSlot = map.registerReader();
+            if (readerSlot < 0) {
+                __android_log_print(ANDROID_LOG_ERROR, "StreamScheduler",
+                                    "no reader slot left on the marker map: %d of %d threads",
+                                    i, threads);
+                break;
+            }
+            workers.emplace_back([this, readerSlot] { processFrames(readerSlot); });
+        }
+    }
+
+    StreamScheduler(const StreamScheduler &) = delete;
+
+    StreamScheduler &operator=(const StreamScheduler &) = delete;
+
+    ~StreamScheduler() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            running = false;
+        }
+        frameQueued.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @return the id of the new stream, or -1 if the scheduler has no thread to process it (no
+     *         reader slot of the map was free)
+     */
+    int openStream(const StreamConfig &config) {
+        if (workers.empty()) {
+            return -1;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        auto *stream = new StreamSession(config);
+        // a new stream starts from the least charged one, so it does not take the whole CPU to
+        // catch up with the streams which have been running for a while
+        double minVirtualTime = -1.0;
+        for (const auto &other : streams) {
+            if (other != nullptr && (minVirtualTime < 0 || other->virtualTime < minVirtualTime)) {
+                minVirtualTime = other->virtualTime;
+            }
+        }
+        stream->virtualTime = std::max(0.0, minVirtualTime);
+        for (int i = 0; i < (int) streams.size(); i++) {
+            if (streams[i] == nullptr) {
+                streams[i].reset(stream);
+                return i;
+            }
+        }
+        streams.emplace_back(stream);
+        return streams.size() - 1;
+    }
+
+    /**
+     * Discards the queued frames of a stream, waits for the ones in flight and releases it.
+     */
+    void closeStream(int streamId) {
+        std::unique_lock<std::mutex> lock(mutex);
+        StreamSession *stream = find(streamId);
+        if (stream == nullptr || stream->closing) {
+            return;
+        }
+        stream->closing = true;
+        frameDone.wait(lock, [stream] { return stream->inFlight == 0 && stream->copying == 0; });
+        streams[streamId].reset();
+    }
+
+    /**
+     * Queues a copy of a frame of a stream; if the queue of the stream is full, its oldest queued
+     * frame is dropped.
+     *
+     * @return false if the stream does not exist
+     */
+    bool submit(int streamId, const cv::Mat &frame, uint64_t frameNumber, int64_t timestampUs) {
+        StreamSession::Slot *slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            StreamSession *stream = find(streamId);
+            if (stream == nullptr || stream->closing) {
+                return false;
+            }
+            stream->submitted++;
+            if (!stream->freeSlots.empty()) {
+                slot = stream->freeSlots.back();
+                stream->freeSlots.pop_back();
+            } else if (stream->pending.empty()) {
+                // all the slots are being processed or filled by other submits: drop this one
+                stream->dropped++;
+                return true;
+            } else {
+                slot = stream->pending.front();
+                stream->pending.pop_front();
+                stream->dropped++;
+            }
+            // the slot is owned by the caller until it is queued, and the stream cannot be
+            // closed meanwhile
+            stream->copying++;
+        }
+        frame.copyTo(slot->frame);
+        slot->frameNumber = frameNumber;
+        slot->timestampUs = timestampUs;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            StreamSession *stream = find(streamId);
+            stream->pending.push_back(slot);
+            stream->copying--;
+        }
+        frameQueued.notify_one();
+        frameDone.notify_all();
+        return true;
+    }
+
+    /**
+     * Copies the last poses of the track of a stream (at most capacity, oldest first).
+     *
+     * @return the number of copied poses
+     */
+    int lastPoses(int streamId, int capacity, StreamPose *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        StreamSession *stream = find(streamId);
+        if (stream == nullptr) {
+            return 0;
+        }
+        int count = std::min<int>(capacity, stream->track.size());
+        std::copy(stream->track.end() - count, stream->track.end(), out);
+        return count;
+    }
+
+    /**
+     * Writes STREAM_STATS_SIZE values on out: [0] submitted frames, [1] processed frames,
+     * [2] dropped frames, [3] poses found, [4] CPU time used (microseconds), [5] queued frames,
+     * [6] frames whose processing failed with an error.
+     *
+     * @return false if the stream does not exist
+     */
+    bool stats(int streamId, jlong *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        StreamSession *stream = find(streamId);
+        if (stream == nullptr) {
+            return false;
+        }
+        out[0] = stream->submitted;
+        out[1] = stream->processed;
+        out[2] = stream->dropped;
+        out[3] = stream->poses;
+        out[4] = stream->cpuTimeNs / 1000;
+        out[5] = stream->pending.size();
+        out[6] = stream->failed;
+        return true;
+    }
+
+private:
+    /// to be called with mutex held
+    StreamSession *find(int streamId) {
+        if (streamId < 0 || streamId >= (int) streams.size()) {
+            return nullptr;
+        }
+        return streams[streamId].get();
+    }
+
+    /// to be called with mutex held
+    StreamSession *nextStream() {
+        StreamSession *next = nullptr;
+        for (const auto &stream : streams) {
+            if (stream != nullptr && stream->runnable() &&
+                (next == nullptr || stream->virtualTime < next->virtualTime)) {
+                next = stream.get();
+            }
+        }
+        return next;
+    }
+
+    static int64_t threadCpuTimeNs() {
+        timespec time{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    void processFrames(int readerSlot) {
+        while (true) {
+            StreamSession *stream;
+            StreamSession::Slot *slot;
+            bool hasLastPose;
+            StreamPose lastPose{};
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameQueued.wait(lock, [this] { return !running || nextStream() != nullptr; });
+                if (!running) {
+                    break;
+                }
+                stream = nextStream();
+                slot = stream->pending.front();
+                stream->pending.pop_front();
+                stream->inFlight++;
+                hasLastPose = !stream->track.empty();
+                if (hasLastPose) {
+                    lastPose = stream->track.back();
+                }
+            }
+
+            int64_t start = threadCpuTimeNs();
+            StreamPose pose{slot->frameNumber, slot->timestampUs};
+            bool found = false, failed = false;
+            try {
+                found = processFrame(*stream, *slot, readerSlot,
+                                     hasLastPose ? &lastPose : nullptr, pose);
+            } catch (const std::exception &e) {
+                // cv::Exception included: the frame is lost, not the worker (its reader slot
+                // was released by the guard of processFrame())
+                __android_log_print(ANDROID_LOG_ERROR, "StreamScheduler",
+                                    "frame %llu failed: %s",
+                                    (unsigned long long) slot->frameNumber, e.what());
+                failed = true;
+            }
+            int64_t cpuTime = threadCpuTimeNs() - start;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (found) {
+                    stream->addPose(pose);
+                }
+                if (failed) {
+                    stream->failed++;
+                }
+                stream->processed++;
+                stream->cpuTimeNs += cpuTime;
+                stream->virtualTime += cpuTime / std::max(1e-3, stream->config.weight);
+                stream->inFlight--;
+                stream->freeSlots.push_back(slot);
+            }
+            // a slot of the stream is free (its budget allows another frame), or a closing
+            // stream may be done
+            frameQueued.notify_one();
+            frameDone.notify_all();
+        }
+        map.unregisterReader(readerSlot);
+    }
+
+    /**
+     * The checks of PoseValidityConstraints.estimatedPoseIsValid() in the app: the pose must be
+     * finite, enough of the known markers must be inliers, and the camera must not have moved
+     * faster than the limits since the last pose of the stream (if any, which must be older).
+     */
+    static bool poseIsValid(const StreamConfig &config, const StreamPose &pose, int knownCount,
+                            const StreamPose *lastPose) {
+        for (int i = 0; i < 3; i++) {
+            if (std::isnan(pose.rvec[i]) || std::isnan(pose.tvec[i])) {
+                return false;
+            }
+        }
+        if (knownCount <= 0 || pose.inliers <= 0 ||
+            (double) pose.inliers / knownCount < config.minInliersRatio) {
+            return false;
+        }
+        if (lastPose == nullptr) {
+            return true;
+        }
+        double elapsed = (pose.timestampUs - lastPose->timestampUs) / 1e6; // seconds
+        if (elapsed <= 0.0) {
+            // the frames are dequeued in order, so the last pose is older unless the timestamps
+            // of the stream are repeated or out of order: the speeds cannot be checked
+            return false;
+        }
+        double distance = cv::norm(positionInRoom(pose.rvec, pose.tvec) -
+                                   positionInRoom(lastPose->rvec, lastPose->tvec));
+        if (std::abs(distance / elapsed) > config.maxSpeed) {
+            return false;
+        }
+        cv::Vec3d inverseRvec, inverseTvec, lastInverseRvec, lastInverseTvec;
+        invertRT(pose.rvec, pose.tvec, inverseRvec, inverseTvec);
+        invertRT(lastPose->rvec, lastPose->tvec, lastInverseRvec, lastInverseTvec);
+        return std::abs(angularDistance(inverseRvec, lastInverseRvec) / elapsed) <=
+               config.maxAngularSpeed;
+    }
+
+    /**
+     * Detects the markers of the frame, estimates the camera pose from the known ones and, if the
+     * pose is valid, adds the new ones to the map.
+     *
+     * @param lastPose the last pose of the track of the stream, or nullptr
+     * @return true if a valid pose was found
+     */
+    bool processFrame(const StreamSession &stream, StreamSession::Slot &slot, int readerSlot,
+                      const StreamPose *lastPose, StreamPose &pose) {
+        const StreamConfig &config = stream.config;
+        FrameContext &context = slot.context;
+        context.reset();
+        MarkerMapReadGuard reading(map, readerSlot);
+        const MarkerMapSnapshot *snapshot = reading.snapshot();
+        std::shared_ptr<const MarkerSizes> markerSizes =
+                sizes != nullptr ? sizes->acquire() : nullptr;
+        int foundCount = detectFrameMarkers(config.markerDictionary, config.cameraMatrix,
+                                            config.distCoeffs, slot.frame, slot.result,
+                                            config.markerLength, context, nullptr, &slot.detector,
+                                            snapshot, nullptr, nullptr, nullptr, 0,
+                                            markerSizes.get());
+        pose.inliers = 0;
+        int knownCount = 0;
+        for (int i = 0; i < foundCount; i++) {
+            if (snapshot->indexOf(context.detectedIDs[i]) >= 0) {
+                knownCount++;
+            }
+        }
+        if (foundCount > 0) {
+            pose.inliers = estimateFrameCameraPose(
+                    config.cameraMatrix, config.distCoeffs, slot.frame.size(), *snapshot,
+                    config.markerLength, foundCount, context.detectedIDs.data(),
+                    context.detectedRvecs.data(), context.detectedTvecs.data(),
+                    context.detectedQualities.data(),
+                    STREAM_TVEC_INLIER_THRESHOLD, STREAM_TVEC_OUTLIER_PROBABILITY,
+                    STREAM_RVEC_INLIER_THRESHOLD, STREAM_RVEC_OUTLIER_PROBABILITY,
+                    STREAM_MAX_RANSAC_ITERATIONS, STREAM_OPTIMAL_MODEL_PROBABILITY,
+                    nullptr, &context, nullptr, pose.rvec, pose.tvec);
+        }
+        bool valid = foundCount > 0 && poseIsValid(config, pose, knownCount, lastPose);
+        if (valid && config.addNewMarkers) {
+            refinePromotedMarkers(config.cameraMatrix, config.distCoeffs, config.markerLength,
+                                  *snapshot, context, markerSizes.get());
+            for (int i = 0; i < foundCount; i++) {
+                if (snapshot->indexOf(context.detectedIDs[i]) >= 0) {
+                    continue;
+                }
+                cv::Vec3d markerRvec, markerTvec;
+                newMarkerPoseInRoom(pose.rvec, pose.tvec, context.detectedRvecs[i],
+                                    context.detectedTvecs[i], markerRvec, markerTvec);
+                map.addIfNotPresent(context.detectedIDs[i], markerRvec, markerTvec);
+            }
+        }
+        return valid;
+    }
+
+    MarkerMap &map;
+    MarkerSizeRegistry *sizes;
+
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameDone;
+    std::vector<std::unique_ptr<StreamSession>> streams; // nullptr for the closed ones
+    bool running = true; // guarded by mutex
+    std::vector<std::thread> workers;
+};
+
+StreamScheduler *castToStreamSchedulerPtr(jlong addr) {
+    return (StreamScheduler *) addr;
+}
+
+#endif //ARUCOSLAM_STREAMSCHEDULER_H
@@ -0,0 +1,605 @@
+//
+// Partitioning of large maps in submaps, of which only the ones near the phone are kept in the
+// marker map; the others are paged out to compact storage.
+//
+
+#ifndef ARUCOSLAM_SUBMAPMANAGER_H
+#define ARUCOSLAM_SUBMAPMANAGER_H
+
+#include <jni.h>
+#include <android/log.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "markerMap.h"
+
+/**
+ * A submap is activated when the phone is within this distance (meters) from the sphere bounding
+ * its markers, and the active submap is kept until the phone goes farther than that (hysteresis).
+ */
+constexpr double SUBMAP_ACTIVATION_MARGIN = 1.0;
+
+/**
+ * The submaps within this distance (meters) from the phone are loaded in advance, in addition to
+ * the active submap and its neighbors.
+ */
+constexpr double SUBMAP_PREFETCH_DISTANCE = 3.0;
+
+/**
+ * Number of values written by SubmapManager::stats().
+ */
+constexpr int SUBMAP_MANAGER_STATS_SIZE = 6;
+
+/**
+ * Page format: "ASMP", u32 version, i32 submap id, u32 marker count, then for each marker its id
+ * (i32) and its pose in the local frame of the submap (f32 rvec[3], f32 tvec[3]): 28 bytes per
+ * marker. Single precision is enough because the poses are local to the submap.
+ */
+constexpr char SUBMAP_PAGE_MAGIC[4] = {'A', 'S', 'M', 'P'};
+constexpr uint32_t SUBMAP_PAGE_VERSION = 1;
+constexpr size_t SUBMAP_PAGE_HEADER_SIZE = 16;
+constexpr size_t SUBMAP_PAGE_MARKER_SIZE = 28;
+
+/**
+ * A marker of a submap, with its pose (local frame of the submap to marker's coord sys).
+ */
+struct SubmapMarker {
+    int markerId;
+    cv::Vec3d rvec, tvec;
+};
+
+/**
+ * A submap: a group of markers (e.g. a room, or a range of marker ids) with its own local frame.
+ * The descriptor (frame, neighbors, bounds) is always resident; the markers are resident only
+ * when the submap is hot, otherwise they are in the page of the submap.
+ */
+struct Submap {
+    int submapId;
+    int minMarkerId, maxMarkerId; // the markers with ids in range belong to this submap
+    cv::Vec3d anchorRvec, anchorTvec; // room's coord sys to local coord sys
+    std::vector<int> neighbors; // indices of the neighbor submaps
+
+    // sphere bounding the markers, in the room
+    cv::Vec3d center;
+    double radius = 0.0;
+    int markerCount = 0;
+
+    bool resident = true;
+    bool dirty = false; // resident markers not written in the page yet
+    std::vector<SubmapMarker> markers;
+    // markers found while the submap was paged out, merged when it is loaded
+    std::vector<SubmapMarker> pending;
+    // page of the submap, when the pages are kept in memory
+    std::vector<unsigned char> page;
+
+    bool owns(int markerId) const {
+        return markerId >= minMarkerId && markerId <= maxMarkerId;
+    }
+
+    void roomPose(const SubmapMarker &marker, cv::Vec3d &rvec, cv::Vec3d &tvec) const {
+        cv::composeRT(anchorRvec, anchorTvec, marker.rvec, marker.tvec, rvec, tvec);
+    }
+
+    SubmapMarker localMarker(int markerId, const cv::Vec3d &rvec, const cv::Vec3d &tvec) const {
+        cv::Vec3d inverseRvec, inverseTvec;
+        invertRT(anchorRvec, anchorTvec, inverseRvec, inverseTvec);
+        SubmapMarker marker{markerId};
+        cv::composeRT(inverseRvec, inverseTvec, rvec, tvec, marker.rvec, marker.tvec);
+        return marker;
+    }
+
+    void updateBounds() {
+        markerCount = markers.size();
+        if (markers.empty()) {
+            center = positionInRoom(anchorRvec, anchorTvec);
+            radius = 0.0;
+            return;
+        }
+        std::vector<cv::Vec3d> positions;
+        positions.reserve(markers.size());
+        center = cv::Vec3d();
+        for (const SubmapMarker &marker : markers) {
+            cv::Vec3d rvec, tvec;
+            roomPose(marker, rvec, tvec);
+            positions.push_back(positionInRoom(rvec, tvec));
+            center += positions.back();
+        }
+        center *= 1.0 / positions.size();
+        radius = 0.0;
+        for (const cv::Vec3d &position : positions) {
+            radius = std::max(radius, cv::norm(position - center));
+        }
+    }
+
+    /**
+     * Distance of a point from the bounding sphere (0 inside).
+     */
+    double distanceFrom(const cv::Vec3d &position) const {
+        return std::max(0.0, cv::norm(position - center) - radius);
+    }
+};
+
+/**
+ * A SubmapManager keeps bounded the size of the marker map (which is what the frame workers read
+ * and what the per-frame queries scale with) when a deployment grows to many rooms: the map is
+ * partitioned in submaps, and only the hot ones (the active submap, i.e. the one the phone is in,
+ * its neighbors and the submaps the phone is approaching) are published in the marker map. The
+ * other ones are paged out to compact pages (files in the page directory, or memory blobs if no
+ * directory is set) and loaded again in background, when the phone gets near them.
+ *
+ * The markers added to the marker map by the workers are collected into their submap at the next
+ * refresh (after each position update): the one owning their id, or else the active one. A marker
+ * of a paged-out submap found again is kept aside and merged when the submap is loaded. The
+ * submaps modified since their pages were written are written again when the manager is
+ * destroyed.
+ * The hot set is recomputed by a background thread, woken up by updatePosition(); the page I/O
+ * is done outside of any lock, and the new hot set is published with MarkerMap::rebuild(), so the
+ * workers never wait for the paging.
+ */
+class SubmapManager {
+public:
+    /**
+     * @param pageDirectory directory of the page files, or an empty string to keep the pages in
+     *                      memory
+     */
+    SubmapManager(MarkerMap &map, const std::string &pageDirectory) :
+            map(map), pageDirectory(pageDirectory) {
+        loader = std::thread([this] { loadSubmaps(); });
+    }
+
+    SubmapManager(const SubmapManager &) = delete;
+
+    SubmapManager &operator=(const SubmapManager &) = delete;
+
+    ~SubmapManager() {
+        {
+            std::unique_lock<std::mutex> lock(positionMutex);
+            running = false;
+        }
+        positionUpdated.notify_one();
+        loader.join();
+        flush();
+    }
+
+    /**
+     * Defines a submap, owning the markers with ids in [minMarkerId, maxMarkerId] (an empty range
+     * for a submap which only collects the new markers found while it is active).
+     *
+     * @param anchorRvec, anchorTvec transformation from room's coord sys to the local coord sys of
+     *                               the submap
+     * @return false if a submap with the same id exists
+     */
+    bool defineSubmap(int submapId, int minMarkerId, int maxMarkerId,
+                      const cv::Vec3d &anchorRvec, const cv::Vec3d &anchorTvec) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (indexBySubmapId.count(submapId) > 0) {
+            return false;
+        }
+        Submap submap;
+        submap.submapId = submapId;
+        submap.minMarkerId = minMarkerId;
+        submap.maxMarkerId = maxMarkerId;
+        submap.anchorRvec = anchorRvec;
+        submap.anchorTvec = anchorTvec;
+        submap.updateBounds();
+        indexBySubmapId[submapId] = submaps.size();
+        submaps.push_back(std::move(submap));
+        if (active < 0) {
+            active = 0;
+        }
+        return true;
+    }
+
+    /**
+     * Makes two submaps neighbors: the neighbors of the active submap are always kept loaded.
+     */
+    bool connect(int submapIdA, int submapIdB) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto a = indexBySubmapId.find(submapIdA), b = indexBySubmapId.find(submapIdB);
+        if (a == indexBySubmapId.end() || b == indexBySubmapId.end() || a == b) {
+            return false;
+        }
+        std::vector<int> &neighborsA = submaps[a->second].neighbors;
+        if (std::find(neighborsA.begin(), neighborsA.end(), b->second) == neighborsA.end()) {
+            neighborsA.push_back(b->second);
+            submaps[b->second].neighbors.push_back(a->second);
+        }
+        return true;
+    }
+
+    /**
+     * Reports the position of the phone in the room; the hot set is updated in background. Cheap
+     * enough to be called at each frame.
+     */
+    void updatePosition(const cv::Vec3d &position) {
+        {
+            std::unique_lock<std::mutex> lock(positionMutex);
+            latestPosition = position;
+            positionChanged = true;
+        }
+        positionUpdated.notify_one();
+    }
+
+    /**
+     * Writes SUBMAP_MANAGER_STATS_SIZE values on out: [0] submaps, [1] resident submaps, [2] id of
+     * the active submap (-1 if none), [3] markers in the hot set, [4] pages loaded, [5] pages
+     * written.
+     */
+    void stats(jlong *out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        out[0] = submaps.size();
+        out[1] = std::count_if(submaps.begin(), submaps.end(),
+                               [](const Submap &submap) { return submap.resident; });
+        out[2] = active >= 0 ? submaps[active].submapId : -1;
+        out[3] = hotMarkers;
+        out[4] = pagesLoaded;
+        out[5] = pagesWritten;
+    }
+
+private:
+    void loadSubmaps() {
+        while (true) {
+            cv::Vec3d position;
+            {
+                std::unique_lock<std::mutex> lock(positionMutex);
+                positionUpdated.wait(lock, [this] { return positionChanged || !running; });
+                if (!running) {
+                    return;
+                }
+                position = latestPosition;
+                positionChanged = false;
+            }
+            refresh(position);
+        }
+    }
+
+    /**
+     * Selects the active submap and the hot set for the position, loads the hot submaps which are
+     * paged out, publishes the hot set in the marker map and pages out the other submaps.
+     */
+    void refresh(const cv::Vec3d &position) {
+        std::vector<int> toLoad;
+        std::vector<std::vector<unsigned char>> inMemoryPages;
+        std::vector<char> hot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (submaps.empty()) {
+                return;
+            }
+            selectActive(position);
+            hot.assign(submaps.size(), 0);
+            hot[active] = 1;
+            for (int neighbor : submaps[active].neighbors) {
+                hot[neighbor] = 1;
+            }
+            bool changed = false;
+            for (int i = 0; i < (int) submaps.size(); i++) {
+                if (submaps[i].distanceFrom(position) <= SUBMAP_PREFETCH_DISTANCE) {
+                    hot[i] = 1;
+                }
+                changed = changed || (hot[i] != 0) != submaps[i].resident;
+                if (hot[i] && !submaps[i].resident) {
+                    toLoad.push_back(i);
+                    inMemoryPages.push_back(std::move(submaps[i].page));
+                }
+            }
+            if (!changed && !firstRefresh) {
+                // no paging needed, but the markers added by the workers go in their submaps now
+                collectMapMarkers();
+                return;
+            }
+            firstRefresh = false;
+        }
+
+        // the pages are read outside of the lock (submaps are added, never removed, so the
+        // indices stay valid; only this thread pages the submaps in and out)
+        std::vector<std::vector<SubmapMarker>> loaded(toLoad.size());
+        for (int i = 0; i < (int) toLoad.size(); i++) {
+            readPage(toLoad[i], inMemoryPages[i], loaded[i]);
+        }
+
+        std::vector<std::pair<int, std::vector<SubmapMarker>>> evicted;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // the submaps defined in the meantime are resident, keep them until the next refresh
+            hot.resize(submaps.size(), 1);
+            for (int i = 0; i < (int) toLoad.size(); i++) {
+                Submap &submap = submaps[toLoad[i]];
+                submap.markers = std::move(loaded[i]);
+                submap.dirty = !submap.pending.empty();
+                for (const SubmapMarker &marker : submap.pending) {
+                    mergeMarker(submap, marker);
+                }
+                submap.pending.clear();
+                submap.resident = true;
+                submap.updateBounds();
+                pagesLoaded++;
+            }
+
+            map.rebuild([&](const MarkerMapSnapshot &old, std::vector<int> &ids,
+                            std::vector<cv::Vec3d> &rvecs, std::vector<cv::Vec3d> &tvecs) {
+                collectNewMarkers(old);
+                for (int i = 0; i < (int) submaps.size(); i++) {
+                    if (!hot[i]) {
+                        continue;
+                    }
+                    const Submap &submap = submaps[i];
+                    for (const SubmapMarker &marker : submap.markers) {
+                        cv::Vec3d rvec, tvec;
+                        submap.roomPose(marker, rvec, tvec);
+                        ids.push_back(marker.markerId);
+                        rvecs.push_back(rvec);
+                        tvecs.push_back(tvec);
+                    }
+                }
+                hotMarkers = ids.size();
+            });
+
+            for (int i = 0; i < (int) submaps.size(); i++) {
+                Submap &submap = submaps[i];
+                if (hot[i] || !submap.resident) {
+                    continue;
+                }
+                submap.updateBounds();
+                submap.resident = false;
+                if (submap.dirty || !pageExists(submap)) {
+                    evicted.emplace_back(i, std::move(submap.markers));
+                }
+                submap.markers = std::vector<SubmapMarker>();
+                submap.dirty = false;
+            }
+        }
+
+        for (auto &page : evicted) {
+            writePage(page.first, page.second);
+        }
+    }
+
+    /// to be called with mutex held
+    void selectActive(const cv::Vec3d &position) {
+        if (active >= 0 && submaps[active].distanceFrom(position) <= SUBMAP_ACTIVATION_MARGIN) {
+            return;
+        }
+        int nearest = -1;
+        for (int i = 0; i < (int) submaps.size(); i++) {
+            if (nearest < 0 || submaps[i].distanceFrom(position) <
+                               submaps[nearest].distanceFrom(position)) {
+                nearest = i;
+            }
+        }
+        if (submaps[nearest].distanceFrom(position) <= SUBMAP_ACTIVATION_MARGIN) {
+            active = nearest;
+        }
+    }
+
+    /**
+     * Writes the pages of the submaps modified since they were written, after collecting the
+     * markers added to the map; the markers found for the paged-out submaps are merged in their
+     * pages. To be called when the loader is stopped.
+     */
+    void flush() {
+        std::vector<std::pair<int, std::vector<SubmapMarker>>> modified;
+        std::vector<std::pair<int, std::vector<SubmapMarker>>> pendingBySubmap;
+        std::vector<std::vector<unsigned char>> inMemoryPages;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (submaps.empty()) {
+                return;
+            }
+            collectMapMarkers();
+            for (int i = 0; i < (int) submaps.size(); i++) {
+                Submap &submap = submaps[i];
+                if (submap.resident && submap.dirty) {
+                    modified.emplace_back(i, submap.markers);
+                    submap.dirty = false;
+                } else if (!submap.resident && !submap.pending.empty()) {
+                    pendingBySubmap.emplace_back(i, std::move(submap.pending));
+                    inMemoryPages.push_back(submap.page);
+                    submap.pending.clear();
+                }
+            }
+        }
+
+        for (auto &page : modified) {
+            writePage(page.first, page.second);
+        }
+        for (int i = 0; i < (int) pendingBySubmap.size(); i++) {
+            Submap merged;
+            readPage(pendingBySubmap[i].first, inMemoryPages[i], merged.markers);
+            for (const SubmapMarker &marker : pendingBySubmap[i].second) {
+                mergeMarker(merged, marker);
+            }
+            writePage(pendingBySubmap[i].first, merged.markers);
+        }
+    }
+
+    /**
+     * Collects the markers added to the marker map since the last collection; to be called with
+     * mutex held.
+     */
+    void collectMapMarkers() {
+        map.inspect([this](const MarkerMapSnapshot &snapshot) {
+            if (snapshot.version != collectedVersion) {
+                collectNewMarkers(snapshot);
+            }
+        });
+    }
+
+    /**
+     * Moves the markers of the snapshot not known by the resident submaps (i.e. added by the
+     * workers since the last collection) into their submaps; to be called with mutex held.
+     */
+    void collectNewMarkers(const MarkerMapSnapshot &snapshot) {
+        collectedVersion = snapshot.version;
+        std::unordered_set<int> known;
+        for (const Submap &submap : submaps) {
+            for (const SubmapMarker &marker : submap.markers) {
+                known.insert(marker.markerId);
+            }
+        }
+        for (int i = 0; i < (int) snapshot.size(); i++) {
+            if (known.count(snapshot.ids[i]) > 0) {
+                continue;
+            }
+            Submap *owner = &submaps[active];
+            for (Submap &submap : submaps) {
+                if (submap.owns(snapshot.ids[i])) {
+                    owner = &submap;
+                    break;
+                }
+            }
+            SubmapMarker marker = owner->localMarker(snapshot.ids[i], snapshot.rvecs[i],
+                                                     snapshot.tvecs[i]);
+            if (owner->resident) {
+                mergeMarker(*owner, marker);
+                owner->dirty = true;
+                owner->updateBounds();
+            } else if (std::none_of(owner->pending.begin(), owner->pending.end(),
+                                    [&](const SubmapMarker &pending) {
+                                        return pending.markerId == marker.markerId;
+                                    })) {
+                owner->pending.push_back(marker);
+            }
+        }
+    }
+
+    static void mergeMarker(Submap &submap, const SubmapMarker &marker) {
+        for (const SubmapMarker &existing : submap.markers) {
+            if (existing.markerId == marker.markerId) {
+                return;
+            }
+        }
+        submap.markers.push_back(marker);
+    }
+
+    std::string pagePath(int submapIndex) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return pageDirectory + "/submap-" + std::to_string(submaps[submapIndex].submapId) +
+               ".asmp";
+    }
+
+    /// to be called with mutex held
+    bool pageExists(const Submap &submap) const {
+        return submap.markerCount == 0 || !submap.page.empty() || !pageDirectory.empty();
+    }
+
+    void readPage(int submapIndex, const std::vector<unsigned char> &inMemoryPage,
+                  std::vector<SubmapMarker> &markers) {
+        std::vector<unsigned char> page;
+        if (pageDirectory.empty()) {
+            page = inMemoryPage;
+        } else {
+            std::string path = pagePath(submapIndex);
+            FILE *file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                return; // never written: the submap is empty
+            }
+            unsigned char buffer[4096];
+            size_t read;
+            while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                page.insert(page.end(), buffer, buffer + read);
+            }
+            fclose(file);
+        }
+        if (page.size() < SUBMAP_PAGE_HEADER_SIZE ||
+            memcmp(page.data(), SUBMAP_PAGE_MAGIC, 4) != 0) {
+            if (!page.empty()) {
+                __android_log_print(ANDROID_LOG_ERROR, "SubmapManager", "invalid page");
+            }
+            return;
+        }
+        uint32_t count;
+        memcpy(&count, page.data() + 12, 4);
+        count = std::min<uint32_t>(count, (page.size() - SUBMAP_PAGE_HEADER_SIZE) /
+                                          SUBMAP_PAGE_MARKER_SIZE);
+        markers.resize(count);
+        const unsigned char *entry = page.data() + SUBMAP_PAGE_HEADER_SIZE;
+        for (SubmapMarker &marker : markers) {
+            float pose[6];
+            memcpy(&marker.markerId, entry, 4);
+            memcpy(pose, entry + 4, sizeof(pose));
+            marker.rvec = cv::Vec3d(pose[0], pose[1], pose[2]);
+            marker.tvec = cv::Vec3d(pose[3], pose[4], pose[5]);
+            entry += SUBMAP_PAGE_MARKER_SIZE;
+        }
+    }
+
+    void writePage(int submapIndex, const std::vector<SubmapMarker> &markers) {
+        std::vector<unsigned char> page(SUBMAP_PAGE_HEADER_SIZE +
+                                        markers.size() * SUBMAP_PAGE_MARKER_SIZE);
+        uint32_t version = SUBMAP_PAGE_VERSION, count = markers.size();
+        int32_t submapId;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            submapId = submaps[submapIndex].submapId;
+        }
+        memcpy(page.data(), SUBMAP_PAGE_MAGIC, 4);
+        memcpy(page.data() + 4, &version, 4);
+        memcpy(page.data() + 8, &submapId, 4);
+        memcpy(page.data() + 12, &count, 4);
+        unsigned char *entry = page.data() + SUBMAP_PAGE_HEADER_SIZE;
+        for (const SubmapMarker &marker : markers) {
+            float pose[6] = {(float) marker.rvec[0], (float) marker.rvec[1],
+                             (float) marker.rvec[2], (float) marker.tvec[0],
+                             (float) marker.tvec[1], (float) marker.tvec[2]};
+            memcpy(entry, &marker.markerId, 4);
+            memcpy(entry + 4, pose, sizeof(pose));
+            entry += SUBMAP_PAGE_MARKER_SIZE;
+        }
+
+        if (pageDirectory.empty()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            submaps[submapIndex].page = std::move(page);
+        } else {
+            std::string path = pagePath(submapIndex);
+            FILE *file = fopen(path.c_str(), "wb");
+            if (file == nullptr || fwrite(page.data(), 1, page.size(), file) != page.size()) {
+                __android_log_print(ANDROID_LOG_ERROR, "SubmapManager", "cannot write %s",
+                                    path.c_str());
+            }
+            if (file != nullptr) {
+                fclose(file);
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        pagesWritten++;
+    }
+
+    MarkerMap &map;
+    const std::string pageDirectory;
+
+    std::mutex mutex; // guards the submaps and the statistics
+    std::vector<Submap> submaps;
+    std::unordered_map<int, int> indexBySubmapId;
+    int active = -1;
+    bool firstRefresh = true;
+    uint64_t collectedVersion = 0; // of the last snapshot whose markers were collected
+    jlong hotMarkers = 0;
+    jlong pagesLoaded = 0;
+    jlong pagesWritten = 0;
+
+    std::mutex positionMutex;
+    std::condition_variable positionUpdated;
+    cv::Vec3d latestPosition;
+    bool positionChanged = false;
+    bool running = true; // guarded by positionMutex
+    std::thread loader;
+};
+
+SubmapManager *castToSubmapManagerPtr(jlong addr) {
+    return (SubmapManager *) addr;
+}
+
+#endif //ARUCOSLAM_SUBMAPMANAGER_H
@@ -62,17 +62,25 @@ cv::Mat *castToMatPtr(jlong addr) {
     return (cv::Mat *) addr;
 }
 
+/**
+ * Writes in {@code out} {@code subsetSize} distinct random indices in [0, originalSize), by
+ * performing a partial Fisher-Yates shuffle (the capacity of {@code out} is re-used).
+ */
+template<typename INDICES>
 void randomUniqueIndices(
         int originalSize,
         int subsetSize,
-        std::vector<int> &out
+        INDICES &out
 ){
-    out = std::vector<int>();
+    out.clear();
     for (int i = 0; i < originalSize; i++) {
         out.push_back(i);
     }
-    while (out.size() > subsetSize) {
-        out.erase(out.begin() + rand() % out.size());
+    for (int i = 0; i < subsetSize && i < originalSize; i++) {
+        std::swap(out[i], out[i + rand() % (originalSize - i)]);
+    }
+    if (subsetSize < originalSize) {
+        out.resize(subsetSize);
     }
 }
 
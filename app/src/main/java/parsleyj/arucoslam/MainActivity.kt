@@ -16,9 +16,18 @@ import org.opencv.android.OpenCVLoader
 import org.opencv.core.Mat
 import parsleyj.arucoslam.datamodel.*
 import parsleyj.arucoslam.datamodel.fixedSpace.FixedMarkerTaggedSpace
+import parsleyj.arucoslam.datamodel.slamspace.KeyframeDatabase
+import parsleyj.arucoslam.datamodel.slamspace.MarkerCandidatePool
+import parsleyj.arucoslam.datamodel.slamspace.SubmapManager
+import parsleyj.arucoslam.framepipeline.CornerTracker
+import parsleyj.arucoslam.framepipeline.PoseStream
 import parsleyj.arucoslam.framepipeline.PoseValidityConstraints
+import parsleyj.arucoslam.framepipeline.QualityController
 import parsleyj.arucoslam.framepipeline.SLAMFrameRenderer
+import parsleyj.arucoslam.framepipeline.SessionRecorder
+import parsleyj.arucoslam.framepipeline.SharpnessGate
 import parsleyj.kotutils.joinWithSeparator
+import java.io.File
 import kotlin.math.PI
 
 
@@ -29,6 +38,16 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
         const val TAG = "MainActivity"
         const val CALIBRATION_REQUEST = 1
         const val DETECTED_MARKERS_MAX_OUTPUT = 50
+        const val RECORD_SESSION = false // set to record the input frames, to investigate issues
+        const val LOG_STATS = false // set to log the statistics of the pipeline stages
+        const val LOG_POSES = false // set to write the computed poses to a binary log
+        const val STATS_LOG_INTERVAL = 100 // frames between two logs of the statistics
+        // set to page the markers of the rooms in and out of the space; the layout of the rooms
+        // below is a placeholder, to be replaced with the one of the actual installation
+        const val USE_SUBMAPS = false
+        const val ROOMS = 5 // rooms of the installation, each one with its own submap
+        const val ROOM_MARKERS = 50 // marker ids reserved to each room (250 in DICT_6X6_250)
+        const val ROOM_SPACING = 8.0 // meters between the origins of consecutive rooms
     }
 
     private val cameraParameters: CalibData by lazy {
@@ -38,6 +57,8 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
 
     private lateinit var slamFrameRenderer: SLAMFrameRenderer
 
+    private val keyframeDatabase by lazy { KeyframeDatabase() }
+
 
     private val markerSpace by lazy {
         FixedMarkerTaggedSpace.singleMarker(
@@ -62,8 +83,78 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
         )
     }
 
+    private val qualityController by lazy {
+        QualityController(
+            60.0, // with 3 workers, a frame can take up to ~100ms before the output stalls
+            100 // max RANSAC iterations at full quality
+        )
+    }
+
+    private val poseStream by lazy {
+        // binary log of all the computed poses of the session, see NativeMethods.POSE_RECORD_SIZE
+        // for the format
+        PoseStream(
+            if (LOG_POSES) File(filesDir, "poses-${System.currentTimeMillis()}.aspl") else null
+        )
+    }
+
+    private val sharpnessGate by lazy {
+        SharpnessGate(
+            0.35 // frames less than ~1/3 as sharp as the recent ones are motion-blurred
+        )
+    }
+
+    private val cornerTracker by lazy {
+        CornerTracker(
+            3 // full detection every 3 frames, optical flow tracking in between
+        )
+    }
+
+    private val submapManager by lazy {
+        if (USE_SUBMAPS) {
+            SubmapManager(markerSpace, File(filesDir, "submaps")).apply {
+                // each room owns a block of marker ids; the rooms are in a row along the x axis
+                // (e.g. along a corridor), so each one is connected to the next one, and the
+                // rooms farther than the next ones are paged out
+                for (room in 0 until ROOMS) {
+                    defineSubmap(
+                        room,
+                        room * ROOM_MARKERS until (room + 1) * ROOM_MARKERS,
+                        // room to submap: the origin of the submap is at x = room * ROOM_SPACING
+                        Pose3d(Vec3d.ORIGIN, Vec3d(-room * ROOM_SPACING, 0.0, 0.0))
+                    )
+                    if (room > 0) {
+                        connect(room - 1, room)
+                    }
+                }
+            }
+        } else {
+            null
+        }
+    }
+
+    private val candidatePool by lazy {
+        MarkerCandidatePool(
+            64 // new markers observed at the same time
+        )
+    }
+
+    private val sessionRecorder by lazy {
+        if (RECORD_SESSION) {
+            SessionRecorder(
+                File(filesDir, "session-${System.currentTimeMillis()}.asrc"),
+                cameraParameters,
+                markerSpace.dictionary.toInt(),
+                markerSpace.commonLength
+            )
+        } else {
+            null
+        }
+    }
+
     private var fullScreenMapMode = false
     private var freezeRendering = false
+    private var suppliedFrames = 0L
 
     override fun onCreate(savedInstanceState: Bundle?) {
         super.onCreate(savedInstanceState)
@@ -104,6 +195,37 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
         opencvCamera.enableView()
     }
 
+    override fun onPause() {
+        super.onPause()
+        opencvCamera.disableView()
+    }
+
+    override fun onDestroy() {
+        super.onDestroy()
+        // the camera is stopped (see onPause), so no frame is being supplied anymore: the workers
+        // can be dismissed, and then all the native objects they share
+        if (this::slamFrameRenderer.isInitialized) {
+            slamFrameRenderer.shutdown()
+            // the records still queued by the workers are delivered and logged first
+            poseStream.release()
+            sessionRecorder?.let {
+                // completes the recording with its final counters
+                it.finish()
+                Log.d(TAG, "Recording = ${it.stats()}")
+                it.release()
+            }
+            keyframeDatabase.release()
+            qualityController.release()
+            sharpnessGate.release()
+            candidatePool.release()
+            cornerTracker.release()
+            track.release()
+            // writes the pages of the modified submaps, before the space they read goes away
+            submapManager?.release()
+            markerSpace.release()
+        }
+    }
+
     override fun onCreateOptionsMenu(menu: Menu?): Boolean {
         menuInflater.inflate(R.menu.main_menu, menu)
         return true
@@ -171,7 +293,15 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
                         synchronized(this@MainActivity) {
                             fullScreenMapMode
                         }
-                    }
+                    },
+                    keyframeDatabase = keyframeDatabase,
+                    qualityController = qualityController,
+                    poseStream = poseStream,
+                    sharpnessGate = sharpnessGate,
+                    sessionRecorder = sessionRecorder,
+                    candidatePool = candidatePool,
+                    cornerTracker = cornerTracker,
+                    submapManager = submapManager
                 )
             }
 
@@ -179,6 +309,9 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
                 slamFrameRenderer.supply(inputMat)
                 val usage = slamFrameRenderer.usage()
                 Log.d(TAG, "Pipeline usage = $usage")
+                if (LOG_STATS && suppliedFrames++ % STATS_LOG_INTERVAL == 0L) {
+                    logStats()
+                }
                 if (usage > 60.0) {
                     for (i in 0 until 10) {
                         Log.d(TAG, "USAGE > 60%!" + (0 until i).map { "!" }.joinWithSeparator(""))
@@ -193,6 +326,23 @@ class MainActivity : AppCompatActivity(), FixedCameraBridgeViewBase.CvCameraView
         }
 
     }
+
+    /**
+     * Logs the statistics of the stages of the pipeline; each of them is read from the native
+     * side, so they are logged only every [STATS_LOG_INTERVAL] frames.
+     */
+    private fun logStats() {
+        Log.d(TAG, "Quality = ${qualityController.telemetry()}")
+        Log.d(TAG, "Poses = ${poseStream.stats()}")
+        sharpnessGate.stats().let {
+            Log.d(TAG, "Sharpness = $it, skip rate = ${"%.2f".format(it.skipRate)}")
+        }
+        sessionRecorder?.let { Log.d(TAG, "Recording = ${it.stats()}") }
+        Log.d(TAG, "Candidate markers = ${candidatePool.stats()}")
+        Log.d(TAG, "Tracking = ${cornerTracker.stats()}")
+        submapManager?.let { Log.d(TAG, "Submaps = ${it.stats()}") }
+        Log.d(TAG, "Long term track = ${track.longTermTrackStats()}")
+    }
 }
 
 
@@ -13,8 +13,9 @@ public class NativeMethods {
      * Given an image, detects all the markers and computes their poses in it. Each "pose"
      * is an RT transformation which switches points from the marker's coordinate system
      * to the coordinate system of the camera?
-     * Moreover, copies the input image on the output image, and adds the "contours"
-     * to the detected markers.
+     * Moreover, copies the input image on the output image, and records the "contours"
+     * of the detected markers on the overlay buffer (see {@link #newOverlayBuffer()}); in
+     * headless mode (overlayAddr == 0) the output image is left untouched.
      *
      * @param markerDictionary the dictionary of markers
      * @param cameraMatrixAddr the camera matrix
@@ -28,6 +29,34 @@ public class NativeMethods {
      *                  poses
      * @param outTvects an array (of size 3*N) which contains the translation vectors of the marker
      *                  poses
+     * @param outQualities an array (of size N) which contains the quality score in (0, 1] of each
+     *                     marker pose, computed from its reprojection error, the apparent area of
+     *                     the marker, the viewing angle and the distance
+     * @param frameContextAddr the native frame context of the worker (see
+     *                         {@link #newFrameContext(long)})
+     * @param overlayAddr the overlay buffer of the worker, or 0 to run headless
+     * @param detectorSessionAddr the detector session of the worker (see
+     *                            {@link #newDetectorSession(long)}), or 0 to search the whole frame
+     *                            with the default detector parameters
+     * @param markerMapSnapshotAddr the snapshot of the known markers: only the corners of the
+     *                              known markers (and of the markers of registered boards) are
+     *                              refined to sub-pixel accuracy, the other ones are refined by
+     *                              {@link #refinePromotedMarkers} only if needed
+     * @param boardRegistryAddr the registered boards, or 0
+     * @param sharpnessGateAddr the sharpness gate (see {@link #newSharpnessGate(double)}): if the
+     *                          frame is too blurred, the detection is skipped and 0 is returned;
+     *                          0 to always run the detection
+     * @param cornerTrackerAddr the corner tracker (see {@link #newCornerTracker(int)}): the full
+     *                          detection runs only every few frames, and the markers are tracked
+     *                          from the previous frames on the others (and when the frame is
+     *                          blurred, or the detection finds nothing); 0 to always run the
+     *                          detection
+     * @param frameNumber the number of the frame
+     * @param markerSizeRegistryAddr the side lengths of the markers which differ from markerSize
+     *                               (see {@link #newMarkerSizeRegistry()}), or 0 if all the
+     *                               markers have the same length; the poses are solved
+     *                               analytically, and the alternative pose of each marker is kept
+     *                               in the frame context for {@link #estimateCameraPosition}
      * @return the number of markers found (N)
      */
     public static native int detectMarkers(
@@ -40,7 +69,17 @@ public class NativeMethods {
             int maxMarkers,
             int[] detectedIDsVect,
             double[] outRvects,
-            double[] outTvects
+            double[] outTvects,
+            double[] outQualities,
+            long frameContextAddr,
+            long overlayAddr,
+            long detectorSessionAddr,
+            long markerMapSnapshotAddr,
+            long boardRegistryAddr,
+            long sharpnessGateAddr,
+            long cornerTrackerAddr,
+            long frameNumber,
+            long markerSizeRegistryAddr
     );
 
     /**
@@ -55,20 +94,21 @@ public class NativeMethods {
      * and returned as result.
      * When more than 2 indicators of such pose are available, the estimate is computed by using
      * the RANSAC method.
-     * Moreover, this function draws the 3D axis of the poses of the markers on the image Mat.
+     * Moreover, this function records the 3D axis of the poses of the markers on the overlay
+     * buffer (unless overlayAddr is 0).
      *
      * @param cameraMatrixAddr the camera matrix
      * @param distCoeffsAddr the distortion coefficients of the camera
      * @param inputMatAddr the input image
-     * @param fixedMarkerCount the count of known markers
-     * @param fixedMarkers the ids of the known markers
-     * @param fixedRVects the rotation vectors of the known markers
-     * @param fixedTVects the translation vectors of the known markers
+     * @param markerMapSnapshotAddr the snapshot of the known markers acquired by the worker for
+     *                              this frame (see {@link #markerMapAcquire(long, int)})
      * @param fixedLength the side length of the markers
      * @param foundPoses the count of found marker poses
      * @param inMarkers the ids of the found markers
      * @param inRvects the rotation vectors of the found markers
      * @param inTvects the translation vectors of the found markers
+     * @param inQualities the quality scores of the found markers (see {@link #detectMarkers}),
+     *                    used to weight both the RANSAC hypotheses and the final estimate
      * @param outRvec the output rotation vector of the computed camera pose estimate
      * @param outTvec the output translation vector of the computed camera pose estimate
      * @param tvecInlierThreshold (RANSAC) threshold of the distance in meters used to determine
@@ -88,6 +128,12 @@ public class NativeMethods {
      *                                      S is the size of the random subset of poses of each
      *                                      iteration, which is equal to 5 if the number of total
      *                                      poses is >= 10, 2 otherwise.
+     * @param boardRegistryAddr the registered boards (see {@link #newBoardRegistry()}), or 0;
+     *                          each board with enough detected markers contributes a single
+     *                          camera pose, used in place of the poses of its markers
+     * @param frameContextAddr the native frame context of the worker (see
+     *                         {@link #newFrameContext(long)})
+     * @param overlayAddr the overlay buffer of the worker, or 0 to run headless
      * @return the number of inliers (w.r.t. the poses used to estimate the pose) of the returned
      *          estimate.
      */
@@ -96,16 +142,14 @@ public class NativeMethods {
             long distCoeffsAddr,
             long inputMatAddr,
 
-            int fixedMarkerCount,
-            int[] fixedMarkers,
-            double[] fixedRVects,
-            double[] fixedTVects,
+            long markerMapSnapshotAddr,
             double fixedLength,
 
             int foundPoses,
             int[] inMarkers,
             double[] inRvects,
             double[] inTvects,
+            double[] inQualities,
             double[] outRvec,
             double[] outTvec,
 
@@ -114,7 +158,10 @@ public class NativeMethods {
             double rvecInlierThreshold,
             double rvecOutlierProbability,
             int maxRansacIterations,
-            double optimalModelTargetProbability
+            double optimalModelTargetProbability,
+            long boardRegistryAddr,
+            long frameContextAddr,
+            long overlayAddr
     );
 
     /**
@@ -213,10 +260,11 @@ public class NativeMethods {
      * Renders a 2D map on the mat. It shows the poses of all found markers, the pose of the camera
      * (if available) and its status, the track of previous positions of the camera.
      *
-     * @param markerLength the side length of all the markers
-     * @param markerRVects the rotation vector of the pose of the known markers
-     * @param markerTVects the translation vector of the pose of the known markers
-     * @param fixedMarkerCount the number of known markers to be rendered
+     * @param markerLength the common side length of the markers
+     * @param markerMapSnapshotAddr the snapshot of the known markers to be rendered (see
+     *                              {@link #markerMapAcquire(long, int)})
+     * @param markerSizeRegistryAddr the side lengths of the markers which differ from the common
+     *                               one (see {@link #newMarkerSizeRegistry()}), or 0
      * @param mapCameraPoseRotation the orientation in the world of the virtual map camera
      * @param mapCameraPoseTranslation the position in the world of the virtual map camera
      * @param mapCameraFovX the angle in radians which defines the horizontal Field Of View of the
@@ -228,9 +276,8 @@ public class NativeMethods {
      * @param phonePoseStatus the current status code of the phone pose
      * @param phonePositionRvect the rotation vector of the phone pose
      * @param phonePositionTvect the translation vector of the phone pose
-     * @param previousPhonePosesCount the count of previous phone poses
-     * @param previousPhonePosesRvects the 3*N array for the rotation vectors of the previous poses
-     * @param previousPhonePosesTvects the 3*N array for the translation vectors of the previous poses
+     * @param trackAddr the compact long term track of the previous phone poses (see
+     *                  {@link #newCompactTrack()})
      * @param mapCameraPixelsX the number of pixels in the resulting mat which will be used to
      *                         render the mat when not in fullscreen mode
      * @param mapCameraPixelsY the number of pixels in the resulting mat which will be used to
@@ -239,12 +286,17 @@ public class NativeMethods {
      * @param mapTopLeftCornerY the x coordinate in the mat of the top-left corner of the map
      * @param resultMatAddr the mat on which the map will be rendered
      * @param fullScreenMode whether the map should be rendered in fullscreen mode or not
+     * @param frameContextAddr the native frame context of the worker (see
+     *                         {@link #newFrameContext(long)})
+     * @param qualityControllerAddr the quality controller (see
+     *                              {@link #newQualityController(double, int)}), or 0; when
+     *                              specified, the rendered map box is kept in it, so that it can be
+     *                              re-used by the frames that skip the map rendering
      */
     public static native void renderMap(
             double markerLength,
-            double[] markerRVects,
-            double[] markerTVects,
-            int fixedMarkerCount,
+            long markerMapSnapshotAddr,
+            long markerSizeRegistryAddr,
             double[] mapCameraPoseRotation,
             double[] mapCameraPoseTranslation,
             double mapCameraFovX,
@@ -254,15 +306,1236 @@ public class NativeMethods {
             int phonePoseStatus,
             double[] phonePositionRvect,
             double[] phonePositionTvect,
-            int previousPhonePosesCount,
-            double[] previousPhonePosesRvects,
-            double[] previousPhonePosesTvects,
+            long trackAddr,
             int mapCameraPixelsX,
             int mapCameraPixelsY,
             int mapTopLeftCornerX,
             int mapTopLeftCornerY,
             long resultMatAddr,
-            boolean fullScreenMode
+            boolean fullScreenMode,
+            long frameContextAddr,
+            long qualityControllerAddr
     );
 
+    /**
+     * Creates a native frame context, i.e. the results of the detection in a frame along with the
+     * arena of the worker: a memory block from which all the short-lived data structures of a
+     * frame are allocated, and the image buffers re-used between frames. Each worker should own
+     * its context, in order to avoid allocator contention between workers.
+     *
+     * @param capacityBytes the initial size of the arena; it is automatically grown when a frame
+     *                      needs more memory
+     * @return the address of the context
+     */
+    public static native long newFrameContext(long capacityBytes);
+
+    /**
+     * Frees a frame context created with {@link #newFrameContext(long)}.
+     *
+     * @param frameContextAddr the address of the context
+     */
+    public static native void releaseFrameContext(long frameContextAddr);
+
+    /**
+     * Rewinds the arena of a context at the beginning of a new frame; every native data structure
+     * allocated from the arena in the previous frame becomes invalid.
+     *
+     * @param frameContextAddr the address of the context
+     */
+    public static native void beginContextFrame(long frameContextAddr);
+
+    /**
+     * Writes the allocation counters of the arena of a context on {@code outStats}, which is
+     * expected to be of size at least 4: <br>
+     * [0] number of heap allocations performed by the frame path in the last completed frame, <br>
+     * [1] peak number of bytes used by a single frame, <br>
+     * [2] current capacity in bytes of the arena, <br>
+     * [3] number of frames processed with the arena.
+     *
+     * @param frameContextAddr the address of the context
+     * @param outStats the output array
+     */
+    public static native void frameContextStats(long frameContextAddr, long[] outStats);
+
+    /**
+     * Creates a native overlay buffer, on which the drawing operations of a frame are recorded as
+     * compact commands, to be rasterized all at once at the end of the frame by
+     * {@link #rasterizeOverlay(long, long)}.
+     *
+     * @return the address of the overlay buffer
+     */
+    public static native long newOverlayBuffer();
+
+    /**
+     * Frees an overlay buffer created with {@link #newOverlayBuffer()}.
+     *
+     * @param overlayAddr the address of the overlay buffer
+     */
+    public static native void releaseOverlayBuffer(long overlayAddr);
+
+    /**
+     * Drops all the commands recorded on the overlay buffer without drawing them.
+     *
+     * @param overlayAddr the address of the overlay buffer
+     */
+    public static native void clearOverlay(long overlayAddr);
+
+    /**
+     * Records a text on the overlay buffer (the parameters are the same of Imgproc.putText).
+     *
+     * @param overlayAddr the address of the overlay buffer
+     * @param text the text
+     * @param x the x coordinate of the bottom-left corner of the text
+     * @param y the y coordinate of the bottom-left corner of the text
+     * @param fontFace the OpenCV font face
+     * @param fontScale the font scale factor
+     * @param red the red component of the color
+     * @param green the green component of the color
+     * @param blue the blue component of the color
+     * @param thickness the thickness of the lines used to draw the text
+     */
+    public static native void overlayText(
+            long overlayAddr,
+            String text,
+            double x,
+            double y,
+            int fontFace,
+            double fontScale,
+            double red,
+            double green,
+            double blue,
+            int thickness
+    );
+
+    /**
+     * Draws all the commands recorded on the overlay buffer directly on the RGBA image, and
+     * empties the buffer.
+     *
+     * @param overlayAddr the address of the overlay buffer
+     * @param resultMatAddr the RGBA image
+     */
+    public static native void rasterizeOverlay(long overlayAddr, long resultMatAddr);
+
+    /**
+     * Creates a native marker map, i.e. the store of the known markers of a SLAM space. The map
+     * is published as a sequence of immutable snapshots: readers acquire the current one without
+     * locks (see {@link #markerMapAcquire(long, int)}), writers replace it atomically.
+     *
+     * @return the address of the marker map
+     */
+    public static native long newMarkerMap();
+
+    /**
+     * Frees a marker map created with {@link #newMarkerMap()}, along with all its snapshots.
+     *
+     * @param markerMapAddr the address of the marker map
+     */
+    public static native void releaseMarkerMap(long markerMapAddr);
+
+    /**
+     * Reserves a reader slot on the marker map. Each thread that acquires snapshots needs its own
+     * slot (i.e. one per frame worker).
+     *
+     * @param markerMapAddr the address of the marker map
+     * @return the index of the slot, or -1 if no more slots are available
+     */
+    public static native int markerMapRegisterReader(long markerMapAddr);
+
+    /**
+     * Frees a reader slot reserved with {@link #markerMapRegisterReader(long)}.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param readerSlot the index of the slot
+     */
+    public static native void markerMapUnregisterReader(long markerMapAddr, int readerSlot);
+
+    /**
+     * Acquires the current snapshot of the marker map, without taking any lock. The snapshot is
+     * never modified and stays valid until {@link #markerMapRelease(long, int)} is called with the
+     * same reader slot.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param readerSlot the reader slot of the calling thread
+     * @return the address of the snapshot
+     */
+    public static native long markerMapAcquire(long markerMapAddr, int readerSlot);
+
+    /**
+     * Releases the snapshot acquired with {@link #markerMapAcquire(long, int)}, allowing its
+     * reclamation when it is replaced.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param readerSlot the reader slot of the calling thread
+     */
+    public static native void markerMapRelease(long markerMapAddr, int readerSlot);
+
+    /**
+     * Publishes a new snapshot of the map with the specified marker, if no marker with the same
+     * id is already known.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param markerId the id of the marker
+     * @param rvec the rotation vector of the marker pose
+     * @param tvec the translation vector of the marker pose
+     * @return true if the marker was added
+     */
+    public static native boolean markerMapAddIfNotPresent(
+            long markerMapAddr,
+            int markerId,
+            double[] rvec,
+            double[] tvec
+    );
+
+    /**
+     * Publishes a new snapshot of the map without the most recently added marker.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @return false if the map was empty
+     */
+    public static native boolean markerMapRemoveLast(long markerMapAddr);
+
+    /**
+     * @param markerMapAddr the address of the marker map
+     * @return the number of markers in the current snapshot
+     */
+    public static native int markerMapSize(long markerMapAddr);
+
+    /**
+     * Reads the marker at the specified index of the current snapshot. Meant for accesses
+     * outside the frame path (e.g. from the UI), since it is serialized with the writers.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param index the index of the marker
+     * @param outRvec the output rotation vector of the marker pose
+     * @param outTvec the output translation vector of the marker pose
+     * @return the id of the marker, or -1 if the index is out of bounds
+     */
+    public static native int markerMapGet(
+            long markerMapAddr,
+            int index,
+            double[] outRvec,
+            double[] outTvec
+    );
+
+    /**
+     * Copies the markers of the current snapshot (as many as they fit in outIds), all from the
+     * same snapshot even if the map is replaced meanwhile (e.g. by the paging of the submaps).
+     * Serialized with the writers, as {@link #markerMapGet}.
+     *
+     * @param markerMapAddr the address of the marker map
+     * @param outIds the output ids of the markers
+     * @param outRvecs the output rotation vectors of the marker poses (3 values per marker)
+     * @param outTvecs the output translation vectors of the marker poses (3 values per marker)
+     * @return the number of markers in the snapshot, which can exceed the length of outIds
+     */
+    public static native int markerMapCopy(
+            long markerMapAddr,
+            int[] outIds,
+            double[] outRvecs,
+            double[] outTvecs
+    );
+
+    /**
+     * @param markerMapSnapshotAddr the address of an acquired snapshot
+     * @return the number of markers in the snapshot
+     */
+    public static native int snapshotSize(long markerMapSnapshotAddr);
+
+    /**
+     * Counts how many of the found markers are known in the snapshot (ids are looked up by hash).
+     *
+     * @param markerMapSnapshotAddr the address of an acquired snapshot
+     * @param foundMarkersCount the number of found markers
+     * @param foundIDs the ids of the found markers
+     * @return the number of found markers which are known
+     */
+    public static native int countKnownMarkers(
+            long markerMapSnapshotAddr,
+            int foundMarkersCount,
+            int[] foundIDs
+    );
+
+    /**
+     * Creates a native board registry, which stores the rigid boards of markers placed in the
+     * world. Boards must be registered before the frames are processed.
+     *
+     * @return the address of the registry
+     */
+    public static native long newBoardRegistry();
+
+    /**
+     * Frees a board registry created with {@link #newBoardRegistry()}.
+     *
+     * @param boardRegistryAddr the address of the registry
+     */
+    public static native void releaseBoardRegistry(long boardRegistryAddr);
+
+    /**
+     * Registers a board made of markers with known relative poses.
+     *
+     * @param boardRegistryAddr the address of the registry
+     * @param markerDictionary the dictionary of the markers of the board
+     * @param markerCount the number of markers of the board
+     * @param markerIds the ids of the markers
+     * @param markerCorners the 3D positions of the 4 corners of each marker in the board's
+     *                      coordinate system (12 values for each marker, corners in clockwise
+     *                      order starting from the top-left one)
+     * @param boardRvec the rotation vector of the board pose in the world
+     * @param boardTvec the translation vector of the board pose in the world
+     * @param axisLength the length of the axis drawn on the board when it is detected
+     * @return the index of the board in the registry
+     */
+    public static native int registerMarkerBoard(
+            long boardRegistryAddr,
+            int markerDictionary,
+            int markerCount,
+            int[] markerIds,
+            double[] markerCorners,
+            double[] boardRvec,
+            double[] boardTvec,
+            double axisLength
+    );
+
+    /**
+     * Registers a ChArUco board, whose pose is refined with the interpolated chessboard corners
+     * when it is detected.
+     *
+     * @param boardRegistryAddr the address of the registry
+     * @param markerDictionary the dictionary of the markers of the board
+     * @param squaresX the number of squares in the X direction
+     * @param squaresY the number of squares in the Y direction
+     * @param squareLength the side length of the chessboard squares
+     * @param markerLength the side length of the markers
+     * @param firstMarkerId the id of the first marker of the board; the markers of the board
+     *                      have consecutive ids starting from this one, which must not be used
+     *                      by the markers of the map or of the other boards
+     * @param boardRvec the rotation vector of the board pose in the world
+     * @param boardTvec the translation vector of the board pose in the world
+     * @return the index of the board in the registry
+     */
+    public static native int registerCharucoBoard(
+            long boardRegistryAddr,
+            int markerDictionary,
+            int squaresX,
+            int squaresY,
+            double squareLength,
+            double markerLength,
+            int firstMarkerId,
+            double[] boardRvec,
+            double[] boardTvec
+    );
+
+    /**
+     * Creates a native keyframe database, which records the camera poses along with the markers
+     * observed from them, indexed by marker id, in order to relocalize the camera when the
+     * tracking is lost.
+     *
+     * @param minTranslation minimum distance (in meters) of a new keyframe from the keyframes
+     *                       which observed the same markers
+     * @param minRotation minimum angular distance (in radians) of a new keyframe from the
+     *                    keyframes which observed the same markers
+     * @param maxKeyframes maximum number of keyframes stored
+     * @return the address of the database
+     */
+    public static native long newKeyframeDatabase(
+            double minTranslation,
+            double minRotation,
+            int maxKeyframes
+    );
+
+    /**
+     * Frees a keyframe database created with
+     * {@link #newKeyframeDatabase(double, double, int)}.
+     *
+     * @param keyframeDatabaseAddr the address of the database
+     */
+    public static native void releaseKeyframeDatabase(long keyframeDatabaseAddr);
+
+    /**
+     * Stores the current frame as a keyframe, unless the database already has a keyframe near to
+     * it which observed the same markers. The observed markers are the ones found by the last call
+     * of {@link #detectMarkers} with the same frame context.
+     *
+     * @param keyframeDatabaseAddr the address of the database
+     * @param frameContextAddr the frame context of the worker
+     * @param markerLength the side length of the markers
+     * @param markerSizeRegistryAddr the side lengths of the markers which differ from
+     *                               markerLength, or 0
+     * @param cameraRvec the rotation vector of the (valid) camera pose
+     * @param cameraTvec the translation vector of the (valid) camera pose
+     * @param timestamp the timestamp of the frame
+     * @return true if the keyframe was stored
+     */
+    public static native boolean insertKeyframe(
+            long keyframeDatabaseAddr,
+            long frameContextAddr,
+            double markerLength,
+            long markerSizeRegistryAddr,
+            double[] cameraRvec,
+            double[] cameraTvec,
+            long timestamp
+    );
+
+    /**
+     * Attempts to recover the camera pose by matching the markers found by the last call of
+     * {@link #detectMarkers} with the keyframes that observed the same markers; the pose is
+     * solved with PnP on the stored marker corners, seeded with the pose of each candidate.
+     *
+     * @param keyframeDatabaseAddr the address of the database
+     * @param frameContextAddr the frame context of the worker
+     * @param cameraMatrixAddr the camera matrix
+     * @param distCoeffsAddr the distortion coefficients of the camera
+     * @param maxReprojectionError maximum RMS reprojection error (in pixels) of an accepted pose
+     * @param outRvec the output rotation vector of the camera pose
+     * @param outTvec the output translation vector of the camera pose
+     * @return the number of markers used to compute the pose, or 0 if the relocalization failed
+     *          (in which case the output vectors are not modified)
+     */
+    public static native int relocalize(
+            long keyframeDatabaseAddr,
+            long frameContextAddr,
+            long cameraMatrixAddr,
+            long distCoeffsAddr,
+            double maxReprojectionError,
+            double[] outRvec,
+            double[] outTvec
+    );
+
+    /**
+     * @param keyframeDatabaseAddr the address of the database
+     * @return the number of stored keyframes
+     */
+    public static native int keyframeDatabaseSize(long keyframeDatabaseAddr);
+
+    /**
+     * Creates a native adaptive quality controller, which keeps the processing time of the frames
+     * within a budget by degrading (and later restoring) the detection (region of interest and
+     * decimation), the cap on the RANSAC iterations and the map refresh rate. It is shared by all
+     * the workers.
+     *
+     * @param frameBudgetMs the target processing time of a frame, in milliseconds
+     * @param maxRansacIterations the cap on the RANSAC iterations at full quality
+     * @return the address of the controller
+     */
+    public static native long newQualityController(double frameBudgetMs, int maxRansacIterations);
+
+    /**
+     * Frees a quality controller created with {@link #newQualityController(double, int)}.
+     *
+     * @param qualityControllerAddr the address of the controller
+     */
+    public static native void releaseQualityController(long qualityControllerAddr);
+
+    /**
+     * @param qualityControllerAddr the address of the controller
+     * @return the current cap on the RANSAC iterations
+     */
+    public static native int qualityControllerMaxRansacIterations(long qualityControllerAddr);
+
+    /**
+     * Must be called once per frame by the workers that display the map.
+     *
+     * @param qualityControllerAddr the address of the controller
+     * @return true if the map must be rendered in this frame, false if the last rendered map box
+     *          can be re-used (see {@link #qualityControllerRestoreMap})
+     */
+    public static native boolean qualityControllerShouldRefreshMap(long qualityControllerAddr);
+
+    /**
+     * Copies the last map box rendered by {@link #renderMap} on the output image.
+     *
+     * @param qualityControllerAddr the address of the controller
+     * @param resultMatAddr the mat on which the map box is copied
+     * @param mapTopLeftCornerX the x coordinate in the mat of the top-left corner of the map
+     * @param mapTopLeftCornerY the y coordinate in the mat of the top-left corner of the map
+     * @param mapPixelsX the width of the map box
+     * @param mapPixelsY the height of the map box
+     * @return false if no compatible map box was rendered yet (the map must be rendered)
+     */
+    public static native boolean qualityControllerRestoreMap(
+            long qualityControllerAddr,
+            long resultMatAddr,
+            int mapTopLeftCornerX,
+            int mapTopLeftCornerY,
+            int mapPixelsX,
+            int mapPixelsY
+    );
+
+    /**
+     * Reports the latencies of the stages of a processed frame; the controller takes its
+     * decisions (if any) here.
+     *
+     * @param qualityControllerAddr the address of the controller
+     * @param detectMs the time spent detecting the markers, in milliseconds
+     * @param estimateMs the time spent estimating the camera pose, in milliseconds
+     * @param renderMs the time spent drawing the overlays and the map, in milliseconds
+     */
+    public static native void qualityControllerReportFrame(
+            long qualityControllerAddr,
+            double detectMs,
+            double estimateMs,
+            double renderMs
+    );
+
+    /**
+     * Writes the telemetry of the controller on an array of 22 elements:
+     * [0] the frame budget (ms), [1] the average frame time (ms), [2..4] the average latencies
+     * of detection, estimation and rendering (ms), [5..7] the current steps of the detection,
+     * RANSAC and map knobs, [8] 1 if the markers are searched in a region of interest, [9] the
+     * detection decimation, [10] the cap on the RANSAC iterations, [11] the map refresh interval,
+     * [12] the number of reported frames, [13] the number of degradations, [14] the number of
+     * restorations, [15] the last decision (0 none, 1 degrade, 2 restore), [16] the knob of the
+     * last decision (0 detection, 1 RANSAC, 2 map), [17] the frame of the last decision, [18] the
+     * average frame time at the last decision (ms), [19..21] the number of frames searched in
+     * full, in the region of interest, and in full after nothing was found in the region of
+     * interest.
+     *
+     * @param qualityControllerAddr the address of the controller
+     * @param outTelemetry the output array
+     */
+    public static native void qualityControllerTelemetry(
+            long qualityControllerAddr,
+            double[] outTelemetry
+    );
+
+    /**
+     * Creates the native detector session of a worker, which keeps the detector parameters and
+     * the region where the markers were found between frames.
+     *
+     * @param qualityControllerAddr the quality controller which decides how the markers are
+     *                              searched, or 0 to always search the whole frame
+     * @return the address of the session
+     */
+    public static native long newDetectorSession(long qualityControllerAddr);
+
+    /**
+     * Frees a detector session created with {@link #newDetectorSession(long)}.
+     *
+     * @param detectorSessionAddr the address of the session
+     */
+    public static native void releaseDetectorSession(long detectorSessionAddr);
+
+    /**
+     * Writes the statistics of the adaptive thresholding window sizes learned by a detector
+     * session on an array of 53 elements: [0] the number N of window sizes, [1] the number of
+     * sweeps (frames in which all the sizes were run one by one), [2] the number of resets (sweeps
+     * forced by a drop of the found markers), [3] the number of detector passes run, [4] the
+     * number of window sizes skipped, then, for each window size i < 16, [5 + 3i] the size,
+     * [6 + 3i] 1 if the size is currently run, [7 + 3i] the number of markers found first with
+     * that size.
+     *
+     * @param detectorSessionAddr the address of the session
+     * @param outStats the output array
+     */
+    public static native void detectorSessionStats(long detectorSessionAddr, long[] outStats);
+
+    /**
+     * Size in bytes of a pose record, in the buffers filled by {@link #poseSubscriptionPoll} and in
+     * the binary pose log. A record is little endian, with the layout: [0] frame number (int64),
+     * [8] start of the processing of the frame (int64, unix epoch microseconds), [16] time of
+     * publication (int64, unix epoch microseconds), [24] rvec (3 x float64), [48] tvec
+     * (3 x float64), [72] mean quality of the inlier observations (float32), [76] inliers
+     * (int32), [80] markers found in the frame (uint16), [82] status, one of the
+     * PHONE_POSE_STATUS_* codes (int8), [83] producer (uint8), [84] reserved (4 bytes).
+     * The log starts with a 16 bytes header: "ASPL", the format version (uint32, currently 1),
+     * the record size (uint32) and 4 reserved bytes.
+     */
+    public static final int POSE_RECORD_SIZE = 88;
+
+    /**
+     * Creates a pose stream, which delivers the published pose records (in frame order) to its
+     * subscribers and appends them to a binary log, from a native background thread.
+     *
+     * @param logPath the path of the binary log (appended if it exists with the same format,
+     *                replaced otherwise), or null for no log
+     * @return the address of the stream
+     */
+    public static native long newPoseStream(String logPath);
+
+    /**
+     * Stops the dispatcher thread of a pose stream, after it delivered and logged the records
+     * still queued, closes its log and deallocates it.
+     *
+     * @param poseStreamAddr the address of the stream
+     */
+    public static native void releasePoseStream(long poseStreamAddr);
+
+    /**
+     * Registers a producer of pose records; each producer must be used by one thread at a time
+     * (e.g. the thread of a worker).
+     *
+     * @param poseStreamAddr the address of the stream
+     * @return the index of the producer, or -1 if the stream has too many producers (16)
+     */
+    public static native int poseStreamRegisterProducer(long poseStreamAddr);
+
+    /**
+     * Publishes the pose estimated in a frame. The number of found markers and the quality of the
+     * pose are read from the frame context. The record is queued without locks and without
+     * blocking.
+     *
+     * @param poseStreamAddr the address of the stream
+     * @param producer the index of the producer
+     * @param frameContextAddr the context of the frame
+     * @param frameNumber the number of the frame
+     * @param frameTimestampMs the time at which the processing of the frame started (unix epoch)
+     * @param rvec the rotation vector of the pose
+     * @param tvec the translation vector of the pose
+     * @param status the status of the pose, one of the PHONE_POSE_STATUS_* codes
+     * @param inliers the number of markers which are inliers of the estimate
+     * @return false if the record was dropped because the queue of the producer is full
+     */
+    public static native boolean poseStreamPublish(
+            long poseStreamAddr,
+            int producer,
+            long frameContextAddr,
+            long frameNumber,
+            long frameTimestampMs,
+            double[] rvec,
+            double[] tvec,
+            int status,
+            int inliers
+    );
+
+    /**
+     * Subscribes to a pose stream: the records published from now on are queued for the
+     * subscription (the ones that do not fit in the queue are dropped).
+     *
+     * @param poseStreamAddr the address of the stream
+     * @param capacity the capacity of the queue, in records
+     * @return the address of the subscription
+     */
+    public static native long poseStreamSubscribe(long poseStreamAddr, int capacity);
+
+    /**
+     * Removes a subscription and deallocates it; it must not be polled anymore.
+     *
+     * @param poseStreamAddr the address of the stream
+     * @param subscriptionAddr the address of the subscription
+     */
+    public static native void poseStreamUnsubscribe(long poseStreamAddr, long subscriptionAddr);
+
+    /**
+     * Copies the queued records of a subscription on a direct buffer (as many as they fit, see
+     * {@link #POSE_RECORD_SIZE} for the layout); if none is queued, waits for new ones up to the
+     * specified timeout. Must be called by one thread at a time.
+     *
+     * @param subscriptionAddr the address of the subscription
+     * @param outBuffer a direct buffer, in native byte order
+     * @param timeoutMicros the maximum wait, in microseconds (0 to return immediately)
+     * @return the number of copied records
+     */
+    public static native int poseSubscriptionPoll(
+            long subscriptionAddr,
+            java.nio.ByteBuffer outBuffer,
+            long timeoutMicros
+    );
+
+    /**
+     * Writes the counters of a pose stream on an array of 3 elements: [0] published records,
+     * [1] records dropped because the queue of their producer was full, [2] records written on
+     * the log.
+     *
+     * @param poseStreamAddr the address of the stream
+     * @param outStats the output array
+     */
+    public static native void poseStreamStats(long poseStreamAddr, long[] outStats);
+
+    /**
+     * Creates a session recorder, which writes the submitted input frames on a chunked container
+     * file from a native background thread, together with the calibration of the camera and the
+     * settings of the detector. The file starts with a 16 bytes header ("ASRC", the format version
+     * as uint32, 8 reserved bytes), followed by chunks made of a 4 bytes tag, 4 reserved bytes,
+     * the size of the payload (uint64) and the payload: "CALB" (calibration), "DSET" (detector
+     * settings), "FRAM" (a frame) and "STAT" (final counters); see sessionRecorder.h for the
+     * layout of the payloads. The values are little endian.
+     *
+     * @param path the path of the recording file (overwritten if it exists)
+     * @param grayOnly if true, only the luma plane of the frames is recorded
+     * @param poolSize the number of frame buffers: when all of them wait to be written, new frames
+     *                 are dropped instead of stalling the pipeline
+     * @param cameraMatrixAddr the camera matrix
+     * @param distCoeffsAddr the distortion coefficients
+     * @param markerDictionary the dictionary of the markers
+     * @param markerLength the length of the side of the markers, in meters
+     * @return the address of the recorder
+     */
+    public static native long newSessionRecorder(
+            String path,
+            boolean grayOnly,
+            int poolSize,
+            long cameraMatrixAddr,
+            long distCoeffsAddr,
+            int markerDictionary,
+            double markerLength
+    );
+
+    /**
+     * Writes the queued frames, closes the recording (if not already finished) and deallocates
+     * the recorder.
+     *
+     * @param sessionRecorderAddr the address of the recorder
+     */
+    public static native void releaseSessionRecorder(long sessionRecorderAddr);
+
+    /**
+     * Writes the queued frames and the "STAT" chunk, and closes the recording; the frames
+     * submitted afterwards are dropped, the counters can still be read. Does nothing if the
+     * recording is already finished.
+     *
+     * @param sessionRecorderAddr the address of the recorder
+     */
+    public static native void sessionRecorderFinish(long sessionRecorderAddr);
+
+    /**
+     * Queues the current frame of a worker for recording, after {@link #detectMarkers} (whose luma
+     * plane is recorded in gray only mode); never blocks on the disk.
+     *
+     * @param sessionRecorderAddr the address of the recorder
+     * @param frameContextAddr the context of the frame
+     * @param detectorSessionAddr the detector session of the worker, whose current settings are
+     *                            recorded with the frame (a "DSET" chunk is written when they
+     *                            change), or 0 to keep the settings of the previous frame
+     * @param inputMatAddr the input frame
+     * @param frameNumber the number of the frame
+     * @param frameTimestampMs the timestamp of the frame (unix epoch)
+     * @return false if the frame was dropped
+     */
+    public static native boolean sessionRecorderSubmit(
+            long sessionRecorderAddr,
+            long frameContextAddr,
+            long detectorSessionAddr,
+            long inputMatAddr,
+            long frameNumber,
+            long frameTimestampMs
+    );
+
+    /**
+     * Writes the counters of a session recorder on an array of 5 elements: [0] recorded frames,
+     * [1] dropped frames, [2] bytes written, [3] the maximum number of frames which waited to be
+     * written, [4] 1 if a write failed (the recording is stopped).
+     *
+     * @param sessionRecorderAddr the address of the recorder
+     * @param outStats the output array
+     */
+    public static native void sessionRecorderStats(long sessionRecorderAddr, long[] outStats);
+
+    /**
+     * Refines the corners of the markers found by {@link #detectMarkers} which are not known in the
+     * snapshot (their corners are not refined during the detection), and re-estimates their poses
+     * and quality scores; to be called before those markers are added to the map.
+     *
+     * @param cameraMatrixAddr the camera matrix
+     * @param distCoeffsAddr the distortion coefficients of the camera
+     * @param markerSize the side length (in meters) of the markers
+     * @param markerMapSnapshotAddr the snapshot passed to {@link #detectMarkers}
+     * @param markerSizeRegistryAddr the marker sizes passed to {@link #detectMarkers}
+     * @param frameContextAddr the native frame context of the worker
+     * @param maxMarkers the maximum numbers of markers expected to be found in an image
+     * @param outRvects the rotation vectors of the marker poses, updated for the refined markers
+     * @param outTvects the translation vectors of the marker poses, updated for the refined
+     *                  markers
+     * @param outQualities the quality scores of the marker poses, updated for the refined markers
+     * @return the number of refined markers
+     */
+    public static native int refinePromotedMarkers(
+            long cameraMatrixAddr,
+            long distCoeffsAddr,
+            double markerSize,
+            long markerMapSnapshotAddr,
+            long markerSizeRegistryAddr,
+            long frameContextAddr,
+            int maxMarkers,
+            double[] outRvects,
+            double[] outTvects,
+            double[] outQualities
+    );
+
+    /**
+     * Creates an accumulator of poses, which keeps only the running sums needed to compute their
+     * centroid (the same of {@link #poseCentroid}): adding a pose and taking the mean are O(1).
+     *
+     * @return the address of the accumulator
+     */
+    public static native long newPoseMeanAccumulator();
+
+    /**
+     * Deallocates a pose accumulator.
+     *
+     * @param accumulatorAddr the address of the accumulator
+     */
+    public static native void releasePoseMeanAccumulator(long accumulatorAddr);
+
+    /**
+     * Adds a pose to an accumulator.
+     *
+     * @param accumulatorAddr the address of the accumulator
+     * @param rvec the rotation vector of the pose
+     * @param tvec the translation vector of the pose
+     */
+    public static native void poseMeanAccumulatorAdd(
+            long accumulatorAddr,
+            double[] rvec,
+            double[] tvec
+    );
+
+    /**
+     * Writes the centroid of the poses added to an accumulator, and empties it.
+     *
+     * @param accumulatorAddr the address of the accumulator
+     * @param outRvec the output rotation (left untouched if no pose was added)
+     * @param outTvec the output translation (left untouched if no pose was added)
+     * @return the number of poses that were added
+     */
+    public static native int poseMeanAccumulatorTakeMean(
+            long accumulatorAddr,
+            double[] outRvec,
+            double[] outTvec
+    );
+
+    /**
+     * Creates a compact track, which stores a sequence of timestamped poses in 14 bytes each
+     * (translations in millimeters and rotations in ~1e-4 radians steps, relative to the origin of
+     * blocks of poses, and delta-encoded timestamps), decoded on the fly when read.
+     *
+     * @return the address of the track
+     */
+    public static native long newCompactTrack();
+
+    /**
+     * Deallocates a compact track.
+     *
+     * @param trackAddr the address of the track
+     */
+    public static native void releaseCompactTrack(long trackAddr);
+
+    /**
+     * Appends a pose to a compact track.
+     *
+     * @param trackAddr the address of the track
+     * @param rvec the rotation vector of the pose
+     * @param tvec the translation vector of the pose
+     * @param timestamp the timestamp of the pose, in milliseconds
+     */
+    public static native void compactTrackAppend(
+            long trackAddr,
+            double[] rvec,
+            double[] tvec,
+            long timestamp
+    );
+
+    /**
+     * @param trackAddr the address of the track
+     * @return the number of poses in a compact track
+     */
+    public static native int compactTrackSize(long trackAddr);
+
+    /**
+     * Decodes the poses of a compact track, starting from the pose of index first.
+     *
+     * @param trackAddr the address of the track
+     * @param first the index of the first pose to read
+     * @param outRvecs output: the rotation vectors of the poses (3 elements each)
+     * @param outTvecs output: the translation vectors of the poses (3 elements each)
+     * @param outTimestamps output: the timestamps of the poses; its length is the maximum number
+     *                      of poses read
+     * @return the number of poses read
+     */
+    public static native int compactTrackRead(
+            long trackAddr,
+            int first,
+            double[] outRvecs,
+            double[] outTvecs,
+            long[] outTimestamps
+    );
+
+    /**
+     * Writes the statistics of a compact track on an array of 3 elements: [0] poses, [1] blocks,
+     * [2] bytes used.
+     *
+     * @param trackAddr the address of the track
+     * @param outStats the output array
+     */
+    public static native void compactTrackStats(long trackAddr, long[] outStats);
+
+    /**
+     * Shift of the dictionary tag in the ids of the markers of the additional dictionaries of a
+     * detector session: tagged id = ((dictionary + 1) << MULTI_DICTIONARY_ID_SHIFT) | id. The ids
+     * of the main dictionary are not tagged.
+     */
+    public static final int MULTI_DICTIONARY_ID_SHIFT = 16;
+
+    /**
+     * Adds a dictionary to a detector session: the candidates rejected by the detector (with the
+     * main dictionary) are decoded against it, without thresholding the image again. The ids of
+     * its markers are tagged with the dictionary (see {@link #MULTI_DICTIONARY_ID_SHIFT}).
+     *
+     * @param detectorSessionAddr the address of the session
+     * @param markerDictionary the dictionary
+     * @return false if the dictionary was already added, or too many (8) dictionaries were added
+     */
+    public static native boolean detectorSessionAddDictionary(
+            long detectorSessionAddr,
+            int markerDictionary
+    );
+
+    /**
+     * Creates a sharpness gate, shared by the workers: before the detection, the sharpness of
+     * each frame (variance of the Laplacian of its decimated luma plane) is compared with a
+     * fraction of the peak sharpness of the recent frames, and the motion-blurred frames are
+     * skipped.
+     *
+     * @param ratio the fraction of the peak sharpness below which a frame is skipped
+     * @return the address of the gate
+     */
+    public static native long newSharpnessGate(double ratio);
+
+    /**
+     * Deallocates a sharpness gate.
+     *
+     * @param sharpnessGateAddr the address of the gate
+     */
+    public static native void releaseSharpnessGate(long sharpnessGateAddr);
+
+    /**
+     * Writes the statistics of a sharpness gate on an array of 5 elements: [0] gated frames,
+     * [1] skipped frames, [2] sharpness of the last frame, [3] current threshold, [4] reference
+     * (peak) sharpness.
+     *
+     * @param sharpnessGateAddr the address of the gate
+     * @param outStats the output array
+     */
+    public static native void sharpnessGateStats(long sharpnessGateAddr, double[] outStats);
+
+    /**
+     * Creates a pool of candidate markers, shared by the workers: the markers detected but not
+     * known yet are observed from several frames, and promoted into the map only when the mean of
+     * their observations has converged.
+     *
+     * @param capacity the maximum number of candidates tracked at the same time
+     * @return the address of the pool
+     */
+    public static native long newMarkerCandidatePool(int capacity);
+
+    /**
+     * Deallocates a pool of candidate markers.
+     *
+     * @param candidatePoolAddr the address of the pool
+     */
+    public static native void releaseMarkerCandidatePool(long candidatePoolAddr);
+
+    /**
+     * Adds to a pool of candidates the observations of the markers detected in a frame (see
+     * {@link #detectMarkers}) which are not known in a snapshot of the map, given the pose of the
+     * camera in the frame; the candidates which have converged are removed from the pool and
+     * returned, with their mean pose in the room.
+     *
+     * @param candidatePoolAddr the address of the pool
+     * @param frameContextAddr the context of the worker which detected the markers
+     * @param markerMapSnapshotAddr the snapshot of the known markers
+     * @param cameraRvec the rotation of the camera pose (room to camera)
+     * @param cameraTvec the translation of the camera pose (room to camera)
+     * @param frameNumber the number of the frame
+     * @param outIds the ids of the promoted markers; its length is the maximum number of markers
+     *               promoted in this call
+     * @param outRvecs the rotations of the promoted markers (3 elements each)
+     * @param outTvecs the translations of the promoted markers (3 elements each)
+     * @return the number of promoted markers
+     */
+    public static native int candidatePoolObserve(
+            long candidatePoolAddr,
+            long frameContextAddr,
+            long markerMapSnapshotAddr,
+            double[] cameraRvec,
+            double[] cameraTvec,
+            long frameNumber,
+            int[] outIds,
+            double[] outRvecs,
+            double[] outTvecs
+    );
+
+    /**
+     * Writes the statistics of a pool of candidates on an array of 4 elements: [0] candidates in
+     * the pool, [1] observations, [2] promoted markers, [3] evicted candidates.
+     *
+     * @param candidatePoolAddr the address of the pool
+     * @param outStats the output array
+     */
+    public static native void candidatePoolStats(long candidatePoolAddr, long[] outStats);
+
+    /**
+     * Creates a corner tracker, shared by the workers: the corners of the markers found in the
+     * most recent frame are tracked into the next frames with pyramidal Lucas-Kanade (with a
+     * forward-backward consistency check), so that a full detection is needed only every few
+     * frames.
+     *
+     * @param detectionInterval the number of frames between two full detections
+     * @return the address of the tracker
+     */
+    public static native long newCornerTracker(int detectionInterval);
+
+    /**
+     * Deallocates a corner tracker.
+     *
+     * @param cornerTrackerAddr the address of the tracker
+     */
+    public static native void releaseCornerTracker(long cornerTrackerAddr);
+
+    /**
+     * Writes the statistics of a corner tracker on an array of 4 elements: [0] full detections,
+     * [1] tracked frames, [2] tracked markers, [3] markers lost by the forward-backward check.
+     *
+     * @param cornerTrackerAddr the address of the tracker
+     * @param outStats the output array
+     */
+    public static native void cornerTrackerStats(long cornerTrackerAddr, long[] outStats);
+
+    /**
+     * Creates a submap manager on a marker map: the map is partitioned in submaps (each with its
+     * own local frame), and only the submaps near the phone are kept in the marker map, while the
+     * other ones are paged out and loaded again in background when the phone gets near them.
+     *
+     * @param markerMapAddr the marker map (see {@link #newMarkerMap()})
+     * @param pageDirectory the directory in which the pages of the submaps are written, or null to
+     *                      keep them in memory
+     * @return the address of the manager
+     */
+    public static native long newSubmapManager(long markerMapAddr, String pageDirectory);
+
+    /**
+     * Deallocates a submap manager, writing the pages of the modified submaps (after collecting
+     * the markers added to the space since the last position update). Must be called before the
+     * space is released.
+     *
+     * @param submapManagerAddr the address of the manager
+     */
+    public static native void releaseSubmapManager(long submapManagerAddr);
+
+    /**
+     * Defines a submap.
+     *
+     * @param submapManagerAddr the address of the manager
+     * @param submapId the id of the submap
+     * @param minMarkerId the first id of the markers owned by the submap
+     * @param maxMarkerId the last id of the markers owned by the submap; the new markers which are
+     *                    not owned by any submap are assigned to the active one
+     * @param anchorRvec the rotation from the room's coordinate system to the local one of the
+     *                   submap
+     * @param anchorTvec the translation from the room's coordinate system to the local one of the
+     *                   submap
+     * @return false if a submap with the same id was already defined
+     */
+    public static native boolean submapManagerDefineSubmap(
+            long submapManagerAddr,
+            int submapId,
+            int minMarkerId,
+            int maxMarkerId,
+            double[] anchorRvec,
+            double[] anchorTvec
+    );
+
+    /**
+     * Makes two submaps neighbors: the neighbors of the active submap are always loaded.
+     *
+     * @param submapManagerAddr the address of the manager
+     * @return false if one of the submaps is not defined
+     */
+    public static native boolean submapManagerConnect(
+            long submapManagerAddr,
+            int submapIdA,
+            int submapIdB
+    );
+
+    /**
+     * Reports the position of the phone in the room to a submap manager; the submaps are paged in
+     * and out in background.
+     *
+     * @param submapManagerAddr the address of the manager
+     * @param position the position of the phone
+     */
+    public static native void submapManagerUpdatePosition(
+            long submapManagerAddr,
+            double[] position
+    );
+
+    /**
+     * Writes the statistics of a submap manager on an array of 6 elements: [0] submaps,
+     * [1] resident submaps, [2] id of the active submap (-1 if none), [3] markers in the marker
+     * map, [4] pages loaded, [5] pages written.
+     *
+     * @param submapManagerAddr the address of the manager
+     * @param outStats the output array
+     */
+    public static native void submapManagerStats(long submapManagerAddr, long[] outStats);
+
+    /**
+     * Creates a scheduler which processes several independent frame streams (e.g. several
+     * cameras) at the same time against the same marker map. The frames of the streams are
+     * processed by a shared pool of threads, which gives each stream a share of the CPU time
+     * proportional to its weight.
+     *
+     * @param markerMapAddr the shared marker map (see {@link #newMarkerMap()})
+     * @param threads the number of worker threads, 0 for one per core
+     * @param markerSizeRegistryAddr the side lengths of the markers which differ from the one of
+     *                               each stream (see {@link #newMarkerSizeRegistry()}), or 0
+     * @return the address of the scheduler
+     */
+    public static native long newStreamScheduler(
+            long markerMapAddr,
+            int threads,
+            long markerSizeRegistryAddr
+    );
+
+    /**
+     * Deallocates a stream scheduler, discarding the frames not processed yet.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     */
+    public static native void releaseStreamScheduler(long streamSchedulerAddr);
+
+    /**
+     * Opens a new stream on a scheduler.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     * @param markerDictionary the dictionary of the markers seen by the stream
+     * @param markerLength the length of the side of the markers
+     * @param cameraMatrixAddr the camera matrix of the stream (copied)
+     * @param distCoeffsAddr the distortion coefficients of the stream (copied)
+     * @param workerBudget the maximum number of frames of the stream processed at the same time
+     * @param weight the share of CPU time of the stream, relative to the other streams
+     * @param addNewMarkers true if the markers not known yet, seen by the stream, are added to the
+     *                      map
+     * @param minInliersRatio a pose is valid if at least this fraction of the known markers are
+     *                        RANSAC inliers
+     * @param maxSpeed a pose is valid if the camera did not move faster than this since the last
+     *                 pose of the stream (meters per second)
+     * @param maxAngularSpeed a pose is valid if the camera did not rotate faster than this since
+     *                        the last pose of the stream (radians per second)
+     * @return the id of the stream, or -1 if the scheduler has no worker thread (no reader slot
+     *         of the map was free when it was created)
+     */
+    public static native int streamSchedulerOpenStream(
+            long streamSchedulerAddr,
+            int markerDictionary,
+            double markerLength,
+            long cameraMatrixAddr,
+            long distCoeffsAddr,
+            int workerBudget,
+            double weight,
+            boolean addNewMarkers,
+            double minInliersRatio,
+            double maxSpeed,
+            double maxAngularSpeed
+    );
+
+    /**
+     * Closes a stream, waiting for its frames being processed to complete.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     * @param streamId the id of the stream
+     */
+    public static native void streamSchedulerCloseStream(long streamSchedulerAddr, int streamId);
+
+    /**
+     * Submits a frame to a stream; the frame is copied, and processed asynchronously.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     * @param streamId the id of the stream
+     * @param frameMatAddr the RGBA frame
+     * @param frameNumber the number of the frame in the stream
+     * @param timestampUs the timestamp of the frame, in microseconds
+     * @return false if the stream is not open
+     */
+    public static native boolean streamSchedulerSubmit(
+            long streamSchedulerAddr,
+            int streamId,
+            long frameMatAddr,
+            long frameNumber,
+            long timestampUs
+    );
+
+    /**
+     * Reads the last poses of the camera estimated in a stream, ordered by frame number.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     * @param streamId the id of the stream
+     * @param outFrameNumbers output: the frame numbers of the poses; its length is the maximum
+     *                        number of poses read
+     * @param outRvecs output: the rotation vectors of the poses (3 elements each)
+     * @param outTvecs output: the translation vectors of the poses (3 elements each)
+     * @return the number of poses read
+     */
+    public static native int streamSchedulerLastPoses(
+            long streamSchedulerAddr,
+            int streamId,
+            long[] outFrameNumbers,
+            double[] outRvecs,
+            double[] outTvecs
+    );
+
+    /**
+     * Writes the statistics of a stream on an array of 7 elements: [0] submitted frames,
+     * [1] processed frames, [2] dropped frames, [3] estimated valid poses, [4] CPU time used
+     * (microseconds), [5] frames waiting to be processed, [6] frames whose processing failed
+     * with an error.
+     *
+     * @param streamSchedulerAddr the address of the scheduler
+     * @param streamId the id of the stream
+     * @param outStats the output array
+     * @return false if the stream is not open
+     */
+    public static native boolean streamSchedulerStats(
+            long streamSchedulerAddr,
+            int streamId,
+            long[] outStats
+    );
+
+    /**
+     * Creates a registry of the side lengths of the markers, for installations which mix markers
+     * of different sizes: the markers not in the registry have the common length of the space.
+     * The registry publishes each modification as a new immutable table, so the frame workers
+     * read it without locks.
+     *
+     * @return the address of the registry
+     */
+    public static native long newMarkerSizeRegistry();
+
+    /**
+     * Deallocates a marker size registry.
+     *
+     * @param registryAddr the address of the registry
+     */
+    public static native void releaseMarkerSizeRegistry(long registryAddr);
+
+    /**
+     * Sets the side length of a marker.
+     *
+     * @param registryAddr the address of the registry
+     * @param markerId the id of the marker
+     * @param length the side length of the marker, in meters; 0 to restore the common length
+     */
+    public static native void markerSizeRegistrySetLength(
+            long registryAddr,
+            int markerId,
+            double length
+    );
+
+    /**
+     * @param registryAddr the address of the registry
+     * @param markerId the id of the marker
+     * @param commonLength the length of the markers which are not in the registry
+     * @return the side length of the marker, in meters
+     */
+    public static native double markerSizeRegistryLengthOf(
+            long registryAddr,
+            int markerId,
+            double commonLength
+    );
+
+    /**
+     * @param registryAddr the address of the registry
+     * @return the number of markers in the registry
+     */
+    public static native int markerSizeRegistrySize(long registryAddr);
+
 }
@@ -3,22 +3,32 @@ package parsleyj.arucoslam.datamodel
 import parsleyj.arucoslam.NativeMethods
 import parsleyj.kotutils.with
 
+/**
+ * History of the poses of the phone. The recent poses are not stored: they are added to a native
+ * streaming accumulator, and every [recentPoseInterval] milliseconds (or [recentPosesMaxSize]
+ * poses) their centroid is appended to the long term track, in constant time. The long term
+ * track is a native compact track (see [NativeMethods.newCompactTrack]), rendered directly by
+ * the native code.
+ */
 class Track(
     val recentPoseInterval: Long,
     val recentPosesMaxSize: Int,
 ) {
+    val longTermTrackAddr: Long = NativeMethods.newCompactTrack()
 
-
-    val recentPosesRvecs: DoubleArray = DoubleArray(recentPosesMaxSize * 3)
-    val recentPosesTvecs: DoubleArray = DoubleArray(recentPosesMaxSize * 3)
-    val recentPosesTimestamps: MutableList<Long> = mutableListOf()
-    val longTermTrackRvecs: ContiguousDoubleList = ContiguousDoubleList(0) { 0.0 }
-    val longTermTrackTvecs: ContiguousDoubleList = ContiguousDoubleList(0) { 0.0 }
-    val longTermTrackTimestamps: MutableList<Long> = mutableListOf()
+    val longTermTrackSize: Int
+        get() = NativeMethods.compactTrackSize(longTermTrackAddr)
 
     var recentPosesSize = 0
         private set
 
+    private val recentPosesAccumulator = NativeMethods.newPoseMeanAccumulator()
+    private var oldestRecentPoseTimestamp = 0L
+    private var recentPosesTimestampsSum = 0L
+
+    // the last added pose, returned by lastPose() until it is compressed
+    private val lastRecentPose = Pose3d()
+    private var lastRecentPoseTimestamp = 0L
 
     // used as recyclable data structures for compress()
     private var centroidRvect = DoubleArray(3) { 0.0 }
@@ -28,90 +38,109 @@ class Track(
         pose: Pose3d,
         timestamp: Long = System.currentTimeMillis(),
     ): Unit = synchronized(this) {
-        val oldestRecentPoseTimestamp = if (recentPosesTimestamps.isEmpty()) {
-            null
-        } else {
-            recentPosesTimestamps[0]
-        }
-        if (recentPosesSize >= recentPosesMaxSize || (oldestRecentPoseTimestamp != null
+        if (recentPosesSize >= recentPosesMaxSize || (recentPosesSize > 0
                     && timestamp - oldestRecentPoseTimestamp >= recentPoseInterval)
         ) {
             compress()
         }
-        recentPosesRvecs[recentPosesSize * 3] = pose.rotationVector.x
-        recentPosesRvecs[recentPosesSize * 3 + 1] = pose.rotationVector.y
-        recentPosesRvecs[recentPosesSize * 3 + 2] = pose.rotationVector.z
-        recentPosesTvecs[recentPosesSize * 3] = pose.translationVector.x
-        recentPosesTvecs[recentPosesSize * 3 + 1] = pose.translationVector.y
-        recentPosesTvecs[recentPosesSize * 3 + 2] = pose.translationVector.z
-        recentPosesTimestamps.add(timestamp)
+        NativeMethods.poseMeanAccumulatorAdd(
+            recentPosesAccumulator,
+            pose.rotationVector.asDoubleArray(),
+            pose.translationVector.asDoubleArray()
+        )
+        if (recentPosesSize == 0) {
+            oldestRecentPoseTimestamp = timestamp
+        }
+        recentPosesTimestampsSum += timestamp
+        pose.copyTo(lastRecentPose)
+        lastRecentPoseTimestamp = timestamp
         recentPosesSize++
     }
 
     fun lastPose(): Pair<Pose3d, Long>? = synchronized(this) {
         when {
             recentPosesSize > 0 -> {
-                val lastIndex = recentPosesSize - 1
-                return Pose3d(
-                    Vec3d(
-                        recentPosesRvecs[lastIndex * 3],
-                        recentPosesRvecs[lastIndex * 3 + 1],
-                        recentPosesRvecs[lastIndex * 3 + 2],
-                    ),
-                    Vec3d(
-                        recentPosesTvecs[lastIndex * 3],
-                        recentPosesTvecs[lastIndex * 3 + 1],
-                        recentPosesTvecs[lastIndex * 3 + 2],
-                    )
-                ) with recentPosesTimestamps[lastIndex]
-            }
-            longTermTrackTimestamps.isNotEmpty() -> {
-                val lastIndex = longTermTrackTimestamps.size - 1
                 return Pose3d(
                     Vec3d(
-                        longTermTrackRvecs[lastIndex * 3],
-                        longTermTrackRvecs[lastIndex * 3 + 1],
-                        longTermTrackRvecs[lastIndex * 3 + 2],
+                        lastRecentPose.rotationVector.x,
+                        lastRecentPose.rotationVector.y,
+                        lastRecentPose.rotationVector.z,
                     ),
                     Vec3d(
-                        longTermTrackTvecs[lastIndex * 3],
-                        longTermTrackTvecs[lastIndex * 3 + 1],
-                        longTermTrackTvecs[lastIndex * 3 + 2],
+                        lastRecentPose.translationVector.x,
+                        lastRecentPose.translationVector.y,
+                        lastRecentPose.translationVector.z,
                     )
-                ) with longTermTrackTimestamps[lastIndex]
+                ) with lastRecentPoseTimestamp
             }
             else -> {
-                return null
+                // the last pose of the long term track, if any
+                return readLongTermTrack(longTermTrackSize - 1, 1).firstOrNull()
             }
         }
     }
 
+    /**
+     * Decodes at most [count] poses of the long term track, starting from the one of index
+     * [first], with their timestamps.
+     */
+    fun readLongTermTrack(first: Int, count: Int): List<Pair<Pose3d, Long>> {
+        val rvecs = DoubleArray(count * 3)
+        val tvecs = DoubleArray(count * 3)
+        val timestamps = LongArray(count)
+        val read = NativeMethods.compactTrackRead(
+            longTermTrackAddr,
+            first,
+            rvecs,
+            tvecs,
+            timestamps
+        )
+        return (0 until read).map { i ->
+            Pose3d(
+                Vec3d(rvecs[i * 3], rvecs[i * 3 + 1], rvecs[i * 3 + 2]),
+                Vec3d(tvecs[i * 3], tvecs[i * 3 + 1], tvecs[i * 3 + 2]),
+            ) with timestamps[i]
+        }
+    }
+
+    fun longTermTrackStats(): CompactTrackStats {
+        val values = LongArray(3)
+        NativeMethods.compactTrackStats(longTermTrackAddr, values)
+        return CompactTrackStats(poses = values[0], blocks = values[1], bytes = values[2])
+    }
+
+    fun release(): Unit = synchronized(this) {
+        NativeMethods.releasePoseMeanAccumulator(recentPosesAccumulator)
+        NativeMethods.releaseCompactTrack(longTermTrackAddr)
+    }
+
     private fun compress() {
-        if(recentPosesSize!= 0) {
-            if (recentPosesSize == 1) {
-                centroidRvect[0] = recentPosesRvecs[0]
-                centroidRvect[1] = recentPosesRvecs[1]
-                centroidRvect[2] = recentPosesRvecs[2]
-                centroidTvect[0] = recentPosesTvecs[0]
-                centroidTvect[1] = recentPosesTvecs[1]
-                centroidTvect[2] = recentPosesTvecs[2]
-            } else {
-                NativeMethods.poseCentroid(
-                    recentPosesRvecs,
-                    recentPosesTvecs,
-                    0,
-                    recentPosesSize,
-                    centroidRvect,
-                    centroidTvect,
-                )
-            }
-            longTermTrackRvecs.addFromArray(centroidRvect)
-            longTermTrackTvecs.addFromArray(centroidTvect)
-            longTermTrackTimestamps.add(
-                recentPosesTimestamps.average().toLong()
+        if (recentPosesSize != 0) {
+            // the mean is read from the running sums, and the accumulator is emptied
+            NativeMethods.poseMeanAccumulatorTakeMean(
+                recentPosesAccumulator,
+                centroidRvect,
+                centroidTvect,
             )
-            recentPosesTimestamps.clear()
+            NativeMethods.compactTrackAppend(
+                longTermTrackAddr,
+                centroidRvect,
+                centroidTvect,
+                recentPosesTimestampsSum / recentPosesSize
+            )
+            recentPosesTimestampsSum = 0L
             recentPosesSize = 0
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @param poses poses in the long term track
+ * @param blocks blocks of the compact encoding
+ * @param bytes memory used by the compact encoding
+ */
+data class CompactTrackStats(
+    val poses: Long,
+    val blocks: Long,
+    val bytes: Long,
+)
@@ -149,7 +149,7 @@ class FixedMarkerTaggedSpace(
     fun getMarkerSpecs(id: Int) = this[id]
 
     fun toSLAMSpace(commonLength: Double = -1.0): SLAMSpace {
-        return SLAMSpace(
+        val slamSpace = SLAMSpace(
             dictionary,
             if(commonLength<=0) {
                 markers.firstOrNull()?.markerSideLength?:0.1
@@ -158,5 +158,8 @@ class FixedMarkerTaggedSpace(
             },
             markers.map{ SLAMMarker(it.markerId, it.pose3d) }
         )
+        // the markers with a different size keep it
+        markers.forEach { slamSpace.setMarkerLength(it.markerId, it.markerSideLength) }
+        return slamSpace
     }
 }
\ No newline at end of file
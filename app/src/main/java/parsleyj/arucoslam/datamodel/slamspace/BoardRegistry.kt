@@ -0,0 +1,89 @@
+package parsleyj.arucoslam.datamodel.slamspace
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.ArucoDictionary
+import parsleyj.arucoslam.datamodel.Pose3d
+
+/**
+ * Set of rigid boards placed in the world (groups of markers with known relative poses, or
+ * ChArUco boards), stored natively with their precomputed object points
+ * (see [NativeMethods.newBoardRegistry]). When enough markers of a board are visible, the camera
+ * pose is estimated from the whole board at once.
+ * All the boards must be registered before the frames are processed.
+ */
+class BoardRegistry {
+    val nativeAddr: Long = NativeMethods.newBoardRegistry()
+
+    var size: Int = 0
+        private set
+
+    /**
+     * Registers a board of markers.
+     *
+     * @param markerIds the ids of the markers of the board
+     * @param markerCorners the 3D positions of the 4 corners of each marker in the board's
+     *                      coordinate system (12 values for each marker)
+     * @param pose the pose of the board in the world
+     * @return the index of the board
+     */
+    fun registerMarkerBoard(
+        dictionary: ArucoDictionary,
+        markerIds: IntArray,
+        markerCorners: DoubleArray,
+        pose: Pose3d,
+        axisLength: Double = 0.1,
+    ): Int {
+        require(markerCorners.size == markerIds.size * 12) {
+            "Expected 4 3D corners for each marker"
+        }
+        size++
+        return NativeMethods.registerMarkerBoard(
+            nativeAddr,
+            dictionary.toInt(),
+            markerIds.size,
+            markerIds,
+            markerCorners,
+            pose.rotationVector.asDoubleArray(),
+            pose.translationVector.asDoubleArray(),
+            axisLength
+        )
+    }
+
+    /**
+     * Registers a ChArUco board.
+     *
+     * @param firstMarkerId the id of the first marker of the board: its markers have the
+     *                      consecutive ids starting from this one (which must be reserved to the
+     *                      board in the whole space), instead of the ids starting from 0 of the
+     *                      boards generated by OpenCV
+     * @param pose the pose of the board in the world
+     * @return the index of the board
+     */
+    fun registerCharucoBoard(
+        dictionary: ArucoDictionary,
+        squaresX: Int,
+        squaresY: Int,
+        squareLength: Double,
+        markerLength: Double,
+        firstMarkerId: Int,
+        pose: Pose3d,
+    ): Int {
+        require(firstMarkerId >= 0) { "Invalid first marker id: $firstMarkerId" }
+        size++
+        return NativeMethods.registerCharucoBoard(
+            nativeAddr,
+            dictionary.toInt(),
+            squaresX,
+            squaresY,
+            squareLength,
+            markerLength,
+            firstMarkerId,
+            pose.rotationVector.asDoubleArray(),
+            pose.translationVector.asDoubleArray()
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseBoardRegistry(nativeAddr)
+    }
+}
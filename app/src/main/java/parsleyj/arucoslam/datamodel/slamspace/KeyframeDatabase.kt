@@ -0,0 +1,94 @@
+package parsleyj.arucoslam.datamodel.slamspace
+
+import org.opencv.core.Mat
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.Pose3d
+import parsleyj.arucoslam.framepipeline.FrameContext
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.math.PI
+
+/**
+ * Native store of keyframes (see [NativeMethods.newKeyframeDatabase]): it remembers from which
+ * camera poses the markers were observed, and it is used to recover the pose quickly when the
+ * tracking is lost.
+ *
+ * @param minTranslation minimum distance (in meters) between keyframes observing the same markers
+ * @param minRotation minimum angular distance (in radians) between keyframes observing the same
+ *                    markers
+ * @param maxKeyframes maximum number of keyframes stored
+ */
+class KeyframeDatabase(
+    minTranslation: Double = 0.2,
+    minRotation: Double = PI / 12.0,
+    maxKeyframes: Int = 4096,
+) {
+    val nativeAddr: Long = NativeMethods.newKeyframeDatabase(
+        minTranslation,
+        minRotation,
+        maxKeyframes
+    )
+
+    val size: Int
+        get() = NativeMethods.keyframeDatabaseSize(nativeAddr)
+
+    // consecutive frames (of all the workers) without a valid pose
+    private val framesWithoutValidPose = AtomicInteger(0)
+
+    /**
+     * Records whether a valid pose was found in the last processed frame.
+     */
+    fun reportPoseValidity(valid: Boolean) {
+        if (valid) {
+            framesWithoutValidPose.set(0)
+        } else {
+            framesWithoutValidPose.incrementAndGet()
+        }
+    }
+
+    /**
+     * @return true if no valid pose was found in the last [lostFrames] frames, i.e. the pose
+     *         should be recovered with [relocalize]
+     */
+    fun trackingLost(lostFrames: Int) = framesWithoutValidPose.get() >= lostFrames
+
+    /**
+     * Stores the markers found in the current frame of the worker owning [frameContext], observed
+     * from the (valid) [pose]; the sizes of the markers are the ones of [slamSpace].
+     */
+    fun insert(frameContext: FrameContext, slamSpace: SLAMSpace, pose: Pose3d, timestamp: Long) =
+        NativeMethods.insertKeyframe(
+            nativeAddr,
+            frameContext.nativeAddr,
+            slamSpace.commonLength,
+            slamSpace.markerSizesAddr,
+            pose.rotationVector.asDoubleArray(),
+            pose.translationVector.asDoubleArray(),
+            timestamp
+        )
+
+    /**
+     * Attempts to recover the camera pose from the markers found in the current frame of the
+     * worker owning [frameContext]; on success, the pose is written on [outPose].
+     *
+     * @return the number of markers used to compute the pose, 0 if the relocalization failed
+     */
+    fun relocalize(
+        frameContext: FrameContext,
+        cameraMatrix: Mat,
+        distCoeffs: Mat,
+        outPose: Pose3d,
+        maxReprojectionError: Double = 3.0,
+    ) = NativeMethods.relocalize(
+        nativeAddr,
+        frameContext.nativeAddr,
+        cameraMatrix.nativeObjAddr,
+        distCoeffs.nativeObjAddr,
+        maxReprojectionError,
+        outPose.rotationVector.asDoubleArray(),
+        outPose.translationVector.asDoubleArray()
+    )
+
+    fun release() {
+        NativeMethods.releaseKeyframeDatabase(nativeAddr)
+    }
+}
@@ -0,0 +1,88 @@
+package parsleyj.arucoslam.datamodel.slamspace
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.Pose3d
+import parsleyj.arucoslam.datamodel.Vec3d
+import parsleyj.arucoslam.framepipeline.FrameContext
+
+/**
+ * Pool of the markers detected but not known yet (see [NativeMethods.newMarkerCandidatePool]),
+ * shared by the workers: instead of adding a new marker to the [SLAMSpace] with the pose computed
+ * in the first frame in which it is seen, its observations are averaged over several frames and
+ * viewpoints, and it is promoted only when its mean pose has converged.
+ *
+ * @param capacity maximum number of candidates tracked at the same time
+ * @param maxPromotedPerFrame maximum number of markers promoted by a single call of [observe]
+ */
+class MarkerCandidatePool(
+    capacity: Int = 64,
+    private val maxPromotedPerFrame: Int = 8,
+) {
+    val nativeAddr: Long = NativeMethods.newMarkerCandidatePool(capacity)
+
+    /**
+     * Observes the unknown markers detected in a frame, given the phone pose estimated in it.
+     *
+     * @param frameContext the context of the worker which detected the markers
+     * @param markerMapSnapshot the snapshot of the known markers used in the frame
+     * @return the markers which have converged, to be added to the map
+     */
+    fun observe(
+        frameContext: FrameContext,
+        markerMapSnapshot: Long,
+        phonePose: Pose3d,
+        frameNumber: Long,
+    ): List<SLAMMarker> {
+        val ids = IntArray(maxPromotedPerFrame)
+        val rvecs = DoubleArray(maxPromotedPerFrame * 3)
+        val tvecs = DoubleArray(maxPromotedPerFrame * 3)
+        val promoted = NativeMethods.candidatePoolObserve(
+            nativeAddr,
+            frameContext.nativeAddr,
+            markerMapSnapshot,
+            phonePose.rotationVector.asDoubleArray(),
+            phonePose.translationVector.asDoubleArray(),
+            frameNumber,
+            ids,
+            rvecs,
+            tvecs
+        )
+        return (0 until promoted).map { i ->
+            SLAMMarker(
+                ids[i],
+                Pose3d(
+                    Vec3d(rvecs[i * 3], rvecs[i * 3 + 1], rvecs[i * 3 + 2]),
+                    Vec3d(tvecs[i * 3], tvecs[i * 3 + 1], tvecs[i * 3 + 2]),
+                )
+            )
+        }
+    }
+
+    fun stats(): MarkerCandidatePoolStats {
+        val values = LongArray(4)
+        NativeMethods.candidatePoolStats(nativeAddr, values)
+        return MarkerCandidatePoolStats(
+            candidates = values[0],
+            observations = values[1],
+            promoted = values[2],
+            evicted = values[3],
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseMarkerCandidatePool(nativeAddr)
+    }
+}
+
+/**
+ * @param candidates markers currently in the pool
+ * @param observations observations added to the pool
+ * @param promoted markers promoted into the map
+ * @param evicted candidates evicted because not observed anymore
+ */
+data class MarkerCandidatePoolStats(
+    val candidates: Long,
+    val observations: Long,
+    val promoted: Long,
+    val evicted: Long,
+)
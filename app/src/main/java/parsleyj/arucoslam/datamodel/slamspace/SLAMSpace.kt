@@ -1,108 +1,136 @@
 package parsleyj.arucoslam.datamodel.slamspace
 
+import parsleyj.arucoslam.NativeMethods
 import parsleyj.arucoslam.datamodel.*
-import parsleyj.arucoslam.flattenVecs
-import parsleyj.kotutils.Tuple4
 import parsleyj.kotutils.itMap
-import parsleyj.kotutils.tuple
-import java.lang.Integer.min
 
 /**
  * A mutable data structure which defines a 3D world of ArUco makers, for SLAM applications.
- * All the markers belong to the same [dictionary] and have the same side length ([commonLength]).
- * The data about the markers is stored inside three special kind of lists (see [ContiguousIntList]
- * and [ContiguousDoubleList]) which allows native methods written in C++ to access to them directly
- * as jintarray or jdoublearray.
+ * All the markers belong to the same [dictionary]; they have the same side length
+ * ([commonLength]), unless a different one is set with [setMarkerLength].
+ * The data about the markers is stored in a native marker map (see [NativeMethods.newMarkerMap]),
+ * which publishes each modification as a new immutable snapshot: the frame workers read the
+ * markers through a [Reader], without ever taking a lock, while the writers (i.e. [addIfNotPresent]
+ * and [removeLastMarker]) are serialized natively.
  */
 class SLAMSpace(
     val dictionary: ArucoDictionary,
-    val markerIDs: ContiguousIntList,
-    val markerRVects: ContiguousDoubleList,
-    val markerTVects: ContiguousDoubleList,
     val commonLength: Double,
+    markers: List<SLAMMarker> = emptyList(),
 ) : Iterable<SLAMMarker> {
 
-    constructor(
-        dictionary: ArucoDictionary,
-        commonLength: Double,
-        markers: List<SLAMMarker> = emptyList(),
-    ) : this(
-        dictionary,
-        ContiguousIntList(markers.map { it.markerId }),
-        ContiguousDoubleList(markers.map { it.pose3d.rotationVector }.flattenVecs()),
-        ContiguousDoubleList(markers.map { it.pose3d.translationVector }.flattenVecs()),
-        commonLength,
-    )
+    val nativeAddr: Long = NativeMethods.newMarkerMap()
 
-    val size:Int
-        get() = synchronized(this){ markerIDs.size }
+    /**
+     * The native registry of the markers whose side length differs from [commonLength] (see
+     * [NativeMethods.newMarkerSizeRegistry]), to be passed to the frame processing.
+     */
+    val markerSizesAddr: Long = NativeMethods.newMarkerSizeRegistry()
 
+    init {
+        markers.forEach { addIfNotPresent(it) }
+    }
+
+    /**
+     * Gives lock-free access to consistent snapshots of the map. Each thread that reads the map
+     * during the processing of the frames must own a different reader.
+     */
+    inner class Reader {
+        private val slot = NativeMethods.markerMapRegisterReader(nativeAddr)
+
+        init {
+            check(slot >= 0) { "No more reader slots available on the marker map" }
+        }
+
+        /**
+         * Returns the address of the current snapshot of the map, which can be passed to the
+         * native methods; it remains valid (and unchanged) until [release] is called.
+         */
+        fun acquire(): Long = NativeMethods.markerMapAcquire(nativeAddr, slot)
+
+        fun release() = NativeMethods.markerMapRelease(nativeAddr, slot)
+
+        fun unregister() = NativeMethods.markerMapUnregisterReader(nativeAddr, slot)
+    }
+
+    val size: Int
+        get() = NativeMethods.markerMapSize(nativeAddr)
 
-    fun getByIndex(index: Int): SLAMMarker? = synchronized(this) {
-        return if (index in 0 until size) {
+
+    fun getByIndex(index: Int): SLAMMarker? {
+        val rVec = DoubleArray(3)
+        val tVec = DoubleArray(3)
+        val markerId = NativeMethods.markerMapGet(nativeAddr, index, rVec, tVec)
+        return if (markerId >= 0) {
             SLAMMarker(
-                markerIDs[index],
+                markerId,
                 Pose3d(
-                    rVec = Vec3d(
-                        markerRVects[index * 3],
-                        markerRVects[index * 3 + 1],
-                        markerRVects[index * 3 + 2],
-                    ),
-                    tVec = Vec3d(
-                        markerTVects[index * 3],
-                        markerTVects[index * 3 + 1],
-                        markerTVects[index * 3 + 2],
-                    )
+                    rVec = Vec3d(rVec[0], rVec[1], rVec[2]),
+                    tVec = Vec3d(tVec[0], tVec[1], tVec[2]),
                 ),
             )
         } else null
     }
 
+    /**
+     * Iterates over a copy of the markers of a single snapshot: the map can be replaced meanwhile
+     * (e.g. by the paging of the submaps) without affecting the iteration.
+     */
     override fun iterator(): Iterator<SLAMMarker> {
-        return (0 until size).itMap { index ->
-            synchronized(this@SLAMSpace) {
-                getByIndex(index)!!
+        var capacity = size
+        while (true) {
+            val ids = IntArray(capacity)
+            val rVecs = DoubleArray(capacity * 3)
+            val tVecs = DoubleArray(capacity * 3)
+            val count = NativeMethods.markerMapCopy(nativeAddr, ids, rVecs, tVecs)
+            if (count > capacity) {
+                // the map grew after its size was read
+                capacity = count
+                continue
             }
-        }.iterator()
-    }
-
-    fun addIfNotPresent(marker: SLAMMarker): Boolean = synchronized(this) {
-        return if (marker.markerId in markerIDs) {
-            false
-        } else {
-            markerIDs.add(marker.markerId)
-            markerRVects.addFromArray(marker.pose3d.rotationVector.asDoubleArray())
-            markerTVects.addFromArray(marker.pose3d.translationVector.asDoubleArray())
-            true
+            return (0 until count).itMap { i ->
+                SLAMMarker(
+                    ids[i],
+                    Pose3d(
+                        rVec = Vec3d(rVecs[i * 3], rVecs[i * 3 + 1], rVecs[i * 3 + 2]),
+                        tVec = Vec3d(tVecs[i * 3], tVecs[i * 3 + 1], tVecs[i * 3 + 2]),
+                    ),
+                )
+            }.iterator()
         }
     }
 
-    fun copyToArrays(
-        idsArr: IntArray,
-        rvects: DoubleArray,
-        tvects: DoubleArray,
-    ) = synchronized(this) {
-        System.arraycopy(markerIDs.elementData, 0,
-            idsArr, 0, min(size, idsArr.size))
-        System.arraycopy(markerRVects.elementData, 0,
-            rvects, 0, min(size, rvects.size))
-        System.arraycopy(markerTVects.elementData, 0,
-            tvects, 0, min(size, tvects.size))
+    fun addIfNotPresent(marker: SLAMMarker): Boolean {
+        return NativeMethods.markerMapAddIfNotPresent(
+            nativeAddr,
+            marker.markerId,
+            marker.pose3d.rotationVector.asDoubleArray(),
+            marker.pose3d.translationVector.asDoubleArray(),
+        )
     }
 
-    fun asArrays():Tuple4<IntArray, DoubleArray, DoubleArray, Int> = synchronized(this) {
-        return@synchronized tuple(
-            this.markerIDs.elementData,
-            this.markerRVects.elementData,
-            this.markerTVects.elementData,
-            this.size,
+    /**
+     * Sets the side length (in meters) of the marker with id [markerId]; it can be changed while
+     * the frames are processed.
+     */
+    fun setMarkerLength(markerId: Int, length: Double) {
+        NativeMethods.markerSizeRegistrySetLength(
+            markerSizesAddr,
+            markerId,
+            if (length == commonLength) 0.0 else length
         )
     }
 
-    fun removeLastMarker(){
-        this.markerIDs.removeLast()
-        this.markerRVects.removeLast()
-        this.markerTVects.removeLast()
+    fun markerLength(markerId: Int): Double =
+        NativeMethods.markerSizeRegistryLengthOf(markerSizesAddr, markerId, commonLength)
+
+    fun removeLastMarker() {
+        NativeMethods.markerMapRemoveLast(nativeAddr)
+    }
+
+    fun release() {
+        NativeMethods.releaseMarkerMap(nativeAddr)
+        NativeMethods.releaseMarkerSizeRegistry(markerSizesAddr)
     }
 
-}
\ No newline at end of file
+}
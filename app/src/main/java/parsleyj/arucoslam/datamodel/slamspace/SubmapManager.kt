@@ -0,0 +1,91 @@
+package parsleyj.arucoslam.datamodel.slamspace
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.Pose3d
+import parsleyj.arucoslam.datamodel.Vec3d
+import java.io.File
+
+/**
+ * Partitions the markers of a [SLAMSpace] in submaps (see [NativeMethods.newSubmapManager]): only
+ * the submap in which the phone is, its neighbors and the submaps the phone is approaching are
+ * kept in the space, the other ones are paged out (to [pageDirectory], or in memory if null) and
+ * loaded again in background when needed. While a manager is active, the [SLAMSpace] (and its
+ * iteration) contains only the markers of the loaded submaps.
+ */
+class SubmapManager(
+    slamSpace: SLAMSpace,
+    pageDirectory: File? = null,
+) {
+    val nativeAddr: Long = NativeMethods.newSubmapManager(
+        slamSpace.nativeAddr,
+        pageDirectory?.apply { mkdirs() }?.absolutePath
+    )
+
+    /**
+     * Defines a submap owning the markers with ids in [markerIds] (an empty range for a submap
+     * which only collects the new markers found while the phone is in it), with the local frame
+     * [anchor] (room to submap).
+     *
+     * @return false if a submap with the same id was already defined
+     */
+    fun defineSubmap(
+        submapId: Int,
+        markerIds: IntRange,
+        anchor: Pose3d = Pose3d(Vec3d.ORIGIN, Vec3d.ORIGIN),
+    ) = NativeMethods.submapManagerDefineSubmap(
+        nativeAddr,
+        submapId,
+        markerIds.first,
+        markerIds.last,
+        anchor.rotationVector.asDoubleArray(),
+        anchor.translationVector.asDoubleArray()
+    )
+
+    fun connect(submapIdA: Int, submapIdB: Int) =
+        NativeMethods.submapManagerConnect(nativeAddr, submapIdA, submapIdB)
+
+    /**
+     * Reports the position of the phone; the submaps are paged in and out in background.
+     */
+    fun updatePosition(position: Vec3d) {
+        NativeMethods.submapManagerUpdatePosition(nativeAddr, position.asDoubleArray())
+    }
+
+    fun stats(): SubmapManagerStats {
+        val values = LongArray(6)
+        NativeMethods.submapManagerStats(nativeAddr, values)
+        return SubmapManagerStats(
+            submaps = values[0].toInt(),
+            residentSubmaps = values[1].toInt(),
+            activeSubmap = values[2].toInt(),
+            hotMarkers = values[3].toInt(),
+            pagesLoaded = values[4],
+            pagesWritten = values[5],
+        )
+    }
+
+    /**
+     * Writes the pages of the modified submaps and deallocates the manager; must be called before
+     * the [SLAMSpace] is released.
+     */
+    fun release() {
+        NativeMethods.releaseSubmapManager(nativeAddr)
+    }
+}
+
+/**
+ * @param submaps defined submaps
+ * @param residentSubmaps submaps currently loaded
+ * @param activeSubmap id of the submap in which the phone is, -1 if none
+ * @param hotMarkers markers of the loaded submaps
+ * @param pagesLoaded submaps paged in
+ * @param pagesWritten submaps paged out
+ */
+data class SubmapManagerStats(
+    val submaps: Int,
+    val residentSubmaps: Int,
+    val activeSubmap: Int,
+    val hotMarkers: Int,
+    val pagesLoaded: Long,
+    val pagesWritten: Long,
+)
@@ -0,0 +1,40 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+
+/**
+ * Kotlin handle of a native corner tracker (see [NativeMethods.newCornerTracker]), shared by the
+ * workers: the markers are detected every [detectionInterval] frames, and tracked with optical
+ * flow from the previous frames on the other ones.
+ */
+class CornerTracker(detectionInterval: Int = 3) {
+    val nativeAddr: Long = NativeMethods.newCornerTracker(detectionInterval)
+
+    fun stats(): CornerTrackerStats {
+        val values = LongArray(4)
+        NativeMethods.cornerTrackerStats(nativeAddr, values)
+        return CornerTrackerStats(
+            detections = values[0],
+            trackedFrames = values[1],
+            trackedMarkers = values[2],
+            lostMarkers = values[3],
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseCornerTracker(nativeAddr)
+    }
+}
+
+/**
+ * @param detections frames on which the full detection was run
+ * @param trackedFrames frames on which the markers were tracked
+ * @param trackedMarkers markers tracked successfully
+ * @param lostMarkers markers lost because their tracking was not consistent
+ */
+data class CornerTrackerStats(
+    val detections: Long,
+    val trackedFrames: Long,
+    val trackedMarkers: Long,
+    val lostMarkers: Long,
+)
@@ -0,0 +1,82 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.ArucoDictionary
+
+/**
+ * Kotlin handle of the native detector session of a worker (see
+ * [NativeMethods.newDetectorSession]): the detector parameters, the region where the markers
+ * were last found and the adaptive thresholding window sizes that actually find markers are kept
+ * between the frames of the worker.
+ *
+ * @param qualityController the controller which decides how the markers are searched; if null,
+ *                          the whole frame is always searched at full resolution
+ * @param extraDictionaries dictionaries whose markers are searched together with the ones of the
+ *                          main dictionary, in the same detection pass; their ids are tagged
+ *                          (see [taggedMarkerId])
+ */
+class DetectorSession(
+    qualityController: QualityController? = null,
+    extraDictionaries: List<ArucoDictionary> = emptyList(),
+) {
+    val nativeAddr: Long = NativeMethods.newDetectorSession(qualityController?.nativeAddr ?: 0L)
+
+    init {
+        for (dictionary in extraDictionaries) {
+            NativeMethods.detectorSessionAddDictionary(nativeAddr, dictionary.toInt())
+        }
+    }
+
+    fun stats(): DetectorSessionStats {
+        val values = LongArray(53)
+        NativeMethods.detectorSessionStats(nativeAddr, values)
+        val windowSizesCount = values[0].toInt()
+        return DetectorSessionStats(
+            sweeps = values[1],
+            resets = values[2],
+            passes = values[3],
+            skippedPasses = values[4],
+            windowSizes = IntArray(windowSizesCount) { values[5 + 3 * it].toInt() },
+            activeWindowSizes = BooleanArray(windowSizesCount) { values[6 + 3 * it] != 0L },
+            markersByWindowSize = LongArray(windowSizesCount) { values[7 + 3 * it] },
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseDetectorSession(nativeAddr)
+    }
+}
+
+/**
+ * Id of a marker of an additional dictionary of a [DetectorSession], as found by the detector.
+ */
+fun taggedMarkerId(dictionary: ArucoDictionary, markerId: Int) =
+    ((dictionary.toInt() + 1) shl NativeMethods.MULTI_DICTIONARY_ID_SHIFT) or markerId
+
+/**
+ * Statistics of the adaptive thresholding window sizes learned by a [DetectorSession].
+ *
+ * @param sweeps frames in which all the window sizes were run one by one
+ * @param resets sweeps forced by a drop of the number of found markers
+ * @param passes detector passes run (one per window size in the sweeps, one for each evenly
+ *               spaced sequence of the run window sizes otherwise)
+ * @param skippedPasses window sizes not run because they did not find markers in the last sweep
+ * @param activeWindowSizes for each window size, whether it is currently run
+ * @param markersByWindowSize for each window size, the number of markers found first with it
+ */
+class DetectorSessionStats(
+    val sweeps: Long,
+    val resets: Long,
+    val passes: Long,
+    val skippedPasses: Long,
+    val windowSizes: IntArray,
+    val activeWindowSizes: BooleanArray,
+    val markersByWindowSize: LongArray,
+) {
+    override fun toString() = "DetectorSessionStats{sweeps=$sweeps, resets=$resets, " +
+            "passes=$passes, skippedPasses=$skippedPasses, windowSizes=" +
+            windowSizes.indices.joinToString(prefix = "[", postfix = "]") {
+                "${windowSizes[it]}${if (activeWindowSizes[it]) "*" else ""}:" +
+                        "${markersByWindowSize[it]}"
+            } + "}"
+}
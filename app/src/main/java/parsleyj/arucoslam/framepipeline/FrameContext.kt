@@ -0,0 +1,49 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+
+/**
+ * Kotlin handle of a native frame context (see [NativeMethods.newFrameContext]). Each worker owns
+ * one of these, and rewinds it with [beginFrame] at the start of every frame; the native code
+ * writes the results of the frame in it, and allocates all its per-frame data structures from its
+ * arena.
+ *
+ * @param capacityBytes initial capacity of the arena, grown automatically when needed
+ */
+class FrameContext(capacityBytes: Long = DEFAULT_CAPACITY) {
+    companion object {
+        const val DEFAULT_CAPACITY = 1L shl 20
+    }
+
+    val nativeAddr: Long = NativeMethods.newFrameContext(capacityBytes)
+
+    // recycled output array for the counters
+    private val stats = LongArray(4)
+
+    fun beginFrame() {
+        NativeMethods.beginContextFrame(nativeAddr)
+        NativeMethods.frameContextStats(nativeAddr, stats)
+    }
+
+    /**
+     * Number of heap allocations performed by the native frame path in the last completed frame.
+     */
+    val heapAllocationsLastFrame: Long
+        get() = stats[0]
+
+    /**
+     * Maximum number of bytes used by a single frame.
+     */
+    val peakUsageBytes: Long
+        get() = stats[1]
+
+    val capacityBytes: Long
+        get() = stats[2]
+
+    fun release() {
+        NativeMethods.releaseFrameContext(nativeAddr)
+    }
+
+    override fun toString() = "FrameContext{heapAllocationsLastFrame=$heapAllocationsLastFrame, " +
+            "peakUsageBytes=$peakUsageBytes, capacityBytes=$capacityBytes}"
+}
@@ -1,14 +1,32 @@
 package parsleyj.arucoslam.framepipeline
 
 import parsleyj.arucoslam.datamodel.Pose3d
+import parsleyj.arucoslam.datamodel.slamspace.SLAMSpace
 
 
 data class FrameRecyclableData(
     val foundIDs: IntArray,
     val foundRVecs: DoubleArray,
     val foundTVecs: DoubleArray,
-    val estimatedPhonePosition: Pose3d
+    val foundQualities: DoubleArray,
+    val estimatedPhonePosition: Pose3d,
+    val frameContext: FrameContext,
+    val overlay: OverlayBuffer?, // null in headless mode
+    val markerMapReader: SLAMSpace.Reader,
+    val detectorSession: DetectorSession,
+    val poseProducer: PoseStream.Producer?, // null if the poses are not streamed
 ) {
+    /**
+     * Releases the native objects of the worker, and gives its reader slot back to the marker map;
+     * to be called when the worker is dismissed.
+     */
+    fun release() {
+        frameContext.release()
+        overlay?.release()
+        markerMapReader.unregister()
+        detectorSession.release()
+    }
+
     override fun equals(other: Any?): Boolean {
         if (this === other) return true
         if (javaClass != other?.javaClass) return false
@@ -18,6 +36,7 @@ data class FrameRecyclableData(
         if (!foundIDs.contentEquals(other.foundIDs)) return false
         if (!foundRVecs.contentEquals(other.foundRVecs)) return false
         if (!foundTVecs.contentEquals(other.foundTVecs)) return false
+        if (!foundQualities.contentEquals(other.foundQualities)) return false
         if (!estimatedPhonePosition.rotationVector.asDoubleArray()
                 .contentEquals(other.estimatedPhonePosition.rotationVector.asDoubleArray())) {
             return false
@@ -26,6 +45,11 @@ data class FrameRecyclableData(
                 .contentEquals(other.estimatedPhonePosition.translationVector.asDoubleArray())) {
             return false
         }
+        if (frameContext != other.frameContext) return false
+        if (overlay != other.overlay) return false
+        if (markerMapReader != other.markerMapReader) return false
+        if (detectorSession != other.detectorSession) return false
+        if (poseProducer != other.poseProducer) return false
         return true
     }
 
@@ -33,8 +57,14 @@ data class FrameRecyclableData(
         var result = foundIDs.contentHashCode()
         result = 31 * result + foundRVecs.contentHashCode()
         result = 31 * result + foundTVecs.contentHashCode()
+        result = 31 * result + foundQualities.contentHashCode()
         result = 31 * result + estimatedPhonePosition.rotationVector.asDoubleArray().contentHashCode()
         result = 31 * result + estimatedPhonePosition.translationVector.asDoubleArray().contentHashCode()
+        result = 31 * result + frameContext.hashCode()
+        result = 31 * result + (overlay?.hashCode() ?: 0)
+        result = 31 * result + markerMapReader.hashCode()
+        result = 31 * result + detectorSession.hashCode()
+        result = 31 * result + (poseProducer?.hashCode() ?: 0)
         return result
     }
 
@@ -0,0 +1,52 @@
+package parsleyj.arucoslam.framepipeline
+
+import org.opencv.core.Mat
+import org.opencv.core.Point
+import org.opencv.core.Scalar
+import parsleyj.arucoslam.NativeMethods
+
+/**
+ * Kotlin handle of a native overlay command buffer (see [NativeMethods.newOverlayBuffer]).
+ * Drawing operations are recorded on it during the processing of a frame and rasterized all
+ * at once, directly on the RGBA output, by [rasterizeOn].
+ */
+class OverlayBuffer {
+    val nativeAddr: Long = NativeMethods.newOverlayBuffer()
+
+    fun beginFrame() {
+        NativeMethods.clearOverlay(nativeAddr)
+    }
+
+    /**
+     * Records a text; same parameters of [org.opencv.imgproc.Imgproc.putText].
+     */
+    fun putText(
+        text: String,
+        origin: Point,
+        fontFace: Int,
+        fontScale: Double,
+        color: Scalar,
+        thickness: Int = 1,
+    ) {
+        NativeMethods.overlayText(
+            nativeAddr,
+            text,
+            origin.x,
+            origin.y,
+            fontFace,
+            fontScale,
+            color.`val`[0],
+            color.`val`[1],
+            color.`val`[2],
+            thickness
+        )
+    }
+
+    fun rasterizeOn(mat: Mat) {
+        NativeMethods.rasterizeOverlay(nativeAddr, mat.nativeObjAddr)
+    }
+
+    fun release() {
+        NativeMethods.releaseOverlayBuffer(nativeAddr)
+    }
+}
@@ -0,0 +1,157 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Kotlin handle of a native pose stream (see [NativeMethods.newPoseStream]): the workers publish
+ * the estimated poses through their [Producer]s, and a native dispatcher thread delivers them in
+ * frame order to the [PoseSubscription]s and appends them to a binary log.
+ *
+ * @param logFile the binary log (appended if it exists with the same format, replaced
+ *                otherwise), or null for no log
+ */
+class PoseStream(logFile: File? = null) {
+    val nativeAddr: Long = NativeMethods.newPoseStream(logFile?.absolutePath)
+
+    /**
+     * A producer of pose records, to be used by one thread at a time.
+     */
+    inner class Producer internal constructor(private val index: Int) {
+        /**
+         * Publishes the pose estimated in a frame, without blocking; the found markers and the
+         * quality of the pose are read from the context of the frame.
+         *
+         * @return false if the record was dropped
+         */
+        fun publish(
+            frameContext: FrameContext,
+            frameNumber: Long,
+            frameTimestampMs: Long,
+            rvec: DoubleArray,
+            tvec: DoubleArray,
+            status: Int,
+            inliers: Int,
+        ): Boolean = NativeMethods.poseStreamPublish(
+            nativeAddr,
+            index,
+            frameContext.nativeAddr,
+            frameNumber,
+            frameTimestampMs,
+            rvec,
+            tvec,
+            status,
+            inliers,
+        )
+    }
+
+    /**
+     * @return a new producer, or null if the stream has too many producers
+     */
+    fun registerProducer(): Producer? {
+        val index = NativeMethods.poseStreamRegisterProducer(nativeAddr)
+        return if (index < 0) null else Producer(index)
+    }
+
+    /**
+     * @param capacity the number of records which can be queued for the subscription before they
+     *                 are dropped
+     */
+    fun subscribe(capacity: Int = 1024) = PoseSubscription(this, capacity)
+
+    fun stats(): PoseStreamStats {
+        val values = LongArray(3)
+        NativeMethods.poseStreamStats(nativeAddr, values)
+        return PoseStreamStats(published = values[0], dropped = values[1], logged = values[2])
+    }
+
+    /**
+     * Delivers and logs the records still queued, then frees the stream; the producers must have
+     * stopped publishing, and the subscriptions must have been unsubscribed.
+     */
+    fun release() {
+        NativeMethods.releasePoseStream(nativeAddr)
+    }
+}
+
+/**
+ * A consumer of a [PoseStream], to be polled by one thread at a time. The records are decoded
+ * from a direct buffer into a single recycled [PoseRecord], so polling does not allocate.
+ */
+class PoseSubscription internal constructor(
+    private val stream: PoseStream,
+    capacity: Int,
+) {
+    val nativeAddr: Long = NativeMethods.poseStreamSubscribe(stream.nativeAddr, capacity)
+
+    private val buffer = ByteBuffer.allocateDirect(64 * NativeMethods.POSE_RECORD_SIZE)
+        .order(ByteOrder.nativeOrder())
+    private val record = PoseRecord()
+
+    /**
+     * Calls onRecord on each queued record (the record is overwritten after the call returns); if
+     * none is queued, waits up to timeoutMicros for new ones.
+     *
+     * @return the number of records passed to onRecord
+     */
+    fun poll(timeoutMicros: Long = 0L, onRecord: (PoseRecord) -> Unit): Int {
+        val count = NativeMethods.poseSubscriptionPoll(nativeAddr, buffer, timeoutMicros)
+        for (i in 0 until count) {
+            record.decode(buffer, i * NativeMethods.POSE_RECORD_SIZE)
+            onRecord(record)
+        }
+        return count
+    }
+
+    fun unsubscribe() {
+        NativeMethods.poseStreamUnsubscribe(stream.nativeAddr, nativeAddr)
+    }
+}
+
+/**
+ * A pose published on a [PoseStream] (see [NativeMethods.POSE_RECORD_SIZE] for the binary layout).
+ *
+ * @param status one of the NativeMethods.PHONE_POSE_STATUS_* codes
+ * @param quality the mean quality in (0, 1] of the inlier observations, 0 if no pose was estimated
+ */
+class PoseRecord(
+    var frameNumber: Long = 0L,
+    var frameTimeMicros: Long = 0L,
+    var publishTimeMicros: Long = 0L,
+    val rvec: DoubleArray = DoubleArray(3),
+    val tvec: DoubleArray = DoubleArray(3),
+    var quality: Float = 0f,
+    var inliers: Int = 0,
+    var foundMarkers: Int = 0,
+    var status: Int = 0,
+    var producer: Int = 0,
+) {
+    internal fun decode(buffer: ByteBuffer, offset: Int) {
+        frameNumber = buffer.getLong(offset)
+        frameTimeMicros = buffer.getLong(offset + 8)
+        publishTimeMicros = buffer.getLong(offset + 16)
+        for (i in 0..2) {
+            rvec[i] = buffer.getDouble(offset + 24 + 8 * i)
+            tvec[i] = buffer.getDouble(offset + 48 + 8 * i)
+        }
+        quality = buffer.getFloat(offset + 72)
+        inliers = buffer.getInt(offset + 76)
+        foundMarkers = buffer.getShort(offset + 80).toInt() and 0xFFFF
+        status = buffer.get(offset + 82).toInt()
+        producer = buffer.get(offset + 83).toInt() and 0xFF
+    }
+
+    override fun toString() = "PoseRecord{frame=$frameNumber, status=$status, " +
+            "inliers=$inliers, foundMarkers=$foundMarkers, quality=$quality, " +
+            "rvec=${rvec.contentToString()}, tvec=${tvec.contentToString()}, " +
+            "latencyMicros=${publishTimeMicros - frameTimeMicros}}"
+}
+
+/**
+ * @param published records published by the producers
+ * @param dropped records dropped because the queue of their producer was full
+ * @param logged records written on the binary log
+ */
+data class PoseStreamStats(val published: Long, val dropped: Long, val logged: Long)
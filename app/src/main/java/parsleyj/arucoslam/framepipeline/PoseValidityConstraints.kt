@@ -10,13 +10,36 @@ import kotlin.math.abs
  * @param minimumInliersRatio a pose is valid if the RANSAC inliers/outliers ratio is higher than this
  * @param maxSpeed a pose is valid if the position did not change more quickly than this
  * @param maxAngularSpeed a pose is valid if the orientation did not change more quickly than this
+ * @param relocalizationLostFrames the tracking is considered lost (and the pose is recovered from
+ *                                 the keyframes) only after this many consecutive frames without
+ *                                 a valid pose
+ * @param relocalizationMaxReprojectionError a recovered pose is valid if the RMS reprojection
+ *                                           error of the corners of its markers is lower than this
+ * @param relocalizationMinMarkers a recovered pose is valid if it was computed from at least this
+ *                                 number of markers
  */
 class PoseValidityConstraints(
     val minimumInliersRatio: Double,
     val maxSpeed: Double, // in meters per second
     val maxAngularSpeed: Double, // in radians per second
+    val relocalizationLostFrames: Int = 10,
+    val relocalizationMaxReprojectionError: Double = 2.0, // in pixels
+    val relocalizationMinMarkers: Int = 2,
 ) {
 
+    /**
+     * Checks a pose recovered from the keyframes: the speed constraints do not apply to it (the
+     * last pose of the track is too old), but it must come from enough markers; its reprojection
+     * error is already bounded by [relocalizationMaxReprojectionError] in the relocalization.
+     */
+    fun recoveredPoseIsValid(recoveredPose: Pose3d, markersCount: Int): Boolean {
+        if (recoveredPose.rotationVector.asDoubleArray().any(Double::isNaN) ||
+            recoveredPose.translationVector.asDoubleArray().any(Double::isNaN)) {
+            return false
+        }
+        return markersCount >= relocalizationMinMarkers
+    }
+
     fun estimatedPoseIsValid(
         currentPoseTimestamp: Long,
         currentPoseEstimate: Pose3d,
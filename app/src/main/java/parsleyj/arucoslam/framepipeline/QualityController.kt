@@ -0,0 +1,124 @@
+package parsleyj.arucoslam.framepipeline
+
+import org.opencv.core.Mat
+import parsleyj.arucoslam.NativeMethods
+
+/**
+ * Kotlin handle of the native adaptive quality controller (see
+ * [NativeMethods.newQualityController]), shared by all the workers of a [SLAMFrameRenderer].
+ * It watches the latency of the stages of each frame and adjusts the detection (region of
+ * interest and decimation), the cap on the RANSAC iterations and the map refresh rate in order to
+ * keep the processing time of a frame within [frameBudgetMs].
+ *
+ * @param frameBudgetMs the target processing time of a frame, in milliseconds
+ * @param maxRansacIterations the cap on the RANSAC iterations at full quality
+ */
+class QualityController(
+    val frameBudgetMs: Double = 60.0,
+    maxRansacIterations: Int = 100,
+) {
+    val nativeAddr: Long = NativeMethods.newQualityController(frameBudgetMs, maxRansacIterations)
+
+    val maxRansacIterations: Int
+        get() = NativeMethods.qualityControllerMaxRansacIterations(nativeAddr)
+
+    /**
+     * @return true if the map must be rendered in the current frame
+     */
+    fun shouldRefreshMap() = NativeMethods.qualityControllerShouldRefreshMap(nativeAddr)
+
+    /**
+     * Copies the last rendered map box on [mat].
+     *
+     * @return false if there is no map box to re-use (the map must be rendered)
+     */
+    fun restoreMap(mat: Mat, topLeftX: Int, topLeftY: Int, width: Int, height: Int) =
+        NativeMethods.qualityControllerRestoreMap(
+            nativeAddr,
+            mat.nativeObjAddr,
+            topLeftX,
+            topLeftY,
+            width,
+            height
+        )
+
+    fun reportFrame(detectMs: Double, estimateMs: Double, renderMs: Double) {
+        NativeMethods.qualityControllerReportFrame(nativeAddr, detectMs, estimateMs, renderMs)
+    }
+
+    fun telemetry(): QualityTelemetry {
+        val values = DoubleArray(22)
+        NativeMethods.qualityControllerTelemetry(nativeAddr, values)
+        return QualityTelemetry(
+            frameBudgetMs = values[0],
+            averageFrameMs = values[1],
+            averageDetectMs = values[2],
+            averageEstimateMs = values[3],
+            averageRenderMs = values[4],
+            detectionStep = values[5].toInt(),
+            ransacStep = values[6].toInt(),
+            mapStep = values[7].toInt(),
+            roiDetection = values[8] != 0.0,
+            decimation = values[9].toInt(),
+            maxRansacIterations = values[10].toInt(),
+            mapRefreshInterval = values[11].toInt(),
+            frames = values[12].toLong(),
+            degradations = values[13].toInt(),
+            restorations = values[14].toInt(),
+            lastDecision = QualityTelemetry.Decision.values()[values[15].toInt()],
+            lastDecisionKnob = values[16].toInt(),
+            lastDecisionFrame = values[17].toLong(),
+            lastDecisionFrameMs = values[18],
+            fullFrameDetections = values[19].toLong(),
+            roiDetections = values[20].toLong(),
+            roiFallbackDetections = values[21].toLong(),
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseQualityController(nativeAddr)
+    }
+}
+
+/**
+ * Snapshot of the state and of the decisions of a [QualityController]; the knobs are numbered as
+ * follows: 0 detection, 1 RANSAC, 2 map (the step of each knob is 0 at full quality).
+ */
+data class QualityTelemetry(
+    val frameBudgetMs: Double,
+    val averageFrameMs: Double,
+    val averageDetectMs: Double,
+    val averageEstimateMs: Double,
+    val averageRenderMs: Double,
+    val detectionStep: Int,
+    val ransacStep: Int,
+    val mapStep: Int,
+    val roiDetection: Boolean,
+    val decimation: Int,
+    val maxRansacIterations: Int,
+    val mapRefreshInterval: Int,
+    val frames: Long,
+    val degradations: Int,
+    val restorations: Int,
+    val lastDecision: Decision,
+    val lastDecisionKnob: Int,
+    val lastDecisionFrame: Long,
+    val lastDecisionFrameMs: Double,
+    val fullFrameDetections: Long,
+    val roiDetections: Long,
+    val roiFallbackDetections: Long,
+) {
+    enum class Decision { NONE, DEGRADE, RESTORE }
+
+    /**
+     * One-line summary, used on the overlay.
+     */
+    fun summary() = "FRAME %.1f/%.0f ms %s DEC=%d RANSAC=%d MAP=1/%d".format(
+        averageFrameMs,
+        frameBudgetMs,
+        if (roiDetection) "ROI" else "FULL",
+        decimation,
+        maxRansacIterations,
+        mapRefreshInterval
+    )
+}
@@ -7,18 +7,20 @@ import org.opencv.core.Mat
 import org.opencv.core.Point
 import org.opencv.core.Scalar
 import org.opencv.core.Size
-import org.opencv.imgproc.Imgproc
 import parsleyj.arucoslam.*
 import parsleyj.arucoslam.NativeMethods.*
+import parsleyj.arucoslam.datamodel.ArucoDictionary
 import parsleyj.arucoslam.datamodel.CalibData
 import parsleyj.arucoslam.datamodel.Pose3d
 import parsleyj.arucoslam.datamodel.Track
 import parsleyj.arucoslam.datamodel.Vec3d
+import parsleyj.arucoslam.datamodel.slamspace.BoardRegistry
+import parsleyj.arucoslam.datamodel.slamspace.KeyframeDatabase
+import parsleyj.arucoslam.datamodel.slamspace.MarkerCandidatePool
 import parsleyj.arucoslam.datamodel.slamspace.SLAMMarker
 import parsleyj.arucoslam.datamodel.slamspace.SLAMSpace
+import parsleyj.arucoslam.datamodel.slamspace.SubmapManager
 import parsleyj.arucoslam.pipeline.RenderingWorkerPool
-import java.time.Instant
-import java.util.*
 import kotlin.math.PI
 
 /**
@@ -38,6 +40,37 @@ import kotlin.math.PI
  * @param mapCameraRotation orientation of the virtual camera used to render the map
  * @param mapCameraTranslation position of the virtual camera used to render the map
  * @param isFullScreenMode callback used to check if the map should be rendered in fullscreen mode
+ * @param headless if true, no overlay (nor the map) is drawn on the output frames: only the poses
+ *                 are computed; useful for batch processing and to measure the tracking throughput
+ * @param boardRegistry optional set of rigid boards placed in the world, used to estimate the
+ *                      phone pose from whole boards instead of their single markers
+ * @param keyframeDatabase optional store of keyframes, used to relocalize the phone when no valid
+ *                         pose could be estimated from the known markers for a few frames (see
+ *                         [PoseValidityConstraints.relocalizationLostFrames])
+ * @param qualityController optional controller that keeps the processing time of the frames
+ *                          within a budget, by degrading the detection, the RANSAC iterations and
+ *                          the map refresh rate under load; without it, every frame is processed
+ *                          at full quality
+ * @param poseStream optional stream on which each worker publishes the pose computed in each
+ *                   frame (with its status, inliers and quality), for the consumers of the poses
+ *                   and for the binary pose log
+ * @param extraDictionaries dictionaries of other marker families placed in the world, searched
+ *                          in the same detection pass of the main dictionary of [markerSpace];
+ *                          the ids of their markers are tagged with the dictionary (see
+ *                          [taggedMarkerId])
+ * @param sharpnessGate optional gate that skips the detection (and the pose estimation) on
+ *                      motion-blurred frames; the last known pose is kept for them
+ * @param sessionRecorder optional recorder of the input frames, for offline analysis; the frames
+ *                        on which markers are searched are queued for it after the detection
+ * @param candidatePool optional pool in which the new markers are observed over several frames,
+ *                      and promoted into [markerSpace] only when their pose has converged; without
+ *                      it, a new marker is added with the pose computed in the first valid frame
+ * @param cornerTracker optional tracker of the marker corners: the full detection runs only every
+ *                      few frames, and the markers are tracked from the previous frames on the
+ *                      others, and through short detection dropouts
+ * @param submapManager optional manager of the submaps of [markerSpace]: the phone position is
+ *                      reported to it at each valid pose, so that only the submaps near the phone
+ *                      are kept in the map
  */
 class SLAMFrameRenderer(
     private val maxMarkersPerFrame: Int,
@@ -53,6 +86,17 @@ class SLAMFrameRenderer(
     var mapCameraRotation: Vec3d = Vec3d(-PI / 2.0, 0.0, 0.0),
     var mapCameraTranslation: Vec3d = Vec3d(0.0, -1.0, 10.0),
     isFullScreenMode: () -> Boolean,
+    private val headless: Boolean = false,
+    private val boardRegistry: BoardRegistry? = null,
+    private val keyframeDatabase: KeyframeDatabase? = null,
+    private val qualityController: QualityController? = null,
+    private val poseStream: PoseStream? = null,
+    private val extraDictionaries: List<ArucoDictionary> = emptyList(),
+    private val sharpnessGate: SharpnessGate? = null,
+    private val sessionRecorder: SessionRecorder? = null,
+    private val candidatePool: MarkerCandidatePool? = null,
+    private val cornerTracker: CornerTracker? = null,
+    private val submapManager: SubmapManager? = null,
 ) : RenderingWorkerPool<Mat, Mat, FrameRecyclableData>(
     maxWorkers,
     { Mat.zeros(frameSize, frameType) },
@@ -62,279 +106,400 @@ class SLAMFrameRenderer(
             foundIDs = IntArray(maxMarkersPerFrame) { 0 },
             foundRVecs = DoubleArray(maxMarkersPerFrame * 3) { 0.0 },
             foundTVecs = DoubleArray(maxMarkersPerFrame * 3) { 0.0 },
+            foundQualities = DoubleArray(maxMarkersPerFrame) { 0.0 },
             estimatedPhonePosition = Pose3d(
                 Vec3d(0.0, 0.0, 0.0),
                 Vec3d(0.0, 0.0, 0.0)
-            )
+            ),
+            frameContext = FrameContext(),
+            overlay = if (headless) null else OverlayBuffer(),
+            markerMapReader = markerSpace.Reader(),
+            detectorSession = DetectorSession(qualityController, extraDictionaries),
+            poseProducer = poseStream?.registerProducer()
         )
     },
     coroutineScope,
     jobTimeout,
-    block = block@{ inMat, outMat, (foundIDs, foundRvecs, foundTvecs, estimatedPose), frameNumber, frameTimeStamp ->
+    block = block@{ inMat, outMat, (foundIDs, foundRvecs, foundTvecs, foundQualities, estimatedPose, frameContext, overlay, markerMapReader, detectorSession, poseProducer), frameNumber, frameTimeStamp ->
         fun staleJob() = System.currentTimeMillis() - frameTimeStamp > jobTimeout
 
-        // get the known markers as arrays (no copy is done here)
-        val (
-            fixedMarkerIds,
-            fixedMarkerRvects,
-            fixedMarkerTvects,
-            fixedMarkerCount,
-        ) = markerSpace.asArrays()
+        fun millisSince(startNanos: Long) = (System.nanoTime() - startNanos) / 1e6
 
-        val (estimatedPositionRVec, estimatedPositionTVec) = estimatedPose.asPairOfVec3d()
+        // all the native data of the previous frame of this worker can be discarded
+        frameContext.beginFrame()
+        overlay?.beginFrame()
+        val overlayAddr = overlay?.nativeAddr ?: 0L
 
-        if (staleJob()) {
-            return@block
-        }
-
-        val fullScreenMode = isFullScreenMode()
-        val mapSizeInPixels = inMat.rows() / 2
-
-        if (fullScreenMode) {
-            val lastPoseWithTimestamp: Pair<Pose3d, Long>? = track.lastPose()
-            val lastPoseAvailable = lastPoseWithTimestamp != null
-            lastPoseWithTimestamp?.let { (lastPose, _) -> lastPose.copyTo(estimatedPose) }
-
-            renderMap(
-                // currently known markers:
-                markerSpace.commonLength,
-                fixedMarkerRvects,
-                fixedMarkerTvects,
-                fixedMarkerCount,
-
-                // pose of the "virtual" map camera
-                mapCameraRotation.asDoubleArray(),
-                mapCameraTranslation.asDoubleArray(),
-
-                // horizontal and vertical FOV angles of the virtual camera
-                PI / 2.0,
-                PI / 2.0,
-
-                // horizontal and vertical sensor aperture of the virtual camera
-                2400.0,
-                2400.0,
-
-                // info about the current phone pose
-                if (lastPoseAvailable) PHONE_POSE_STATUS_LAST_KNOWN else PHONE_POSE_STATUS_UNAVAILABLE,
-                estimatedPositionRVec.asDoubleArray(),
-                estimatedPositionTVec.asDoubleArray(),
-
-                // history of positions
-                track.longTermTrackTimestamps.size,
-                track.longTermTrackRvecs.elementData,
-                track.longTermTrackTvecs.elementData,
-
-                // size and topLeft corner position of the map box
-                mapSizeInPixels,
-                mapSizeInPixels,
-                inMat.cols() - mapSizeInPixels,
-                inMat.rows() - mapSizeInPixels,
-
-                // mat on which the map box will be rendered
-                outMat.nativeObjAddr,
-                true //full screen mode
-            )
-        } else {
-
-            // find all the markers in the image and estimate their poses w.r.t. camera
-            val foundMarkersCount = detectMarkers(
-                markerSpace.dictionary.toInt(),
-                calibDataSupplier().cameraMatrix.nativeObjAddr,
-                calibDataSupplier().distCoeffs.nativeObjAddr,
-                inMat.nativeObjAddr,
-                outMat.nativeObjAddr,
-                markerSpace.commonLength,
-                maxMarkersPerFrame,
-                foundIDs,
-                foundRvecs,
-                foundTvecs
-            )
-
-
-            val newPhonePoseAvailable: Boolean
-            val validNewPhonePoseAvailable: Boolean
-            val lastPoseWithTimestamp: Pair<Pose3d, Long>? = track.lastPose()
-            val lastPoseAvailable = lastPoseWithTimestamp != null
+        // get a consistent snapshot of the known markers for the whole frame (no lock and no copy
+        // is done here); writers publish new snapshots without affecting this one
+        val markerMapSnapshot = markerMapReader.acquire()
+        try {
+            val (estimatedPositionRVec, estimatedPositionTVec) = estimatedPose.asPairOfVec3d()
 
             if (staleJob()) {
                 return@block
             }
-            // if markers are found
-            if (foundMarkersCount > 0) {
-                // attempt to estimate a new phone pose
-                val inliersCount = estimateCameraPosition(
-                    calibDataSupplier().cameraMatrix.nativeObjAddr, //in
-                    calibDataSupplier().distCoeffs.nativeObjAddr, //in
-                    outMat.nativeObjAddr, //in&out
-                    fixedMarkerCount, //in
-                    fixedMarkerIds, //in
-                    fixedMarkerRvects, //in
-                    fixedMarkerTvects, //in
-                    markerSpace.commonLength, //in
-                    foundMarkersCount, //in
-                    foundIDs, //in
-                    foundRvecs, //in
-                    foundTvecs, //in
-                    estimatedPositionRVec.asDoubleArray(), //out
-                    estimatedPositionTVec.asDoubleArray(), //out
-                    0.05, //(RANSAC) tvec inlier threshold (meters)
-                    0.1, //(RANSAC) tvec outlier probability
-                    PI/8.0, //(RANSAC) rvec inlier threshold (radians)
-                    0.1, //(RANSAC) rvec outlier pobability,
-                    100, //(RANSAC) max RANSAC iterations
-                    0.9, //(RANSAC) target probability to get the optimal model
+
+            val fullScreenMode = isFullScreenMode()
+            val mapSizeInPixels = inMat.rows() / 2
+
+            if (fullScreenMode && !headless) {
+                val lastPoseWithTimestamp: Pair<Pose3d, Long>? = track.lastPose()
+                val lastPoseAvailable = lastPoseWithTimestamp != null
+                lastPoseWithTimestamp?.let { (lastPose, _) -> lastPose.copyTo(estimatedPose) }
+
+                renderMap(
+                    // currently known markers:
+                    markerSpace.commonLength,
+                    markerMapSnapshot,
+                    markerSpace.markerSizesAddr,
+
+                    // pose of the "virtual" map camera
+                    mapCameraRotation.asDoubleArray(),
+                    mapCameraTranslation.asDoubleArray(),
+
+                    // horizontal and vertical FOV angles of the virtual camera
+                    PI / 2.0,
+                    PI / 2.0,
+
+                    // horizontal and vertical sensor aperture of the virtual camera
+                    2400.0,
+                    2400.0,
+
+                    // info about the current phone pose
+                    if (lastPoseAvailable) PHONE_POSE_STATUS_LAST_KNOWN else PHONE_POSE_STATUS_UNAVAILABLE,
+                    estimatedPositionRVec.asDoubleArray(),
+                    estimatedPositionTVec.asDoubleArray(),
+
+                    // history of positions
+                    track.longTermTrackAddr,
+
+                    // size and topLeft corner position of the map box
+                    mapSizeInPixels,
+                    mapSizeInPixels,
+                    inMat.cols() - mapSizeInPixels,
+                    inMat.rows() - mapSizeInPixels,
+
+                    // mat on which the map box will be rendered
+                    outMat.nativeObjAddr,
+                    true, //full screen mode
+                    frameContext.nativeAddr,
+                    0L // the full screen map is always rendered
                 )
-                newPhonePoseAvailable = true
+            } else {
+
+                // find all the markers in the image and estimate their poses w.r.t. camera
+                val detectStart = System.nanoTime()
+                val foundMarkersCount = detectMarkers(
+                    markerSpace.dictionary.toInt(),
+                    calibDataSupplier().cameraMatrix.nativeObjAddr,
+                    calibDataSupplier().distCoeffs.nativeObjAddr,
+                    inMat.nativeObjAddr,
+                    outMat.nativeObjAddr,
+                    markerSpace.commonLength,
+                    maxMarkersPerFrame,
+                    foundIDs,
+                    foundRvecs,
+                    foundTvecs,
+                    foundQualities,
+                    frameContext.nativeAddr,
+                    overlayAddr,
+                    detectorSession.nativeAddr,
+                    markerMapSnapshot,
+                    boardRegistry?.nativeAddr ?: 0L,
+                    sharpnessGate?.nativeAddr ?: 0L,
+                    cornerTracker?.nativeAddr ?: 0L,
+                    frameNumber,
+                    markerSpace.markerSizesAddr
+                )
+                val detectMs = millisSince(detectStart)
+
+                // the frame (or its luma plane, computed by the detection) is only copied on a
+                // recycled buffer here: the recorder writes it in background
+                sessionRecorder?.submit(
+                    frameContext, detectorSession, inMat.nativeObjAddr, frameNumber,
+                    frameTimeStamp
+                )
+
+                val estimateStart = System.nanoTime()
+
+
+                val newPhonePoseAvailable: Boolean
+                val inliersCount: Int
+                val validNewPhonePoseAvailable: Boolean
+                val lastPoseWithTimestamp: Pair<Pose3d, Long>? = track.lastPose()
+                val lastPoseAvailable = lastPoseWithTimestamp != null
+
                 if (staleJob()) {
                     return@block
                 }
-                var knownMarkersFoundCount = 0
-                for (i in 0 until foundMarkersCount) {
-                    if (foundIDs[i] in fixedMarkerIds) {
-                        knownMarkersFoundCount++
+                // if markers are found
+                if (foundMarkersCount > 0) {
+                    // attempt to estimate a new phone pose
+                    inliersCount = estimateCameraPosition(
+                        calibDataSupplier().cameraMatrix.nativeObjAddr, //in
+                        calibDataSupplier().distCoeffs.nativeObjAddr, //in
+                        outMat.nativeObjAddr, //in&out
+                        markerMapSnapshot, //in
+                        markerSpace.commonLength, //in
+                        foundMarkersCount, //in
+                        foundIDs, //in
+                        foundRvecs, //in
+                        foundTvecs, //in
+                        foundQualities, //in
+                        estimatedPositionRVec.asDoubleArray(), //out
+                        estimatedPositionTVec.asDoubleArray(), //out
+                        0.05, //(RANSAC) tvec inlier threshold (meters)
+                        0.1, //(RANSAC) tvec outlier probability
+                        PI/8.0, //(RANSAC) rvec inlier threshold (radians)
+                        0.1, //(RANSAC) rvec outlier pobability,
+                        // (RANSAC) max RANSAC iterations (hypotheses are quality-weighted); lowered by
+                        // the quality controller under load
+                        qualityController?.maxRansacIterations ?: 100,
+                        0.9, //(RANSAC) target probability to get the optimal model
+                        boardRegistry?.nativeAddr ?: 0L,
+                        frameContext.nativeAddr,
+                        overlayAddr
+                    )
+                    newPhonePoseAvailable = true
+                    if (staleJob()) {
+                        return@block
+                    }
+                    val knownMarkersFoundCount = countKnownMarkers(
+                        markerMapSnapshot,
+                        foundMarkersCount,
+                        foundIDs
+                    )
+
+                    // evaluate the validity of the estimate;
+                    // if the estimated pose is valid
+                    validNewPhonePoseAvailable = poseValidityConstraints.estimatedPoseIsValid(
+                        frameTimeStamp,
+                        estimatedPose,
+                        track,
+                        knownMarkersFoundCount,
+                        inliersCount
+                    ) || (keyframeDatabase != null &&
+                            keyframeDatabase.trackingLost(
+                                poseValidityConstraints.relocalizationLostFrames
+                            ) &&
+                            // seed the pose from the keyframes which observed the same markers
+                            poseValidityConstraints.recoveredPoseIsValid(
+                                estimatedPose,
+                                keyframeDatabase.relocalize(
+                                    frameContext,
+                                    calibDataSupplier().cameraMatrix,
+                                    calibDataSupplier().distCoeffs,
+                                    estimatedPose,
+                                    poseValidityConstraints.relocalizationMaxReprojectionError
+                                )
+                            ))
+                    if (staleJob()) {
+                        return@block
                     }
+                } else {
+                    inliersCount = 0
+                    newPhonePoseAvailable = false
+                    validNewPhonePoseAvailable = false
                 }
+                keyframeDatabase?.reportPoseValidity(validNewPhonePoseAvailable)
+
+                overlay?.putText(
+                    "KNOWN MARKERS: ${snapshotSize(markerMapSnapshot)}",
+                    Point(30.0, 30.0),
+                    FONT_HERSHEY_COMPLEX_SMALL,
+                    0.8,
+                    Scalar(50.0, 255.0, 50.0),
+                    1
+                )
 
-                // evaluate the validity of the estimate;
-                // if the estimated pose is valid
-                validNewPhonePoseAvailable = poseValidityConstraints.estimatedPoseIsValid(
-                    frameTimeStamp,
-                    estimatedPose,
-                    track,
-                    knownMarkersFoundCount,
-                    inliersCount
+                overlay?.putText(
+                    "FRAME NUMBER = $frameNumber",
+                    Point(30.0, 70.0),
+                    FONT_HERSHEY_COMPLEX_SMALL,
+                    0.8,
+                    Scalar(50.0, 255.0, 50.0),
+                    1
                 )
                 if (staleJob()) {
                     return@block
                 }
-            } else {
-                newPhonePoseAvailable = false
-                validNewPhonePoseAvailable = false
-            }
+                if (validNewPhonePoseAvailable) {
+                    // the corners of the unknown markers were not refined by the detection: refine
+                    // them now, since they are going to be stored in the keyframes and in the map
+                    refinePromotedMarkers(
+                        calibDataSupplier().cameraMatrix.nativeObjAddr,
+                        calibDataSupplier().distCoeffs.nativeObjAddr,
+                        markerSpace.commonLength,
+                        markerMapSnapshot,
+                        markerSpace.markerSizesAddr,
+                        frameContext.nativeAddr,
+                        maxMarkersPerFrame,
+                        foundRvecs,
+                        foundTvecs,
+                        foundQualities
+                    )
 
-            Imgproc.putText(
-                outMat,
-                "KNOWN MARKERS: ${markerSpace.size}",
-                Point(30.0, 30.0),
-                FONT_HERSHEY_COMPLEX_SMALL,
-                0.8,
-                Scalar(50.0, 255.0, 50.0),
-                1
-            )
-
-            Imgproc.putText(
-                outMat,
-                "FRAME NUMBER = $frameNumber",
-                Point(30.0, 70.0),
-                FONT_HERSHEY_COMPLEX_SMALL,
-                0.8,
-                Scalar(50.0, 255.0, 50.0),
-                1
-            )
-            if (staleJob()) {
-                return@block
-            }
-            if (newPhonePoseAvailable) {
-                Log.d("SLAMFramePipeline", "pose estimate: $estimatedPose " +
-                        "at time ${Date.from(Instant.ofEpochMilli(frameTimeStamp))}" +
-                        "for frame $frameNumber")
-            }
-            if (staleJob()) {
-                return@block
-            }
-            if (validNewPhonePoseAvailable) {
-                // update the track
-                track.addPose(estimatedPose, frameTimeStamp)
+                    // update the track
+                    track.addPose(estimatedPose, frameTimeStamp)
+                    submapManager?.updatePosition(estimatedPose.invert().translationVector)
 
-                // update new markers found
-                for (i in 0 until foundMarkersCount) {
-                    if (staleJob()) {
-                        return@block
-                    }
-                    markerSpace.addIfNotPresent(
-                        SLAMMarker(
-                            foundIDs[i],
-                            estimatedPose * Pose3d(
-                                Vec3d(
-                                    foundRvecs[i * 3],
-                                    foundRvecs[i * 3 + 1],
-                                    foundRvecs[i * 3 + 2],
-                                ),
-                                Vec3d(
-                                    foundTvecs[i * 3],
-                                    foundTvecs[i * 3 + 1],
-                                    foundTvecs[i * 3 + 2],
-                                )
-                            ).invertInPlace(),
-                        )
+                    keyframeDatabase?.insert(
+                        frameContext,
+                        markerSpace,
+                        estimatedPose,
+                        frameTimeStamp
                     )
+
+                    // update new markers found
+                    if (candidatePool != null) {
+                        candidatePool.observe(
+                            frameContext,
+                            markerMapSnapshot,
+                            estimatedPose,
+                            frameNumber
+                        ).forEach { markerSpace.addIfNotPresent(it) }
+                    } else {
+                        for (i in 0 until foundMarkersCount) {
+                            if (staleJob()) {
+                                return@block
+                            }
+                            markerSpace.addIfNotPresent(
+                                SLAMMarker(
+                                    foundIDs[i],
+                                    estimatedPose * Pose3d(
+                                        Vec3d(
+                                            foundRvecs[i * 3],
+                                            foundRvecs[i * 3 + 1],
+                                            foundRvecs[i * 3 + 2],
+                                        ),
+                                        Vec3d(
+                                            foundTvecs[i * 3],
+                                            foundTvecs[i * 3 + 1],
+                                            foundTvecs[i * 3 + 2],
+                                        )
+                                    ).invertInPlace(),
+                                )
+                            )
+                        }
+                    }
+                }
+                if (staleJob()) {
+                    return@block
                 }
-            }
-            if (staleJob()) {
-                return@block
-            }
 
 
-            val phonePoseStatus = when {
-                // found a new pose estimate, but it's invalid
-                newPhonePoseAvailable &&
-                        !validNewPhonePoseAvailable -> PHONE_POSE_STATUS_INVALID
-                // found a new pose estimate and it's valid
-                validNewPhonePoseAvailable -> PHONE_POSE_STATUS_UPDATED
-                // not found a new pose estimate, however the last pose is known
-                lastPoseAvailable -> PHONE_POSE_STATUS_LAST_KNOWN
-                // no pose found yet
-                else -> PHONE_POSE_STATUS_UNAVAILABLE
-            }
+                val phonePoseStatus = when {
+                    // found a new pose estimate, but it's invalid
+                    newPhonePoseAvailable &&
+                            !validNewPhonePoseAvailable -> PHONE_POSE_STATUS_INVALID
+                    // found a new pose estimate and it's valid
+                    validNewPhonePoseAvailable -> PHONE_POSE_STATUS_UPDATED
+                    // not found a new pose estimate, however the last pose is known
+                    lastPoseAvailable -> PHONE_POSE_STATUS_LAST_KNOWN
+                    // no pose found yet
+                    else -> PHONE_POSE_STATUS_UNAVAILABLE
+                }
 
-            if (phonePoseStatus == PHONE_POSE_STATUS_LAST_KNOWN) {
-                lastPoseWithTimestamp?.let { (lastPose, _) -> lastPose.copyTo(estimatedPose) }
-            }
+                if (phonePoseStatus == PHONE_POSE_STATUS_LAST_KNOWN) {
+                    lastPoseWithTimestamp?.let { (lastPose, _) -> lastPose.copyTo(estimatedPose) }
+                }
 
-            renderMap(
-                // currently known markers:
-                markerSpace.commonLength,
-                fixedMarkerRvects,
-                fixedMarkerTvects,
-                fixedMarkerCount,
-
-                // pose of the "virtual" map camera
-                mapCameraRotation.asDoubleArray(),
-                mapCameraTranslation.asDoubleArray(),
-
-                // horizontal and vertical FOV angles of the virtual camera
-                PI / 2.0,
-                PI / 2.0,
-
-                // horizontal and vertical sensor aperture of the virtual camera
-                2400.0,
-                2400.0,
-
-                // info about the current phone pose
-                phonePoseStatus,
-                estimatedPositionRVec.asDoubleArray(),
-                estimatedPositionTVec.asDoubleArray(),
-
-                // history of positions
-                track.longTermTrackTimestamps.size,
-                track.longTermTrackRvecs.elementData,
-                track.longTermTrackTvecs.elementData,
-
-                // size and topLeft corner position of the map box
-                mapSizeInPixels,
-                mapSizeInPixels,
-                inMat.cols() - mapSizeInPixels,
-                inMat.rows() - mapSizeInPixels,
-
-                // mat on which the map box will be rendered
-                outMat.nativeObjAddr,
-                false
-            )
-            if (staleJob()) {
-                return@block
+                // the record is queued without locks nor formatting; the dispatcher thread of the
+                // stream does the rest
+                poseProducer?.publish(
+                    frameContext,
+                    frameNumber,
+                    frameTimeStamp,
+                    estimatedPositionRVec.asDoubleArray(),
+                    estimatedPositionTVec.asDoubleArray(),
+                    phonePoseStatus,
+                    inliersCount
+                )
+
+                val estimateMs = millisSince(estimateStart)
+
+                if (overlay == null) {
+                    // headless: nothing else to draw
+                    qualityController?.reportFrame(detectMs, estimateMs, 0.0)
+                    return@block
+                }
+
+                val renderStart = System.nanoTime()
+                if (qualityController != null) {
+                    overlay.putText(
+                        qualityController.telemetry().summary(),
+                        Point(30.0, 110.0),
+                        FONT_HERSHEY_COMPLEX_SMALL,
+                        0.8,
+                        Scalar(50.0, 255.0, 50.0),
+                        1
+                    )
+                }
+
+                // all the overlays recorded so far are drawn in a single pass, before the map box
+                overlay.rasterizeOn(outMat)
+
+                // under load, the map box rendered by a previous frame can be re-used
+                val mapReused = qualityController != null &&
+                        !qualityController.shouldRefreshMap() &&
+                        qualityController.restoreMap(
+                            outMat,
+                            inMat.cols() - mapSizeInPixels,
+                            inMat.rows() - mapSizeInPixels,
+                            mapSizeInPixels,
+                            mapSizeInPixels
+                        )
+                if (!mapReused) {
+                    renderMap(
+                        // currently known markers:
+                        markerSpace.commonLength,
+                        markerMapSnapshot,
+                        markerSpace.markerSizesAddr,
+
+                        // pose of the "virtual" map camera
+                        mapCameraRotation.asDoubleArray(),
+                        mapCameraTranslation.asDoubleArray(),
+
+                        // horizontal and vertical FOV angles of the virtual camera
+                        PI / 2.0,
+                        PI / 2.0,
+
+                        // horizontal and vertical sensor aperture of the virtual camera
+                        2400.0,
+                        2400.0,
+
+                        // info about the current phone pose
+                        phonePoseStatus,
+                        estimatedPositionRVec.asDoubleArray(),
+                        estimatedPositionTVec.asDoubleArray(),
+
+                        // history of positions
+                        track.longTermTrackAddr,
+
+                        // size and topLeft corner position of the map box
+                        mapSizeInPixels,
+                        mapSizeInPixels,
+                        inMat.cols() - mapSizeInPixels,
+                        inMat.rows() - mapSizeInPixels,
+
+                        // mat on which the map box will be rendered
+                        outMat.nativeObjAddr,
+                        false,
+                        frameContext.nativeAddr,
+                        qualityController?.nativeAddr ?: 0L
+                    )
+                }
+                qualityController?.reportFrame(detectMs, estimateMs, millisSince(renderStart))
+                if (staleJob()) {
+                    return@block
+                }
             }
+        } finally {
+            markerMapReader.release()
         }
     },
-    onCannotProcess = { _, input -> input }
+    onCannotProcess = { _, input -> input },
+    onReleaseSupportData = { it.release() }
 )
 
@@ -0,0 +1,98 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.CalibData
+import java.io.File
+
+/**
+ * Kotlin handle of a native session recorder (see [NativeMethods.newSessionRecorder]): the input
+ * frames submitted by the workers are written, with the calibration and the detector settings,
+ * on a recording file by a background thread. Frames are dropped, rather than delaying the
+ * pipeline, when the disk cannot keep up.
+ *
+ * @param file the recording file (overwritten if it exists)
+ * @param calibData the parameters of the camera
+ * @param markerDictionary the dictionary of the markers
+ * @param markerLength the length of the side of the markers, in meters
+ * @param grayOnly if true, only the luma plane of the frames is recorded
+ * @param poolSize the number of frames which can wait to be written
+ */
+class SessionRecorder(
+    file: File,
+    calibData: CalibData,
+    markerDictionary: Int,
+    markerLength: Double,
+    grayOnly: Boolean = true,
+    poolSize: Int = 16,
+) {
+    val nativeAddr: Long = NativeMethods.newSessionRecorder(
+        file.absolutePath,
+        grayOnly,
+        poolSize,
+        calibData.cameraMatrix.nativeObjAddr,
+        calibData.distCoeffs.nativeObjAddr,
+        markerDictionary,
+        markerLength
+    )
+
+    /**
+     * Queues the input frame of a worker, after the markers are detected on it, with the current
+     * settings of the detector session of the worker.
+     *
+     * @return false if the frame was dropped
+     */
+    fun submit(
+        frameContext: FrameContext,
+        detectorSession: DetectorSession,
+        inputMatAddr: Long,
+        frameNumber: Long,
+        frameTimestamp: Long
+    ) =
+        NativeMethods.sessionRecorderSubmit(
+            nativeAddr,
+            frameContext.nativeAddr,
+            detectorSession.nativeAddr,
+            inputMatAddr,
+            frameNumber,
+            frameTimestamp
+        )
+
+    fun stats(): SessionRecorderStats {
+        val values = LongArray(5)
+        NativeMethods.sessionRecorderStats(nativeAddr, values)
+        return SessionRecorderStats(
+            recorded = values[0],
+            dropped = values[1],
+            bytesWritten = values[2],
+            maxQueued = values[3],
+            writeFailed = values[4] != 0L,
+        )
+    }
+
+    /**
+     * Completes the recording; the frames submitted afterwards are dropped, [stats] can still be
+     * called until [release].
+     */
+    fun finish() {
+        NativeMethods.sessionRecorderFinish(nativeAddr)
+    }
+
+    fun release() {
+        NativeMethods.releaseSessionRecorder(nativeAddr)
+    }
+}
+
+/**
+ * @param recorded frames written on the recording
+ * @param dropped frames dropped because no buffer was free (or the recording failed)
+ * @param bytesWritten size of the recording
+ * @param maxQueued maximum number of frames which waited to be written
+ * @param writeFailed if true, a write failed and the recording is stopped
+ */
+data class SessionRecorderStats(
+    val recorded: Long,
+    val dropped: Long,
+    val bytesWritten: Long,
+    val maxQueued: Long,
+    val writeFailed: Boolean,
+)
@@ -0,0 +1,46 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+
+/**
+ * Kotlin handle of a native sharpness gate (see [NativeMethods.newSharpnessGate]), shared by the
+ * workers: the detection is skipped on the frames whose sharpness is below [ratio] times the peak
+ * sharpness of the recent frames.
+ */
+class SharpnessGate(ratio: Double = 0.35) {
+    val nativeAddr: Long = NativeMethods.newSharpnessGate(ratio)
+
+    fun stats(): SharpnessGateStats {
+        val values = DoubleArray(5)
+        NativeMethods.sharpnessGateStats(nativeAddr, values)
+        return SharpnessGateStats(
+            frames = values[0].toLong(),
+            skipped = values[1].toLong(),
+            lastSharpness = values[2],
+            threshold = values[3],
+            peakSharpness = values[4],
+        )
+    }
+
+    fun release() {
+        NativeMethods.releaseSharpnessGate(nativeAddr)
+    }
+}
+
+/**
+ * @param frames frames measured by the gate
+ * @param skipped frames skipped because blurred
+ * @param lastSharpness sharpness of the last frame
+ * @param threshold sharpness below which frames are currently skipped
+ * @param peakSharpness reference sharpness of the recent frames
+ */
+data class SharpnessGateStats(
+    val frames: Long,
+    val skipped: Long,
+    val lastSharpness: Double,
+    val threshold: Double,
+    val peakSharpness: Double,
+) {
+    val skipRate: Double
+        get() = if (frames == 0L) 0.0 else skipped.toDouble() / frames
+}
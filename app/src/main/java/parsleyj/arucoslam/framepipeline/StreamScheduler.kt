@@ -0,0 +1,149 @@
+package parsleyj.arucoslam.framepipeline
+
+import parsleyj.arucoslam.NativeMethods
+import parsleyj.arucoslam.datamodel.CalibData
+import parsleyj.arucoslam.datamodel.Pose3d
+import parsleyj.arucoslam.datamodel.Vec3d
+import parsleyj.arucoslam.datamodel.slamspace.SLAMSpace
+
+/**
+ * Kotlin handle of a native stream scheduler (see [NativeMethods.newStreamScheduler]): several
+ * independent frame streams (other cameras, recordings being replayed) are processed at the same
+ * time by a shared pool of threads, against the marker map of [slamSpace], each stream getting a
+ * share of the CPU time proportional to its weight.
+ *
+ * @param threads the number of worker threads, 0 for one per core
+ */
+class StreamScheduler(slamSpace: SLAMSpace, threads: Int = 0) {
+    val nativeAddr: Long = NativeMethods.newStreamScheduler(
+        slamSpace.nativeAddr,
+        threads,
+        slamSpace.markerSizesAddr
+    )
+
+    /**
+     * Opens a new stream.
+     *
+     * @param calibData the parameters of the camera of the stream
+     * @param markerDictionary the dictionary of the markers
+     * @param markerLength the length of the side of the markers, in meters (the ones set with
+     *                     [SLAMSpace.setMarkerLength] keep their own)
+     * @param poseValidityConstraints the checks of the estimated poses (the same ones of the
+     *                                app): only the valid poses are tracked, and used to add new
+     *                                markers
+     * @param workerBudget the maximum number of frames of the stream processed at the same time
+     * @param weight the share of CPU time of the stream, relative to the other streams
+     * @param addNewMarkers true if the markers not known yet are added to the map
+     */
+    fun openStream(
+        calibData: CalibData,
+        markerDictionary: Int,
+        markerLength: Double,
+        poseValidityConstraints: PoseValidityConstraints,
+        workerBudget: Int = 2,
+        weight: Double = 1.0,
+        addNewMarkers: Boolean = true,
+    ): Stream {
+        val streamId = NativeMethods.streamSchedulerOpenStream(
+            nativeAddr,
+            markerDictionary,
+            markerLength,
+            calibData.cameraMatrix.nativeObjAddr,
+            calibData.distCoeffs.nativeObjAddr,
+            workerBudget,
+            weight,
+            addNewMarkers,
+            poseValidityConstraints.minimumInliersRatio,
+            poseValidityConstraints.maxSpeed,
+            poseValidityConstraints.maxAngularSpeed
+        )
+        check(streamId >= 0) { "No worker threads: no more reader slots available on the map" }
+        return Stream(streamId)
+    }
+
+    fun release() {
+        NativeMethods.releaseStreamScheduler(nativeAddr)
+    }
+
+    inner class Stream(val streamId: Int) {
+        /**
+         * Submits an RGBA frame of the stream; the frame is copied, so it can be reused as soon as
+         * this returns.
+         *
+         * @return false if the stream was closed
+         */
+        fun submit(frameMatAddr: Long, frameNumber: Long, timestampUs: Long) =
+            NativeMethods.streamSchedulerSubmit(
+                nativeAddr,
+                streamId,
+                frameMatAddr,
+                frameNumber,
+                timestampUs
+            )
+
+        /**
+         * @return the last (at most [capacity]) camera poses estimated in the stream, with their
+         *         frame numbers, ordered by frame number
+         */
+        fun lastPoses(capacity: Int = 16): List<Pair<Long, Pose3d>> {
+            val frameNumbers = LongArray(capacity)
+            val rvecs = DoubleArray(capacity * 3)
+            val tvecs = DoubleArray(capacity * 3)
+            val count = NativeMethods.streamSchedulerLastPoses(
+                nativeAddr,
+                streamId,
+                frameNumbers,
+                rvecs,
+                tvecs
+            )
+            return (0 until count).map { i ->
+                frameNumbers[i] to Pose3d(
+                    Vec3d(rvecs[i * 3], rvecs[i * 3 + 1], rvecs[i * 3 + 2]),
+                    Vec3d(tvecs[i * 3], tvecs[i * 3 + 1], tvecs[i * 3 + 2]),
+                )
+            }
+        }
+
+        /**
+         * @return the statistics of the stream, or null if it was closed
+         */
+        fun stats(): StreamStats? {
+            val values = LongArray(7)
+            if (!NativeMethods.streamSchedulerStats(nativeAddr, streamId, values)) {
+                return null
+            }
+            return StreamStats(
+                submitted = values[0],
+                processed = values[1],
+                dropped = values[2],
+                poses = values[3],
+                cpuTimeUs = values[4],
+                queued = values[5],
+                failed = values[6],
+            )
+        }
+
+        fun close() {
+            NativeMethods.streamSchedulerCloseStream(nativeAddr, streamId)
+        }
+    }
+}
+
+/**
+ * @param submitted frames submitted to the stream
+ * @param processed frames processed
+ * @param dropped frames dropped because the stream was falling behind
+ * @param poses valid camera poses estimated
+ * @param cpuTimeUs CPU time used by the stream, in microseconds
+ * @param queued frames waiting to be processed
+ * @param failed frames whose processing failed with an error (logged)
+ */
+data class StreamStats(
+    val submitted: Long,
+    val processed: Long,
+    val dropped: Long,
+    val poses: Long,
+    val cpuTimeUs: Long,
+    val queued: Long,
+    val failed: Long,
+)
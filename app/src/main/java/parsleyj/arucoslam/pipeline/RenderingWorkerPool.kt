@@ -21,6 +21,8 @@ import parsleyj.arucoslam.mainDispatcher
  * @param jobTimeout time in milliseconds after which a job is cancelled
  * @param onCannotProcess a callback that tells the pool what to do when there are no free workers
  *                        and no new workers cannot be created
+ * @param onReleaseSupportData a callback that releases the resources of a support data structure
+ *                             when the pool is shut down (see [shutdown])
  * @param block a suspendable function that defines what to do in each job; the parameters are:
  *              1. the input of the job; 2. the reference on which to write the output of the job;
  *              3. the support data structure; 4. a numerical token identifying the current job;
@@ -33,10 +35,13 @@ open class RenderingWorkerPool<InputT, OutputT, SupportDataT>(
     private val coroutineScope: CoroutineScope = mainDispatcher,
     private val jobTimeout: Long = 1000L,
     private val onCannotProcess: (OutputT, InputT) -> OutputT = { _, _ -> supplyEmptyOutput() },
+    private val onReleaseSupportData: (SupportDataT) -> Unit = {},
     private val block: suspend (InputT, OutputT, SupportDataT, Long, Long) -> Unit,
 ) {
     private var lastResult = supplyEmptyOutput()
     private var lastResultToken = -1L
+    @Volatile
+    private var isShutDown = false
     protected val workers = mutableListOf<Worker<InputT, OutputT, SupportDataT>>()
     private val tokenGenerator = object:Iterator<Long>{
         var count = 0L
@@ -52,6 +57,9 @@ open class RenderingWorkerPool<InputT, OutputT, SupportDataT>(
 
 
     fun supply(input: InputT) {
+        if (isShutDown) {
+            return
+        }
         val token = tokenGenerator.next()
         Log.d("WorkerPool", "Supply invoked - token: $token")
         // if there are no free workers, do not process the frame.
@@ -72,12 +80,34 @@ open class RenderingWorkerPool<InputT, OutputT, SupportDataT>(
                 val job = worker.compute()
                 //if after 'jobTimeout' milliseconds the job is not done, it is cancelled
                 delay(jobTimeout)
-                job?.cancel()
-                worker.isActive = false
+                if (job != null && !job.isCompleted) {
+                    job.cancel()
+                    // the worker is released only when its job is really over, since its
+                    // recycled (native) state cannot be shared by two jobs at the same time;
+                    // a completed job could have already been replaced by a new one, which must
+                    // not be marked as inactive
+                    job.join()
+                    worker.isActive = false
+                }
             }
         }
     }
 
+    /**
+     * Stops the pool: the inputs supplied from now on are ignored, the running jobs are waited
+     * for, and the support data of all the workers are released with onReleaseSupportData.
+     * It must be called after the last call of [supply] returned (e.g. once the camera that
+     * supplies the frames is stopped).
+     */
+    fun shutdown() {
+        isShutDown = true
+        runBlocking {
+            workers.forEach { it.close() }
+        }
+        workers.forEach { onReleaseSupportData(it.recycledState) }
+        workers.clear()
+    }
+
     /**
      * Retrieves the last computed result
      */
@@ -23,6 +23,7 @@ open class Worker<InputT, OutputT, SupportDataT>(
     var requestToken = -1L
     private set
     private var currentJob: Job? = null
+    private var closed = false
 
     fun assignInput(input: InputT?, token: Long){
         if(input!=null){
@@ -32,7 +33,11 @@ open class Worker<InputT, OutputT, SupportDataT>(
     }
 
 
-    suspend fun compute() :Job? {
+    suspend fun compute() :Job? = synchronized(this) {
+        if (closed) {
+            // the pool was shut down after the input was assigned
+            return null
+        }
         isActive = true
         currentJob = coroutineScope.launch {
             val inp = input
@@ -50,6 +55,17 @@ open class Worker<InputT, OutputT, SupportDataT>(
         return currentJob
     }
 
+    /**
+     * Prevents any further computation, and waits for the running one (if any) to be over.
+     */
+    suspend fun close() {
+        val job = synchronized(this) {
+            closed = true
+            currentJob
+        }
+        job?.cancelAndJoin()
+    }
+
     private fun done() {
         isActive = false
         this.onDone()
@@ -0,0 +1,382 @@
+//
+// Accuracy and latency benchmark of the frame pipeline on synthetic scenes.
+//
+// For each marker count, frames of a SyntheticScene are rendered from random known camera poses
+// and processed with detectFrameMarkers() and estimateFrameCameraPose(), i.e. the same code run by
+// the detectMarkers and estimateCameraPosition native methods. Each marker count is run once for
+// each pipeline configuration, i.e. with the optional stages of the pipeline (detector session,
+// sharpness gate, corner tracker) enabled as in SLAMFrameRenderer. The report contains:
+//  - the detection recall (detected visible markers / visible markers) and the false detections,
+//  - the pose success rate and the pose errors (camera position and orientation),
+//  - the frames skipped by the sharpness gate and the frames whose markers were tracked,
+//  - the latency percentiles of the detection, of the estimation and of the whole frame.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "framePipeline.h"
+#include "syntheticScene.h"
+
+/**
+ * The optional stages of the frame pipeline enabled in a run.
+ */
+struct PipelineConfig {
+    const char *name;
+    bool detectorSession; // learned threshold windows, search around the last markers
+    bool sharpnessGate; // no detection on the blurred frames
+    bool cornerTracker; // full detection every few frames, markers tracked on the others
+};
+
+static const PipelineConfig PIPELINE_CONFIGS[] = {
+        {"baseline",  false, false, false},
+        {"session",   true,  false, false},
+        {"sharpness", false, true,  false},
+        {"tracker",   false, false, true},
+        {"all",       true,  true,  true},
+};
+
+struct BenchmarkConfig {
+    BenchmarkConfig() {
+        // the detector session and the corner tracker use the previous frames: the camera must
+        // move smoothly
+        scene.trajectoryFrames = 30;
+    }
+
+    SceneConfig scene;
+    std::vector<int> markerCounts = {1, 10, 100, 1000};
+    std::vector<PipelineConfig> pipelines{std::begin(PIPELINE_CONFIGS),
+                                          std::end(PIPELINE_CONFIGS)};
+    int frames = 200;
+};
+
+/**
+ * Values collected over the frames of a run; the percentiles are computed at the end.
+ */
+struct BenchmarkResults {
+    long visibleMarkers = 0;
+    long detectedVisibleMarkers = 0;
+    long falseDetections = 0;
+    int framesWithKnownMarkers = 0;
+    int successfulPoses = 0;
+    long skippedFrames = 0; // by the sharpness gate
+    long trackedFrames = 0; // by the corner tracker
+    std::vector<double> translationErrors; // meters
+    std::vector<double> rotationErrors; // degrees
+    std::vector<double> detectLatencies; // milliseconds
+    std::vector<double> estimateLatencies;
+    std::vector<double> totalLatencies;
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Angle (in degrees) of the rotation between two orientations.
+ */
+static double rotationDistance(const cv::Vec3d &rvec1, const cv::Vec3d &rvec2) {
+    cv::Matx33d rotation1, rotation2;
+    cv::Rodrigues(rvec1, rotation1);
+    cv::Rodrigues(rvec2, rotation2);
+    cv::Vec3d difference;
+    cv::Rodrigues(rotation1 * rotation2.t(), difference);
+    return cv::norm(difference) * 180.0 / CV_PI;
+}
+
+static BenchmarkResults run(const SceneConfig &sceneConfig, const PipelineConfig &pipeline,
+                            int frames) {
+    SyntheticScene scene(sceneConfig);
+    const cv::Mat &cameraMatrix = scene.getCameraMatrix();
+    const cv::Mat &distCoeffs = scene.getDistCoeffs();
+
+    // all the markers are known, as if they were mapped before
+    MarkerMap markerMap;
+    for (const SyntheticMarker &marker : scene.getMarkers()) {
+        markerMap.addIfNotPresent(marker.id, marker.rvec, marker.tvec);
+    }
+    int readerSlot = markerMap.registerReader();
+    const MarkerMapSnapshot *snapshot = markerMap.acquire(readerSlot);
+
+    FrameContext context(1 << 20); // same initial capacity of FrameContext.kt
+    DetectorSession session(nullptr);
+    SharpnessGate gate;
+    CornerTracker tracker;
+    BenchmarkResults results;
+    cv::Mat inputMat, resultMat;
+    std::vector<int> visibleIds;
+    for (int frame = 0; frame < frames; frame++) {
+        cv::Vec3d trueRvec, trueTvec;
+        scene.render(inputMat, trueRvec, trueTvec, visibleIds);
+        context.reset();
+
+        auto frameStart = std::chrono::steady_clock::now();
+        int foundCount = detectFrameMarkers(sceneConfig.dictionary, cameraMatrix, distCoeffs,
+                                            inputMat, resultMat, sceneConfig.markerLength,
+                                            context, nullptr,
+                                            pipeline.detectorSession ? &session : nullptr,
+                                            snapshot, nullptr,
+                                            pipeline.sharpnessGate ? &gate : nullptr,
+                                            pipeline.cornerTracker ? &tracker : nullptr,
+                                            static_cast<uint64_t>(frame));
+        double detectLatency = millisecondsSince(frameStart);
+
+        auto estimateStart = std::chrono::steady_clock::now();
+        cv::Vec3d cameraRvec, cameraTvec;
+        int inliers = 0;
+        if (foundCount > 0) {
+            inliers = estimateFrameCameraPose(
+                    cameraMatrix, distCoeffs, inputMat.size(),
+                    *snapshot, sceneConfig.markerLength,
+                    foundCount,
+                    context.detectedIDs.data(),
+                    context.detectedRvecs.data(),
+                    context.detectedTvecs.data(),
+                    context.detectedQualities.data(),
+                    0.05, 0.1, CV_PI / 8.0, 0.1, 100, 0.9, // same values of SLAMFrameRenderer
+                    nullptr, &context, nullptr,
+                    cameraRvec, cameraTvec);
+        }
+        double estimateLatency = millisecondsSince(estimateStart);
+
+        results.detectLatencies.push_back(detectLatency);
+        results.estimateLatencies.push_back(estimateLatency);
+        results.totalLatencies.push_back(millisecondsSince(frameStart));
+
+        results.visibleMarkers += visibleIds.size();
+        for (int id : context.detectedIDs) {
+            if (std::find(visibleIds.begin(), visibleIds.end(), id) != visibleIds.end()) {
+                results.detectedVisibleMarkers++;
+            } else {
+                results.falseDetections++;
+            }
+        }
+
+        if (!visibleIds.empty()) {
+            results.framesWithKnownMarkers++;
+            if (inliers > 0) {
+                results.successfulPoses++;
+                results.translationErrors.push_back(
+                        cv::norm(positionInRoom(cameraRvec, cameraTvec) -
+                                 positionInRoom(trueRvec, trueTvec)));
+                results.rotationErrors.push_back(rotationDistance(cameraRvec, trueRvec));
+            }
+        }
+    }
+
+    double gateStats[SHARPNESS_GATE_STATS_SIZE];
+    gate.stats(gateStats);
+    results.skippedFrames = static_cast<long>(gateStats[1]);
+    jlong trackerStats[CORNER_TRACKER_STATS_SIZE];
+    tracker.stats(trackerStats);
+    results.trackedFrames = static_cast<long>(trackerStats[1]);
+
+    markerMap.release(readerSlot);
+    markerMap.unregisterReader(readerSlot);
+    return results;
+}
+
+static void printHeader() {
+    printf("%-9s %7s %7s %7s %7s %7s %7s | %9s %9s %8s %8s | %-23s | %-23s | %-23s\n",
+           "pipeline", "markers", "recall", "falseDt", "poseOk", "gated", "tracked",
+           "tErr50mm", "tErr90mm", "rErr50", "rErr90",
+           "detect p50/p90/p99/max", "estimate p50/p90/p99/max", "total p50/p90/p99/max");
+}
+
+static void printLatencies(const std::vector<double> &latencies) {
+    char text[64];
+    snprintf(text, sizeof(text), "%.2f/%.2f/%.2f/%.2f",
+             percentile(latencies, 0.5), percentile(latencies, 0.9),
+             percentile(latencies, 0.99), percentile(latencies, 1.0));
+    printf(" %-23s |", text);
+}
+
+static void printResults(const PipelineConfig &pipeline, int markerCount, int frames,
+                         const BenchmarkResults &results) {
+    double recall = results.visibleMarkers > 0 ?
+                    double(results.detectedVisibleMarkers) / results.visibleMarkers : 0.0;
+    double poseSuccess = results.framesWithKnownMarkers > 0 ?
+                         double(results.successfulPoses) / results.framesWithKnownMarkers : 0.0;
+    printf("%-9s %7d %6.1f%% %7ld %6.1f%% %6.1f%% %6.1f%% | %9.2f %9.2f %8.3f %8.3f |",
+           pipeline.name, markerCount, recall * 100.0, results.falseDetections,
+           poseSuccess * 100.0,
+           100.0 * results.skippedFrames / frames, 100.0 * results.trackedFrames / frames,
+           percentile(results.translationErrors, 0.5) * 1000.0,
+           percentile(results.translationErrors, 0.9) * 1000.0,
+           percentile(results.rotationErrors, 0.5),
+           percentile(results.rotationErrors, 0.9));
+    printLatencies(results.detectLatencies);
+    printLatencies(results.estimateLatencies);
+    printLatencies(results.totalLatencies);
+    printf("\n");
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --dictionary N      predefined ArUco dictionary (default: 11, DICT_6X6_1000)\n"
+            "  --markers A,B,...   marker counts, one run each (default: 1,10,100,1000)\n"
+            "  --pipelines A,B,... pipeline configurations, one run each for each marker count\n"
+            "                      (baseline, session, sharpness, tracker, all; default: all of\n"
+            "                      them)\n"
+            "  --frames N          frames per run (default: 200)\n"
+            "  --marker-length M   side of the markers, in meters (default: 0.05)\n"
+            "  --width W           frame width (default: 1280)\n"
+            "  --height H          frame height (default: 720)\n"
+            "  --focal F           focal length, in pixels (default: 900)\n"
+            "  --blur S            gaussian blur sigma, in pixels (default: 0)\n"
+            "  --noise S           gaussian noise sigma, in gray levels (default: 0)\n"
+            "  --gain G            lighting gain (default: 1)\n"
+            "  --offset O          lighting offset, in gray levels (default: 0)\n"
+            "  --gradient F        light lost from the left to the right border (default: 0)\n"
+            "  --max-tilt R        maximum camera tilt, in radians (default: 0.25)\n"
+            "  --trajectory N      frames to move between two random camera poses; 0 renders\n"
+            "                      every frame from an independent pose (default: 30)\n"
+            "  --blurred-frames F  fraction of frames with an additional blur (default: 0)\n"
+            "  --blurred-sigma S   gaussian blur sigma of those frames, in pixels (default: 4)\n"
+            "  --seed N            random seed (default: 42)\n",
+            program);
+}
+
+static std::vector<int> parseList(const char *text) {
+    std::vector<int> values;
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > start) {
+            values.push_back(std::atoi(list.substr(start, end - start).c_str()));
+        }
+        start = end + 1;
+    }
+    return values;
+}
+
+static bool parsePipelines(const char *text, std::vector<PipelineConfig> &pipelines) {
+    pipelines.clear();
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string name = list.substr(start, end - start);
+        auto found = std::find_if(std::begin(PIPELINE_CONFIGS), std::end(PIPELINE_CONFIGS),
+                                  [&name](const PipelineConfig &pipeline) {
+                                      return name == pipeline.name;
+                                  });
+        if (found == std::end(PIPELINE_CONFIGS)) {
+            return false;
+        }
+        pipelines.push_back(*found);
+        start = end + 1;
+    }
+    return true;
+}
+
+static bool parseArguments(int argc, char **argv, BenchmarkConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(option, "--dictionary")) {
+            config.scene.dictionary = std::atoi(value);
+        } else if (!strcmp(option, "--markers")) {
+            config.markerCounts = parseList(value);
+        } else if (!strcmp(option, "--pipelines")) {
+            if (!parsePipelines(value, config.pipelines)) {
+                return false;
+            }
+        } else if (!strcmp(option, "--frames")) {
+            config.frames = std::atoi(value);
+        } else if (!strcmp(option, "--marker-length")) {
+            config.scene.markerLength = std::atof(value);
+        } else if (!strcmp(option, "--width")) {
+            config.scene.frameSize.width = std::atoi(value);
+        } else if (!strcmp(option, "--height")) {
+            config.scene.frameSize.height = std::atoi(value);
+        } else if (!strcmp(option, "--focal")) {
+            config.scene.focalLength = std::atof(value);
+        } else if (!strcmp(option, "--blur")) {
+            config.scene.blurSigma = std::atof(value);
+        } else if (!strcmp(option, "--noise")) {
+            config.scene.noiseSigma = std::atof(value);
+        } else if (!strcmp(option, "--gain")) {
+            config.scene.gain = std::atof(value);
+        } else if (!strcmp(option, "--offset")) {
+            config.scene.offset = std::atof(value);
+        } else if (!strcmp(option, "--gradient")) {
+            config.scene.gradient = std::atof(value);
+        } else if (!strcmp(option, "--max-tilt")) {
+            config.scene.maxTilt = std::atof(value);
+        } else if (!strcmp(option, "--trajectory")) {
+            config.scene.trajectoryFrames = std::atoi(value);
+        } else if (!strcmp(option, "--blurred-frames")) {
+            config.scene.blurredFrames = std::atof(value);
+        } else if (!strcmp(option, "--blurred-sigma")) {
+            config.scene.blurredFrameSigma = std::atof(value);
+        } else if (!strcmp(option, "--seed")) {
+            config.scene.seed = std::strtoull(value, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return !config.markerCounts.empty() && !config.pipelines.empty() && config.frames > 0;
+}
+
+int main(int argc, char **argv) {
+    BenchmarkConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    printf("dictionary=%d frames=%d size=%dx%d markerLength=%.3f blur=%.2f noise=%.2f "
+           "gain=%.2f offset=%.1f gradient=%.2f trajectory=%d blurredFrames=%.2f "
+           "blurredSigma=%.2f seed=%llu\n",
+           config.scene.dictionary, config.frames,
+           config.scene.frameSize.width, config.scene.frameSize.height,
+           config.scene.markerLength, config.scene.blurSigma, config.scene.noiseSigma,
+           config.scene.gain, config.scene.offset, config.scene.gradient,
+           config.scene.trajectoryFrames, config.scene.blurredFrames,
+           config.scene.blurredFrameSigma, (unsigned long long) config.scene.seed);
+    printf("(errors of the camera position in mm and of the orientation in degrees, "
+           "latencies in ms)\n");
+    printHeader();
+    for (int markerCount : config.markerCounts) {
+        SceneConfig sceneConfig = config.scene;
+        sceneConfig.markerCount = markerCount;
+        // the same frames (same seed) for all the configurations
+        for (const PipelineConfig &pipeline : config.pipelines) {
+            try {
+                printResults(pipeline, markerCount, config.frames,
+                             run(sceneConfig, pipeline, config.frames));
+            } catch (const std::exception &e) {
+                fprintf(stderr, "%s, %d markers: %s\n", pipeline.name, markerCount, e.what());
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+//
+// Offline map builder: builds the map of a venue from session recordings (the .asrc files
+// written by the SessionRecorder of the app) with all the cores, see MapBuilder.
+//
+// The map is written as a CSV file with one marker per line:
+//     markerId,rx,ry,rz,tx,ty,tz,observations
+// where (r, t) is the pose of the marker (map's coord sys to marker's coord sys).
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "mapBuilder.h"
+
+struct BuildMapConfig {
+    std::vector<std::string> recordings;
+    std::string output = "map.csv";
+    int threads = 0;
+    int chunkFrames = MAP_BUILDER_DEFAULT_CHUNK_FRAMES;
+    int chunkOverlap = MAP_BUILDER_DEFAULT_CHUNK_OVERLAP;
+    int anchorMarkerId = -1;
+};
+
+static void printUsage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] recording.asrc...\n"
+            "  --output FILE       the map, as CSV (default: map.csv)\n"
+            "  --threads N         mapping threads (default: 0, one per core)\n"
+            "  --chunk N           frames per chunk (default: %d)\n"
+            "  --overlap N         frames shared by consecutive chunks (default: %d)\n"
+            "  --anchor ID         marker at the origin of the map (default: the first seen)\n",
+            program, MAP_BUILDER_DEFAULT_CHUNK_FRAMES, MAP_BUILDER_DEFAULT_CHUNK_OVERLAP);
+}
+
+static bool parseArguments(int argc, char **argv, BuildMapConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        if (strncmp(option, "--", 2) != 0) {
+            config.recordings.emplace_back(option);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(option, "--output")) {
+            config.output = value;
+        } else if (!strcmp(option, "--threads")) {
+            config.threads = std::atoi(value);
+        } else if (!strcmp(option, "--chunk")) {
+            config.chunkFrames = std::atoi(value);
+        } else if (!strcmp(option, "--overlap")) {
+            config.chunkOverlap = std::atoi(value);
+        } else if (!strcmp(option, "--anchor")) {
+            config.anchorMarkerId = std::atoi(value);
+        } else {
+            return false;
+        }
+    }
+    return !config.recordings.empty() && config.chunkFrames > 0 && config.chunkOverlap >= 0;
+}
+
+static bool writeMap(const std::string &path, const std::vector<BuiltMarker> &markers) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "markerId,rx,ry,rz,tx,ty,tz,observations\n");
+    for (const BuiltMarker &marker : markers) {
+        fprintf(file, "%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%d\n", marker.markerId,
+                marker.rvec[0], marker.rvec[1], marker.rvec[2],
+                marker.tvec[0], marker.tvec[1], marker.tvec[2], marker.observations);
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+    BuildMapConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    MapBuilder builder(config.threads, config.chunkFrames, config.chunkOverlap);
+    for (const std::string &recording : config.recordings) {
+        if (!builder.addRecording(recording)) {
+            fprintf(stderr, "%s: not a readable recording\n", recording.c_str());
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BuiltMarker> markers;
+    MapBuilderStats stats = builder.build(config.anchorMarkerId, markers);
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    printf("recordings=%d frames=%lld framesWithPose=%lld chunks=%d alignedChunks=%d "
+           "markers=%d time=%.1fs (%.0f frames/s)\n",
+           stats.recordings, (long long) stats.frames, (long long) stats.framesWithPose,
+           stats.chunks, stats.alignedChunks, stats.markers, seconds,
+           seconds > 0.0 ? stats.frames / seconds : 0.0);
+    if (stats.alignedChunks < stats.chunks) {
+        fprintf(stderr, "%d chunks share no marker with the map and were discarded\n",
+                stats.chunks - stats.alignedChunks);
+    }
+    if (config.anchorMarkerId >= 0 &&
+        std::none_of(markers.begin(), markers.end(), [&config](const BuiltMarker &marker) {
+            return marker.markerId == config.anchorMarkerId;
+        })) {
+        fprintf(stderr, "the anchor marker %d was never seen\n", config.anchorMarkerId);
+    }
+    if (!writeMap(config.output, markers)) {
+        fprintf(stderr, "%s: write failed\n", config.output.c_str());
+        return 1;
+    }
+    return 0;
+}
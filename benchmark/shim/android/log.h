@@ -0,0 +1,36 @@
+//
+// Minimal replacement of the Android logging API, used to build the native sources on Linux.
+//
+
+#ifndef ARUCOSLAM_BENCHMARK_ANDROID_LOG_H
+#define ARUCOSLAM_BENCHMARK_ANDROID_LOG_H
+
+#include <cstdarg>
+#include <cstdio>
+
+enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+};
+
+inline int __android_log_print(int priority, const char *tag, const char *format, ...) {
+    if (priority < ANDROID_LOG_WARN) {
+        return 0; // the benchmark output is not cluttered with debug logs
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%s] ", tag);
+    int written = vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return written;
+}
+
+#endif //ARUCOSLAM_BENCHMARK_ANDROID_LOG_H
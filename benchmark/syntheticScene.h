@@ -0,0 +1,284 @@
+//
+// Synthetic scenes of ArUco markers, rendered from known camera poses (ground truth).
+//
+
+#ifndef ARUCOSLAM_BENCHMARK_SYNTHETICSCENE_H
+#define ARUCOSLAM_BENCHMARK_SYNTHETICSCENE_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/aruco.hpp>
+
+/**
+ * Parameters of a synthetic scene and of the degradations applied to its frames.
+ */
+struct SceneConfig {
+    int dictionary = cv::aruco::DICT_6X6_1000;
+    int markerCount = 10;
+    double markerLength = 0.05; // meters
+    cv::Size frameSize = cv::Size(1280, 720);
+    double focalLength = 900.0; // pixels
+    double blurSigma = 0.0; // pixels; 0 means no blur
+    double noiseSigma = 0.0; // gray levels; 0 means no noise
+    double gain = 1.0; // lighting: each pixel p becomes gain * p + offset
+    double offset = 0.0;
+    double gradient = 0.0; // fraction of the light lost from the left to the right border
+    double maxTilt = 0.25; // radians, maximum tilt of the camera w.r.t. the marker plane
+    // 0: every frame is rendered from an independent random pose; N > 0: the camera moves
+    // smoothly from a random pose to the next one in N frames (as needed to track the markers)
+    int trajectoryFrames = 0;
+    double blurredFrames = 0.0; // fraction of the frames with an additional (motion) blur
+    double blurredFrameSigma = 4.0; // pixels, gaussian blur sigma of those frames
+    uint64_t seed = 42;
+};
+
+struct SyntheticMarker {
+    int id;
+    // Transformation to switch from room's coord sys to marker's coord sys
+    cv::Vec3d rvec, tvec;
+    cv::Vec3d center;
+};
+
+/**
+ * A planar grid of markers (in the z = 0 plane of the room, facing +z), observed by a pinhole
+ * camera without distortion from random poses on the +z side of the plane.
+ * Each rendered frame comes with its ground truth: the camera pose and the ids of the markers
+ * entirely visible in the frame.
+ */
+class SyntheticScene {
+public:
+    explicit SyntheticScene(const SceneConfig &config) :
+            config(config),
+            dictionary(cv::aruco::getPredefinedDictionary(config.dictionary)),
+            rng(config.seed) {
+        if (config.markerCount > dictionary->bytesList.rows) {
+            throw std::invalid_argument("the dictionary does not have enough markers");
+        }
+        int columns = static_cast<int>(std::ceil(std::sqrt(double(config.markerCount))));
+        int rows = (config.markerCount + columns - 1) / columns;
+        double pitch = config.markerLength * 1.6;
+        for (int i = 0; i < config.markerCount; i++) {
+            SyntheticMarker marker;
+            marker.id = i;
+            marker.center = cv::Vec3d((i % columns - (columns - 1) / 2.0) * pitch,
+                                      (i / columns - (rows - 1) / 2.0) * pitch,
+                                      0.0);
+            marker.rvec = cv::Vec3d(0, 0, 0);
+            marker.tvec = -marker.center;
+            markers.push_back(marker);
+        }
+
+        // the camera is far enough to see the whole grid, but not so far that the markers are
+        // too small to be decoded
+        double extent = std::max(columns, rows) * pitch;
+        double minSide = std::min(config.frameSize.width, config.frameSize.height);
+        gridExtent = extent;
+        baseDistance = std::max(config.focalLength * extent / (0.8 * minSide),
+                                config.focalLength * config.markerLength / (0.25 * minSide));
+
+        cameraMatrix = (cv::Mat_<double>(3, 3) <<
+                config.focalLength, 0.0, config.frameSize.width / 2.0,
+                0.0, config.focalLength, config.frameSize.height / 2.0,
+                0.0, 0.0, 1.0);
+        distCoeffs = cv::Mat::zeros(1, 5, CV_64F);
+    }
+
+    const std::vector<SyntheticMarker> &getMarkers() const { return markers; }
+
+    const cv::Mat &getCameraMatrix() const { return cameraMatrix; }
+
+    const cv::Mat &getDistCoeffs() const { return distCoeffs; }
+
+    /**
+     * Renders the scene from a new random camera pose (or from the next pose of the trajectory).
+     *
+     * @param rgbaFrame the output frame (RGBA, as the ones coming from the camera)
+     * @param cameraRvec, cameraTvec the ground truth: transformation from room's coord sys to
+     *                               camera's coord sys
+     * @param visibleIds the ids of the markers entirely inside the frame
+     */
+    void render(cv::Mat &rgbaFrame, cv::Vec3d &cameraRvec, cv::Vec3d &cameraTvec,
+                std::vector<int> &visibleIds) {
+        nextCameraPose(cameraRvec, cameraTvec);
+        visibleIds.clear();
+
+        cv::Mat canvas(config.frameSize, CV_8UC1, cv::Scalar(255));
+        double halfLength = config.markerLength / 2.0;
+        int markerCells = dictionary->markerSize + 2;
+        for (const SyntheticMarker &marker : markers) {
+            // same order of the corners used by estimatePoseSingleMarkers
+            cv::Point3f corners3d[4] = {
+                    cv::Point3f(marker.center[0] - halfLength, marker.center[1] + halfLength, 0),
+                    cv::Point3f(marker.center[0] + halfLength, marker.center[1] + halfLength, 0),
+                    cv::Point3f(marker.center[0] + halfLength, marker.center[1] - halfLength, 0),
+                    cv::Point3f(marker.center[0] - halfLength, marker.center[1] - halfLength, 0),
+            };
+            cv::Point2f corners2d[4];
+            cv::Mat corners2dMat(4, 1, CV_32FC2, corners2d);
+            cv::projectPoints(cv::Mat(4, 1, CV_32FC3, corners3d), cameraRvec, cameraTvec,
+                              cameraMatrix, distCoeffs, corners2dMat);
+            if (!insideFrame(corners3d, corners2d, cameraRvec, cameraTvec)) {
+                continue;
+            }
+
+            // marker image with about one source pixel per destination pixel
+            double side = cv::norm(corners2d[1] - corners2d[0]);
+            int cellPixels = std::max(1, static_cast<int>(std::ceil(side / markerCells)));
+            cv::Mat markerImage;
+            dictionary->drawMarker(marker.id, markerCells * cellPixels, markerImage, 1);
+
+            // the warp is restricted to the bounding box of the marker in the frame
+            cv::Rect box = cv::boundingRect(cv::Mat(4, 1, CV_32FC2, corners2d)) &
+                           cv::Rect(0, 0, config.frameSize.width, config.frameSize.height);
+            float imageSide = static_cast<float>(markerImage.cols);
+            cv::Point2f source[4] = {
+                    cv::Point2f(0, 0), cv::Point2f(imageSide, 0),
+                    cv::Point2f(imageSide, imageSide), cv::Point2f(0, imageSide),
+            };
+            cv::Point2f destination[4];
+            for (int j = 0; j < 4; j++) {
+                destination[j] = corners2d[j] - cv::Point2f(box.x, box.y);
+            }
+            cv::Mat homography = cv::getPerspectiveTransform(source, destination);
+            cv::Mat boxCanvas = canvas(box);
+            cv::warpPerspective(markerImage, boxCanvas, homography, box.size(),
+                                cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+            visibleIds.push_back(marker.id);
+        }
+
+        degrade(canvas);
+        cv::cvtColor(canvas, rgbaFrame, cv::COLOR_GRAY2RGBA);
+    }
+
+    double getBaseDistance() const { return baseDistance; }
+
+private:
+    /**
+     * A camera pose, as the position of the camera in the room and the tilts and roll of the
+     * camera w.r.t. the view perpendicular to the marker plane.
+     */
+    struct CameraPlacement {
+        cv::Vec3d position;
+        cv::Vec3d perturbation;
+    };
+
+    CameraPlacement randomPlacement() {
+        CameraPlacement placement;
+        placement.position = cv::Vec3d(rng.uniform(-0.1, 0.1) * gridExtent,
+                                       rng.uniform(-0.1, 0.1) * gridExtent,
+                                       baseDistance * rng.uniform(0.9, 1.2));
+        placement.perturbation = cv::Vec3d(rng.uniform(-config.maxTilt, config.maxTilt),
+                                           rng.uniform(-config.maxTilt, config.maxTilt),
+                                           rng.uniform(-CV_PI, CV_PI));
+        return placement;
+    }
+
+    void nextCameraPose(cv::Vec3d &cameraRvec, cv::Vec3d &cameraTvec) {
+        if (config.trajectoryFrames <= 0) {
+            cameraPose(randomPlacement(), cameraRvec, cameraTvec);
+            return;
+        }
+        int step = renderedFrames % config.trajectoryFrames;
+        if (renderedFrames == 0) {
+            trajectoryEnd = randomPlacement();
+        }
+        if (step == 0) {
+            trajectoryStart = trajectoryEnd;
+            trajectoryEnd = randomPlacement();
+            // the roll takes the shortest way
+            trajectoryEnd.perturbation[2] = trajectoryStart.perturbation[2] + std::remainder(
+                    trajectoryEnd.perturbation[2] - trajectoryStart.perturbation[2],
+                    2.0 * CV_PI);
+        }
+        double t = double(step) / config.trajectoryFrames;
+        CameraPlacement placement;
+        placement.position = trajectoryStart.position * (1.0 - t) + trajectoryEnd.position * t;
+        placement.perturbation = trajectoryStart.perturbation * (1.0 - t) +
+                                 trajectoryEnd.perturbation * t;
+        cameraPose(placement, cameraRvec, cameraTvec);
+        renderedFrames++;
+    }
+
+    void cameraPose(const CameraPlacement &placement, cv::Vec3d &cameraRvec,
+                    cv::Vec3d &cameraTvec) const {
+        const cv::Vec3d &position = placement.position;
+        const cv::Vec3d &perturbation = placement.perturbation;
+        // looking towards -z (i.e. at the front of the markers), with y pointing down, then
+        // tilted and rolled
+        cv::Matx33d lookAtPlane(1, 0, 0,
+                                0, -1, 0,
+                                0, 0, -1);
+        cv::Matx33d perturbationRotation;
+        cv::Rodrigues(perturbation, perturbationRotation);
+        cv::Matx33d rotation = perturbationRotation * lookAtPlane;
+        cv::Rodrigues(rotation, cameraRvec);
+        cameraTvec = -(rotation * position);
+    }
+
+    bool insideFrame(const cv::Point3f *corners3d, const cv::Point2f *corners2d,
+                     const cv::Vec3d &cameraRvec, const cv::Vec3d &cameraTvec) const {
+        cv::Matx33d rotation;
+        cv::Rodrigues(cameraRvec, rotation);
+        for (int j = 0; j < 4; j++) {
+            cv::Vec3d inCamera = rotation * cv::Vec3d(corners3d[j].x, corners3d[j].y,
+                                                      corners3d[j].z) + cameraTvec;
+            if (inCamera[2] <= 0) {
+                return false;
+            }
+            if (corners2d[j].x < 2 || corners2d[j].y < 2 ||
+                corners2d[j].x > config.frameSize.width - 3 ||
+                corners2d[j].y > config.frameSize.height - 3) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Applies lighting, blur and noise, in this order.
+     */
+    void degrade(cv::Mat &canvas) {
+        cv::Mat frame;
+        canvas.convertTo(frame, CV_32F, config.gain, config.offset);
+        if (config.gradient > 0) {
+            for (int y = 0; y < frame.rows; y++) {
+                float *row = frame.ptr<float>(y);
+                for (int x = 0; x < frame.cols; x++) {
+                    row[x] *= static_cast<float>(1.0 - config.gradient * x / frame.cols);
+                }
+            }
+        }
+        if (config.blurSigma > 0) {
+            cv::GaussianBlur(frame, frame, cv::Size(0, 0), config.blurSigma);
+        }
+        if (config.blurredFrames > 0 && rng.uniform(0.0, 1.0) < config.blurredFrames) {
+            cv::GaussianBlur(frame, frame, cv::Size(0, 0), config.blurredFrameSigma);
+        }
+        if (config.noiseSigma > 0) {
+            cv::Mat noise(frame.size(), CV_32F);
+            rng.fill(noise, cv::RNG::NORMAL, 0.0, config.noiseSigma);
+            frame += noise;
+        }
+        frame.convertTo(canvas, CV_8U);
+    }
+
+    SceneConfig config;
+    cv::Ptr<cv::aruco::Dictionary> dictionary;
+    cv::RNG rng;
+    std::vector<SyntheticMarker> markers;
+    double gridExtent;
+    double baseDistance;
+    // current segment of the trajectory of the camera
+    CameraPlacement trajectoryStart, trajectoryEnd;
+    int renderedFrames = 0;
+    cv::Mat cameraMatrix;
+    cv::Mat distCoeffs;
+};
+
+#endif //ARUCOSLAM_BENCHMARK_SYNTHETICSCENE_H
@@ -0,0 +1,138 @@
+//
+// Unit tests of the candidate pool (candidatePool.h): the running statistics of the observations
+// of a candidate, and its promotion.
+//
+
+#include <vector>
+
+#include "candidatePool.h"
+#include "tests/testing.h"
+
+/**
+ * The Welford running mean and covariance of the translations, and the circular mean of the
+ * rotations, match the ones computed with two passes over all the observations.
+ */
+static void runningStatisticsMatchTwoPass() {
+    cv::RNG rng(7);
+    std::vector<cv::Vec3d> rvecs, tvecs;
+    MarkerCandidate candidate;
+    for (int i = 0; i < 50; i++) {
+        // the third component is close to pi, so its observations wrap around
+        cv::Vec3d rvec(0.1 + rng.gaussian(0.05), -0.2 + rng.gaussian(0.05),
+                       std::remainder(3.1 + rng.gaussian(0.05), 2.0 * CV_PI));
+        cv::Vec3d tvec(1.0 + rng.gaussian(0.02), 2.0 + rng.gaussian(0.02),
+                       3.0 + rng.gaussian(0.02));
+        rvecs.push_back(rvec);
+        tvecs.push_back(tvec);
+        candidate.observe(rvec, tvec, cv::Vec3d(0.01 * i, 0.0, 0.0));
+    }
+
+    cv::Vec3d mean;
+    for (const cv::Vec3d &tvec : tvecs) {
+        mean += tvec;
+    }
+    mean *= 1.0 / tvecs.size();
+    cv::Matx33d covariance;
+    for (const cv::Vec3d &tvec : tvecs) {
+        cv::Vec3d delta = tvec - mean;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++) {
+                covariance(row, col) += delta[row] * delta[col] / (tvecs.size() - 1);
+            }
+        }
+    }
+
+    CHECK(candidate.observations == 50);
+    for (int row = 0; row < 3; row++) {
+        CHECK_NEAR(candidate.meanTvec[row], mean[row], 1e-12);
+        for (int col = 0; col < 3; col++) {
+            CHECK_NEAR(candidate.tvecM2(row, col) / (candidate.observations - 1),
+                       covariance(row, col), 1e-12);
+        }
+    }
+
+    cv::Vec3d meanRvec = candidate.meanRvec();
+    for (int axis = 0; axis < 3; axis++) {
+        double sinSum = 0.0, cosSum = 0.0;
+        for (const cv::Vec3d &rvec : rvecs) {
+            sinSum += std::sin(rvec[axis]);
+            cosSum += std::cos(rvec[axis]);
+        }
+        CHECK_NEAR(meanRvec[axis], std::atan2(sinSum, cosSum), 1e-12);
+    }
+    // the arithmetic mean of the wrapped angles would be far from 3.1
+    CHECK_NEAR(std::remainder(meanRvec[2] - 3.1, 2.0 * CV_PI), 0.0, 0.05);
+    CHECK_NEAR(candidate.baseline, 0.49, 1e-12);
+}
+
+/**
+ * A candidate observed with little noise from viewpoints far enough apart is promoted, with the
+ * mean of its observations; a noisy one is not.
+ */
+static void convergedCandidatesArePromoted() {
+    cv::RNG rng(11);
+    MarkerCandidatePool pool(8);
+    cv::Vec3d trueRvec(0.3, -0.1, 0.2), trueTvec(0.5, -0.25, 2.0);
+    cv::Vec3d outRvec, outTvec;
+    int promotedAt = -1;
+    for (int frame = 1; frame <= 20 && promotedAt < 0; frame++) {
+        cv::Vec3d noise(rng.gaussian(0.002), rng.gaussian(0.002), rng.gaussian(0.002));
+        if (pool.observe(3, trueRvec + noise, trueTvec + noise, cv::Vec3d(0.02 * frame, 0, 0),
+                         frame, outRvec, outTvec)) {
+            promotedAt = frame;
+        }
+    }
+    CHECK(promotedAt == CANDIDATE_MIN_OBSERVATIONS);
+    CHECK(cv::norm(outTvec - trueTvec) < 0.005);
+    CHECK(cv::norm(outRvec - trueRvec) < 0.005);
+
+    for (int frame = 1; frame <= 20; frame++) {
+        cv::Vec3d noise(rng.gaussian(0.1), rng.gaussian(0.1), rng.gaussian(0.1));
+        CHECK(!pool.observe(4, trueRvec, trueTvec + noise, cv::Vec3d(0.02 * frame, 0, 0),
+                            frame, outRvec, outTvec));
+    }
+
+    jlong stats[CANDIDATE_POOL_STATS_SIZE];
+    pool.stats(stats);
+    CHECK(stats[0] == 1); // the noisy candidate
+    CHECK(stats[1] == CANDIDATE_MIN_OBSERVATIONS + 20);
+    CHECK(stats[2] == 1);
+}
+
+/**
+ * When the pool is full, a new marker takes the slot of the least recently observed candidate
+ * only if it is stale; the other candidates are still found after the eviction.
+ */
+static void staleCandidatesAreEvicted() {
+    MarkerCandidatePool pool(4);
+    cv::Vec3d rvec, tvec, outRvec, outTvec;
+    for (int id = 0; id < 4; id++) {
+        pool.observe(id * 4, rvec, tvec, cv::Vec3d(), id, outRvec, outTvec);
+    }
+    jlong stats[CANDIDATE_POOL_STATS_SIZE];
+    pool.observe(100, rvec, tvec, cv::Vec3d(), 10, outRvec, outTvec);
+    pool.stats(stats);
+    CHECK(stats[0] == 4);
+    CHECK(stats[3] == 0);
+
+    pool.observe(100, rvec, tvec, cv::Vec3d(), CANDIDATE_STALE_FRAMES + 1, outRvec, outTvec);
+    pool.stats(stats);
+    CHECK(stats[0] == 4);
+    CHECK(stats[3] == 1); // the candidate of marker 0
+
+    // the candidates left are found in the table: observing them takes no new slot
+    for (int id = 1; id < 4; id++) {
+        pool.observe(id * 4, rvec, tvec, cv::Vec3d(), CANDIDATE_STALE_FRAMES + 2, outRvec,
+                     outTvec);
+    }
+    pool.stats(stats);
+    CHECK(stats[0] == 4);
+    CHECK(stats[3] == 1);
+}
+
+int main() {
+    runningStatisticsMatchTwoPass();
+    convergedCandidatesArePromoted();
+    staleCandidatesAreEvicted();
+    return testResult("candidatePoolTest");
+}
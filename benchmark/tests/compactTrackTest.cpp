@@ -0,0 +1,87 @@
+//
+// Unit tests of the compact track (compactTrack.h): the round trip of the poses through the
+// quantized blocks.
+//
+
+#include <vector>
+
+#include "compactTrack.h"
+#include "tests/testing.h"
+
+/**
+ * The decoded poses are within half a quantization step of the appended ones, and the timestamps
+ * are exact, across the blocks started by a full block, a jump of the position out of the range
+ * of the block and a pause longer than the maximum timestamp delta.
+ */
+static void posesSurviveTheQuantization() {
+    cv::RNG rng(5);
+    CompactTrack track;
+    std::vector<cv::Vec3d> rvecs, tvecs;
+    std::vector<int64_t> timestamps;
+    cv::Vec3d tvec(1.0, -2.0, 0.5);
+    int64_t timestamp = 1000000;
+    for (int i = 0; i < 1000; i++) {
+        cv::Vec3d rvec(rng.uniform(-CV_PI, CV_PI), rng.uniform(-CV_PI, CV_PI),
+                       rng.uniform(-CV_PI, CV_PI));
+        tvec += cv::Vec3d(rng.uniform(-0.05, 0.05), rng.uniform(-0.05, 0.05),
+                          rng.uniform(-0.05, 0.05));
+        timestamp += rng.uniform(20, 50);
+        if (i == 500) {
+            tvec[0] += 40.0;
+        }
+        if (i == 700) {
+            timestamp += 100000;
+        }
+        track.append(rvec, tvec, timestamp);
+        rvecs.push_back(rvec);
+        tvecs.push_back(tvec);
+        timestamps.push_back(timestamp);
+    }
+    CHECK(track.size() == 1000);
+
+    std::vector<cv::Vec3d> decodedRvecs(1000), decodedTvecs(1000);
+    std::vector<int64_t> decodedTimestamps(1000);
+    CHECK(track.decode(0, 1000, decodedRvecs.data(), decodedTvecs.data(),
+                       decodedTimestamps.data()) == 1000);
+    double maxRvecError = 0.0, maxTvecError = 0.0;
+    int wrongTimestamps = 0;
+    for (int i = 0; i < 1000; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            maxRvecError = std::max(maxRvecError, std::abs(decodedRvecs[i][axis] - rvecs[i][axis]));
+            maxTvecError = std::max(maxTvecError, std::abs(decodedTvecs[i][axis] - tvecs[i][axis]));
+        }
+        wrongTimestamps += decodedTimestamps[i] != timestamps[i];
+    }
+    CHECK(maxRvecError <= COMPACT_TRACK_ROTATION_STEP / 2 + 1e-9);
+    CHECK(maxTvecError <= COMPACT_TRACK_TRANSLATION_STEP / 2 + 1e-9);
+    CHECK(wrongTimestamps == 0);
+
+    // blocks starting at 0, 256 (full block), 500 (jump), 700 (pause), 956 (full block)
+    jlong stats[COMPACT_TRACK_STATS_SIZE];
+    track.stats(stats);
+    CHECK(stats[0] == 1000);
+    CHECK(stats[1] == 5);
+
+    // a range across the blocks decodes as the same poses of the whole track
+    std::vector<cv::Vec3d> rangeRvecs(300), rangeTvecs(300);
+    std::vector<int64_t> rangeTimestamps(300);
+    CHECK(track.decode(450, 300, rangeRvecs.data(), rangeTvecs.data(),
+                       rangeTimestamps.data()) == 300);
+    int differentPoses = 0;
+    for (int i = 0; i < 300; i++) {
+        differentPoses += rangeRvecs[i] != decodedRvecs[450 + i] ||
+                          rangeTvecs[i] != decodedTvecs[450 + i] ||
+                          rangeTimestamps[i] != decodedTimestamps[450 + i];
+    }
+    CHECK(differentPoses == 0);
+
+    // the range is clamped to the track, and the timestamps are optional
+    CHECK(track.decode(990, 50, rangeRvecs.data(), rangeTvecs.data(), nullptr) == 10);
+    CHECK(rangeTvecs[9] == decodedTvecs[999]);
+    CHECK(track.decode(1000, 10, rangeRvecs.data(), rangeTvecs.data(), nullptr) == 0);
+}
+
+int main() {
+    posesSurviveTheQuantization();
+    return testResult("compactTrackTest");
+}
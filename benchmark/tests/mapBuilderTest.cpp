@@ -0,0 +1,78 @@
+//
+// Unit tests of the offline map builder (mapBuilder.h): the alignment of the local maps of the
+// chunks of a recording.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "mapBuilder.h"
+#include "syntheticScene.h"
+#include "tests/testing.h"
+
+/**
+ * Records the frames of a synthetic scene, and builds its map from chunks of the recording: each
+ * chunk has its own local coord sys (the first marker it sees), so all the markers end up in the
+ * coord sys of the anchor only if the chunks are aligned correctly.
+ */
+static void chunksAreAlignedOnTheAnchor() {
+    const char *path = "mapBuilderTest.asrc";
+    SceneConfig sceneConfig;
+    sceneConfig.markerCount = 9;
+    sceneConfig.frameSize = cv::Size(640, 480);
+    sceneConfig.focalLength = 600.0;
+    sceneConfig.trajectoryFrames = 10;
+    SyntheticScene scene(sceneConfig);
+    {
+        SessionRecorder recorder(path, true, 8, scene.getCameraMatrix(), scene.getDistCoeffs(),
+                                 sceneConfig.dictionary, sceneConfig.markerLength);
+        cv::Mat frame, grayFrame;
+        for (uint64_t frameNumber = 0; frameNumber < 100; frameNumber++) {
+            cv::Vec3d cameraRvec, cameraTvec;
+            std::vector<int> visibleIds;
+            scene.render(frame, cameraRvec, cameraTvec, visibleIds);
+            cv::cvtColor(frame, grayFrame, CV_RGBA2GRAY);
+            // the buffers are freed by the writer thread
+            while (!recorder.submit(frameNumber, frameNumber * 33000, frame, grayFrame,
+                                    nullptr)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        recorder.finish();
+    }
+
+    MapBuilder builder(2, 25, 5);
+    CHECK(builder.addRecording(path));
+    std::vector<BuiltMarker> markers;
+    const int anchorId = 4;
+    MapBuilderStats stats = builder.build(anchorId, markers);
+    std::remove(path);
+
+    CHECK(stats.frames == 100);
+    CHECK(stats.chunks == 5);
+    CHECK(stats.alignedChunks == stats.chunks);
+    CHECK(markers.size() == scene.getMarkers().size());
+
+    // the markers of the scene all have the rotation of the room: in the map, their
+    // translations are the offsets from the center of the anchor
+    const cv::Vec3d &anchorCenter = scene.getMarkers()[anchorId].center;
+    for (const BuiltMarker &marker : markers) {
+        CHECK(marker.markerId >= 0 && marker.markerId < (int) scene.getMarkers().size());
+        if (marker.markerId < 0 || marker.markerId >= (int) scene.getMarkers().size()) {
+            continue;
+        }
+        cv::Vec3d expectedTvec = anchorCenter - scene.getMarkers()[marker.markerId].center;
+        CHECK(cv::norm(marker.tvec - expectedTvec) < 0.01);
+        CHECK(cv::norm(marker.rvec) < 0.05);
+        if (marker.markerId == anchorId) {
+            CHECK(cv::norm(marker.tvec) < 1e-9);
+        }
+    }
+}
+
+int main() {
+    chunksAreAlignedOnTheAnchor();
+    return testResult("mapBuilderTest");
+}
@@ -0,0 +1,172 @@
+//
+// Unit tests of the analytic pose estimation of square markers (squarePnP.h), against the ground
+// truth and the iterative solvePnP of OpenCV on synthetic squares.
+//
+
+#include <vector>
+
+#include "squarePnP.h"
+#include "tests/testing.h"
+
+static const double SQUARE_LENGTH = 0.1;
+
+/**
+ * Angle of the rotation between two rotations.
+ */
+static double rotationAngle(const cv::Vec3d &rvecA, const cv::Vec3d &rvecB) {
+    cv::Matx33d rotationA, rotationB;
+    cv::Rodrigues(rvecA, rotationA);
+    cv::Rodrigues(rvecB, rotationB);
+    cv::Vec3d difference;
+    cv::Rodrigues(cv::Matx33d(rotationA.t() * rotationB), difference);
+    return cv::norm(difference);
+}
+
+/**
+ * A random pose of a square facing the camera (tilted up to 0.8 radians, with any roll), between
+ * 0.4 and 1.2 meters from it and inside the field of view.
+ */
+static void randomSquarePose(cv::RNG &rng, cv::Vec3d &rvec, cv::Vec3d &tvec) {
+    double tiltDirection = rng.uniform(0.0, 2.0 * CV_PI), tilt = rng.uniform(0.0, 0.8);
+    cv::Matx33d flip, roll, tiltRotation;
+    cv::Rodrigues(cv::Vec3d(CV_PI, 0, 0), flip);
+    cv::Rodrigues(cv::Vec3d(0, 0, rng.uniform(-CV_PI, CV_PI)), roll);
+    cv::Rodrigues(cv::Vec3d(tilt * std::cos(tiltDirection), tilt * std::sin(tiltDirection), 0),
+                  tiltRotation);
+    cv::Rodrigues(cv::Matx33d(flip * roll * tiltRotation), rvec);
+    double z = rng.uniform(0.4, 1.2);
+    tvec = cv::Vec3d(rng.uniform(-0.2, 0.2) * z, rng.uniform(-0.15, 0.15) * z, z);
+}
+
+/**
+ * Projects the corners of the square (same order of the corners used by
+ * estimatePoseSingleMarkers), with a gaussian noise of the given sigma (pixels).
+ */
+static void projectSquare(const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                          const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                          cv::RNG &rng, double noiseSigma, const cv::Point3f objectPoints[4],
+                          std::vector<cv::Point2f> &imageCorners,
+                          std::vector<cv::Point2f> &normalizedCorners) {
+    cv::projectPoints(cv::Mat(4, 1, CV_32FC3, (void *) objectPoints), rvec, tvec, cameraMatrix,
+                      distCoeffs, imageCorners);
+    for (cv::Point2f &corner : imageCorners) {
+        corner += cv::Point2f((float) rng.gaussian(noiseSigma), (float) rng.gaussian(noiseSigma));
+    }
+    cv::undistortPoints(imageCorners, normalizedCorners, cameraMatrix, distCoeffs);
+}
+
+/**
+ * Reprojection error of a pose, in normalized image coordinates (as SquarePose::error).
+ */
+static double reprojectionError(const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                                const cv::Point3f objectPoints[4],
+                                const std::vector<cv::Point2f> &normalizedCorners) {
+    cv::Matx33d rotation;
+    cv::Rodrigues(rvec, rotation);
+    double error = 0.0;
+    for (int i = 0; i < 4; i++) {
+        cv::Vec3d point = rotation * cv::Vec3d(objectPoints[i].x, objectPoints[i].y, 0.0) + tvec;
+        double du = point[0] / point[2] - normalizedCorners[i].x;
+        double dv = point[1] / point[2] - normalizedCorners[i].y;
+        error += du * du + dv * dv;
+    }
+    return error;
+}
+
+/**
+ * On exact corners, the best solution is the true pose.
+ */
+static void exactCornersGiveTheTruePose(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                                        const cv::Point3f objectPoints[4]) {
+    cv::RNG rng(3);
+    double maxTvecError = 0.0, maxRotationError = 0.0;
+    int failures = 0;
+    for (int trial = 0; trial < 200; trial++) {
+        cv::Vec3d rvec, tvec;
+        randomSquarePose(rng, rvec, tvec);
+        std::vector<cv::Point2f> imageCorners, normalizedCorners;
+        projectSquare(rvec, tvec, cameraMatrix, distCoeffs, rng, 0.0, objectPoints,
+                      imageCorners, normalizedCorners);
+        SquarePose solutions[2];
+        if (!solveSquarePose(normalizedCorners.data(), SQUARE_LENGTH, solutions)) {
+            failures++;
+            continue;
+        }
+        maxTvecError = std::max(maxTvecError, cv::norm(solutions[0].tvec - tvec));
+        maxRotationError = std::max(maxRotationError, rotationAngle(solutions[0].rvec, rvec));
+        CHECK(solutions[0].error <= solutions[1].error);
+    }
+    CHECK(failures == 0);
+    CHECK(maxTvecError < 1e-4);
+    CHECK(maxRotationError < 1e-3);
+}
+
+/**
+ * On noisy corners, the true pose is one of the two solutions, and the best one is as accurate as
+ * the pose found by the iterative solvePnP.
+ */
+static void noisyCornersMatchSolvePnP(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                                      const cv::Point3f objectPoints[4]) {
+    cv::RNG rng(9);
+    double squarePnPTvecError = 0.0, solvePnPTvecError = 0.0;
+    double squarePnPReprojection = 0.0, solvePnPReprojection = 0.0;
+    int failures = 0, trueSolutionMissing = 0;
+    for (int trial = 0; trial < 200; trial++) {
+        cv::Vec3d rvec, tvec;
+        randomSquarePose(rng, rvec, tvec);
+        std::vector<cv::Point2f> imageCorners, normalizedCorners;
+        projectSquare(rvec, tvec, cameraMatrix, distCoeffs, rng, 0.3, objectPoints,
+                      imageCorners, normalizedCorners);
+        SquarePose solutions[2];
+        if (!solveSquarePose(normalizedCorners.data(), SQUARE_LENGTH, solutions)) {
+            failures++;
+            continue;
+        }
+        if (std::min(rotationAngle(solutions[0].rvec, rvec),
+                     rotationAngle(solutions[1].rvec, rvec)) > 0.15) {
+            trueSolutionMissing++;
+        }
+        cv::Vec3d solvePnPRvec, solvePnPTvec;
+        cv::solvePnP(cv::Mat(4, 1, CV_32FC3, (void *) objectPoints), imageCorners, cameraMatrix,
+                     distCoeffs, solvePnPRvec, solvePnPTvec);
+        squarePnPTvecError += cv::norm(solutions[0].tvec - tvec);
+        solvePnPTvecError += cv::norm(solvePnPTvec - tvec);
+        squarePnPReprojection += solutions[0].error;
+        solvePnPReprojection += reprojectionError(solvePnPRvec, solvePnPTvec, objectPoints,
+                                                  normalizedCorners);
+    }
+    CHECK(failures == 0);
+    CHECK(trueSolutionMissing == 0);
+    // solvePnP minimizes the reprojection error: the analytic solution is close to the minimum
+    CHECK(squarePnPReprojection <= 2.0 * solvePnPReprojection);
+    CHECK(squarePnPTvecError / 200 <= 1.5 * solvePnPTvecError / 200 + 0.001);
+}
+
+/**
+ * Corners which do not form a quadrilateral have no solution (the pipeline falls back to
+ * solvePnP).
+ */
+static void degenerateCornersAreRejected() {
+    cv::Point2f corners[4] = {
+            cv::Point2f(0.1f, 0.1f), cv::Point2f(0.1f, 0.1f),
+            cv::Point2f(0.1f, 0.1f), cv::Point2f(0.1f, 0.1f),
+    };
+    SquarePose solutions[2];
+    CHECK(!solveSquarePose(corners, SQUARE_LENGTH, solutions));
+}
+
+int main() {
+    cv::Mat cameraMatrix = (cv::Mat_<double>(3, 3) << 800, 0, 640, 0, 800, 360, 0, 0, 1);
+    cv::Mat distCoeffs = cv::Mat::zeros(5, 1, CV_64F);
+    float halfLength = static_cast<float>(SQUARE_LENGTH / 2.0);
+    cv::Point3f objectPoints[4] = {
+            cv::Point3f(-halfLength, halfLength, 0),
+            cv::Point3f(halfLength, halfLength, 0),
+            cv::Point3f(halfLength, -halfLength, 0),
+            cv::Point3f(-halfLength, -halfLength, 0),
+    };
+    exactCornersGiveTheTruePose(cameraMatrix, distCoeffs, objectPoints);
+    noisyCornersMatchSolvePnP(cameraMatrix, distCoeffs, objectPoints);
+    degenerateCornersAreRejected();
+    return testResult("squarePnPTest");
+}
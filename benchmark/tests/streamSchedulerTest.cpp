@@ -0,0 +1,69 @@
+//
+// Unit tests of the stream scheduler (streamScheduler.h): the sharing of the CPU between the
+// streams.
+//
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "streamScheduler.h"
+#include "syntheticScene.h"
+#include "tests/testing.h"
+
+/**
+ * With one processing thread and the queues of the streams always full, each stream gets a share
+ * of the CPU time proportional to its weight.
+ */
+static void cpuTimeIsProportionalToWeight() {
+    SceneConfig sceneConfig;
+    sceneConfig.trajectoryFrames = 8;
+    SyntheticScene scene(sceneConfig);
+    std::vector<cv::Mat> frames(8);
+    for (cv::Mat &frame : frames) {
+        cv::Vec3d cameraRvec, cameraTvec;
+        std::vector<int> visibleIds;
+        scene.render(frame, cameraRvec, cameraTvec, visibleIds);
+    }
+
+    MarkerMap map;
+    StreamScheduler scheduler(map, 1);
+    StreamConfig config;
+    config.markerDictionary = sceneConfig.dictionary;
+    config.markerLength = sceneConfig.markerLength;
+    config.cameraMatrix = scene.getCameraMatrix();
+    config.distCoeffs = scene.getDistCoeffs();
+    config.workerBudget = 1;
+    config.addNewMarkers = false; // the same work for each frame of both the streams
+    int light = scheduler.openStream(config);
+    config.weight = 3.0;
+    int heavy = scheduler.openStream(config);
+    CHECK(light >= 0 && heavy >= 0);
+
+    // the queues are refilled much faster than the frames are processed
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    for (uint64_t frameNumber = 0; std::chrono::steady_clock::now() < end; frameNumber++) {
+        const cv::Mat &frame = frames[frameNumber % frames.size()];
+        int64_t timestampUs = frameNumber * 1000;
+        scheduler.submit(light, frame, frameNumber, timestampUs);
+        scheduler.submit(heavy, frame, frameNumber, timestampUs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    jlong lightStats[STREAM_STATS_SIZE], heavyStats[STREAM_STATS_SIZE];
+    CHECK(scheduler.stats(light, lightStats));
+    CHECK(scheduler.stats(heavy, heavyStats));
+    scheduler.closeStream(light);
+    scheduler.closeStream(heavy);
+    CHECK(!scheduler.stats(light, lightStats));
+
+    CHECK(lightStats[1] > 0 && heavyStats[1] > 0);
+    CHECK(lightStats[6] == 0 && heavyStats[6] == 0);
+    // [4]: CPU time (microseconds)
+    CHECK_NEAR((double) heavyStats[4] / std::max<jlong>(1, lightStats[4]), 3.0, 0.5);
+}
+
+int main() {
+    cpuTimeIsProportionalToWeight();
+    return testResult("streamSchedulerTest");
+}
@@ -0,0 +1,49 @@
+//
+// Minimal checks for the unit tests of the native sources: each test is an executable which
+// reports the failed checks and exits with a non-zero status if any failed (see CMakeLists.txt).
+//
+
+#ifndef ARUCOSLAM_BENCHMARK_TESTING_H
+#define ARUCOSLAM_BENCHMARK_TESTING_H
+
+#include <cstdio>
+#include <cmath>
+
+static int failedChecks = 0;
+
+static bool check(bool condition, const char *expression, const char *file, int line) {
+    if (!condition) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+        failedChecks++;
+    }
+    return condition;
+}
+
+static bool checkNear(double actual, double expected, double tolerance, const char *expression,
+                      const char *file, int line) {
+    if (!(std::abs(actual - expected) <= tolerance)) {
+        fprintf(stderr, "%s:%d: check failed: %s = %g, expected %g (tolerance %g)\n",
+                file, line, expression, actual, expected, tolerance);
+        failedChecks++;
+        return false;
+    }
+    return true;
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_NEAR(actual, expected, tolerance) \
+    checkNear((actual), (expected), (tolerance), #actual, __FILE__, __LINE__)
+
+/**
+ * @return the exit status of the test
+ */
+static int testResult(const char *test) {
+    if (failedChecks > 0) {
+        fprintf(stderr, "%s: %d checks failed\n", test, failedChecks);
+        return 1;
+    }
+    printf("%s: passed\n", test);
+    return 0;
+}
+
+#endif //ARUCOSLAM_BENCHMARK_TESTING_H